@@ -0,0 +1,250 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "archiveindex.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <karchive.h>
+#include <kdebug.h>
+#include <ksavefile.h>
+#include <kstandarddirs.h>
+
+static const char s_indexMagic[] = "KIOARIDX";
+static const quint32 s_indexVersion = 1;
+// An entry takes at least this many bytes: the lengths of its five strings,
+// its permissions, date, position and size
+static const qint64 s_minimumEntrySize = 5 * 4 + 4 + 3 * 8;
+
+// The number of cache files of each kind to keep, the oldest ones are removed first
+#define MAX_CACHE_FILES 64
+
+static ArchiveIndex::Entry makeEntry( const KArchiveEntry * archiveEntry )
+{
+    ArchiveIndex::Entry entry;
+    entry.name = archiveEntry->name();
+    entry.permissions = archiveEntry->permissions();
+    entry.date = archiveEntry->date();
+    entry.position = 0;
+    entry.size = 0;
+    if ( archiveEntry->isFile() )
+    {
+        const KArchiveFile * file = static_cast<const KArchiveFile *>( archiveEntry );
+        entry.position = file->position();
+        entry.size = file->size();
+    }
+    entry.user = archiveEntry->user();
+    entry.group = archiveEntry->group();
+    entry.symLinkTarget = archiveEntry->symLinkTarget();
+    return entry;
+}
+
+void ArchiveIndex::build( const KArchiveDirectory * root )
+{
+    m_entries.clear();
+    m_paths.clear();
+    m_byPath.clear();
+    m_children.clear();
+
+    addEntry( QString(), makeEntry( root ) );
+    addDirectory( root, QString() );
+}
+
+void ArchiveIndex::addDirectory( const KArchiveDirectory * dir, const QString & path )
+{
+    const QStringList names = dir->entries();
+    for ( QStringList::const_iterator it = names.constBegin(); it != names.constEnd(); ++it )
+    {
+        const KArchiveEntry * archiveEntry = dir->entry( *it );
+        if ( !archiveEntry )
+            continue;
+
+        const QString childPath = path.isEmpty() ? *it : path + QLatin1Char( '/' ) + *it;
+        addEntry( childPath, makeEntry( archiveEntry ) );
+
+        if ( archiveEntry->isDirectory() && archiveEntry != dir &&
+             *it != QLatin1String( "." ) && *it != QLatin1String( ".." ) )
+        {
+            addDirectory( static_cast<const KArchiveDirectory *>( archiveEntry ), childPath );
+        }
+    }
+}
+
+void ArchiveIndex::addEntry( const QString & path, const Entry & entry )
+{
+    const int index = m_entries.count();
+    m_entries.append( entry );
+    m_paths.append( path );
+    m_byPath.insert( path, index );
+
+    if ( !path.isEmpty() )
+    {
+        const int pos = path.lastIndexOf( QLatin1Char( '/' ) );
+        m_children[ pos == -1 ? QString() : path.left( pos ) ].append( index );
+    }
+}
+
+const ArchiveIndex::Entry * ArchiveIndex::entry( const QString & path ) const
+{
+    QHash<QString, int>::const_iterator it = m_byPath.constFind( normalizedPath( path ) );
+    if ( it == m_byPath.constEnd() )
+        return 0;
+    return &m_entries.at( it.value() );
+}
+
+QList<const ArchiveIndex::Entry *> ArchiveIndex::entries( const QString & path ) const
+{
+    QList<const Entry *> result;
+    const QList<int> children = m_children.value( normalizedPath( path ) );
+    for ( QList<int>::const_iterator it = children.constBegin(); it != children.constEnd(); ++it )
+        result.append( &m_entries.at( *it ) );
+    return result;
+}
+
+QString ArchiveIndex::normalizedPath( const QString & path )
+{
+    int start = 0;
+    int end = path.length();
+    while ( start < end && path[ start ] == QLatin1Char( '/' ) )
+        ++start;
+    while ( end > start && path[ end - 1 ] == QLatin1Char( '/' ) )
+        --end;
+    return path.mid( start, end - start );
+}
+
+QString ArchiveIndex::cacheFileName( const QString & archiveName, qint64 size, time_t mtime,
+                                     const QString & extension )
+{
+    QByteArray key = QFile::encodeName( archiveName );
+    key += '\n';
+    key += QByteArray::number( size );
+    key += '\n';
+    key += QByteArray::number( qint64( mtime ) );
+
+    const QByteArray hash = QCryptographicHash::hash( key, QCryptographicHash::Sha1 ).toHex();
+    return KStandardDirs::locateLocal( "cache", QLatin1String( "kio_archive/" ) + QString::fromLatin1( hash ) + QLatin1Char( '.' ) + extension );
+}
+
+void ArchiveIndex::pruneCache( const QString & extension )
+{
+    QDir dir( KStandardDirs::locateLocal( "cache", QLatin1String( "kio_archive/" ) ) );
+    const QFileInfoList files = dir.entryInfoList( QStringList() << QLatin1String( "*." ) + extension,
+                                                   QDir::Files, QDir::Time );
+    for ( int i = MAX_CACHE_FILES; i < files.count(); ++i )
+        QFile::remove( files.at( i ).absoluteFilePath() );
+}
+
+bool ArchiveIndex::load( const QString & archiveName, qint64 size, time_t mtime )
+{
+    QFile file( cacheFileName( archiveName, size, mtime, QLatin1String( "index" ) ) );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QDataStream stream( &file );
+    stream.setVersion( QDataStream::Qt_4_6 );
+
+    char magic[ sizeof( s_indexMagic ) - 1 ];
+    if ( stream.readRawData( magic, sizeof( magic ) ) != int( sizeof( magic ) ) ||
+         qstrncmp( magic, s_indexMagic, sizeof( magic ) ) != 0 )
+        return false;
+
+    quint32 version;
+    QString name;
+    qint64 archiveSize;
+    qint64 archiveTime;
+    quint32 count;
+    stream >> version >> name >> archiveSize >> archiveTime >> count;
+    if ( stream.status() != QDataStream::Ok || version != s_indexVersion ||
+         name != archiveName || archiveSize != size || archiveTime != qint64( mtime ) )
+    {
+        kDebug(7109) << "Index of" << archiveName << "is out of date";
+        return false;
+    }
+    // A damaged count must not make us allocate more than the file can hold
+    if ( qint64( count ) > ( file.size() - file.pos() ) / s_minimumEntrySize )
+    {
+        kDebug(7109) << "Index of" << archiveName << "is truncated";
+        return false;
+    }
+
+    m_entries.clear();
+    m_paths.clear();
+    m_byPath.clear();
+    m_children.clear();
+    m_entries.reserve( count );
+    m_paths.reserve( count );
+
+    for ( quint32 i = 0; i < count; ++i )
+    {
+        QString path;
+        Entry entry;
+        quint32 permissions;
+        qint64 date;
+        stream >> path >> entry.name >> permissions >> date >> entry.position >> entry.size
+               >> entry.user >> entry.group >> entry.symLinkTarget;
+        if ( stream.status() != QDataStream::Ok )
+        {
+            kDebug(7109) << "Index of" << archiveName << "is truncated";
+            m_entries.clear();
+            m_paths.clear();
+            m_byPath.clear();
+            m_children.clear();
+            return false;
+        }
+
+        entry.permissions = permissions;
+        entry.date = date;
+        addEntry( path, entry );
+    }
+
+    kDebug(7109) << "Loaded index of" << archiveName << "with" << count << "entries";
+    return true;
+}
+
+bool ArchiveIndex::save( const QString & archiveName, qint64 size, time_t mtime ) const
+{
+    KSaveFile file( cacheFileName( archiveName, size, mtime, QLatin1String( "index" ) ) );
+    if ( !file.open() )
+        return false;
+
+    QDataStream stream( &file );
+    stream.setVersion( QDataStream::Qt_4_6 );
+
+    stream.writeRawData( s_indexMagic, sizeof( s_indexMagic ) - 1 );
+    stream << s_indexVersion << archiveName << size << qint64( mtime ) << quint32( m_entries.count() );
+
+    for ( int i = 0; i < m_entries.count(); ++i )
+    {
+        const Entry & entry = m_entries.at( i );
+        stream << m_paths.at( i ) << entry.name << quint32( entry.permissions ) << qint64( entry.date )
+               << entry.position << entry.size << entry.user << entry.group << entry.symLinkTarget;
+    }
+
+    if ( stream.status() != QDataStream::Ok || !file.finalize() )
+    {
+        file.abort();
+        return false;
+    }
+
+    pruneCache( QLatin1String( "index" ) );
+    return true;
+}
@@ -0,0 +1,115 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef ARCHIVEINDEX_H
+#define ARCHIVEINDEX_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class KArchiveDirectory;
+
+/**
+ * The entries of an archive, as far as listDir and stat need them.
+ *
+ * Parsing an archive means reading all of it, which for a compressed tarball
+ * means decompressing it completely. The index is saved next to the other
+ * caches of the user, so that browsing the archive again later does not need
+ * to open it at all.
+ */
+class ArchiveIndex
+{
+public:
+    struct Entry
+    {
+        QString name;
+        // File type and permissions, like KArchiveEntry::permissions()
+        mode_t permissions;
+        time_t date;
+        // Position of the data in the archive and its size, 0 for directories
+        qint64 position;
+        qint64 size;
+        QString user;
+        QString group;
+        QString symLinkTarget;
+
+        bool isDirectory() const
+        {
+            return S_ISDIR( permissions );
+        }
+    };
+
+    /**
+     * Builds the index from an opened archive.
+     */
+    void build( const KArchiveDirectory * root );
+
+    /**
+     * Loads the index of @p archiveName from the cache. Fails if there is no index,
+     * or if the archive changed since it was saved.
+     */
+    bool load( const QString & archiveName, qint64 size, time_t mtime );
+
+    /**
+     * Saves the index of @p archiveName to the cache.
+     */
+    bool save( const QString & archiveName, qint64 size, time_t mtime ) const;
+
+    /**
+     * \return the entry at @p path relative to the root of the archive, or 0.
+     * An empty path or "/" is the root directory.
+     */
+    const Entry * entry( const QString & path ) const;
+
+    /**
+     * \return the entries of the directory at @p path, in the order
+     * KArchiveDirectory::entries() returned them when the index was built.
+     * That is the order of a hash, not the order of the archive.
+     */
+    QList<const Entry *> entries( const QString & path ) const;
+
+    /**
+     * \return the name of the cache file with @p extension for a version of
+     * @p archiveName. Also used for other data kept about an archive.
+     */
+    static QString cacheFileName( const QString & archiveName, qint64 size, time_t mtime,
+                                  const QString & extension );
+
+    /**
+     * Removes the oldest cache files with @p extension.
+     */
+    static void pruneCache( const QString & extension );
+
+private:
+    void addDirectory( const KArchiveDirectory * dir, const QString & path );
+    void addEntry( const QString & path, const Entry & entry );
+
+    static QString normalizedPath( const QString & path );
+
+    QVector<Entry> m_entries;
+    QVector<QString> m_paths;
+    QHash<QString, int> m_byPath;
+    QHash<QString, QList<int> > m_children;
+};
+
+#endif // ARCHIVEINDEX_H
@@ -40,8 +40,15 @@
 
 #include <kuser.h>
 
+#include "seekablefilterdevice.h"
+
 using namespace KIO;
 
+// The number of archives to keep open, or at least their index
+#define MAX_OPEN_ARCHIVES 4
+// Archives smaller than this are not worth saving an index for
+#define INDEX_MINIMUM_SIZE 0x100000 // 1MB
+
 extern "C" { int KDE_EXPORT kdemain(int argc, char **argv); }
 
 int kdemain( int argc, char **argv )
@@ -66,12 +73,18 @@ int kdemain( int argc, char **argv )
 ArchiveProtocol::ArchiveProtocol( const QByteArray &pool, const QByteArray &app ) : SlaveBase( "tar", pool, app )
 {
   kDebug( 7109 ) << "ArchiveProtocol::ArchiveProtocol";
-  m_archiveFile = 0L;
+  m_current = 0L;
 }
 
 ArchiveProtocol::~ArchiveProtocol()
 {
-    delete m_archiveFile;
+    qDeleteAll( m_archives );
+}
+
+ArchiveProtocol::OpenArchive::~OpenArchive()
+{
+    delete archive;
+    delete device;
 }
 
 bool ArchiveProtocol::checkNewFile( const KUrl & url, QString & path, KIO::Error& errorNum )
@@ -84,30 +97,35 @@ bool ArchiveProtocol::checkNewFile( const KUrl & url, QString & path, KIO::Error
     kDebug(7109) << "ArchiveProtocol::checkNewFile" << fullPath;
 
 
-    // Are we already looking at that file ?
-    if ( m_archiveFile && m_archiveName == fullPath.left(m_archiveName.length()) )
+    // Are we already looking at that file, or did we recently ?
+    for ( int i = 0; i < m_archives.count(); ++i )
     {
+        OpenArchive * openArchive = m_archives.at( i );
+        const int len = openArchive->name.length();
+        if ( openArchive->protocol != url.protocol() || fullPath.left( len ) != openArchive->name ||
+             ( fullPath.length() > len && fullPath[ len ] != '/' ) )
+            continue;
+
         // Has it changed ?
         KDE_struct_stat statbuf;
-        if ( KDE_stat( QFile::encodeName( m_archiveName ), &statbuf ) == 0 )
+        if ( KDE_stat( QFile::encodeName( openArchive->name ), &statbuf ) == 0 &&
+             openArchive->mtime == statbuf.st_mtime && openArchive->size == statbuf.st_size )
         {
-            if ( m_mtime == statbuf.st_mtime )
-            {
-                path = fullPath.mid( m_archiveName.length() );
-                kDebug(7109) << "ArchiveProtocol::checkNewFile returning" << path;
-                return true;
-            }
+            m_archives.move( i, 0 );
+            m_current = openArchive;
+            path = fullPath.mid( len );
+            kDebug(7109) << "ArchiveProtocol::checkNewFile returning" << path;
+            return true;
         }
-    }
-    kDebug(7109) << "Need to open a new file";
 
-    // Close previous file
-    if ( m_archiveFile )
-    {
-        m_archiveFile->close();
-        delete m_archiveFile;
-        m_archiveFile = 0L;
+        // It did, forget about it
+        m_archives.removeAt( i );
+        if ( m_current == openArchive )
+            m_current = 0L;
+        delete openArchive;
+        break;
     }
+    kDebug(7109) << "Need to open a new file";
 
     // Find where the tar file is in the full path
     int pos = 0;
@@ -121,6 +139,7 @@ bool ArchiveProtocol::checkNewFile( const KUrl & url, QString & path, KIO::Error
     kDebug(7109) << "the full path is" << fullPath;
     KDE_struct_stat statbuf;
     statbuf.st_mode = 0; // be sure to clear the directory bit
+    OpenArchive * openArchive = new OpenArchive;
     while ( (pos=fullPath.indexOf( '/', pos+1 )) != -1 )
     {
         QString tryPath = fullPath.left( pos );
@@ -133,15 +152,16 @@ bool ArchiveProtocol::checkNewFile( const KUrl & url, QString & path, KIO::Error
         if ( !S_ISDIR(statbuf.st_mode) )
         {
             archiveFile = tryPath;
-            m_mtime = statbuf.st_mtime;
+            openArchive->mtime = statbuf.st_mtime;
+            openArchive->size = statbuf.st_size;
 #ifdef Q_WS_WIN // st_uid and st_gid provides no information
-            m_user.clear();
-            m_group.clear();
+            openArchive->user.clear();
+            openArchive->group.clear();
 #else
             KUser user(statbuf.st_uid);
-            m_user = user.loginName();
+            openArchive->user = user.loginName();
             KUserGroup group(statbuf.st_gid);
-            m_group = group.name();
+            openArchive->group = group.name();
 #endif
             path = fullPath.mid( pos + 1 );
             kDebug(7109).nospace() << "fullPath=" << fullPath << " path=" << path;
@@ -160,6 +180,7 @@ bool ArchiveProtocol::checkNewFile( const KUrl & url, QString & path, KIO::Error
     if ( archiveFile.isEmpty() )
     {
         kDebug(7109) << "ArchiveProtocol::checkNewFile: not found";
+        delete openArchive;
         if ( S_ISDIR(statbuf.st_mode) ) // Was the last stat about a directory?
         {
             // Too bad, it is a directory, not an archive.
@@ -171,58 +192,127 @@ bool ArchiveProtocol::checkNewFile( const KUrl & url, QString & path, KIO::Error
         return false;
     }
 
+    if ( url.protocol() != "tar" && url.protocol() != "ar" && url.protocol() != "zip" ) {
+        kWarning(7109) << "Protocol" << url.protocol() << "not supported by this IOSlave" ;
+        delete openArchive;
+        errorNum = KIO::ERR_UNSUPPORTED_PROTOCOL;
+        return false;
+    }
+
+    openArchive->name = archiveFile;
+    openArchive->protocol = url.protocol();
+
+    // The index of an archive we have seen before saves parsing it again
+    if ( !openArchive->index.load( archiveFile, openArchive->size, openArchive->mtime ) )
+    {
+        if ( !openArchiveFile( openArchive, errorNum ) )
+        {
+            delete openArchive;
+            return false;
+        }
+    }
+
+    m_archives.prepend( openArchive );
+    m_current = openArchive;
+    while ( m_archives.count() > MAX_OPEN_ARCHIVES )
+        delete m_archives.takeLast();
+
+    return true;
+}
+
+bool ArchiveProtocol::openArchiveFile( OpenArchive * openArchive, KIO::Error& errorNum )
+{
+    const QString & archiveFile = openArchive->name;
+
     // Open new file
-    if ( url.protocol() == "tar" ) {
+    if ( openArchive->protocol == "tar" ) {
         kDebug(7109) << "Opening KTar on" << archiveFile;
-        m_archiveFile = new KTar( archiveFile );
-    } else if ( url.protocol() == "ar" ) {
+        openArchive->archive = new KTar( archiveFile );
+    } else if ( openArchive->protocol == "ar" ) {
         kDebug(7109) << "Opening KAr on " << archiveFile;
-        m_archiveFile = new KAr( archiveFile );
-    } else if ( url.protocol() == "zip" ) {
-        kDebug(7109) << "Opening KZip on " << archiveFile;
-        m_archiveFile = new KZip( archiveFile );
+        openArchive->archive = new KAr( archiveFile );
     } else {
-        kWarning(7109) << "Protocol" << url.protocol() << "not supported by this IOSlave" ;
-        errorNum = KIO::ERR_UNSUPPORTED_PROTOCOL;
-        return false;
+        kDebug(7109) << "Opening KZip on " << archiveFile;
+        openArchive->archive = new KZip( archiveFile );
     }
 
-    if ( !m_archiveFile->open( QIODevice::ReadOnly ) )
+    if ( !openArchive->archive->open( QIODevice::ReadOnly ) )
     {
         kDebug(7109) << "Opening" << archiveFile << "failed.";
-        delete m_archiveFile;
-        m_archiveFile = 0L;
+        delete openArchive->archive;
+        openArchive->archive = 0L;
         errorNum = KIO::ERR_CANNOT_OPEN_FOR_READING;
         return false;
     }
 
-    m_archiveName = archiveFile;
+    if ( openArchive->index.entry( QString() ) == 0 )
+    {
+        openArchive->index.build( openArchive->archive->directory() );
+
+        // Small archives are parsed quickly, no need to keep their index around
+        if ( openArchive->size >= INDEX_MINIMUM_SIZE &&
+             !openArchive->index.save( archiveFile, openArchive->size, openArchive->mtime ) )
+            kDebug(7109) << "Could not save the index of" << archiveFile;
+    }
+
     return true;
 }
 
+void ArchiveProtocol::closeArchives()
+{
+    for ( QList<OpenArchive *>::const_iterator it = m_archives.constBegin(); it != m_archives.constEnd(); ++it )
+    {
+        delete (*it)->archive;
+        (*it)->archive = 0L;
+        delete (*it)->device;
+        (*it)->device = 0L;
+    }
+}
+
+SeekableFilterDevice * ArchiveProtocol::seekableDevice( OpenArchive * openArchive )
+{
+    // Reading a file of a small archive through KArchive is quick anyway
+    if ( openArchive->protocol != "tar" || openArchive->size < INDEX_MINIMUM_SIZE )
+        return 0L;
+
+    if ( !openArchive->device && openArchive->seekable )
+    {
+        openArchive->device = new SeekableFilterDevice( openArchive->name, openArchive->size, openArchive->mtime );
+        if ( !openArchive->device->open( QIODevice::ReadOnly ) )
+        {
+            delete openArchive->device;
+            openArchive->device = 0L;
+            // Do not try again, e.g. a bzip2 compressed archive
+            openArchive->seekable = false;
+        }
+    }
+
+    return openArchive->device;
+}
+
 
 void ArchiveProtocol::createRootUDSEntry( KIO::UDSEntry & entry )
 {
     entry.clear();
     entry.insert( KIO::UDSEntry::UDS_NAME, "." );
     entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFDIR );
-    entry.insert( KIO::UDSEntry::UDS_MODIFICATION_TIME, m_mtime );
+    entry.insert( KIO::UDSEntry::UDS_MODIFICATION_TIME, m_current->mtime );
     //entry.insert( KIO::UDSEntry::UDS_ACCESS, 07777 ); // fake 'x' permissions, this is a pseudo-directory
-    entry.insert( KIO::UDSEntry::UDS_USER, m_user);
-    entry.insert( KIO::UDSEntry::UDS_GROUP, m_group);
+    entry.insert( KIO::UDSEntry::UDS_USER, m_current->user);
+    entry.insert( KIO::UDSEntry::UDS_GROUP, m_current->group);
 }
 
-void ArchiveProtocol::createUDSEntry( const KArchiveEntry * archiveEntry, UDSEntry & entry )
+void ArchiveProtocol::createUDSEntry( const ArchiveIndex::Entry & archiveEntry, UDSEntry & entry )
 {
     entry.clear();
-    entry.insert( KIO::UDSEntry::UDS_NAME, archiveEntry->name() );
-    entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, archiveEntry->permissions() & S_IFMT ); // keep file type only
-    entry.insert( KIO::UDSEntry::UDS_SIZE, archiveEntry->isFile() ? ((KArchiveFile *)archiveEntry)->size() : 0L );
-    entry.insert( KIO::UDSEntry::UDS_MODIFICATION_TIME, archiveEntry->date());
-    entry.insert( KIO::UDSEntry::UDS_ACCESS, archiveEntry->permissions() & 07777 ); // keep permissions only
-    entry.insert( KIO::UDSEntry::UDS_USER, archiveEntry->user());
-    entry.insert( KIO::UDSEntry::UDS_GROUP, archiveEntry->group());
-    entry.insert( KIO::UDSEntry::UDS_LINK_DEST, archiveEntry->symLinkTarget());
+    entry.insert( KIO::UDSEntry::UDS_NAME, archiveEntry.name );
+    entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, archiveEntry.permissions & S_IFMT ); // keep file type only
+    entry.insert( KIO::UDSEntry::UDS_SIZE, archiveEntry.size );
+    entry.insert( KIO::UDSEntry::UDS_MODIFICATION_TIME, archiveEntry.date);
+    entry.insert( KIO::UDSEntry::UDS_ACCESS, archiveEntry.permissions & 07777 ); // keep permissions only
+    entry.insert( KIO::UDSEntry::UDS_USER, archiveEntry.user);
+    entry.insert( KIO::UDSEntry::UDS_GROUP, archiveEntry.group);
+    entry.insert( KIO::UDSEntry::UDS_LINK_DEST, archiveEntry.symLinkTarget);
 }
 
 void ArchiveProtocol::listDir( const KUrl & url )
@@ -255,8 +345,7 @@ void ArchiveProtocol::listDir( const KUrl & url )
         redirection( redir );
         finished();
         // And let go of the tar file - for people who want to unmount a cdrom after that
-        delete m_archiveFile;
-        m_archiveFile = 0L;
+        closeArchives();
         return;
     }
 
@@ -272,12 +361,11 @@ void ArchiveProtocol::listDir( const KUrl & url )
     }
 
     kDebug( 7109 ) << "checkNewFile done";
-    const KArchiveDirectory* root = m_archiveFile->directory();
-    const KArchiveDirectory* dir;
+    const ArchiveIndex & index = m_current->index;
     if (!path.isEmpty() && path != "/")
     {
         kDebug(7109) << "Looking for entry" << path;
-        const KArchiveEntry* e = root->entry( path );
+        const ArchiveIndex::Entry* e = index.entry( path );
         if ( !e )
         {
             error( KIO::ERR_DOES_NOT_EXIST, url.prettyUrl() );
@@ -288,27 +376,26 @@ void ArchiveProtocol::listDir( const KUrl & url )
             error( KIO::ERR_IS_FILE, url.prettyUrl() );
             return;
         }
-        dir = (KArchiveDirectory*)e;
-    } else {
-        dir = root;
     }
 
-    const QStringList l = dir->entries();
+    const QList<const ArchiveIndex::Entry*> l = index.entries( path );
     totalSize( l.count() );
 
     UDSEntry entry;
-    if (!l.contains(".")) {
+    bool hasDot = false;
+    QList<const ArchiveIndex::Entry*>::const_iterator it = l.begin();
+    for( ; it != l.end() && !hasDot; ++it )
+        hasDot = ( (*it)->name == "." );
+    if (!hasDot) {
         createRootUDSEntry(entry);
         listEntry(entry, false);
     }
 
-    QStringList::const_iterator it = l.begin();
-    for( ; it != l.end(); ++it )
+    for( it = l.begin(); it != l.end(); ++it )
     {
-        kDebug(7109) << (*it);
-        const KArchiveEntry* archiveEntry = dir->entry( (*it) );
+        kDebug(7109) << (*it)->name;
 
-        createUDSEntry( archiveEntry, entry );
+        createUDSEntry( *(*it), entry );
 
         listEntry( entry, false );
     }
@@ -369,27 +456,22 @@ void ArchiveProtocol::stat( const KUrl & url )
         finished();
 
         // And let go of the tar file - for people who want to unmount a cdrom after that
-        delete m_archiveFile;
-        m_archiveFile = 0L;
+        closeArchives();
         return;
     }
 
-    const KArchiveDirectory* root = m_archiveFile->directory();
-    const KArchiveEntry* archiveEntry;
     if ( path.isEmpty() )
     {
         path = QString::fromLatin1( "/" );
-        archiveEntry = root;
-    } else {
-        archiveEntry = root->entry( path );
     }
+    const ArchiveIndex::Entry* archiveEntry = m_current->index.entry( path );
     if ( !archiveEntry )
     {
         error( KIO::ERR_DOES_NOT_EXIST, url.prettyUrl() );
         return;
     }
 
-    createUDSEntry( archiveEntry, entry );
+    createUDSEntry( *archiveEntry, entry );
     statEntry( entry );
 
     finished();
@@ -420,8 +502,7 @@ void ArchiveProtocol::get( const KUrl & url )
         }
     }
 
-    const KArchiveDirectory* root = m_archiveFile->directory();
-    const KArchiveEntry* archiveEntry = root->entry( path );
+    const ArchiveIndex::Entry* archiveEntry = m_current->index.entry( path );
 
     if ( !archiveEntry )
     {
@@ -433,11 +514,10 @@ void ArchiveProtocol::get( const KUrl & url )
         error( KIO::ERR_IS_DIRECTORY, url.prettyUrl() );
         return;
     }
-    const KArchiveFile* archiveFileEntry = static_cast<const KArchiveFile *>(archiveEntry);
-    if ( !archiveEntry->symLinkTarget().isEmpty() )
+    if ( !archiveEntry->symLinkTarget.isEmpty() )
     {
-      kDebug(7109) << "Redirection to" << archiveEntry->symLinkTarget();
-      KUrl realURL( url, archiveEntry->symLinkTarget() );
+      kDebug(7109) << "Redirection to" << archiveEntry->symLinkTarget;
+      KUrl realURL( url, archiveEntry->symLinkTarget );
       kDebug(7109).nospace() << "realURL=" << realURL.url();
       redirection( realURL );
       finished();
@@ -453,43 +533,67 @@ void ArchiveProtocol::get( const KUrl & url )
      * - errors are skipped, resulting in an empty file
      */
 
-    QIODevice* io = archiveFileEntry->createDevice();
+    // In a compressed tar archive, the decompression can start at the seek
+    // point right before the file, instead of at the start of the archive
+    QIODevice* io = seekableDevice( m_current );
+    const bool ownDevice = !io || !io->seek( archiveEntry->position );
 
-    if (!io)
+    if ( ownDevice )
     {
-        error( KIO::ERR_SLAVE_DEFINED,
-            i18n( "The archive file could not be opened, perhaps because the format is unsupported.\n%1" ,
-                      url.prettyUrl() ) );
-        return;
-    }
+        if ( !m_current->archive && !openArchiveFile( m_current, errorNum ) )
+        {
+            error( KIO::ERR_SLAVE_DEFINED,
+                   i18n( "Could not open the file, probably due to an unsupported file format.\n%1",
+                             url.prettyUrl() ) );
+            return;
+        }
 
-    if ( !io->open( QIODevice::ReadOnly ) )
-    {
-        error( KIO::ERR_CANNOT_OPEN_FOR_READING, url.prettyUrl() );
-        delete io;
-        return;
+        const KArchiveEntry* entry = m_current->archive->directory()->entry( path );
+        if ( !entry || !entry->isFile() )
+        {
+            error( KIO::ERR_DOES_NOT_EXIST, url.prettyUrl() );
+            return;
+        }
+
+        io = static_cast<const KArchiveFile *>( entry )->createDevice();
+
+        if (!io)
+        {
+            error( KIO::ERR_SLAVE_DEFINED,
+                i18n( "The archive file could not be opened, perhaps because the format is unsupported.\n%1" ,
+                          url.prettyUrl() ) );
+            return;
+        }
+
+        if ( !io->open( QIODevice::ReadOnly ) )
+        {
+            error( KIO::ERR_CANNOT_OPEN_FOR_READING, url.prettyUrl() );
+            delete io;
+            return;
+        }
     }
 
-    totalSize( archiveFileEntry->size() );
+    totalSize( archiveEntry->size );
 
     // Size of a QIODevice read. It must be large enough so that the mime type check will not fail
     const qint64 maxSize = 0x100000; // 1MB
 
-    qint64 bufferSize = qMin( maxSize, archiveFileEntry->size() );
+    qint64 bufferSize = qMin( maxSize, archiveEntry->size );
     QByteArray buffer;
     buffer.resize( bufferSize );
     if ( buffer.isEmpty() && bufferSize > 0 )
     {
         // Something went wrong
         error( KIO::ERR_OUT_OF_MEMORY, url.prettyUrl() );
-        delete io;
+        if ( ownDevice )
+            delete io;
         return;
     }
 
     bool firstRead = true;
 
     // How much file do we still have to process?
-    qint64 fileSize = archiveFileEntry->size();
+    qint64 fileSize = archiveEntry->size;
     KIO::filesize_t processed = 0;
 
     while ( !io->atEnd() && fileSize > 0 )
@@ -504,7 +608,8 @@ void ArchiveProtocol::get( const KUrl & url )
         {
             kWarning(7109) << "Read" << read << "bytes but expected" << bufferSize ;
             error( KIO::ERR_COULD_NOT_READ, url.prettyUrl() );
-            delete io;
+            if ( ownDevice )
+                delete io;
             return;
         }
         if ( firstRead )
@@ -521,8 +626,11 @@ void ArchiveProtocol::get( const KUrl & url )
         processedSize( processed );
         fileSize -= bufferSize;
     }
-    io->close();
-    delete io;
+    if ( ownDevice )
+    {
+        io->close();
+        delete io;
+    }
 
     data( QByteArray() );
 
@@ -22,11 +22,15 @@
 
 #include <sys/types.h>
 
+#include <QtCore/QList>
+
 #include <kio/global.h>
 #include <kio/slavebase.h>
 
+#include "archiveindex.h"
+
 class KArchive;
-class KArchiveEntry;
+class SeekableFilterDevice;
 
 class ArchiveProtocol : public KIO::SlaveBase
 {
@@ -39,8 +43,29 @@ public:
     virtual void get( const KUrl & url );
 
 private:
+    /**
+     * A recently visited archive. listDir and stat only need the index,
+     * the archive itself is opened when data is read from it.
+     */
+    struct OpenArchive
+    {
+        OpenArchive() : archive( 0 ), device( 0 ), seekable( true ), size( 0 ), mtime( 0 ) {}
+        ~OpenArchive();
+
+        KArchive * archive;
+        ArchiveIndex index;
+        // The uncompressed tar data, for reading files without opening the archive
+        SeekableFilterDevice * device;
+        bool seekable;
+        QString name;
+        QString protocol;
+        qint64 size;
+        time_t mtime;
+        QString user, group;
+    };
+
     void createRootUDSEntry( KIO::UDSEntry & entry );
-    void createUDSEntry( const KArchiveEntry * tarEntry, KIO::UDSEntry & entry );
+    void createUDSEntry( const ArchiveIndex::Entry & archiveEntry, KIO::UDSEntry & entry );
 
     /**
      * \brief find, check and open the archive file
@@ -51,10 +76,25 @@ private:
      */
     bool checkNewFile( const KUrl & url, QString & path, KIO::Error& errorNum );
 
-    KArchive * m_archiveFile;
-    QString m_archiveName;
-    QString m_user, m_group;
-    time_t m_mtime;
+    /**
+     * \brief open the archive of @p openArchive, building its index if needed
+     */
+    bool openArchiveFile( OpenArchive * openArchive, KIO::Error& errorNum );
+
+    /**
+     * \brief the uncompressed data of the tar archive of @p openArchive, or 0
+     * if it can not be read that way
+     */
+    SeekableFilterDevice * seekableDevice( OpenArchive * openArchive );
+
+    /**
+     * \brief close all archives, their indexes are kept
+     */
+    void closeArchives();
+
+    // The recently visited archives, the most recent one first
+    QList<OpenArchive *> m_archives;
+    OpenArchive * m_current;
 };
 
 #endif // KIO_ARCHIVE_H
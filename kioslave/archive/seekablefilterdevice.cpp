@@ -0,0 +1,706 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "seekablefilterdevice.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <QDataStream>
+
+#include <kdebug.h>
+#include <ksavefile.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+#include "archiveindex.h"
+
+static const char s_seekPointsMagic[] = "KIOARSKP";
+static const quint32 s_seekPointsVersion = 1;
+// A seek point takes at least this many bytes: its two positions, its bits
+// and the length of its window
+static const qint64 s_minimumSeekPointSize = 2 * 8 + 4 + 4;
+
+// Distance between two gzip seek points in the uncompressed data
+#define SEEK_POINT_SPAN 0x200000 // 2MB
+// Size of the deflate window, which has to be saved with each seek point
+#define WINDOW_SIZE 0x8000
+// Size of the reads from the compressed file
+#define INPUT_SIZE 0x10000
+
+class SeekableFilterDevice::Private
+{
+public:
+    Private()
+        : active( false ), streamEnd( false ), inputEnd( false )
+    {
+#ifdef HAVE_ZLIB
+        memset( &zStream, 0, sizeof( zStream ) );
+#endif
+#ifdef HAVE_LIBLZMA
+        const lzma_stream init = LZMA_STREAM_INIT;
+        xzStream = init;
+        xzIndex = 0;
+        xzCheck = LZMA_CHECK_NONE;
+        memset( &xzBlock, 0, sizeof( xzBlock ) );
+        xzFilters[ 0 ].id = LZMA_VLI_UNKNOWN;
+#endif
+    }
+
+    // Whether a decompressor is set up, whether it reached the end of its
+    // data and whether all of the compressed file was read
+    bool active;
+    bool streamEnd;
+    bool inputEnd;
+    QByteArray input;
+    QByteArray skipBuffer;
+
+#ifdef HAVE_ZLIB
+    z_stream zStream;
+#endif
+#ifdef HAVE_LIBLZMA
+    lzma_stream xzStream;
+    lzma_index * xzIndex;
+    lzma_check xzCheck;
+    // The decoder writes into the block until it is done with it
+    lzma_block xzBlock;
+    lzma_filter xzFilters[ LZMA_FILTERS_MAX + 1 ];
+#endif
+};
+
+SeekableFilterDevice::SeekableFilterDevice( const QString & fileName, qint64 size, time_t mtime )
+    : d( new Private ),
+      m_file( fileName ),
+      m_fileName( fileName ),
+      m_fileSize( size ),
+      m_mtime( mtime ),
+      m_format( Unsupported ),
+      m_size( 0 ),
+      m_decodedPos( 0 )
+{
+}
+
+SeekableFilterDevice::~SeekableFilterDevice()
+{
+    close();
+#ifdef HAVE_LIBLZMA
+    if ( d->xzIndex )
+        lzma_index_end( d->xzIndex, 0 );
+#endif
+    delete d;
+}
+
+bool SeekableFilterDevice::open( OpenMode mode )
+{
+    if ( isOpen() )
+        return ( mode & ReadWrite ) == ReadOnly;
+    if ( ( mode & ReadWrite ) != ReadOnly )
+        return false;
+
+    if ( !m_file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    bool ok = false;
+    m_format = detectFormat();
+    switch ( m_format )
+    {
+    case Plain:
+        m_size = m_file.size();
+        ok = true;
+        break;
+    case Gzip:
+        ok = openGzip();
+        break;
+    case Xz:
+        ok = openXz();
+        break;
+    case Unsupported:
+        break;
+    }
+
+    if ( !ok )
+    {
+        kDebug(7109) << "Can not seek in" << m_fileName;
+        m_file.close();
+        return false;
+    }
+
+    d->input.resize( INPUT_SIZE );
+    m_decodedPos = 0;
+    return QIODevice::open( ReadOnly | Unbuffered );
+}
+
+void SeekableFilterDevice::close()
+{
+    if ( !isOpen() )
+        return;
+
+    endDecompression();
+    m_file.close();
+    QIODevice::close();
+}
+
+bool SeekableFilterDevice::isSequential() const
+{
+    return false;
+}
+
+qint64 SeekableFilterDevice::size() const
+{
+    return m_size;
+}
+
+qint64 SeekableFilterDevice::readData( char * data, qint64 maxSize )
+{
+    const qint64 target = pos();
+    if ( target >= m_size )
+        return 0;
+
+    if ( m_format == Plain )
+    {
+        if ( m_file.pos() != target && !m_file.seek( target ) )
+            return -1;
+        return m_file.read( data, maxSize );
+    }
+
+    // Going on from where the decompressor is beats a restart, unless there
+    // is a seek point or block in between
+    if ( !d->active || target < m_decodedPos || resumePosition( target ) > m_decodedPos )
+    {
+        if ( !restart( target ) )
+            return -1;
+    }
+
+    if ( m_decodedPos < target )
+    {
+        d->skipBuffer.resize( INPUT_SIZE );
+        while ( m_decodedPos < target )
+        {
+            const qint64 skipped = decompress( d->skipBuffer.data(), qMin( target - m_decodedPos, qint64( INPUT_SIZE ) ) );
+            if ( skipped <= 0 )
+                return -1;
+        }
+    }
+
+    return decompress( data, maxSize );
+}
+
+qint64 SeekableFilterDevice::writeData( const char *, qint64 )
+{
+    return -1;
+}
+
+SeekableFilterDevice::Format SeekableFilterDevice::detectFormat()
+{
+    char header[ 512 ];
+    const qint64 length = m_file.read( header, sizeof( header ) );
+    m_file.seek( 0 );
+    if ( length < 6 )
+        return Unsupported;
+
+    if ( uchar( header[ 0 ] ) == 0x1f && uchar( header[ 1 ] ) == 0x8b && header[ 2 ] == 8 )
+        return Gzip;
+    if ( memcmp( header, "\xfd" "7zXZ\0", 6 ) == 0 )
+        return Xz;
+    // Only uncompressed tar files are read as they are
+    if ( length == sizeof( header ) && memcmp( header + 257, "ustar", 5 ) == 0 )
+        return Plain;
+    return Unsupported;
+}
+
+qint64 SeekableFilterDevice::resumePosition( qint64 pos ) const
+{
+#ifdef HAVE_ZLIB
+    if ( m_format == Gzip )
+    {
+        qint64 out = 0;
+        for ( int i = 0; i < m_seekPoints.count() && m_seekPoints.at( i ).out <= pos; ++i )
+            out = m_seekPoints.at( i ).out;
+        return out;
+    }
+#endif
+#ifdef HAVE_LIBLZMA
+    if ( m_format == Xz )
+    {
+        lzma_index_iter iter;
+        lzma_index_iter_init( &iter, d->xzIndex );
+        if ( !lzma_index_iter_locate( &iter, pos ) )
+            return iter.block.uncompressed_file_offset;
+    }
+#endif
+    Q_UNUSED( pos );
+    return 0;
+}
+
+bool SeekableFilterDevice::restart( qint64 pos )
+{
+    endDecompression();
+
+#ifdef HAVE_ZLIB
+    if ( m_format == Gzip )
+    {
+        int i = 0;
+        while ( i + 1 < m_seekPoints.count() && m_seekPoints.at( i + 1 ).out <= pos )
+            ++i;
+        if ( m_seekPoints.isEmpty() )
+            return false;
+        const SeekPoint & point = m_seekPoints.at( i );
+
+        z_stream & strm = d->zStream;
+        memset( &strm, 0, sizeof( strm ) );
+        // The seek points are in the raw deflate data, after the gzip header
+        if ( inflateInit2( &strm, -15 ) != Z_OK )
+            return false;
+        d->active = true;
+
+        if ( !m_file.seek( point.in - ( point.bits ? 1 : 0 ) ) )
+            return false;
+        if ( point.bits )
+        {
+            char c;
+            if ( !m_file.getChar( &c ) )
+                return false;
+            inflatePrime( &strm, point.bits, uchar( c ) >> ( 8 - point.bits ) );
+        }
+        if ( !point.window.isEmpty() )
+        {
+            const QByteArray window = qUncompress( point.window );
+            if ( window.isEmpty() ||
+                 inflateSetDictionary( &strm, reinterpret_cast<const Bytef *>( window.constData() ), window.size() ) != Z_OK )
+                return false;
+        }
+
+        m_decodedPos = point.out;
+        return true;
+    }
+#endif
+#ifdef HAVE_LIBLZMA
+    if ( m_format == Xz )
+    {
+        lzma_index_iter iter;
+        lzma_index_iter_init( &iter, d->xzIndex );
+        if ( lzma_index_iter_locate( &iter, pos ) )
+            return false;
+
+        // Decode the header of the block, the index only knows where it is
+        char size;
+        if ( !m_file.seek( iter.block.compressed_file_offset ) || !m_file.getChar( &size ) || size == 0 )
+            return false;
+        QByteArray header( lzma_block_header_size_decode( uchar( size ) ), 0 );
+        header[ 0 ] = size;
+        if ( m_file.read( header.data() + 1, header.size() - 1 ) != header.size() - 1 )
+            return false;
+
+        lzma_block & block = d->xzBlock;
+        memset( &block, 0, sizeof( block ) );
+        block.version = 0;
+        block.check = d->xzCheck;
+        block.filters = d->xzFilters;
+        block.header_size = header.size();
+        d->active = true;
+        if ( lzma_block_header_decode( &block, 0, reinterpret_cast<const uint8_t *>( header.constData() ) ) != LZMA_OK )
+        {
+            d->xzFilters[ 0 ].id = LZMA_VLI_UNKNOWN;
+            return false;
+        }
+
+        if ( lzma_block_compressed_size( &block, iter.block.unpadded_size ) != LZMA_OK ||
+             lzma_block_decoder( &d->xzStream, &block ) != LZMA_OK )
+            return false;
+
+        m_decodedPos = iter.block.uncompressed_file_offset;
+        return true;
+    }
+#endif
+    Q_UNUSED( pos );
+    return false;
+}
+
+qint64 SeekableFilterDevice::decompress( char * data, qint64 maxSize )
+{
+    qint64 produced = 0;
+    while ( produced < maxSize )
+    {
+        if ( d->streamEnd )
+        {
+            // xz blocks are decoded one at a time
+            if ( m_format == Xz && m_decodedPos < m_size && restart( m_decodedPos ) )
+                continue;
+            break;
+        }
+
+        size_t availableInput = 0;
+#ifdef HAVE_ZLIB
+        if ( m_format == Gzip )
+            availableInput = d->zStream.avail_in;
+#endif
+#ifdef HAVE_LIBLZMA
+        if ( m_format == Xz )
+            availableInput = d->xzStream.avail_in;
+#endif
+        if ( availableInput == 0 && !d->inputEnd )
+        {
+            const qint64 length = m_file.read( d->input.data(), d->input.size() );
+            if ( length < 0 )
+                return -1;
+            d->inputEnd = length == 0;
+#ifdef HAVE_ZLIB
+            if ( m_format == Gzip )
+            {
+                d->zStream.next_in = reinterpret_cast<Bytef *>( d->input.data() );
+                d->zStream.avail_in = length;
+            }
+#endif
+#ifdef HAVE_LIBLZMA
+            if ( m_format == Xz )
+            {
+                d->xzStream.next_in = reinterpret_cast<const uint8_t *>( d->input.constData() );
+                d->xzStream.avail_in = length;
+            }
+#endif
+        }
+
+        const uint outSize = qMin( maxSize - produced, qint64( INT_MAX ) );
+        uint outLeft = outSize;
+        bool ok = false;
+
+#ifdef HAVE_ZLIB
+        if ( m_format == Gzip )
+        {
+            z_stream & strm = d->zStream;
+            strm.next_out = reinterpret_cast<Bytef *>( data + produced );
+            strm.avail_out = outSize;
+            const int ret = inflate( &strm, Z_NO_FLUSH );
+            outLeft = strm.avail_out;
+            d->streamEnd = ret == Z_STREAM_END;
+            ok = ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR;
+        }
+#endif
+#ifdef HAVE_LIBLZMA
+        if ( m_format == Xz )
+        {
+            lzma_stream & strm = d->xzStream;
+            strm.next_out = reinterpret_cast<uint8_t *>( data + produced );
+            strm.avail_out = outSize;
+            const lzma_ret ret = lzma_code( &strm, LZMA_RUN );
+            outLeft = strm.avail_out;
+            d->streamEnd = ret == LZMA_STREAM_END;
+            ok = ret == LZMA_OK || ret == LZMA_STREAM_END || ret == LZMA_BUF_ERROR;
+        }
+#endif
+
+        if ( !ok )
+        {
+            kDebug(7109) << "Decompression error in" << m_fileName;
+            endDecompression();
+            return -1;
+        }
+
+        produced += outSize - outLeft;
+        m_decodedPos += outSize - outLeft;
+
+        if ( outLeft == outSize && !d->streamEnd && d->inputEnd )
+        {
+            kDebug(7109) << "Unexpected end of" << m_fileName;
+            endDecompression();
+            return produced > 0 ? produced : -1;
+        }
+    }
+
+    return produced;
+}
+
+void SeekableFilterDevice::endDecompression()
+{
+    if ( !d->active )
+        return;
+
+#ifdef HAVE_ZLIB
+    if ( m_format == Gzip )
+        inflateEnd( &d->zStream );
+#endif
+#ifdef HAVE_LIBLZMA
+    if ( m_format == Xz )
+    {
+        lzma_end( &d->xzStream );
+        const lzma_stream init = LZMA_STREAM_INIT;
+        d->xzStream = init;
+        for ( int i = 0; d->xzFilters[ i ].id != LZMA_VLI_UNKNOWN; ++i )
+            free( d->xzFilters[ i ].options );
+        d->xzFilters[ 0 ].id = LZMA_VLI_UNKNOWN;
+    }
+#endif
+    d->active = false;
+    d->streamEnd = false;
+    d->inputEnd = false;
+}
+
+bool SeekableFilterDevice::openGzip()
+{
+#ifdef HAVE_ZLIB
+    if ( loadSeekPoints() )
+        return true;
+    if ( !buildSeekPoints() )
+        return false;
+    if ( !saveSeekPoints() )
+        kDebug(7109) << "Could not save the seek points of" << m_fileName;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool SeekableFilterDevice::loadSeekPoints()
+{
+    QFile file( ArchiveIndex::cacheFileName( m_fileName, m_fileSize, m_mtime, QLatin1String( "seek" ) ) );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QDataStream stream( &file );
+    stream.setVersion( QDataStream::Qt_4_6 );
+
+    char magic[ sizeof( s_seekPointsMagic ) - 1 ];
+    if ( stream.readRawData( magic, sizeof( magic ) ) != int( sizeof( magic ) ) ||
+         qstrncmp( magic, s_seekPointsMagic, sizeof( magic ) ) != 0 )
+        return false;
+
+    quint32 version;
+    QString name;
+    qint64 fileSize;
+    qint64 fileTime;
+    qint64 size;
+    quint32 count;
+    stream >> version >> name >> fileSize >> fileTime >> size >> count;
+    if ( stream.status() != QDataStream::Ok || version != s_seekPointsVersion ||
+         name != m_fileName || fileSize != m_fileSize || fileTime != qint64( m_mtime ) )
+        return false;
+    // A damaged count must not make us allocate more than the file can hold
+    if ( qint64( count ) > ( file.size() - file.pos() ) / s_minimumSeekPointSize )
+        return false;
+
+    QVector<SeekPoint> points;
+    points.reserve( count );
+    for ( quint32 i = 0; i < count; ++i )
+    {
+        SeekPoint point;
+        qint32 bits;
+        stream >> point.out >> point.in >> bits >> point.window;
+        point.bits = bits;
+        points.append( point );
+    }
+    if ( stream.status() != QDataStream::Ok || points.isEmpty() )
+        return false;
+
+    m_seekPoints = points;
+    m_size = size;
+    kDebug(7109) << "Loaded" << count << "seek points of" << m_fileName;
+    return true;
+}
+
+bool SeekableFilterDevice::saveSeekPoints() const
+{
+    KSaveFile file( ArchiveIndex::cacheFileName( m_fileName, m_fileSize, m_mtime, QLatin1String( "seek" ) ) );
+    if ( !file.open() )
+        return false;
+
+    QDataStream stream( &file );
+    stream.setVersion( QDataStream::Qt_4_6 );
+
+    stream.writeRawData( s_seekPointsMagic, sizeof( s_seekPointsMagic ) - 1 );
+    stream << s_seekPointsVersion << m_fileName << m_fileSize << qint64( m_mtime ) << m_size
+           << quint32( m_seekPoints.count() );
+    for ( int i = 0; i < m_seekPoints.count(); ++i )
+    {
+        const SeekPoint & point = m_seekPoints.at( i );
+        stream << point.out << point.in << qint32( point.bits ) << point.window;
+    }
+
+    if ( stream.status() != QDataStream::Ok || !file.finalize() )
+    {
+        file.abort();
+        return false;
+    }
+
+    ArchiveIndex::pruneCache( QLatin1String( "seek" ) );
+    return true;
+}
+
+bool SeekableFilterDevice::buildSeekPoints()
+{
+#ifdef HAVE_ZLIB
+    // Decompress the whole file once, remembering the state of the
+    // decompressor at block boundaries every SEEK_POINT_SPAN bytes.
+    // See examples/zran.c in the zlib sources.
+    z_stream strm;
+    memset( &strm, 0, sizeof( strm ) );
+    // Only gzip headers, no zlib ones
+    if ( inflateInit2( &strm, 15 + 16 ) != Z_OK )
+        return false;
+
+    QByteArray input( INPUT_SIZE, 0 );
+    QByteArray window( WINDOW_SIZE, 0 );
+    qint64 totalIn = 0;
+    qint64 totalOut = 0;
+    qint64 last = 0;
+    QVector<SeekPoint> points;
+    int ret = Z_OK;
+
+    m_file.seek( 0 );
+    strm.avail_out = 0;
+    do
+    {
+        const qint64 length = m_file.read( input.data(), input.size() );
+        if ( length <= 0 )
+        {
+            ret = Z_DATA_ERROR;
+            break;
+        }
+        strm.next_in = reinterpret_cast<Bytef *>( input.data() );
+        strm.avail_in = length;
+
+        do
+        {
+            // The output goes round the window, so that the last 32K are always in it
+            if ( strm.avail_out == 0 )
+            {
+                strm.next_out = reinterpret_cast<Bytef *>( window.data() );
+                strm.avail_out = WINDOW_SIZE;
+            }
+
+            totalIn += strm.avail_in;
+            totalOut += strm.avail_out;
+            ret = inflate( &strm, Z_BLOCK );
+            totalIn -= strm.avail_in;
+            totalOut -= strm.avail_out;
+            if ( ret != Z_OK && ret != Z_BUF_ERROR )
+                break;
+
+            // At the end of a block, and not behind the last one
+            if ( ( strm.data_type & 128 ) && !( strm.data_type & 64 ) &&
+                 ( totalOut == 0 || totalOut - last > SEEK_POINT_SPAN ) )
+            {
+                const int used = WINDOW_SIZE - strm.avail_out;
+                const QByteArray ordered = window.mid( used ) + window.left( used );
+
+                SeekPoint point;
+                point.out = totalOut;
+                point.in = totalIn;
+                point.bits = strm.data_type & 7;
+                if ( totalOut > 0 )
+                    point.window = qCompress( ordered.right( qMin( totalOut, qint64( WINDOW_SIZE ) ) ) );
+                points.append( point );
+                last = totalOut;
+            }
+        } while ( strm.avail_in != 0 );
+    } while ( ret == Z_OK || ret == Z_BUF_ERROR );
+
+    const bool trailingData = ret == Z_STREAM_END && ( strm.avail_in != 0 || !m_file.atEnd() );
+    inflateEnd( &strm );
+
+    if ( ret != Z_STREAM_END )
+    {
+        kDebug(7109) << "Could not decompress" << m_fileName;
+        return false;
+    }
+    if ( trailingData )
+    {
+        // Several gzip members, the raw deflate data of the seek points would
+        // not go on into the next one
+        kDebug(7109) << m_fileName << "has several gzip members";
+        return false;
+    }
+
+    m_seekPoints = points;
+    m_size = totalOut;
+    kDebug(7109) << "Built" << points.count() << "seek points for" << m_fileName;
+    return !points.isEmpty();
+#else
+    return false;
+#endif
+}
+
+bool SeekableFilterDevice::openXz()
+{
+#ifdef HAVE_LIBLZMA
+    // The stream footer at the end of the file says where the index is.
+    // Stream padding comes in multiples of four zero bytes.
+    uint8_t footer[ LZMA_STREAM_HEADER_SIZE ];
+    qint64 end = m_file.size();
+    for ( ;; )
+    {
+        if ( end < 2 * LZMA_STREAM_HEADER_SIZE || !m_file.seek( end - LZMA_STREAM_HEADER_SIZE ) ||
+             m_file.read( reinterpret_cast<char *>( footer ), sizeof( footer ) ) != sizeof( footer ) )
+            return false;
+        if ( memcmp( footer + sizeof( footer ) - 4, "\0\0\0\0", 4 ) != 0 )
+            break;
+        end -= 4;
+    }
+
+    lzma_stream_flags footerFlags;
+    if ( lzma_stream_footer_decode( &footerFlags, footer ) != LZMA_OK )
+        return false;
+
+    const qint64 indexStart = end - LZMA_STREAM_HEADER_SIZE - qint64( footerFlags.backward_size );
+    if ( indexStart < LZMA_STREAM_HEADER_SIZE || !m_file.seek( indexStart ) )
+        return false;
+    const QByteArray indexData = m_file.read( footerFlags.backward_size );
+    if ( indexData.size() != qint64( footerFlags.backward_size ) )
+        return false;
+
+    uint64_t memLimit = UINT64_MAX;
+    size_t inPos = 0;
+    if ( lzma_index_buffer_decode( &d->xzIndex, &memLimit, 0,
+                                   reinterpret_cast<const uint8_t *>( indexData.constData() ),
+                                   &inPos, indexData.size() ) != LZMA_OK )
+    {
+        d->xzIndex = 0;
+        return false;
+    }
+
+    // Only a single stream is supported, which is what xz writes
+    uint8_t header[ LZMA_STREAM_HEADER_SIZE ];
+    lzma_stream_flags headerFlags;
+    if ( qint64( lzma_index_file_size( d->xzIndex ) ) != end || !m_file.seek( 0 ) ||
+         m_file.read( reinterpret_cast<char *>( header ), sizeof( header ) ) != sizeof( header ) ||
+         lzma_stream_header_decode( &headerFlags, header ) != LZMA_OK ||
+         lzma_stream_flags_compare( &headerFlags, &footerFlags ) != LZMA_OK )
+    {
+        kDebug(7109) << m_fileName << "has several xz streams";
+        return false;
+    }
+
+    // A single block has to be decompressed from the start anyway
+    if ( lzma_index_block_count( d->xzIndex ) < 2 )
+    {
+        kDebug(7109) << m_fileName << "has a single xz block";
+        return false;
+    }
+
+    d->xzCheck = headerFlags.check;
+    m_size = lzma_index_uncompressed_size( d->xzIndex );
+    return true;
+#else
+    return false;
+#endif
+}
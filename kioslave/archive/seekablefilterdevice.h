@@ -0,0 +1,108 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef SEEKABLEFILTERDEVICE_H
+#define SEEKABLEFILTERDEVICE_H
+
+#include <sys/types.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QIODevice>
+#include <QtCore/QVector>
+
+/**
+ * The uncompressed contents of a plain, gzip or xz compressed file, with
+ * cheap seeking.
+ *
+ * Seeking in a compressed stream normally means decompressing everything
+ * before the wanted position. For gzip files the state of the decompressor is
+ * saved every few MiB (a seek point), which costs one pass over the file when
+ * it is opened the first time; the seek points are then kept in the cache dir.
+ * xz files split into several blocks (xz -T, --block-size) already carry an
+ * index of their blocks. Decompression then starts at the seek point or block
+ * right before the wanted position.
+ *
+ * open() fails for formats or files which can not be read this way, e.g.
+ * bzip2, concatenated gzip members or single block xz files.
+ */
+class SeekableFilterDevice : public QIODevice
+{
+public:
+    /**
+     * @p size and @p mtime identify the version of the file the seek points
+     * are saved for.
+     */
+    SeekableFilterDevice( const QString & fileName, qint64 size, time_t mtime );
+    virtual ~SeekableFilterDevice();
+
+    virtual bool open( OpenMode mode );
+    virtual void close();
+    virtual bool isSequential() const;
+    virtual qint64 size() const;
+
+protected:
+    virtual qint64 readData( char * data, qint64 maxSize );
+    virtual qint64 writeData( const char * data, qint64 maxSize );
+
+private:
+    enum Format { Plain, Gzip, Xz, Unsupported };
+
+    // A position in a gzip stream decompression can be resumed from
+    struct SeekPoint
+    {
+        qint64 out;         // position in the uncompressed data
+        qint64 in;          // position in the compressed file
+        int bits;           // bits of the byte before 'in' which belong to the seek point
+        QByteArray window;  // the last 32 KiB of uncompressed data before 'out'
+    };
+
+    Format detectFormat();
+
+    bool openGzip();
+    bool loadSeekPoints();
+    bool saveSeekPoints() const;
+    bool buildSeekPoints();
+
+    bool openXz();
+
+    // The position of the seek point or block before @p pos
+    qint64 resumePosition( qint64 pos ) const;
+    // Starts decompressing at the seek point or block before @p pos
+    bool restart( qint64 pos );
+    // Decompresses up to @p maxSize bytes, 0 at the end of the data, -1 on errors
+    qint64 decompress( char * data, qint64 maxSize );
+    void endDecompression();
+
+    class Private;
+    Private * const d;
+
+    QFile m_file;
+    QString m_fileName;
+    qint64 m_fileSize;
+    time_t m_mtime;
+    Format m_format;
+
+    // The size of the uncompressed data
+    qint64 m_size;
+    // The position in the uncompressed data the decompressor is at
+    qint64 m_decodedPos;
+    QVector<SeekPoint> m_seekPoints;
+};
+
+#endif // SEEKABLEFILTERDEVICE_H
@@ -26,8 +26,12 @@
 #include <kstandarddirs.h>
 #include <kdebug.h>
 
+#include <utime.h>
+
 QTEST_KDEMAIN(TestKioArchive, NoGUI)
 static const char s_tarFileName[] = "karchivetest.tar";
+static const char s_secondTarFileName[] = "karchivetest2.tar";
+static const char s_tarGzFileName[] = "karchivetest3.tar.gz";
 
 static void writeTestFilesToArchive( KArchive* archive )
 {
@@ -107,6 +111,34 @@ KUrl TestKioArchive::tarUrl() const
     return url;
 }
 
+KUrl TestKioArchive::secondTarUrl() const
+{
+    KUrl url;
+    url.setProtocol("tar");
+    url.setPath(QDir::currentPath());
+    url.addPath(s_secondTarFileName);
+    return url;
+}
+
+KUrl TestKioArchive::tarGzUrl() const
+{
+    KUrl url;
+    url.setProtocol("tar");
+    url.setPath(QDir::currentPath());
+    url.addPath(s_tarGzFileName);
+    return url;
+}
+
+void TestKioArchive::listArchive(const KUrl& url)
+{
+    m_listResult.clear();
+    KIO::ListJob* job = KIO::listDir(url, KIO::HideProgressInfo);
+    connect( job, SIGNAL( entries( KIO::Job*, const KIO::UDSEntryList& ) ),
+             SLOT( slotEntries( KIO::Job*, const KIO::UDSEntryList& ) ) );
+    bool ok = KIO::NetAccess::synchronousRun( job, 0 );
+    QVERIFY( ok );
+}
+
 void TestKioArchive::slotEntries( KIO::Job*, const KIO::UDSEntryList& lst )
 {
     for( KIO::UDSEntryList::ConstIterator it = lst.begin(); it != lst.end(); ++it ) {
@@ -126,6 +158,8 @@ QString TestKioArchive::tmpDir() const
 void TestKioArchive::cleanupTestCase()
 {
     KIO::NetAccess::synchronousRun(KIO::del(tmpDir(), KIO::HideProgressInfo), 0);
+    QFile::remove(s_secondTarFileName);
+    QFile::remove(s_tarGzFileName);
 }
 
 void TestKioArchive::copyFromTar(const KUrl& src, const QString& destPath)
@@ -167,3 +201,83 @@ void TestKioArchive::testExtractSymlinkFromTar()
     // -> ### TODO
     QVERIFY(QFileInfo(destPath).isSymLink());
 }
+
+void TestKioArchive::testListTwoArchives()
+{
+    KTar tar( s_secondTarFileName );
+    QVERIFY( tar.open( QIODevice::WriteOnly ) );
+    QVERIFY( tar.writeFile( "other", "weis", "users", "Salut", 5 ) );
+    QVERIFY( tar.close() );
+
+    // The slave keeps both archives open, switching must not mix them up
+    for (int i = 0; i < 2; ++i) {
+        listArchive(tarUrl());
+        QCOMPARE(m_listResult.count("test1"), 1);
+        QCOMPARE(m_listResult.count("other"), 0);
+
+        listArchive(secondTarUrl());
+        QCOMPARE(m_listResult.count("other"), 1);
+        QCOMPARE(m_listResult.count("test1"), 0);
+    }
+}
+
+void TestKioArchive::testListChangedArchive()
+{
+    listArchive(secondTarUrl());
+    QCOMPARE(m_listResult.count("other"), 1);
+
+    // Rewrite the archive, the cached entries must not be used anymore
+    {
+        KTar tar( s_secondTarFileName );
+        QVERIFY( tar.open( QIODevice::WriteOnly ) );
+        QVERIFY( tar.writeFile( "changed", "weis", "users", "Salut", 5 ) );
+        QVERIFY( tar.close() );
+    }
+
+    // Make sure the mtime differs, even if it was written within the same second
+    struct utimbuf times;
+    times.actime = times.modtime = QFileInfo( s_secondTarFileName ).lastModified().toTime_t() + 10;
+    QCOMPARE(::utime( s_secondTarFileName, &times ), 0);
+
+    listArchive(secondTarUrl());
+    QCOMPARE(m_listResult.count("changed"), 1);
+    QCOMPARE(m_listResult.count("other"), 0);
+}
+
+void TestKioArchive::testExtractFileFromTarGz()
+{
+    // Large enough for the slave to read it from its seek points, and hardly compressible
+    QByteArray big( 3 * 1024 * 1024, 0 );
+    qsrand( 42 );
+    for (int i = 0; i < big.size(); ++i)
+        big[i] = char( qrand() );
+
+    {
+        KTar tar( s_tarGzFileName, "application/x-gzip" );
+        QVERIFY( tar.open( QIODevice::WriteOnly ) );
+        QVERIFY( tar.writeFile( "big", "weis", "users", big.constData(), big.size() ) );
+        QVERIFY( tar.writeFile( "last", "weis", "users", "Hallo", 5 ) );
+        QVERIFY( tar.close() );
+    }
+    QVERIFY( QFileInfo( s_tarGzFileName ).size() > 1024 * 1024 );
+
+    // Twice, the second time the seek points are known already
+    for (int i = 0; i < 2; ++i) {
+        const QString destPath = tmpDir() + "fileFromTarGz_copied";
+        QFile::remove(destPath);
+        KUrl u = tarGzUrl();
+        u.addPath("last");
+        copyFromTar(u, destPath);
+        QFile last(destPath);
+        QVERIFY(last.open(QIODevice::ReadOnly));
+        QCOMPARE(last.readAll(), QByteArray("Hallo"));
+    }
+
+    const QString destPath = tmpDir() + "bigFromTarGz_copied";
+    KUrl u = tarGzUrl();
+    u.addPath("big");
+    copyFromTar(u, destPath);
+    QFile file(destPath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll() == big);
+}
@@ -41,6 +41,9 @@ private Q_SLOTS:
     void testListRecursive();
     void testExtractFileFromTar();
     void testExtractSymlinkFromTar();
+    void testListTwoArchives();
+    void testListChangedArchive();
+    void testExtractFileFromTarGz();
     void cleanupTestCase();
 
 protected Q_SLOTS: // real slots, not tests
@@ -49,6 +52,9 @@ protected Q_SLOTS: // real slots, not tests
 private:
     QString tmpDir() const;
     KUrl tarUrl() const;
+    KUrl secondTarUrl() const;
+    KUrl tarGzUrl() const;
+    void listArchive(const KUrl& url);
     void copyFromTar(const KUrl& url, const QString& destPath);
 
     QStringList m_listResult;
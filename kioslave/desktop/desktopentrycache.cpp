@@ -0,0 +1,220 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "desktopentrycache.h"
+
+#include <KAuthorized>
+#include <KConfigGroup>
+#include <KDebug>
+#include <KDesktopFile>
+#include <KGlobal>
+#include <KLocale>
+#include <KSaveFile>
+#include <KStandardDirs>
+#include <kde_file.h>
+
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QUrl>
+
+// The cache has a first line "D1 <language>", then
+// "<device> <inode> <mtime> <size> <nodisplay> <authorized> <path> <name> <tryexec>"
+// for each file, with the language and the last three fields percent encoded.
+// The names depend on the language, so a cache in another one is not used.
+#define CACHE_NAME "kio_desktop-entries"
+#define CACHE_VERSION "D2"
+
+static qint64 modificationTime(const QString &path)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0)
+        return -1;
+    return buff.st_mtime;
+}
+
+// The part of KDesktopFile::tryExec() that does not depend on TryExec
+static bool isAuthorized(const KDesktopFile &file)
+{
+    const QStringList actions = file.desktopGroup().readEntry("X-KDE-AuthorizeAction", QStringList());
+    foreach (const QString &action, actions) {
+        if (!KAuthorized::authorize(action.trimmed()))
+            return false;
+    }
+    return true;
+}
+
+DesktopEntryCache::DesktopEntryCache()
+    : m_cachePath(KStandardDirs::locateLocal("cache", CACHE_NAME)),
+      m_language(KGlobal::locale()->language()),
+      m_cacheMtime(-1),
+      m_changed(false)
+{
+}
+
+void DesktopEntryCache::refresh()
+{
+    m_executables.clear();
+
+    const qint64 cacheMtime = modificationTime(m_cachePath);
+    if (cacheMtime != -1 && cacheMtime != m_cacheMtime)
+        load();
+}
+
+bool DesktopEntryCache::entry(const QString &path, Entry &entry)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0)
+        return false;
+
+    QHash<QString, Entry>::const_iterator it = m_entries.constFind(path);
+    if (it != m_entries.constEnd() && it->device == qint64(buff.st_dev) && it->inode == qint64(buff.st_ino) &&
+        it->mtime == qint64(buff.st_mtime) && it->size == qint64(buff.st_size)) {
+        entry = *it;
+        return true;
+    }
+
+    KDesktopFile file(path);
+    entry.device = buff.st_dev;
+    entry.inode = buff.st_ino;
+    entry.mtime = buff.st_mtime;
+    entry.size = buff.st_size;
+    entry.name = file.readName();
+    // Only TryExec can change without the file changing, the rest is kept
+    entry.tryExec = file.desktopGroup().readEntry("TryExec", QString());
+    entry.noDisplay = file.noDisplay();
+    entry.authorized = isAuthorized(file);
+    m_entries.insert(path, entry);
+    m_changed = true;
+    return true;
+}
+
+bool DesktopEntryCache::isHidden(const Entry &entry)
+{
+    if (entry.noDisplay || !entry.authorized)
+        return true;
+    if (entry.tryExec.isEmpty())
+        return false;
+
+    QHash<QString, bool>::const_iterator it = m_executables.constFind(entry.tryExec);
+    if (it == m_executables.constEnd())
+        it = m_executables.insert(entry.tryExec, !KStandardDirs::findExe(entry.tryExec).isEmpty());
+    return !*it;
+}
+
+void DesktopEntryCache::updateDirectory(const QString &directory)
+{
+    refresh();
+
+    const QFileInfoList infos = QDir(directory).entryInfoList(QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot);
+    QSet<QString> paths;
+    Entry unused;
+    foreach (const QFileInfo &info, infos) {
+        QString path = info.absoluteFilePath();
+        if (info.isDir())
+            path += QLatin1String("/.directory");
+        else if (!KDesktopFile::isDesktopFile(path))
+            continue;
+        if (entry(path, unused))
+            paths.insert(path);
+    }
+
+    // Forget the files in the directory which are gone. The .directory file
+    // of the directory itself belongs to the listing of its parent.
+    const QString prefix = QDir(directory).absolutePath() + QLatin1Char('/');
+    QHash<QString, Entry>::iterator it = m_entries.begin();
+    while (it != m_entries.end()) {
+        const QString relativePath = it.key().mid(prefix.length());
+        const int slashes = relativePath.count(QLatin1Char('/'));
+        if (it.key().startsWith(prefix) && !paths.contains(it.key()) &&
+            ((slashes == 0 && relativePath != QLatin1String(".directory")) ||
+             (slashes == 1 && relativePath.endsWith(QLatin1String("/.directory"))))) {
+            it = m_entries.erase(it);
+            m_changed = true;
+        } else {
+            ++it;
+        }
+    }
+
+    save();
+}
+
+void DesktopEntryCache::load()
+{
+    QFile file(m_cachePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    // A broken cache is not read again, it is replaced when it is saved
+    m_cacheMtime = modificationTime(m_cachePath);
+
+    QByteArray line = file.readLine();
+    line.chop(1);
+    if (line != CACHE_VERSION " " + QUrl::toPercentEncoding(m_language))
+        return;
+
+    QHash<QString, Entry> entries;
+    while (!file.atEnd()) {
+        line = file.readLine();
+        if (!line.endsWith('\n'))
+            return; // truncated
+        line.chop(1);
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.count() != 9)
+            return;
+        Entry entry;
+        entry.device = fields.at(0).toLongLong();
+        entry.inode = fields.at(1).toLongLong();
+        entry.mtime = fields.at(2).toLongLong();
+        entry.size = fields.at(3).toLongLong();
+        entry.noDisplay = (fields.at(4) == "1");
+        entry.authorized = (fields.at(5) == "1");
+        entry.name = QUrl::fromPercentEncoding(fields.at(7));
+        entry.tryExec = QUrl::fromPercentEncoding(fields.at(8));
+        entries.insert(QFile::decodeName(QByteArray::fromPercentEncoding(fields.at(6))), entry);
+    }
+
+    m_entries = entries;
+    m_changed = false;
+}
+
+void DesktopEntryCache::save()
+{
+    if (!m_changed)
+        return;
+
+    KSaveFile file(m_cachePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        kWarning() << "Could not write" << m_cachePath;
+        return;
+    }
+
+    file.write(CACHE_VERSION " " + QUrl::toPercentEncoding(m_language) + '\n');
+    QHash<QString, Entry>::const_iterator it = m_entries.constBegin();
+    for (; it != m_entries.constEnd(); ++it) {
+        file.write(QByteArray::number(it->device) + ' ' + QByteArray::number(it->inode) + ' ' +
+                   QByteArray::number(it->mtime) + ' ' + QByteArray::number(it->size) + ' ' +
+                   (it->noDisplay ? '1' : '0') + ' ' + (it->authorized ? '1' : '0') + ' ' +
+                   QFile::encodeName(it.key()).toPercentEncoding() + ' ' +
+                   QUrl::toPercentEncoding(it->name) + ' ' +
+                   QUrl::toPercentEncoding(it->tryExec) + '\n');
+    }
+    if (file.finalize()) {
+        m_cacheMtime = modificationTime(m_cachePath);
+        m_changed = false;
+    }
+}
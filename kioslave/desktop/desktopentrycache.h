@@ -0,0 +1,92 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef DESKTOPENTRYCACHE_H
+#define DESKTOPENTRYCACHE_H
+
+#include <QHash>
+#include <QString>
+
+/**
+ * The fields of .desktop and .directory files that the desktop slave
+ * shows: the name, and whether the file is hidden.
+ *
+ * A file is only parsed again when its inode, modification time or size
+ * changed. The cache is saved in the cache directory and shared with the
+ * desktop notifier in kded, which reads the files of a directory again as
+ * soon as KDirWatch reports that it changed.
+ */
+class DesktopEntryCache
+{
+public:
+    struct Entry
+    {
+        qint64 device;
+        qint64 inode;
+        qint64 mtime;
+        qint64 size;
+        QString name;
+        QString tryExec;   ///< Program that has to exist for the file to be shown
+        bool noDisplay;    ///< NoDisplay is set
+        bool authorized;   ///< The X-KDE-AuthorizeAction actions are allowed
+    };
+
+    DesktopEntryCache();
+
+    /**
+     * Picks up the entries that other processes saved. Also forgets which
+     * programs were found, so that installing a program is noticed.
+     */
+    void refresh();
+
+    /**
+     * Looks up the file at @p path, reading it if it is not in the cache
+     * or changed. Returns false if the file does not exist.
+     */
+    bool entry(const QString &path, Entry &entry);
+
+    /**
+     * Returns whether the file of @p entry is hidden, because of NoDisplay,
+     * because it is not authorized or because its TryExec program is not
+     * installed.
+     */
+    bool isHidden(const Entry &entry);
+
+    /**
+     * Brings the entries of the .desktop files in @p directory, and of the
+     * .directory files of its subdirectories, up to date and saves them.
+     */
+    void updateDirectory(const QString &directory);
+
+    /**
+     * Saves the cache if files were read since it was loaded or saved
+     */
+    void save();
+
+private:
+    void load();
+
+    QString m_cachePath;
+    QString m_language;
+    QHash<QString, Entry> m_entries;
+    QHash<QString, bool> m_executables;   ///< Whether each TryExec program was found
+    qint64 m_cacheMtime;                  ///< Modification time of the cache file when it was last loaded or saved
+    bool m_changed;
+};
+
+#endif
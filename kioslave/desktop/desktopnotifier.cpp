@@ -28,6 +28,8 @@
 
 #include <kdirnotify.h>
 
+#include <QFileInfo>
+
 
 K_PLUGIN_FACTORY(DesktopNotifierFactory, registerPlugin<DesktopNotifier>();)
 K_EXPORT_PLUGIN(DesktopNotifierFactory("kio_desktop"))
@@ -41,11 +43,16 @@ DesktopNotifier::DesktopNotifier(QObject *parent, const QList<QVariant> &)
     dirWatch->addDir(KGlobal::dirs()->localxdgdatadir() + "Trash/files");
 
     connect(dirWatch, SIGNAL(dirty(QString)), SLOT(dirty(QString)));
+
+    cache.updateDirectory(KGlobalSettings::desktopPath());
 }
 
 void DesktopNotifier::watchDir(const QString &path)
 {
-    dirWatch->addDir(path);
+    // Every slave asks for the directories it lists, but a directory
+    // must only be added once
+    if (!dirWatch->contains(path))
+        dirWatch->addDir(path);
 }
 
 void DesktopNotifier::dirty(const QString &path)
@@ -57,6 +64,10 @@ void DesktopNotifier::dirty(const QString &path)
         if (QFile::exists(KGlobalSettings::desktopPath() + "/trash.desktop"))
             org::kde::KDirNotify::emitFilesChanged(QStringList() << "desktop:/trash.desktop");
     } else {
+        // Read the changed .desktop files before the slaves do
+        if (QFileInfo(path).isDir())
+            cache.updateDirectory(path);
+
         // Emitting FilesAdded forces a re-read of the dir
         KUrl url("desktop:/");
         url.addPath(KUrl::relativePath(KGlobalSettings::desktopPath(), path));
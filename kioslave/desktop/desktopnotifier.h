@@ -22,6 +22,8 @@
 #include <kdedmodule.h>
 #include <QtDBus/QtDBus>
 
+#include "desktopentrycache.h"
+
 class KDirWatch;
 
 class DesktopNotifier : public KDEDModule
@@ -40,6 +42,7 @@ private slots:
 
 private:
     KDirWatch *dirWatch;
+    DesktopEntryCache cache;
 };
 
 #endif
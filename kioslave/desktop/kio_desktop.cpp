@@ -29,7 +29,9 @@
 #include <kio/udsentry.h>
 
 #include <QFile>
+#include <QDBusConnection>
 #include <QDBusInterface>
+#include <QDBusMessage>
 #include <QDesktopServices>
 #include <QDir>
 
@@ -159,13 +161,22 @@ bool DesktopProtocol::rewriteUrl(const KUrl &url, KUrl &newUrl)
 
 void DesktopProtocol::listDir(const KUrl &url)
 {
+    m_cache.refresh();
     KIO::ForwardingSlaveBase::listDir(url);
+    m_cache.save();
 
     KUrl actual;
     rewriteUrl(url, actual);
 
-    QDBusInterface kded("org.kde.kded", "/modules/desktopnotifier", "org.kde.DesktopNotifier");
-    kded.call("watchDir", actual.path());
+    // Ask kded only once to watch each directory, and do not wait for it
+    const QString path = actual.path();
+    if (!m_watchedDirs.contains(path)) {
+        m_watchedDirs.insert(path);
+        QDBusMessage message = QDBusMessage::createMethodCall("org.kde.kded", "/modules/desktopnotifier",
+                                                              "org.kde.DesktopNotifier", "watchDir");
+        message << path;
+        QDBusConnection::sessionBus().send(message);
+    }
 }
 
 QString DesktopProtocol::desktopFile(KIO::UDSEntry &entry) const
@@ -177,11 +188,9 @@ QString DesktopProtocol::desktopFile(KIO::UDSEntry &entry) const
     KUrl url = processedUrl();
     url.addPath(name);
 
+    // Whether the .directory file exists is left to the cache
     if (entry.isDir()) {
         url.addPath(".directory");
-        if (!KStandardDirs::exists(url.path()))
-            return QString();
-
         return url.path();
     }
 
@@ -196,14 +205,12 @@ void DesktopProtocol::prepareUDSEntry(KIO::UDSEntry &entry, bool listing) const
     ForwardingSlaveBase::prepareUDSEntry(entry, listing);
     const QString path = desktopFile(entry);
 
-    if (!path.isEmpty()) {
-        KDesktopFile file(path);
-
-        const QString name = file.readName();
-        if (!name.isEmpty())
-            entry.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, name);
+    DesktopEntryCache::Entry desktopEntry;
+    if (!path.isEmpty() && m_cache.entry(path, desktopEntry)) {
+        if (!desktopEntry.name.isEmpty())
+            entry.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, desktopEntry.name);
 
-        if (file.noDisplay() || !file.tryExec())
+        if (m_cache.isHidden(desktopEntry))
             entry.insert(KIO::UDSEntry::UDS_HIDDEN, 1);
     }
 
@@ -22,6 +22,10 @@
 
 #include <kio/forwardingslavebase.h>
 
+#include <QSet>
+
+#include "desktopentrycache.h"
+
 class DesktopProtocol : public KIO::ForwardingSlaveBase
 {
     Q_OBJECT
@@ -36,6 +40,10 @@ protected:
     virtual void listDir(const KUrl &url);
     virtual void prepareUDSEntry(KIO::UDSEntry &entry, bool listing=false) const;
     virtual void rename(const KUrl &, const KUrl &, KIO::JobFlags flags);
+
+private:
+    mutable DesktopEntryCache m_cache;
+    QSet<QString> m_watchedDirs;
 };
 
 #endif
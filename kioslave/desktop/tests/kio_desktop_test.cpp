@@ -49,6 +49,7 @@ private Q_SLOTS:
     {
         QFile::remove(m_desktopPath + '/' + m_testFileName);
         QFile::remove(m_desktopPath + '/' + m_testFileName + ".part");
+        QFile::remove(m_desktopPath + '/' + m_testFileName + ".desktop");
     }
 
     void testCopyToDesktop()
@@ -122,7 +123,43 @@ private Q_SLOTS:
         QVERIFY(QFile::exists(destFilePath));
     }
 
+    void testDesktopFileChanges()
+    {
+        const QString fileName = m_testFileName + ".desktop";
+        const QString filePath = m_desktopPath + '/' + fileName;
+
+        writeDesktopFile(filePath, "First name", false);
+        KIO::UDSEntry entry = statDesktopUrl(KUrl("desktop:/" + fileName));
+        QCOMPARE(entry.stringValue(KIO::UDSEntry::UDS_DISPLAY_NAME), QString("First name"));
+        QCOMPARE(entry.numberValue(KIO::UDSEntry::UDS_HIDDEN, 0), 0LL);
+
+        // The slave caches the file, but has to notice that it changed,
+        // even within the same second
+        writeDesktopFile(filePath, "Second", true);
+        entry = statDesktopUrl(KUrl("desktop:/" + fileName));
+        QCOMPARE(entry.stringValue(KIO::UDSEntry::UDS_DISPLAY_NAME), QString("Second"));
+        QCOMPARE(entry.numberValue(KIO::UDSEntry::UDS_HIDDEN, 0), 1LL);
+    }
+
 private:
+    void writeDesktopFile(const QString &path, const QString &name, bool noDisplay)
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write("[Desktop Entry]\nType=Link\nURL=file:///tmp\nName=" + name.toUtf8() + '\n');
+        if (noDisplay)
+            file.write("NoDisplay=true\n");
+    }
+
+    KIO::UDSEntry statDesktopUrl(const KUrl &url)
+    {
+        KIO::StatJob* job = KIO::stat(url, KIO::HideProgressInfo);
+        job->setUiDelegate(0);
+        if (!job->exec())
+            return KIO::UDSEntry();
+        return job->statResult();
+    }
+
     QString m_desktopPath;
     QString m_testFileName;
 };
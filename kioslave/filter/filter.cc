@@ -23,6 +23,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include "filter.h"
+#include "paralleldecompressor.h"
 #include <QFileInfo>
 #include <QFile>
 
@@ -32,8 +33,25 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <kfilterbase.h>
 #include <kurl.h>
 
+// The output buffer grows up to this, as does the size of the data sent at once
+#define MAXIMUM_BUFFER_SIZE (1024*1024)
+#define INPUT_BUFFER_SIZE (256*1024)
+
 extern "C" { KDE_EXPORT int kdemain(int argc, char **argv); }
 
+static bool parallelFormat(const QByteArray &protocol, ParallelDecompressor::Format *format)
+{
+    if (protocol == "gzip")
+        *format = ParallelDecompressor::Gzip;
+    else if (protocol == "bzip" || protocol == "bzip2")
+        *format = ParallelDecompressor::Bzip2;
+    else if (protocol == "xz")
+        *format = ParallelDecompressor::Xz;
+    else
+        return false;
+    return true;
+}
+
 int kdemain( int argc, char ** argv)
 {
   KComponentData componentData( "kio_filter" );
@@ -89,17 +107,60 @@ void FilterProtocol::get(const KUrl& url)
   needSubUrlData();
 #endif
 
+    bNeedMimetype = true;
+
+    // Files made of several independent parts are decompressed on several threads
+    qint64 position = 0;
+    ParallelDecompressor::Format format;
+    if (parallelFormat(mProtocol, &format)) {
+        uchar *map = localFile.map(0, localFile.size());
+        if (map) {
+            ParallelDecompressor decompressor(format, map, localFile.size());
+            if (decompressor.open()) {
+                if (decompressor.uncompressedSize() >= 0)
+                    totalSize(decompressor.uncompressedSize());
+                QByteArray buffer;
+                while (decompressor.read(buffer))
+                    sendData(buffer);
+                if (decompressor.error()) {
+                    error(KIO::ERR_COULD_NOT_READ, subURL.url());
+                    subURL = KUrl(); // Clear subURL
+                    return;
+                }
+                position = decompressor.position();
+                kDebug(7110) << "decompressed in parallel up to" << position;
+            }
+            localFile.unmap(map);
+        }
+    }
+
+    bool bError = false;
+    if (position == 0 || position < localFile.size()) {
+        localFile.seek(position);
+        bError = !decompress(localFile);
+    }
+
+    if (!bError) {
+        data(QByteArray()); // Send EOF
+        finished();
+    } else {
+        error(KIO::ERR_COULD_NOT_READ, subURL.url());
+    }
+    subURL = KUrl(); // Clear subURL
+}
+
+bool FilterProtocol::decompress(QFile &localFile)
+{
   filter->init(QIODevice::ReadOnly);
 
   bool bNeedHeader = true;
-  bool bNeedMimetype = true;
   bool bError = true;
   int result;
 
   QByteArray inputBuffer;
-  inputBuffer.resize(8*1024);
+  inputBuffer.resize(INPUT_BUFFER_SIZE);
   QByteArray outputBuffer;
-  outputBuffer.resize(8*1024); // Start with a modest buffer
+  outputBuffer.resize(8*1024); // Start with a modest buffer, the mimetype is determined from it
   filter->setOutBuffer( outputBuffer.data(), outputBuffer.size() );
   while(true)
   {
@@ -117,7 +178,7 @@ void FilterProtocol::get(const KUrl& url)
           bError = true;
           break; // Unexpected EOF.
         }
-        filter->setInBuffer( inputBuffer.data(), inputBuffer.size() );
+        filter->setInBuffer( inputBuffer.data(), result );
      }
      if (bNeedHeader)
      {
@@ -129,32 +190,33 @@ void FilterProtocol::get(const KUrl& url)
      result = filter->uncompress();
      if ((filter->outBufferAvailable() == 0) || (result == KFilterBase::End))
      {
-         kDebug(7110) << "avail_out = " << filter->outBufferAvailable();
-        if (filter->outBufferAvailable() != 0)
-        {
-            // Discard unused space :-)
-            outputBuffer.resize(outputBuffer.size() - filter->outBufferAvailable());
-        }
-        if (bNeedMimetype) {
-            // Can we use the "base" filename? E.g. foo.txt.bz2
-            const QString extension = QFileInfo(subURL.path()).suffix();
-            KMimeType::Ptr mime;
-            if (extension == "gz" || extension == "bz" || extension == "bz2") {
-                QString baseName = subURL.path();
-                baseName.truncate(baseName.length() - extension.length() - 1 /*the dot*/);
-                kDebug(7110) << "baseName=" << baseName;
-                mime = KMimeType::findByNameAndContent(baseName, outputBuffer);
-            } else {
-                mime = KMimeType::findByContent(outputBuffer);
-            }
-            kDebug(7110) << "Emitting mimetype " << mime->name();
-            mimeType( mime->name() );
-            bNeedMimetype = false;
-        }
-        data( outputBuffer ); // Send data
+        kDebug(7110) << "avail_out = " << filter->outBufferAvailable();
+        // Only send what was decompressed
+        const int used = outputBuffer.size() - filter->outBufferAvailable();
+        if (used > 0)
+            sendData( QByteArray::fromRawData(outputBuffer.constData(), used) );
+        // Fewer, larger pieces once the data is flowing
+        if (outputBuffer.size() < MAXIMUM_BUFFER_SIZE)
+            outputBuffer.resize(qMin(2 * outputBuffer.size(), MAXIMUM_BUFFER_SIZE));
         filter->setOutBuffer( outputBuffer.data(), outputBuffer.size() );
         if (result == KFilterBase::End)
-           break; // Finished.
+        {
+           // Concatenated streams are decompressed one after the other, like zcat does
+           const qint64 next = localFile.pos() - filter->inBufferAvailable();
+           if (!isStreamStart(localFile, next))
+           {
+              bError = false;
+              break; // Finished.
+           }
+           kDebug(7110) << "next stream at" << next;
+           localFile.seek(next);
+           filter->terminate();
+           filter->init(QIODevice::ReadOnly);
+           filter->setInBuffer( inputBuffer.data(), 0 );
+           filter->setOutBuffer( outputBuffer.data(), outputBuffer.size() );
+           bNeedHeader = true;
+           continue;
+        }
      }
      if (result != KFilterBase::Ok)
      {
@@ -163,25 +225,51 @@ void FilterProtocol::get(const KUrl& url)
      }
   }
 
-    if (!bError) {
-#if 0
-        dataReq(); // Request data
-        result = readData( inputBuffer);
-#else
-        result = localFile.read(inputBuffer.data(), inputBuffer.size());
-#endif
-        kDebug(7110) << "requestData: got" << result << "(expecting 0)";
-        data(QByteArray()); // Send EOF
-    }
-
     filter->terminate();
+    return !bError;
+}
 
-    if (bError) {
-        error(KIO::ERR_COULD_NOT_READ, subURL.url());
-    } else {
-        finished();
+void FilterProtocol::sendData(const QByteArray &buffer)
+{
+    if (bNeedMimetype) {
+        // Can we use the "base" filename? E.g. foo.txt.bz2
+        const QString extension = QFileInfo(subURL.path()).suffix();
+        KMimeType::Ptr mime;
+        if (extension == "gz" || extension == "bz" || extension == "bz2") {
+            QString baseName = subURL.path();
+            baseName.truncate(baseName.length() - extension.length() - 1 /*the dot*/);
+            kDebug(7110) << "baseName=" << baseName;
+            mime = KMimeType::findByNameAndContent(baseName, buffer);
+        } else {
+            mime = KMimeType::findByContent(buffer);
+        }
+        kDebug(7110) << "Emitting mimetype " << mime->name();
+        mimeType( mime->name() );
+        bNeedMimetype = false;
     }
-    subURL = KUrl(); // Clear subURL
+
+    // Large pieces from the parallel decompression are split up
+    for (int pos = 0; pos < buffer.size(); pos += MAXIMUM_BUFFER_SIZE) {
+        const int size = qMin(buffer.size() - pos, MAXIMUM_BUFFER_SIZE);
+        data( QByteArray::fromRawData(buffer.constData() + pos, size) ); // Send data
+    }
+}
+
+bool FilterProtocol::isStreamStart(QFile &localFile, qint64 pos) const
+{
+    QByteArray magic;
+    if (mProtocol == "gzip")
+        magic = "\x1f\x8b";
+    else if (mProtocol == "bzip" || mProtocol == "bzip2")
+        magic = "BZh";
+    else if (mProtocol == "xz")
+        magic = QByteArray("\xfd" "7zXZ\0", 6);
+    else
+        return false; // lzma has no magic
+
+    if (!localFile.seek(pos))
+        return false;
+    return localFile.peek(magic.size()) == magic;
 }
 
 #if 0
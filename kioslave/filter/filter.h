@@ -30,6 +30,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 class KUrl;
 class KFilterBase;
+class QFile;
 
 class FilterProtocol : /*public QObject, */ public KIO::SlaveBase
 {
@@ -45,8 +46,13 @@ public:
 #endif
 
 private:
+    bool decompress(QFile &localFile);
+    void sendData(const QByteArray &buffer);
+    bool isStreamStart(QFile &localFile, qint64 pos) const;
+
     KUrl subURL;
     KFilterBase * filter;
+    bool bNeedMimetype;
 };
 
 #endif
@@ -0,0 +1,561 @@
+/*
+This file is part of KDE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "paralleldecompressor.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+
+#include <kdebug.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+// Compressed size of a segment. The first part starting after it ends the segment.
+#define SEGMENT_SIZE (4 * 1024 * 1024)
+// How far to look for the start of a part, beyond that the part is
+// decompressed sequentially
+#define SCAN_LIMIT (4 * 1024 * 1024)
+// Segments decompressing to more are left to sequential decompression
+#define MAXIMUM_SEGMENT_OUTPUT (64 * 1024 * 1024)
+// Output of all segments held at once. Other segments give up beyond that,
+// only the one read next may still add up to MAXIMUM_SEGMENT_OUTPUT.
+#define MAXIMUM_BUFFERED_OUTPUT (128 * 1024 * 1024)
+// Input and output given to the decompressor at once
+#define INPUT_STEP (1024 * 1024)
+#define OUTPUT_STEP (256 * 1024)
+
+struct ParallelDecompressor::Segment
+{
+    Segment(qint64 _begin, qint64 _end)
+        : begin(_begin), end(_end), decodedEnd(_begin), reserved(0), state(Queued) {}
+
+    qint64 begin;          ///< Start of the first part
+    qint64 end;            ///< The first part ending here or later is the last one
+    qint64 decodedEnd;     ///< Where the last part really ended
+    qint64 reserved;       ///< Output counted against MAXIMUM_BUFFERED_OUTPUT
+    QByteArray output;
+    SegmentState state;
+};
+
+class ParallelDecompressor::Task : public QRunnable
+{
+public:
+    Task(ParallelDecompressor *decompressor, Segment *segment)
+        : m_decompressor(decompressor), m_segment(segment) {}
+
+    virtual void run()
+    {
+        m_decompressor->decode(m_segment);
+    }
+
+private:
+    ParallelDecompressor *m_decompressor;
+    Segment *m_segment;
+};
+
+ParallelDecompressor::ParallelDecompressor(Format format, const uchar *data, qint64 size)
+    : m_format(format),
+      m_data(data),
+      m_size(size),
+      m_queuedEnd(0),
+      m_queueEnded(false),
+      m_position(0),
+      m_stopped(false),
+      m_error(false),
+      m_head(0),
+      m_buffered(0),
+      m_nextBlock(0),
+      m_xzCheck(0),
+      m_uncompressedSize(-1)
+{
+    m_pool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+ParallelDecompressor::~ParallelDecompressor()
+{
+    m_cancelled = 1;
+    m_pool.waitForDone();
+    qDeleteAll(m_segments);
+}
+
+bool ParallelDecompressor::open()
+{
+    switch (m_format) {
+    case Gzip:
+#ifdef HAVE_ZLIB
+        return isStreamStart(0);
+#else
+        return false;
+#endif
+    case Bzip2:
+#ifdef HAVE_BZIP2
+        return isStreamStart(0);
+#else
+        return false;
+#endif
+    case Xz:
+        return isStreamStart(0) && openXz();
+    }
+    return false;
+}
+
+bool ParallelDecompressor::openXz()
+{
+#ifdef HAVE_LIBLZMA
+    // The stream footer at the end of the file says where the index is.
+    // Stream padding comes in multiples of four zero bytes.
+    qint64 end = m_size;
+    while (end >= 2 * LZMA_STREAM_HEADER_SIZE && memcmp(m_data + end - 4, "\0\0\0\0", 4) == 0)
+        end -= 4;
+    if (end < 2 * LZMA_STREAM_HEADER_SIZE)
+        return false;
+
+    lzma_stream_flags footerFlags;
+    if (lzma_stream_footer_decode(&footerFlags, m_data + end - LZMA_STREAM_HEADER_SIZE) != LZMA_OK)
+        return false;
+    const qint64 indexStart = end - LZMA_STREAM_HEADER_SIZE - qint64(footerFlags.backward_size);
+    if (indexStart < LZMA_STREAM_HEADER_SIZE)
+        return false;
+
+    lzma_index *index = 0;
+    uint64_t memLimit = UINT64_MAX;
+    size_t inPos = 0;
+    if (lzma_index_buffer_decode(&index, &memLimit, 0, m_data + indexStart, &inPos,
+                                 footerFlags.backward_size) != LZMA_OK)
+        return false;
+
+    // Only a single stream is supported, which is what xz writes
+    lzma_stream_flags headerFlags;
+    bool ok = qint64(lzma_index_file_size(index)) == end &&
+              lzma_stream_header_decode(&headerFlags, m_data) == LZMA_OK &&
+              lzma_stream_flags_compare(&headerFlags, &footerFlags) == LZMA_OK &&
+              lzma_index_block_count(index) >= 2;
+
+    lzma_index_iter iter;
+    lzma_index_iter_init(&iter, index);
+    while (ok && !lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+        Block block;
+        block.offset = iter.block.compressed_file_offset;
+        block.unpaddedSize = iter.block.unpadded_size;
+        block.uncompressedSize = iter.block.uncompressed_size;
+        // A block is decompressed in one go
+        ok = block.uncompressedSize <= MAXIMUM_SEGMENT_OUTPUT;
+        m_blocks.append(block);
+    }
+    m_uncompressedSize = lzma_index_uncompressed_size(index);
+    lzma_index_end(index, 0);
+
+    if (!ok) {
+        kDebug(7110) << "not decompressing in parallel, single stream with several small blocks needed";
+        m_blocks.clear();
+        m_uncompressedSize = -1;
+        return false;
+    }
+    m_xzCheck = headerFlags.check;
+    return true;
+#else
+    return false;
+#endif
+}
+
+qint64 ParallelDecompressor::uncompressedSize() const
+{
+    return m_uncompressedSize;
+}
+
+qint64 ParallelDecompressor::position() const
+{
+    return m_position;
+}
+
+bool ParallelDecompressor::error() const
+{
+    return m_error;
+}
+
+bool ParallelDecompressor::isStreamStart(qint64 pos) const
+{
+    const uchar *d = m_data + pos;
+    switch (m_format) {
+    case Gzip:
+        // Deflate, no reserved flags
+        return m_size - pos >= 10 && d[0] == 0x1f && d[1] == 0x8b && d[2] == 8 && (d[3] & 0xe0) == 0;
+    case Bzip2:
+        // Stream header and the magic of the first block
+        return m_size - pos >= 10 && memcmp(d, "BZh", 3) == 0 && d[3] >= '1' && d[3] <= '9' &&
+               memcmp(d + 4, "\x31\x41\x59\x26\x53\x59", 6) == 0;
+    case Xz:
+        return m_size - pos >= 6 && memcmp(d, "\xfd" "7zXZ\0", 6) == 0;
+    }
+    return false;
+}
+
+qint64 ParallelDecompressor::findStreamStart(qint64 from, qint64 to) const
+{
+    const uchar first = m_format == Gzip ? 0x1f : 'B';
+    while (from < to) {
+        const uchar *p = static_cast<const uchar *>(memchr(m_data + from, first, to - from));
+        if (!p)
+            break;
+        from = p - m_data;
+        if (isStreamStart(from))
+            return from;
+        ++from;
+    }
+    return -1;
+}
+
+void ParallelDecompressor::queueSegments()
+{
+    // Keep all threads busy, and the next segment ready when the current one is sent
+    while (!m_queueEnded && m_segments.count() < m_pool.maxThreadCount() + 1 &&
+           (m_segments.isEmpty() || bufferedOutput() < MAXIMUM_BUFFERED_OUTPUT)) {
+        const qint64 begin = m_queuedEnd;
+        qint64 end;
+        if (m_format == Xz) {
+            // Whole blocks, the index says where they are
+            qint64 output = 0;
+            int next = m_nextBlock;
+            do {
+                output += m_blocks.at(next).uncompressedSize;
+                ++next;
+            } while (next < m_blocks.count() && m_blocks.at(next).offset - begin < SEGMENT_SIZE &&
+                     output + m_blocks.at(next).uncompressedSize <= MAXIMUM_SEGMENT_OUTPUT);
+            m_nextBlock = next;
+            end = next < m_blocks.count() ? m_blocks.at(next).offset : m_size;
+        } else if (m_size - begin <= SEGMENT_SIZE) {
+            end = m_size;
+        } else {
+            const qint64 scanEnd = qMin(m_size, begin + SEGMENT_SIZE + SCAN_LIMIT);
+            end = findStreamStart(begin + SEGMENT_SIZE, scanEnd);
+            if (end < 0 && scanEnd == m_size) {
+                end = m_size; // the last part
+            } else if (end < 0) {
+                kDebug(7110) << "no part starts after" << begin + SEGMENT_SIZE;
+                m_queueEnded = true;
+                break;
+            }
+        }
+
+        Segment *segment = new Segment(begin, end);
+        m_segments.append(segment);
+        startSegment(segment);
+        m_queuedEnd = end;
+        m_queueEnded = end >= m_size;
+    }
+}
+
+void ParallelDecompressor::startSegment(Segment *segment)
+{
+    m_pool.start(new Task(this, segment));
+}
+
+void ParallelDecompressor::deleteSegment(Segment *segment)
+{
+    QMutexLocker locker(&m_mutex);
+    m_buffered -= segment->reserved;
+    delete segment;
+}
+
+qint64 ParallelDecompressor::bufferedOutput()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_buffered;
+}
+
+bool ParallelDecompressor::reserveOutput(Segment *segment, qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    if (segment != m_head && m_buffered + bytes > MAXIMUM_BUFFERED_OUTPUT) {
+        // Decoded again once it is the next one to be read
+        m_buffered -= segment->reserved;
+        segment->reserved = 0;
+        return false;
+    }
+    m_buffered += bytes;
+    segment->reserved += bytes;
+    return true;
+}
+
+bool ParallelDecompressor::read(QByteArray &data)
+{
+    data.clear();
+    while (!m_error && !m_stopped) {
+        queueSegments();
+        if (m_segments.isEmpty())
+            return false; // at the end, or where a large part starts
+
+        Segment *segment = m_segments.first();
+        if (segment->begin > m_position) {
+            // The part before ended inside of the segment the scan skipped
+            segment = new Segment(m_position, segment->begin);
+            m_segments.prepend(segment);
+            startSegment(segment);
+        }
+
+        m_mutex.lock();
+        m_head = segment;
+        forever {
+            while (segment->state == Queued)
+                m_segmentDone.wait(&m_mutex);
+            if (segment->state != Deferred || segment->begin < m_position)
+                break;
+            // It gave up to stay within the budget, which does not apply to it anymore
+            segment->state = Queued;
+            segment->output.clear();
+            startSegment(segment);
+        }
+        m_head = 0;
+        m_mutex.unlock();
+        m_segments.removeFirst();
+
+        if (segment->begin < m_position) {
+            // It started in the middle of a part, the segment before decoded it
+            deleteSegment(segment);
+            continue;
+        }
+
+        switch (segment->state) {
+        case Decoded:
+            data = segment->output;
+            m_position = segment->decodedEnd;
+            break;
+        case TooLarge:
+            kDebug(7110) << "large part at" << m_position;
+            m_stopped = true;
+            break;
+        default:
+            // Without an index, the rest may just not be made of parts we know
+            kDebug(7110) << "could not decompress the part at" << m_position;
+            m_stopped = m_format != Xz;
+            m_error = m_format == Xz;
+            break;
+        }
+        deleteSegment(segment);
+        if (!data.isEmpty())
+            return true;
+    }
+    // The segments still running are not needed anymore
+    m_cancelled = 1;
+    return false;
+}
+
+void ParallelDecompressor::decode(Segment *segment)
+{
+    SegmentState state = Failed;
+    switch (m_format) {
+    case Gzip:
+        state = decodeGzip(segment);
+        break;
+    case Bzip2:
+        state = decodeBzip2(segment);
+        break;
+    case Xz:
+        state = decodeXz(segment);
+        break;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    segment->state = state;
+    m_segmentDone.wakeAll();
+}
+
+ParallelDecompressor::SegmentState ParallelDecompressor::decodeGzip(Segment *segment)
+{
+#ifdef HAVE_ZLIB
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return Failed;
+
+    QByteArray &output = segment->output;
+    qint64 pos = segment->begin;
+    int produced = 0;
+    SegmentState state = Failed;
+    while (!m_cancelled) {
+        if (output.size() - produced < OUTPUT_STEP) {
+            if (!reserveOutput(segment, produced + OUTPUT_STEP - output.size())) {
+                state = Deferred;
+                produced = 0;
+                break;
+            }
+            output.resize(produced + OUTPUT_STEP);
+        }
+        zs.next_in = const_cast<Bytef *>(m_data + pos);
+        zs.avail_in = uInt(qMin<qint64>(m_size - pos, INPUT_STEP));
+        zs.next_out = reinterpret_cast<Bytef *>(output.data() + produced);
+        zs.avail_out = output.size() - produced;
+        const int ret = inflate(&zs, Z_NO_FLUSH);
+        pos = zs.next_in - m_data;
+        produced = output.size() - zs.avail_out;
+
+        if (produced > MAXIMUM_SEGMENT_OUTPUT) {
+            state = TooLarge;
+            break;
+        }
+        if (ret == Z_STREAM_END) {
+            if (pos >= segment->end) {
+                state = Decoded;
+                break;
+            }
+            // The next member follows right away
+            inflateReset(&zs);
+        } else if (ret != Z_OK) {
+            break; // damaged or truncated
+        }
+    }
+    inflateEnd(&zs);
+    output.resize(produced);
+    segment->decodedEnd = pos;
+    return state;
+#else
+    Q_UNUSED(segment);
+    return Failed;
+#endif
+}
+
+ParallelDecompressor::SegmentState ParallelDecompressor::decodeBzip2(Segment *segment)
+{
+#ifdef HAVE_BZIP2
+    bz_stream bs;
+    memset(&bs, 0, sizeof(bs));
+    if (BZ2_bzDecompressInit(&bs, 0, 0) != BZ_OK)
+        return Failed;
+
+    QByteArray &output = segment->output;
+    qint64 pos = segment->begin;
+    int produced = 0;
+    SegmentState state = Failed;
+    while (!m_cancelled) {
+        if (output.size() - produced < OUTPUT_STEP) {
+            if (!reserveOutput(segment, produced + OUTPUT_STEP - output.size())) {
+                state = Deferred;
+                produced = 0;
+                break;
+            }
+            output.resize(produced + OUTPUT_STEP);
+        }
+        bs.next_in = const_cast<char *>(reinterpret_cast<const char *>(m_data + pos));
+        bs.avail_in = uint(qMin<qint64>(m_size - pos, INPUT_STEP));
+        bs.next_out = output.data() + produced;
+        bs.avail_out = output.size() - produced;
+        const int ret = BZ2_bzDecompress(&bs);
+        const int before = produced;
+        pos = reinterpret_cast<const uchar *>(bs.next_in) - m_data;
+        produced = output.size() - bs.avail_out;
+
+        if (produced > MAXIMUM_SEGMENT_OUTPUT) {
+            state = TooLarge;
+            break;
+        }
+        if (ret == BZ_STREAM_END) {
+            if (pos >= segment->end) {
+                state = Decoded;
+                break;
+            }
+            // The next stream follows right away
+            BZ2_bzDecompressEnd(&bs);
+            memset(&bs, 0, sizeof(bs));
+            if (BZ2_bzDecompressInit(&bs, 0, 0) != BZ_OK)
+                return Failed;
+        } else if (ret != BZ_OK || (pos == m_size && produced == before)) {
+            break; // damaged or truncated
+        }
+    }
+    BZ2_bzDecompressEnd(&bs);
+    output.resize(produced);
+    segment->decodedEnd = pos;
+    return state;
+#else
+    Q_UNUSED(segment);
+    return Failed;
+#endif
+}
+
+ParallelDecompressor::SegmentState ParallelDecompressor::decodeXz(Segment *segment)
+{
+#ifdef HAVE_LIBLZMA
+    QByteArray &output = segment->output;
+    for (int i = 0; i < m_blocks.count() && !m_cancelled; ++i) {
+        const Block &b = m_blocks.at(i);
+        if (b.offset < segment->begin || b.offset >= segment->end)
+            continue;
+        if (!reserveOutput(segment, b.uncompressedSize)) {
+            output.clear();
+            return Deferred;
+        }
+
+        // Decode the header of the block, the index only knows where it is
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block;
+        memset(&block, 0, sizeof(block));
+        block.version = 0;
+        block.check = lzma_check(m_xzCheck);
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(m_data[b.offset]);
+        if (m_data[b.offset] == 0 || b.offset + block.header_size > m_size ||
+            lzma_block_header_decode(&block, 0, m_data + b.offset) != LZMA_OK)
+            return Failed;
+
+        lzma_stream strm = LZMA_STREAM_INIT;
+        const bool ok = lzma_block_compressed_size(&block, b.unpaddedSize) == LZMA_OK &&
+                        lzma_block_decoder(&strm, &block) == LZMA_OK;
+        // The decoder has its own copy of the filter options
+        for (int f = 0; filters[f].id != LZMA_VLI_UNKNOWN; ++f)
+            free(filters[f].options);
+        if (!ok) {
+            lzma_end(&strm);
+            return Failed;
+        }
+
+        const int produced = output.size();
+        output.resize(produced + b.uncompressedSize);
+        strm.next_in = m_data + b.offset + block.header_size;
+        strm.avail_in = m_size - (b.offset + block.header_size);
+        strm.next_out = reinterpret_cast<uint8_t *>(output.data() + produced);
+        strm.avail_out = b.uncompressedSize;
+        lzma_ret ret;
+        do {
+            ret = lzma_code(&strm, LZMA_RUN);
+        } while (ret == LZMA_OK);
+        lzma_end(&strm);
+        if (ret != LZMA_STREAM_END || strm.avail_out != 0)
+            return Failed;
+    }
+    segment->decodedEnd = segment->end;
+    return m_cancelled ? Failed : Decoded;
+#else
+    Q_UNUSED(segment);
+    return Failed;
+#endif
+}
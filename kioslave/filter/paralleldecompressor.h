@@ -0,0 +1,115 @@
+/*
+This file is part of KDE
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN
+AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __paralleldecompressor_h__
+#define __paralleldecompressor_h__
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+/**
+ * Decompresses a memory mapped file on several threads.
+ *
+ * This works for files made of independent parts: concatenated gzip members
+ * (e.g. from pigz -i, bgzip or appending to a log), concatenated bzip2
+ * streams (pbzip2) and xz files with several blocks (xz -T). gzip and bzip2
+ * do not record where their parts start, so the file is scanned for their
+ * headers; a part only counts once the part before it ended right there.
+ *
+ * read() returns the decompressed data in order. When the rest of the file
+ * is a single large part, it returns false and position() tells where the
+ * caller has to go on decompressing sequentially.
+ */
+class ParallelDecompressor
+{
+public:
+    enum Format { Gzip, Bzip2, Xz };
+
+    ParallelDecompressor(Format format, const uchar *data, qint64 size);
+    ~ParallelDecompressor();
+
+    /// Returns false if the file can not be decompressed in parallel at all
+    bool open();
+
+    /// Returns the size of the decompressed data, or -1 if unknown
+    qint64 uncompressedSize() const;
+
+    /// Reads the next piece of decompressed data, returns false at the end or on errors
+    bool read(QByteArray &data);
+    /// Returns where the parallel decompression stopped
+    qint64 position() const;
+    bool error() const;
+
+private:
+    enum SegmentState { Queued, Decoded, Failed, TooLarge, Deferred };
+    struct Segment;
+    class Task;
+    struct Block
+    {
+        qint64 offset;
+        qint64 unpaddedSize;
+        qint64 uncompressedSize;
+    };
+
+    bool openXz();
+    bool isStreamStart(qint64 pos) const;
+    qint64 findStreamStart(qint64 from, qint64 to) const;
+    void queueSegments();
+    void startSegment(Segment *segment);
+    void deleteSegment(Segment *segment);
+    qint64 bufferedOutput();
+    /// Counts @p bytes more output of @p segment, false if they are over the budget
+    bool reserveOutput(Segment *segment, qint64 bytes);
+    void decode(Segment *segment);
+    SegmentState decodeGzip(Segment *segment);
+    SegmentState decodeBzip2(Segment *segment);
+    SegmentState decodeXz(Segment *segment);
+
+    Format m_format;
+    const uchar *m_data;
+    qint64 m_size;
+
+    QList<Segment *> m_segments;   ///< Queued, in the order of the file
+    qint64 m_queuedEnd;            ///< Where the next segment starts
+    bool m_queueEnded;             ///< No more segments to queue
+    qint64 m_position;             ///< End of the data returned so far
+    bool m_stopped;                ///< The rest is left to sequential decompression
+    bool m_error;
+    Segment *m_head;               ///< The segment read() waits for
+    qint64 m_buffered;             ///< Output reserved by all segments
+
+    QVector<Block> m_blocks;       ///< Blocks of an xz file
+    int m_nextBlock;               ///< First block of the next segment
+    int m_xzCheck;
+    qint64 m_uncompressedSize;
+
+    QThreadPool m_pool;
+    QMutex m_mutex;                ///< Guards the state of the segments, m_head and m_buffered
+    QWaitCondition m_segmentDone;
+    QAtomicInt m_cancelled;
+};
+
+#endif
@@ -25,3 +25,5 @@
 /* Defines whether we can use the openpty() function */
 #cmakedefine HAVE_OPENPTY 1
 
+/* Define to 1 if you have zlib */
+#cmakedefine HAVE_ZLIB 1
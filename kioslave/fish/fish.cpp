@@ -80,6 +80,10 @@
 #include <sys/resource.h>
 #include <kdefakes.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "fishcode.h"
 
 #ifndef NDEBUG
@@ -124,6 +128,13 @@ static KProcess *childPid = 0;
 
 #define E(x) ((const char*)remoteEncoding()->encode(x).data())
 
+/** data sent with one pipelined WRITE command */
+#define WRITE_CHUNK_SIZE (256 * 1024)
+/** number of pipelined WRITE commands sent ahead of their answers */
+#define WRITE_PIPELINE_DEPTH 4
+/** size of the buffer for decompressed ZRETR data */
+#define INFLATE_BUFFER_SIZE (256 * 1024)
+
 using namespace KIO;
 extern "C" {
 
@@ -154,7 +165,7 @@ const struct fishProtocol::fish_info fishProtocol::fishInfo[] = {
       ("echo; /bin/sh -c start_fish_server > /dev/null 2>/dev/null; perl .fishsrv.pl " CHECKSUM " 2>/dev/null; perl -e '$|=1; print \"### 100 transfer fish server\\n\"; while(<STDIN>) { last if /^__END__/; $code.=$_; } exit(eval($code));' 2>/dev/null;"),
       1 },
     { ("VER 0.0.3 copy append lscount lslinks lsmime exec stat"), 0,
-      ("echo 'VER 0.0.3 copy append lscount lslinks lsmime exec stat'"),
+      ("if gzip -c </dev/null >/dev/null 2>&1; then echo 'VER 0.0.3 copy append lscount lslinks lsmime exec stat zretr'; else echo 'VER 0.0.3 copy append lscount lslinks lsmime exec stat'; fi"),
       1 },
     { ("PWD"), 0,
       ("pwd"),
@@ -227,7 +238,13 @@ const struct fishProtocol::fish_info fishProtocol::fishInfo[] = {
       0 },
     { ("EXEC"), 2,
       ("UMASK=`umask`; umask 077; touch %2; umask $UMASK; eval %1 < /dev/null > %2 2>&1; echo \"###RESULT: $?\" >> %2"),
-      0 }
+      0 },
+    // Like RETR, but the data is a zlib or gzip stream which ends by itself.
+    // Messages of gzip must not end up in that stream, not even through the
+    // "2>&1" which is appended to each command.
+    { ("ZRETR"), 1,
+      ("ls -l %1 2>&1 | ( read -r a b c d x e; echo $x ) 2>&1; echo '### 001'; ( gzip -1 -c %1 2>/dev/null )"),
+      1 }
 };
 
 fishProtocol::fishProtocol(const QByteArray &pool_socket, const QByteArray &app_socket)
@@ -267,6 +284,11 @@ fishProtocol::fishProtocol(const QByteArray &pool_socket, const QByteArray &app_
     udsType = 0;
 
     hasAppend = false;
+    hasPipeline = false;
+    hasCompression = false;
+    writesInFlight = 0;
+    putDataEnd = false;
+    inflater = NULL;
 
     isStat = false; // FIXME: just a workaround for konq deficiencies
     redirectUser = ""; // FIXME: just a workaround for konq deficiencies
@@ -786,6 +808,15 @@ void fishProtocol::shutdownConnection(bool forced){
     rawWrite = -1;
     recvLen = -1;
     sendLen = -1;
+    writesInFlight = 0;
+    putDataEnd = false;
+#ifdef HAVE_ZLIB
+    if (inflater) {
+        inflateEnd(inflater);
+        delete inflater;
+        inflater = NULL;
+    }
+#endif
 }
 /**
 builds each FISH request and sets the error counter
@@ -796,11 +827,26 @@ bool fishProtocol::sendCommand(fish_command_type cmd, ...) {
 
     va_list list;
     va_start(list, cmd);
+    QStringList args;
+    for (int i = 0; i < info.params; i++) {
+        args.append(QString(va_arg(list, const char *)));
+    }
+    va_end(list);
+    commandList.append(formatCommand(cmd, args));
+    commandCodes.append(cmd);
+    return true;
+}
+
+/**
+builds the text of a FISH request, with the alternative shell command
+*/
+QString fishProtocol::formatCommand(fish_command_type cmd, const QStringList &args) {
+    const fish_info &info = fishInfo[cmd];
     QString realCmd = info.command;
     QString realAlt = info.alt;
     static QRegExp rx("[][\\\\\n $`#!()*?{}~&<>;'\"%^@|\t]");
     for (int i = 0; i < info.params; i++) {
-        QString arg(va_arg(list, const char *));
+        QString arg(args[i]);
         int pos = -2;
         while ((pos = rx.indexIn(arg,pos+2)) >= 0) {
             arg.replace(pos,0,QString("\\"));
@@ -813,10 +859,37 @@ bool fishProtocol::sendCommand(fish_command_type cmd, ...) {
     s.append(realCmd).append("\n ").append(realAlt).append(" 2>&1;echo '### 000'\n");
     if (realCmd == "FISH")
         s.prepend(" ");
-    commandList.append(s);
-    commandCodes.append(cmd);
-    va_end(list);
-    return true;
+    return s;
+}
+
+/**
+sends WRITE commands for the next pieces of a put, each followed directly by its
+data, until WRITE_PIPELINE_DEPTH of them wait for their answer
+*/
+void fishProtocol::fillWritePipeline() {
+    while (writesInFlight < WRITE_PIPELINE_DEPTH && !putDataEnd) {
+        QByteArray chunk;
+        while (chunk.size() < WRITE_CHUNK_SIZE) {
+            dataReq();
+            if (readData(rawData) <= 0) {
+                putDataEnd = true;
+                break;
+            }
+            chunk.append(rawData);
+        }
+        rawData.clear();
+        if (chunk.isEmpty())
+            break;
+
+        QByteArray command = formatCommand(FISH_WRITE, QStringList()
+                                           << E(QString::number(putPos))
+                                           << E(QString::number(chunk.size()))
+                                           << E(url.path())).toLatin1();
+        command.append(chunk);
+        putPos += chunk.size();
+        writesInFlight++;
+        writeStdin(command);
+    }
 }
 
 /**
@@ -885,6 +958,13 @@ void fishProtocol::manageConnection(const QString &l) {
             if (line.startsWith(QLatin1String("VER 0.0.3"))) {
                 line.append(" ");
                 hasAppend = line.contains(" append ");
+#ifndef Q_WS_WIN
+                // writeChild() can not send binary data from a queued line on Windows
+                hasPipeline = line.contains(" pipeline ");
+#endif
+#ifdef HAVE_ZLIB
+                hasCompression = line.contains(" zretr ");
+#endif
             } else {
                 error(ERR_UNSUPPORTED_PROTOCOL,line);
                 shutdownConnection();
@@ -1063,6 +1143,7 @@ void fishProtocol::manageConnection(const QString &l) {
             break;
 
         case FISH_RETR:
+        case FISH_ZRETR:
             if (line.length() == 0) {
                 error(ERR_IS_DIRECTORY,url.prettyUrl());
                 recvLen = 0;
@@ -1087,6 +1168,7 @@ void fishProtocol::manageConnection(const QString &l) {
             recvLen = 1024;
             /* fall through */
         case FISH_RETR:
+        case FISH_ZRETR:
             myDebug( << "reading " << recvLen << endl);
             if (recvLen == -1) {
                 error(ERR_COULD_NOT_READ,url.prettyUrl());
@@ -1100,10 +1182,28 @@ void fishProtocol::manageConnection(const QString &l) {
                     mimeType("application/x-zerosize");
                     mimeTypeSent = true;
                 }
+#ifdef HAVE_ZLIB
+                if (fishCommand == FISH_ZRETR) {
+                    // Even an empty file comes as a stream, which has to be read
+                    inflater = new z_stream;
+                    memset(inflater, 0, sizeof(z_stream));
+                    // 15+32: zlib or gzip format, detected from the header
+                    if (inflateInit2(inflater, 15 + 32) != Z_OK) {
+                        delete inflater;
+                        inflater = NULL;
+                        error(ERR_OUT_OF_MEMORY,url.prettyUrl());
+                        shutdownConnection();
+                    }
+                }
+#endif
             }
             break;
-        case FISH_STOR:
         case FISH_WRITE:
+            // The data of pipelined writes has been sent with the command
+            if (writesInFlight > 0)
+                break;
+            /* fall through */
+        case FISH_STOR:
         case FISH_APPEND:
             rawWrite = sendLen;
             //myDebug( << "sending " << sendLen << endl);
@@ -1120,6 +1220,7 @@ void fishProtocol::manageConnection(const QString &l) {
             shutdownConnection();
             break;
         case FISH_RETR:
+        case FISH_ZRETR:
             error(ERR_COULD_NOT_READ,url.prettyUrl());
             shutdownConnection();
             break;
@@ -1189,7 +1290,14 @@ void fishProtocol::manageConnection(const QString &l) {
         }
     } else {
         if (fishCommand == FISH_STOR) fishCommand = (hasAppend?FISH_APPEND:FISH_WRITE);
-        if (fishCommand == FISH_FISH) {
+        if (fishCommand == FISH_WRITE && hasPipeline) {
+            // Answer to STOR or to one of the pipelined writes
+            if (writesInFlight > 0) writesInFlight--;
+            fillWritePipeline();
+            if (writesInFlight > 0)
+                return; // Don't call finished!
+            if (!checkExist && putPerm > -1) sendCommand(FISH_CHMOD,E(QString::number(putPerm,8)),E(url.path()));
+        } else if (fishCommand == FISH_FISH) {
             connected();
         } else if (fishCommand == FISH_LIST) {
             if (listReason == LIST) {
@@ -1215,7 +1323,7 @@ void fishProtocol::manageConnection(const QString &l) {
             else if (!checkExist && putPerm > -1) sendCommand(FISH_CHMOD,E(QString::number(putPerm,8)),E(url.path()));
             putPos += rawData.size();
             sendLen = rawData.size();
-        } else if (fishCommand == FISH_RETR) {
+        } else if (fishCommand == FISH_RETR || fishCommand == FISH_ZRETR) {
             data(QByteArray());
         }
         finished();
@@ -1224,7 +1332,12 @@ void fishProtocol::manageConnection(const QString &l) {
 
 void fishProtocol::writeStdin(const QString &line)
 {
-    qlist.append(line.toLatin1());
+    writeStdin(line.toLatin1());
+}
+
+void fishProtocol::writeStdin(const QByteArray &bytes)
+{
+    qlist.append(bytes);
 
     if (writeReady) {
         writeReady = false;
@@ -1273,48 +1386,53 @@ int fishProtocol::received(const char *buffer, KIO::fileoffset_t buflen)
     do {
         if (buflen <= 0) break;
 
-        if (rawRead > 0) {
-            myDebug( << "processedSize " << dataRead << ", len " << buflen << "/" << rawRead << endl);
-            int dataSize = (rawRead > buflen?buflen:rawRead);
-            if (!mimeTypeSent)
-            {
-                int mimeSize = qMin(dataSize, (int)(mimeBuffer.size()-dataRead));
-                memcpy(mimeBuffer.data()+dataRead,buffer,mimeSize);
-                dataRead += mimeSize;
-                rawRead -= mimeSize;
-                buffer += mimeSize;
-                buflen -= mimeSize;
-                if (rawRead == 0) // End of data
-                    mimeBuffer.resize(dataRead);
-                if (dataRead < (int)mimeBuffer.size())
-                {
-                    myDebug( << "wait for more" << endl);
+#ifdef HAVE_ZLIB
+        if (inflater) {
+            if (inflateBuffer.isEmpty())
+                inflateBuffer.resize(INFLATE_BUFFER_SIZE);
+            inflater->next_in = (Bytef *)buffer;
+            inflater->avail_in = buflen;
+            int zrc;
+            bool tooLong = false;
+            do {
+                inflater->next_out = (Bytef *)inflateBuffer.data();
+                inflater->avail_out = inflateBuffer.size();
+                zrc = inflate(inflater, Z_NO_FLUSH);
+                int inflated = inflateBuffer.size() - inflater->avail_out;
+                if (inflated > rawRead) {
+                    // More data than ls(1) reported, it must not be dropped silently
+                    tooLong = true;
                     break;
                 }
-                sendmimeType(KMimeType::findByNameAndContent(url.path(), mimeBuffer)->name());
-                mimeTypeSent = true;
-                if (fishCommand != FISH_READ) {
-                    totalSize(dataRead + rawRead);
-                    data(mimeBuffer);
-                    processedSize(dataRead);
-                }
-                mimeBuffer.resize(1024);
-                pos = 0;
-                continue; // Process rest of buffer/buflen
+                if (inflated > 0)
+                    receivedData(inflateBuffer.constData(), inflated);
+            } while (zrc == Z_OK && (inflater->avail_in > 0 || inflater->avail_out == 0));
+            buffer += buflen - inflater->avail_in;
+            buflen = inflater->avail_in;
+
+            if (!tooLong && (zrc == Z_OK || zrc == Z_BUF_ERROR)) {
+                myDebug( << "wait for more" << endl);
+                return 0;
             }
-
-            QByteArray bdata(buffer,dataSize);
-            data(bdata);
-
-            dataRead += dataSize;
-            rawRead -= dataSize;
-            processedSize(dataRead);
-            if (rawRead <= 0) {
-                buffer += dataSize;
-                buflen -= dataSize;
-            } else {
+            inflateEnd(inflater);
+            delete inflater;
+            inflater = NULL;
+            // The file may have changed size since ls(1) looked at it
+            if (tooLong || zrc != Z_STREAM_END || rawRead > 0) {
+                myDebug( << "inflate failed, rc: " << zrc << ", " << rawRead << " bytes missing, too long: " << tooLong << endl);
+                error(ERR_COULD_NOT_READ,url.prettyUrl());
+                shutdownConnection();
                 return 0;
             }
+        } else
+#endif
+        if (rawRead > 0) {
+            myDebug( << "processedSize " << dataRead << ", len " << buflen << "/" << rawRead << endl);
+            int used = receivedData(buffer, buflen);
+            buffer += used;
+            buflen -= used;
+            if (rawRead > 0)
+                return 0;
         }
 
         if (buflen <= 0) break;
@@ -1338,9 +1456,54 @@ int fishProtocol::received(const char *buffer, KIO::fileoffset_t buflen)
            while((pos < buflen) && (buffer[pos] != '\n'))
                ++pos;
         }
-    } while (childPid && buflen && (rawRead > 0 || pos < buflen));
+    } while (childPid && buflen && (rawRead > 0 || inflater || pos < buflen));
     return buflen;
 }
+
+/**
+passes on the data of RETR or READ, without copying it
+*/
+int fishProtocol::receivedData(const char *buffer, int buflen)
+{
+    int dataSize = (rawRead > buflen?buflen:rawRead);
+    int used = 0;
+    if (!mimeTypeSent)
+    {
+        int mimeSize = qMin(dataSize, (int)(mimeBuffer.size()-dataRead));
+        memcpy(mimeBuffer.data()+dataRead,buffer,mimeSize);
+        dataRead += mimeSize;
+        rawRead -= mimeSize;
+        buffer += mimeSize;
+        dataSize -= mimeSize;
+        used += mimeSize;
+        if (rawRead == 0) // End of data
+            mimeBuffer.resize(dataRead);
+        if (dataRead < (int)mimeBuffer.size())
+        {
+            myDebug( << "wait for more" << endl);
+            return used;
+        }
+        sendmimeType(KMimeType::findByNameAndContent(url.path(), mimeBuffer)->name());
+        mimeTypeSent = true;
+        if (fishCommand != FISH_READ) {
+            totalSize(dataRead + rawRead);
+            data(mimeBuffer);
+            processedSize(dataRead);
+        }
+        mimeBuffer.resize(1024);
+    }
+
+    if (dataSize > 0) {
+        // data() has sent the bytes on when it returns
+        data(QByteArray::fromRawData(buffer,dataSize));
+
+        dataRead += dataSize;
+        rawRead -= dataSize;
+        used += dataSize;
+        processedSize(dataRead);
+    }
+    return used;
+}
 /** get a file */
 void fishProtocol::get(const KUrl& u){
     myDebug( << "@@@@@@@@@ get " << u << endl);
@@ -1353,7 +1516,11 @@ void fishProtocol::get(const KUrl& u){
         sendCommand(FISH_PWD);
     } else {
         recvLen = -1;
-        sendCommand(FISH_RETR,E(url.path()));
+        // Compressing costs more than it saves when there is no network
+        if (hasCompression && !local && config()->readEntry("Compression", true))
+            sendCommand(FISH_ZRETR,E(url.path()));
+        else
+            sendCommand(FISH_RETR,E(url.path()));
     }
     run();
 }
@@ -1375,6 +1542,7 @@ void fishProtocol::put(const KUrl& u, int permissions, KIO::JobFlags flags) {
         checkOverwrite = flags & KIO::Overwrite;
         checkExist = false;
         putPos = 0;
+        putDataEnd = false;
         listReason = CHECK;
         sendCommand(FISH_LIST,E(url.path()));
         sendCommand(FISH_STOR,"0",E(url.path()));
@@ -1431,7 +1599,7 @@ with .fishsrv.pl typically running on another computer. */
         fd_set rfds, wfds;
         FD_ZERO(&rfds);
 #endif
-        char buf[32768];
+        char buf[65536];
         int offset = 0;
         while (isRunning) {
 #ifndef Q_WS_WIN
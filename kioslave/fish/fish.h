@@ -25,6 +25,8 @@
 
 #define FISH_EXEC_CMD 'X'
 
+struct z_stream_s;
+
 class fishProtocol : public KIO::SlaveBase
 {
 public:
@@ -150,6 +152,14 @@ protected: // Protected attributes
   enum { CHECK, LIST } listReason;
   /** true if FISH server understands APPEND command */
   bool hasAppend;
+  /** true if FISH server reads the data of a WRITE without answering its command first */
+  bool hasPipeline;
+  /** true if FISH server understands ZRETR command */
+  bool hasCompression;
+  /** number of WRITE commands sent but not answered yet */
+  int writesInFlight;
+  /** true if all data of the current put has been read */
+  bool putDataEnd;
   /** permission of created file */
   int putPerm;
   /** true if file may be overwritten */
@@ -168,6 +178,10 @@ protected: // Protected attributes
   bool mimeTypeSent;
   /** number of bytes read so far */
   KIO::fileoffset_t dataRead;
+  /** decompresses the data of ZRETR, NULL if not receiving one */
+  struct z_stream_s *inflater;
+  /** output buffer for inflater */
+  QByteArray inflateBuffer;
   /** details about each fishCommand */
   static const struct fish_info {
       const char *command;
@@ -180,7 +194,8 @@ protected: // Protected attributes
     FISH_RETR, FISH_STOR,
     FISH_CWD, FISH_CHMOD, FISH_DELE, FISH_MKD, FISH_RMD,
     FISH_RENAME, FISH_LINK, FISH_SYMLINK, FISH_CHOWN,
-    FISH_CHGRP, FISH_READ, FISH_WRITE, FISH_COPY, FISH_APPEND, FISH_EXEC } fishCommand;
+    FISH_CHGRP, FISH_READ, FISH_WRITE, FISH_COPY, FISH_APPEND, FISH_EXEC,
+    FISH_ZRETR } fishCommand;
   int fishCodeLen;
 protected: // Protected methods
   /** manages initial communication setup including password queries */
@@ -190,9 +205,15 @@ protected: // Protected methods
   int establishConnection(const QByteArray &buffer);
 #endif
   int received(const char *buffer, KIO::fileoffset_t buflen);
+  /** passes on data of RETR or READ, returns the number of bytes used */
+  int receivedData(const char *buffer, int buflen);
   void sent();
   /** builds each FISH request and sets the error counter */
   bool sendCommand(fish_command_type cmd, ...);
+  /** builds the text of a FISH request */
+  QString formatCommand(fish_command_type cmd, const QStringList &args);
+  /** sends WRITE commands with their data until enough are in flight */
+  void fillWritePipeline();
   /** checks response string for result code, converting 000 and 001 appropriately */
   int handleResponse(const QString &str);
   /** parses a ls -l time spec */
@@ -211,6 +232,7 @@ protected: // Protected methods
   void manageConnection(const QString &line);
   /** writes to process */
   void writeStdin(const QString &line);
+  void writeStdin(const QByteArray &bytes);
   /** Verify port **/
   void setHostInternal(const KUrl & u);
 
@@ -37,6 +37,7 @@ use strict;
 use POSIX qw(getcwd dup2 strftime);
 $SIG{'CHLD'} = 'IGNORE';
 $| = 1;
+my $zlib = eval { require Compress::Zlib; 1; };
 MAIN: while (<STDIN>) {
     chomp;
     chomp;
@@ -46,7 +47,9 @@ MAIN: while (<STDIN>) {
     /^VER / && do {
         # We do not advertise "append" capability anymore, as "write" is
         # as fast in perl mode and more reliable (overlapping writes)
-        print "VER 0.0.3 copy lscount lslinks lsmime exec stat\n### 200\n";
+        # "pipeline": the data of a write always follows its command, so
+        # several writes may be sent without waiting for their answers
+        print "VER 0.0.3 copy lscount lslinks lsmime exec stat pipeline",($zlib?" zretr":""),"\n### 200\n";
         next;
     };
     /^PWD$/ && do {
@@ -176,6 +179,10 @@ MAIN: while (<STDIN>) {
         read_loop($1);
         next;
     };
+    /^ZRETR\s+((?:\\.|[^\\])*?)\s*$/ && do {
+        read_loop($1,undef,undef,1);
+        next;
+    };
     /^READ\s+(\d+)\s+(\d+)\s+((?:\\.|[^\\])*?)\s*$/ && do {
         read_loop($3,$2,$1);
         next;
@@ -247,26 +254,31 @@ sub read_loop {
         sysseek(FH,int($_[2]),0) || do { close(FH); $error ||= $!; };
     }
     print "### 500 $error\n" and return if $error;
-    if (@_ < 2) {
+    if (!defined($_[1])) {
         print "$size\n";
     }
     print "### 100\n";
+    # ZRETR sends the data as one zlib stream, which ends by itself
+    my $deflater;
+    ($deflater) = Compress::Zlib::deflateInit(-Level => 1) if $_[3];
     my $buffer = '';
     my $read = 1;
     while ($size > 32768 && ($read = sysread(FH,$buffer,32768)) > 0) {
 #print DEBUG "$size left, $read read\n";
         $size -= $read;
-        print $buffer;
+        print ($deflater?scalar($deflater->deflate($buffer)):$buffer);
     }
     while ($size > 0 && ($read = sysread(FH,$buffer,$size)) > 0) {
 #print DEBUG "$size left, $read read\n";
         $size -= $read;
-        print $buffer;
+        print ($deflater?scalar($deflater->deflate($buffer)):$buffer);
     }
     while ($size > 0) {
-        print ' ';
-        $size--;
+        $buffer = ' ' x ($size > 32768?32768:$size);
+        $size -= length($buffer);
+        print ($deflater?scalar($deflater->deflate($buffer)):$buffer);
     }
+    print scalar($deflater->flush()) if $deflater;
     $error ||= $! if $read <= 0;
     close(FH);
     if (!$error) {
@@ -281,11 +293,18 @@ sub write_loop {
     my $fn = unquote($_[1]);
 #print DEBUG "write_loop called $size size, $fn fn, $_[2]\n";
     my $error = '';
-    sysopen(FH,$fn,$_[2]) || do { print "### 400 $!\n"; return; };
-    eval { flock(FH,2); };
-    if ($_[3]) {
-        sysseek(FH,int($_[3]),0) || do { close(FH);print "### 400 $!\n"; return; };
+    # The data is read even if the file can not be written, so that it is
+    # never taken for commands when the client did not wait for "### 100"
+    my $open = sysopen(FH,$fn,$_[2]);
+    if (!$open) {
+        $error = $!;
+    } else {
+        eval { flock(FH,2); };
+        if ($_[3]) {
+            sysseek(FH,int($_[3]),0) || ($error = $!);
+        }
     }
+    my $openError = $error;
     <STDIN>;
     print "### 100\n";
     my $buffer = '';
@@ -293,15 +312,17 @@ sub write_loop {
     while ($size > 32768 && ($read = read(STDIN,$buffer,32768)) > 0) {
 #print DEBUG "$size left, $read read\n";
         $size -= $read;
-        $error ||= $! if (syswrite(FH,$buffer,$read) != $read);
+        $error ||= $! if (!$error && syswrite(FH,$buffer,$read) != $read);
     }
     while ($size > 0 && ($read = read(STDIN,$buffer,$size)) > 0) {
 #print DEBUG "$size left, $read read\n";
         $size -= $read;
-        $error ||= $! if (syswrite(FH,$buffer,$read) != $read);
+        $error ||= $! if (!$error && syswrite(FH,$buffer,$read) != $read);
     }
-    close(FH);
-    if (!$error) {
+    close(FH) if $open;
+    if ($openError) {
+        print "### 400 $openError\n";
+    } elsif (!$error) {
         print "### 200\n";
     } else {
         print "### 500 $error\n";
@@ -33,6 +33,8 @@
 #include <QMap>
 #include <QRegExp>
 #include <QTextCodec>
+#include <QThread>
+#include <QThreadPool>
 
 #include <kdebug.h>
 #include <kcomponentdata.h>
@@ -43,6 +45,8 @@
 
 #include "kio_man.moc"
 #include "man2html.h"
+#include "manindex.h"
+#include "manpagecache.h"
 #include <assert.h>
 #include <kfilterbase.h>
 #include <kfilterdev.h>
@@ -53,33 +57,10 @@ MANProtocol *MANProtocol::_self = 0;
 
 #define SGML2ROFF_DIRS "/usr/lib/sgml"
 
-/*
- * Drop trailing ".section[.gz]" from name
- */
-static
-void stripExtension( QString *name )
-{
-    int pos = name->length();
-
-    if ( name->indexOf(".gz", -3) != -1 )
-        pos -= 3;
-    else if ( name->indexOf(".z", -2, Qt::CaseInsensitive) != -1 )
-        pos -= 2;
-    else if ( name->indexOf(".bz2", -4) != -1 )
-        pos -= 4;
-    else if ( name->indexOf(".bz", -3) != -1 )
-        pos -= 3;
-    else if ( name->indexOf(".lzma", -5) != -1 )
-        pos -= 5;
-    else if ( name->indexOf(".xz", -3) != -1 )
-        pos -= 3;
-
-    if ( pos > 0 )
-        pos = name->lastIndexOf('.', pos-1);
-
-    if ( pos > 0 )
-        name->truncate( pos );
-}
+// Size of the rendered pages kept in the cache, they are compressed
+#define MAXIMUM_CACHE_SIZE (64 * 1024 * 1024)
+// Pages of an index rendered in advance, the rest is rendered when opened
+#define MAXIMUM_PREFETCH_PAGES 32
 
 static
 bool parseUrl(const QString& _url, QString &title, QString &section)
@@ -127,6 +108,115 @@ bool parseUrl(const QString& _url, QString &title, QString &section)
 }
 
 
+/*
+ * Reads the man page at filename, which is relative to lastdir, and
+ * converts it to UTF-8. Returns NULL on errors. The file which was
+ * actually read is appended to readFiles.
+ */
+static
+char *readManPageFile(QByteArray filename, QByteArray &lastdir, QStringList &readFiles)
+{
+    QByteArray array, dirName;
+
+    if (QDir::isRelativePath(filename))
+    {
+        kDebug(7107) << "relative " << filename;
+        filename = QDir::cleanPath(lastdir + '/' + filename).toUtf8();
+        kDebug(7107) << "resolved to " << filename;
+    }
+
+    lastdir = filename.left(filename.lastIndexOf('/'));
+
+    // get the last directory name (which might be a language name, to be able to guess the encoding)
+    QDir dir(lastdir);
+    dir.cdUp();
+    dirName = QFile::encodeName(dir.dirName());
+
+    if ( !QFile::exists(QFile::decodeName(filename)) )  // if given file does not exist, find with suffix
+    {
+        kDebug(7107) << "not existing " << filename;
+        QDir mandir(lastdir);
+        mandir.setNameFilters(QStringList() << (filename.mid(filename.lastIndexOf('/') + 1) + ".*"));
+        filename = lastdir + '/' + QFile::encodeName(mandir.entryList().first());
+        kDebug(7107) << "resolved to " << filename;
+    }
+
+    readFiles.append(QFile::decodeName(filename));
+    QIODevice *fd = KFilterDev::deviceForFile(filename);
+
+    if ( !fd || !fd->open(QIODevice::ReadOnly))
+    {
+       delete fd;
+       return 0;
+    }
+    array = fd->readAll();
+    kDebug(7107) << "read " << array.size();
+    fd->close();
+    delete fd;
+
+    if (array.isEmpty())
+      return 0;
+
+    return manPageToUtf8(array, dirName);
+}
+
+/*
+ * Renders man pages into the cache, in a thread of its own
+ */
+class ManPageRenderer : public QRunnable, public Man2Html
+{
+public:
+    ManPageRenderer(const ManPageCache *cache, const QString &path, const QAtomicInt *cancelled,
+                    QAtomicInt *pending, const QByteArray &cssPath, const QByteArray &cssFile)
+        : m_cache(cache), m_path(path), m_cancelled(cancelled), m_pending(pending)
+    {
+        setResourcePath(cssPath);
+        setCssFile(cssFile);
+    }
+
+    virtual void run()
+    {
+        render();
+        // The last one of a batch makes room for what it has added
+        if (!m_pending->deref() && !*m_cancelled)
+            m_cache->prune(MAXIMUM_CACHE_SIZE);
+    }
+
+protected:
+    virtual void output(const char *insert)
+    {
+        m_html += insert;
+    }
+
+    virtual char *readManPage(const char *filename)
+    {
+        return readManPageFile(filename, m_lastdir, m_readFiles);
+    }
+
+private:
+    void render()
+    {
+        if (*m_cancelled || m_cache->contains(m_path))
+            return;
+        char *buf = readManPage(QFile::encodeName(m_path));
+        if (!buf)
+            return;
+        // Only the files included with .so are left
+        m_readFiles.clear();
+        scanManPage(buf);
+        delete [] buf;
+        m_cache->write(m_path, m_html, m_readFiles);
+    }
+
+    const ManPageCache *m_cache;
+    QString m_path;
+    const QAtomicInt *m_cancelled;
+    QAtomicInt *m_pending;
+    QByteArray m_lastdir;
+    QStringList m_readFiles;
+    QByteArray m_html;
+};
+
 MANProtocol::MANProtocol(const QByteArray &pool_socket, const QByteArray &app_socket)
     : QObject(), SlaveBase("man", pool_socket, app_socket)
 {
@@ -141,90 +231,24 @@ MANProtocol::MANProtocol(const QByteArray &pool_socket, const QByteArray &app_so
     QString cssPath(KStandardDirs::locate( "data", "kio_docfilter/kio_docfilter.css" ));
     KUrl cssUrl(KUrl::fromPath(cssPath));
     m_manCSSFile = cssUrl.url().toUtf8();
+
+    m_cache = new ManPageCache(m_cssPath, m_manCSSFile);
+    m_index = new ManIndex;
+    m_renderPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
 }
 
 MANProtocol *MANProtocol::self() { return _self; }
 
 MANProtocol::~MANProtocol()
 {
+    // Pages still queued are not rendered anymore
+    m_renderCancelled = 1;
+    m_renderPool.waitForDone();
+    delete m_cache;
+    delete m_index;
     _self = 0;
 }
 
-void MANProtocol::parseWhatIs( QMap<QString, QString> &i, QTextStream &t, const QString &mark )
-{
-    QRegExp re( mark );
-    QString l;
-    while ( !t.atEnd() )
-    {
-	l = t.readLine();
-	int pos = re.indexIn( l );
-	if (pos != -1)
-	{
-	    QString names = l.left(pos);
-	    QString descr = l.mid(pos + re.matchedLength());
-	    while ((pos = names.indexOf(",")) != -1)
-	    {
-		i[names.left(pos++)] = descr;
-		while (names[pos] == ' ')
-		    pos++;
-		names = names.mid(pos);
-	    }
-	    i[names] = descr;
-	}
-    }
-}
-
-bool MANProtocol::addWhatIs(QMap<QString, QString> &i, const QString &name, const QString &mark)
-{
-    QFile f(name);
-    if (!f.open(QIODevice::ReadOnly))
-        return false;
-    QTextStream t(&f);
-    parseWhatIs( i, t, mark );
-    return true;
-}
-
-QMap<QString, QString> MANProtocol::buildIndexMap(const QString &section)
-{
-    QMap<QString, QString> i;
-    QStringList man_dirs = manDirectories();
-    // Supplementary places for whatis databases
-    man_dirs += m_mandbpath;
-    if (!man_dirs.contains("/var/cache/man"))
-        man_dirs << "/var/cache/man";
-    if (!man_dirs.contains("/var/catman"))
-        man_dirs << "/var/catman";
-
-    QStringList names;
-    names << "whatis.db" << "whatis";
-    QString mark = "\\s+\\(" + section + "[a-z]*\\)\\s+-\\s+";
-
-    for ( QStringList::ConstIterator it_dir = man_dirs.constBegin();
-          it_dir != man_dirs.constEnd();
-          ++it_dir )
-    {
-        if ( QFile::exists( *it_dir ) ) {
-    	    QStringList::ConstIterator it_name;
-            for ( it_name = names.constBegin();
-	          it_name != names.constEnd();
-	          it_name++ )
-            {
-	        if (addWhatIs(i, (*it_dir) + '/' + (*it_name), mark))
-		    break;
-	    }
-            if ( it_name == names.constEnd() ) {
-                KProcess proc;
-                proc << "whatis" << "-M" << (*it_dir) << "-w" << "*";
-                proc.setOutputChannelMode( KProcess::OnlyStdoutChannel );
-                proc.execute();
-                QTextStream t( proc.readAllStandardOutput(), QIODevice::ReadOnly );
-                parseWhatIs( i, t, mark );
-            }
-        }
-    }
-    return i;
-}
-
 //---------------------------------------------------------------------
 
 QStringList MANProtocol::manDirectories()
@@ -268,12 +292,8 @@ QStringList MANProtocol::manDirectories()
     return man_dirs;
 }
 
-QStringList MANProtocol::findPages(const QString &_section,
-                                   const QString &title,
-                                   bool full_path)
+QStringList MANProtocol::findPages(const QString &section, const QString &title)
 {
-    QString section = _section;
-
     QStringList list;
 
     // kDebug() << "findPages '" << section << "' '" << title << "'\n";
@@ -282,143 +302,22 @@ QStringList MANProtocol::findPages(const QString &_section,
        return list;
     }
 
-    const QString star( "*" );
-
-    //
-    // Find man sections in this directory
-    //
-    QStringList sect_list;
-    if ( section.isEmpty() )
-        section = star;
-
-    if ( section != star )
-    {
-        //
-        // Section given as argument
-        //
-        sect_list += section;
-        while ( (!section.isEmpty()) && (section.at(section.length() - 1).isLetter()) ) {
-            section.truncate(section.length() - 1);
-            sect_list += section;
-        }
-    } else {
-        sect_list += section;
-    }
-
-    QStringList man_dirs = manDirectories();
-
-    //
-    // Find man pages in the sections listed above
-    //
-    for ( int i=0;i<sect_list.count(); i++)
-    {
-            QString it_s=sect_list.at(i);
-	    QString it_real = it_s.toLower();
-        //
-        // Find pages
-        //
-        //kDebug(7107)<<"Before inner loop";
-        for ( QStringList::const_iterator it_dir = man_dirs.constBegin();
-              it_dir != man_dirs.constEnd();
-              it_dir++ )
-        {
-            QString man_dir = (*it_dir);
-            //
-            // Sections = all sub directories "man*" and "sman*"
-            //
-            DIR *dp = ::opendir( QFile::encodeName( man_dir ) );
-
-            if ( !dp )
-                continue;
-
-            struct dirent *ep;
-
-            const QString man = QString("man");
-            const QString sman = QString("sman");
-
-            while ( (ep = ::readdir( dp )) != 0L ) {
-
-                const QString file = QFile::decodeName( ep->d_name );
-                QString sect;
-
-                if ( file.startsWith( man ) )
-                    sect = file.mid(3);
-                else if (file.startsWith(sman))
-                    sect = file.mid(4);
-
-		if (sect.toLower()==it_real) it_real = sect;
-
-                // Only add sect if not already contained, avoid duplicates
-                if (!sect_list.contains(sect) && _section.isEmpty())  {
-                    //kDebug() << "another section " << sect;
-                    sect_list += sect;
-                }
-            }
-
-            //kDebug(7107) <<" after while loop";
-            ::closedir( dp );
-#if 0
-            kDebug(7107)<<"================-";
-            kDebug(7107)<<"star=="<<star;
-            kDebug(7107)<<"it_s=="<<it_s;
-            kDebug(7107)<<"================+";
-#endif
-            if ( it_s != star ) { // in that case we only look around for sections
-                //kDebug(7107)<<"Within if ( it_s != star )";
-                const QString dir = man_dir + QString("/man") + (it_real) + '/';
-                const QString sdir = man_dir + QString("/sman") + (it_real) + '/';
-
-                //kDebug(7107)<<"calling findManPagesInSection";
-                findManPagesInSection(dir, title, full_path, list);
-                findManPagesInSection(sdir, title, full_path, list);
-            }
-            kDebug(7107)<<"After if";
-        }
-    }
-
-    //kDebug(7107) << "finished " << list << " " << sect_list;
-
+    updateIndex();
+    foreach (const ManIndex::Page &page, m_index->pages(section, title))
+        list += page.path;
     return list;
 }
 
-void MANProtocol::findManPagesInSection(const QString &dir, const QString &title, bool full_path, QStringList &list)
+void MANProtocol::updateIndex()
 {
-    kDebug(7107) << "findManPagesInSection " << dir << " " << title;
-    bool title_given = !title.isEmpty();
-
-    DIR *dp = ::opendir( QFile::encodeName( dir ) );
-
-    if ( !dp )
-        return;
-
-    struct dirent *ep;
-
-    while ( (ep = ::readdir( dp )) != 0L ) {
-        if ( ep->d_name[0] != '.' ) {
-
-            QString name = QFile::decodeName( ep->d_name );
-
-            // check title if we're looking for a specific page
-            if ( title_given ) {
-                if ( !name.startsWith( title ) ) {
-                    continue;
-                }
-                else {
-                    // beginning matches, do a more thorough check...
-                    QString tmp_name = name;
-                    stripExtension( &tmp_name );
-                    if ( tmp_name != title )
-                        continue;
-                }
-            }
-
-            if ( full_path )
-                name.prepend( dir );
+    // Supplementary places for whatis databases
+    QStringList whatis_dirs = m_mandbpath;
+    if (!whatis_dirs.contains("/var/cache/man"))
+        whatis_dirs << "/var/cache/man";
+    if (!whatis_dirs.contains("/var/catman"))
+        whatis_dirs << "/var/catman";
 
-            list += name ;
-        }
-    }
-    ::closedir( dp );
+    m_index->update(manDirectories(), whatis_dirs);
 }
 
 void MANProtocol::output(const char *insert)
@@ -426,6 +325,7 @@ void MANProtocol::output(const char *insert)
     if (insert)
     {
         m_outputBuffer.write(insert,strlen(insert));
+        m_renderedPage += insert;
     }
     if (!insert || m_outputBuffer.pos() >= 2048)
     {
@@ -475,6 +375,13 @@ void MANProtocol::get(const KUrl& url )
         return;
     }
 
+    // man:ls* lists the pages starting with "ls"
+    if (title.endsWith('*') && !title.startsWith('/'))
+    {
+        showPrefixSearch(section, title.left(title.length() - 1));
+        return;
+    }
+
     const QStringList foundPages=findPages(section, title);
     bool pageFound=true;
 
@@ -504,9 +411,19 @@ void MANProtocol::get(const KUrl& url )
 
     if (pageFound)
     {
+       QByteArray html;
+       if (m_cache->read(foundPages[0], html))
+       {
+          data(html);
+          data(QByteArray());
+          finished();
+          return;
+       }
+
        setResourcePath(m_cssPath);
        setCssFile(m_manCSSFile);
        m_outputBuffer.open(QIODevice::WriteOnly);
+       m_renderedPage.clear();
        const QByteArray filename=QFile::encodeName(foundPages[0]);
        char *buf = readManPage(filename);
 
@@ -516,6 +433,8 @@ void MANProtocol::get(const KUrl& url )
           finished();
           return;
        }
+       // Only the files included with .so are left
+       m_readFiles.clear();
        // will call output_real
        scan_man_page(buf);
        delete [] buf;
@@ -525,6 +444,8 @@ void MANProtocol::get(const KUrl& url )
        m_outputBuffer.close();
        data(m_outputBuffer.buffer());
        m_outputBuffer.setData(QByteArray());
+       m_cache->write(foundPages[0], m_renderedPage, m_readFiles);
+       m_renderedPage.clear();
        // tell we are done
        data(QByteArray());
     }
@@ -550,46 +471,14 @@ char *MANProtocol::readManPage(const char *_filename)
         // Determine path to sgml2roff, if not already done.
         getProgramPath();
         proc << mySgml2RoffPath << filename;
+        m_readFiles.append(QFile::decodeName(filename));
         proc.setOutputChannelMode( KProcess::OnlyStdoutChannel );
         proc.execute();
         array = proc.readAllStandardOutput();
     }
     else
     {
-      if (QDir::isRelativePath(filename))
-      {
-          kDebug(7107) << "relative " << filename;
-          filename = QDir::cleanPath(lastdir + '/' + filename).toUtf8();
-          kDebug(7107) << "resolved to " << filename;
-      }
-
-      lastdir = filename.left(filename.lastIndexOf('/'));
-
-      // get the last directory name (which might be a language name, to be able to guess the encoding)
-      QDir dir(lastdir);
-      dir.cdUp();
-      dirName = QFile::encodeName(dir.dirName());
-
-      if ( !QFile::exists(QFile::decodeName(filename)) )  // if given file does not exist, find with suffix
-      {
-          kDebug(7107) << "not existing " << filename;
-          QDir mandir(lastdir);
-          mandir.setNameFilters(QStringList() << (filename.mid(filename.lastIndexOf('/') + 1) + ".*"));
-          filename = lastdir + '/' + QFile::encodeName(mandir.entryList().first());
-          kDebug(7107) << "resolved to " << filename;
-      }
-
-      QIODevice *fd = KFilterDev::deviceForFile(filename);
-
-      if ( !fd || !fd->open(QIODevice::ReadOnly))
-      {
-         delete fd;
-         return 0;
-      }
-      array = fd->readAll();
-      kDebug(7107) << "read " << array.size();
-      fd->close();
-      delete fd;
+      return readManPageFile(filename, lastdir, m_readFiles);
     }
 
     if (array.isEmpty())
@@ -1085,53 +974,6 @@ void MANProtocol::checkManPaths()
 }
 
 
-// Setup my own structure, with char pointers.
-// from now on only pointers are copied, no strings
-//
-// containing the whole path string,
-// the beginning of the man page name
-// and the length of the name
-struct man_index_t {
-    char *manpath;  // the full path including man file
-    const char *manpage_begin;  // pointer to the begin of the man file name in the path
-    int manpage_len; // len of the man file name
-};
-typedef man_index_t *man_index_ptr;
-
-int compare_man_index(const void *s1, const void *s2)
-{
-    struct man_index_t *m1 = *(struct man_index_t **)s1;
-    struct man_index_t *m2 = *(struct man_index_t **)s2;
-    int i;
-    // Compare the names of the pages
-    // with the shorter length.
-    // Man page names are not '\0' terminated, so
-    // this is a bit tricky
-    if ( m1->manpage_len > m2->manpage_len)
-    {
-	i = qstrnicmp( m1->manpage_begin,
-		      m2->manpage_begin,
-		      m2->manpage_len);
-	if (!i)
-	    return 1;
-	return i;
-    }
-
-    if ( m1->manpage_len < m2->manpage_len)
-    {
-	i = qstrnicmp( m1->manpage_begin,
-		      m2->manpage_begin,
-		      m1->manpage_len);
-	if (!i)
-	    return -1;
-	return i;
-    }
-
-    return qstrnicmp( m1->manpage_begin,
-		     m2->manpage_begin,
-		     m1->manpage_len);
-}
-
 void MANProtocol::showIndex(const QString& section)
 {
     QByteArray array_h;
@@ -1158,7 +1000,8 @@ void MANProtocol::showIndex(const QString& section)
     infoMessage(i18n("Generating Index"));
 
     // search for the man pages
-    QStringList pages = findPages( section, QString() );
+    updateIndex();
+    const QList<ManIndex::Page> pages = m_index->pages(section);
 
     if ( pages.count() == 0 )  // not a single page found
     {
@@ -1171,134 +1014,34 @@ void MANProtocol::showIndex(const QString& section)
       return;
     }
 
-    QMap<QString, QString> indexmap = buildIndexMap(section);
-
     // print out the list
     os << "<table>" << endl;
 
-    int listlen = pages.count();
-    man_index_ptr *indexlist = new man_index_ptr[listlen];
-    listlen = 0;
-
-    QStringList::const_iterator page;
-    for (page = pages.constBegin(); page != pages.constEnd(); ++page)
-    {
-	// I look for the beginning of the man page name
-	// i.e. "bla/pagename.3.gz" by looking for the last "/"
-	// Then look for the end of the name by searching backwards
-	// for the last ".", not counting zip extensions.
-	// If the len of the name is >0,
-	// store it in the list structure, to be sorted later
-
-        char *manpage_end;
-        struct man_index_t *manindex = new man_index_t;
-	manindex->manpath = strdup((*page).toUtf8());
-
-	manindex->manpage_begin = strrchr(manindex->manpath, '/');
-	if (manindex->manpage_begin)
-	{
-	    manindex->manpage_begin++;
-	    assert(manindex->manpage_begin >= manindex->manpath);
-	}
-	else
-	{
-	    manindex->manpage_begin = manindex->manpath;
-	    assert(manindex->manpage_begin >= manindex->manpath);
-	}
-
-	// Skip extension ".section[.gz]"
-
-	char *begin = (char*)(manindex->manpage_begin);
-	int len = strlen( begin );
-	char *end = begin+(len-1);
-
-	if ( len >= 3 && strcmp( end-2, ".gz" ) == 0 )
-	    end -= 3;
-	else if ( len >= 2 && strcmp( end-1, ".Z" ) == 0 )
-	    end -= 2;
-	else if ( len >= 2 && strcmp( end-1, ".z" ) == 0 )
-	    end -= 2;
-	else if ( len >= 4 && strcmp( end-3, ".bz2" ) == 0 )
-	    end -= 4;
-	else if ( len >= 5 && strcmp( end-4, ".lzma" ) == 0 )
-	    end -= 5;
-	else if ( len >= 3 && strcmp( end-2, ".xz" ) == 0 )
-	    end -= 3;
-
-	while ( end >= begin && *end != '.' )
-	    end--;
-
-	if ( end < begin )
-	    manpage_end = 0;
-	else
-	    manpage_end = end;
-
-	if (NULL == manpage_end)
-	{
-	    // no '.' ending ???
-	    // set the pointer past the end of the filename
-	    manindex->manpage_len = (*page).length();
-	    manindex->manpage_len -= (manindex->manpage_begin - manindex->manpath);
-	    assert(manindex->manpage_len >= 0);
-	}
-	else
-	{
-	    manindex->manpage_len = (manpage_end - manindex->manpage_begin);
-	    assert(manindex->manpage_len >= 0);
-	}
-
-	if (0 < manindex->manpage_len)
-	{
-	    indexlist[listlen] = manindex;
-	    listlen++;
-	}
-	else delete manindex;
-    }
-
     //
-    // Now do the sorting on the page names
-    // and the printout afterwards
-    // While printing avoid duplicate man page names
+    // The index is sorted on the page names already,
+    // avoid duplicate man page names while printing
     //
 
-    struct man_index_t dummy_index = {0l,0l,0};
-    struct man_index_t *last_index = &dummy_index;
-
-    // sort and print
-    qsort(indexlist, listlen, sizeof(struct man_index_t *), compare_man_index);
-
     QChar firstchar, tmp;
     QString indexLine="<div class=\"secidxshort\">\n";
-    if (indexlist[0]->manpage_len>0)
-    {
-	firstchar=QChar((indexlist[0]->manpage_begin)[0]).toLower();
+    firstchar=pages.first().name.at(0).toLower();
+
+    const QString appendixstr = QString(
+	" [<a href=\"#%1\" accesskey=\"%2\">%3</a>]\n"
+    ).arg(firstchar).arg(firstchar).arg(firstchar);
+    indexLine.append(appendixstr);
 
-	const QString appendixstr = QString(
-	    " [<a href=\"#%1\" accesskey=\"%2\">%3</a>]\n"
-	).arg(firstchar).arg(firstchar).arg(firstchar);
-	indexLine.append(appendixstr);
-    }
     os << "<tr><td class=\"secidxnextletter\"" << " colspan=\"3\">\n  <a name=\""
        << firstchar << "\">" << firstchar <<"</a>\n</td></tr>" << endl;
 
-    for (int i=0; i<listlen; i++)
+    QStringList paths;
+    QString last_name;
+    foreach (const ManIndex::Page &page, pages)
     {
-	struct man_index_t *manindex = indexlist[i];
-
-	// qstrncmp():
-	// "last_man" has already a \0 string ending, but
-	// "manindex->manpage_begin" has not,
-	// so do compare at most "manindex->manpage_len" of the strings.
-	if (last_index->manpage_len == manindex->manpage_len &&
-	    !qstrncmp(last_index->manpage_begin,
-		      manindex->manpage_begin,
-		      manindex->manpage_len)
-	    )
-	{
+	if (page.name == last_name)
 	    continue;
-	}
 
-	tmp=QChar((manindex->manpage_begin)[0]).toLower();
+	tmp=page.name.at(0).toLower();
 	if (firstchar != tmp)
 	{
 	    firstchar = tmp;
@@ -1311,24 +1054,17 @@ void MANProtocol::showIndex(const QString& section)
 	    indexLine.append(appendixstr);
 	}
 	os << "<tr><td><a href=\"man:"
-	   << manindex->manpath << "\">\n";
+	   << page.path << "\">\n";
 
-	((char *)manindex->manpage_begin)[manindex->manpage_len] = '\0';
-	os << manindex->manpage_begin
+	os << page.name
 	   << "</a></td><td>&nbsp;</td><td> "
-	   << (indexmap.contains(manindex->manpage_begin) ? indexmap[manindex->manpage_begin] : "" )
+	   << page.description
 	   << "</td></tr>"  << endl;
-	last_index = manindex;
+	last_name = page.name;
+	paths += page.path;
     }
     indexLine.append("</div>");
 
-    for (int i=0; i<listlen; i++) {
-	::free(indexlist[i]->manpath);   // allocated by strdup
-	delete indexlist[i];
-    }
-
-    delete [] indexlist;
-
     os << "</table></div>" << endl;
 
     os << indexLine << endl;
@@ -1342,6 +1078,58 @@ void MANProtocol::showIndex(const QString& section)
     infoMessage(QString());
     data(array_h + array_d);
     finished();
+
+    // The user is likely to open some of the first ones next
+    renderInBackground(paths.mid(0, MAXIMUM_PREFETCH_PAGES));
+}
+
+void MANProtocol::showPrefixSearch(const QString &section, const QString &prefix)
+{
+    QByteArray array;
+    QTextStream os(&array, QIODevice::WriteOnly);
+    os.setCodec( "UTF-8" );
+
+    os << "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01 Strict//EN\">" << endl;
+    os << "<html><head><meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\">" << endl;
+    os << "<title>" << i18n("UNIX Manual Index") << "</title>" << endl;
+    if ( !m_manCSSFile.isEmpty() )
+        os << "<link href=\"" << m_manCSSFile << "\" type=\"text/css\" rel=\"stylesheet\">" << endl;
+    os << "</head>" << endl << "<body>" << endl;
+    os << "<div class=\"secidxmain\">" << endl;
+    os << "<h1>" << i18n( "Man pages starting with %1", Qt::escape(prefix) ) << "</h1>" << endl;
+
+    updateIndex();
+    const QList<ManIndex::Page> pages = m_index->pagesWithPrefix(section, prefix);
+
+    os << "<table>" << endl;
+    foreach (const ManIndex::Page &page, pages)
+    {
+        os << "<tr><td><a href=\"man:" << page.path << "\">\n"
+           << page.name << '(' << page.section << ")</a></td><td>&nbsp;</td><td> "
+           << page.description
+           << "</td></tr>" << endl;
+    }
+    os << "</table></div>" << endl;
+
+    // print footer
+    os << "</body></html>" << endl;
+
+    data(array);
+    finished();
+}
+
+void MANProtocol::renderInBackground(const QStringList &pages)
+{
+    m_cache->prune(MAXIMUM_CACHE_SIZE);
+    foreach (const QString &page, pages)
+    {
+        // sgml2roff is left to get(), the others are thread safe
+        if (page.contains("sman", Qt::CaseInsensitive))
+            continue;
+        m_renderPending.ref();
+        m_renderPool.start(new ManPageRenderer(m_cache, page, &m_renderCancelled, &m_renderPending,
+                                               m_cssPath, m_manCSSFile));
+    }
 }
 
 void MANProtocol::listDir(const KUrl &url)
@@ -1380,16 +1168,12 @@ void MANProtocol::listDir(const KUrl &url)
         }
     }
 
-    QStringList list = findPages( section, QString(), false );
-
-    QStringList::Iterator it = list.begin();
-    QStringList::Iterator end = list.end();
-
-    for ( ; it != end; ++it ) {
-        stripExtension( &(*it) );
+    updateIndex();
+    const QList<ManIndex::Page> pages = m_index->pages(section);
 
+    foreach (const ManIndex::Page &page, pages) {
         UDSEntry     uds_entry;
-        uds_entry.insert( KIO::UDSEntry::UDS_NAME, *it );
+        uds_entry.insert( KIO::UDSEntry::UDS_NAME, page.name );
         uds_entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
         uds_entry.insert(KIO::UDSEntry::UDS_MIME_TYPE, QString::fromLatin1("text/html"));
         uds_entry_list.append( uds_entry );
@@ -22,12 +22,17 @@
 
 
 
+#include <QAtomicInt>
 #include <QBuffer>
 #include <QTextStream>
+#include <QThreadPool>
 
 #include <kio/global.h>
 #include <kio/slavebase.h>
 
+class ManIndex;
+class ManPageCache;
+
 class MANProtocol : public QObject, public KIO::SlaveBase
 {
     Q_OBJECT
@@ -48,6 +53,7 @@ public:
 
     void showMainIndex();
     void showIndex(const QString& section);
+    void showPrefixSearch(const QString& section, const QString& prefix);
 
     // the following two functions are the interface to man2html
     void output(const char *insert);
@@ -58,22 +64,18 @@ public:
 private:
     void checkManPaths();
     QStringList manDirectories();
-    QMap<QString, QString> buildIndexMap(const QString& section);
-    bool addWhatIs(QMap<QString, QString>& i, const QString& f, const QString& mark);
-    void parseWhatIs( QMap<QString, QString> &i, QTextStream &t, const QString &mark );
-    QStringList findPages(const QString& section, 
-                          const QString &title, 
-                          bool full_path = true);
+    void updateIndex();
+    QStringList findPages(const QString& section, const QString &title);
 
     void addToBuffer(const char *buffer, int buflen);
     QString pageName(const QString& page) const;
     QStringList buildSectionList(const QStringList& dirs) const;
     void constructPath(QStringList& constr_path, QStringList constr_catmanpath);
+    void renderInBackground(const QStringList &pages);
 private:
     static MANProtocol *_self;
     QByteArray lastdir;
 
-    void findManPagesInSection(const QString &dir, const QString &title, bool full_path, QStringList &list);
     QStringList m_manpath; ///< Path of man directories
     QStringList m_mandbpath; ///< Path of catman directories
     QStringList section_names;
@@ -84,6 +86,13 @@ private:
     QByteArray m_cssPath; ///< Path to KDE resources, encoded for CSS
     QBuffer m_outputBuffer; ///< Buffer for the output
     QByteArray m_manCSSFile; ///< Path to kio_man.css
+    QByteArray m_renderedPage; ///< All of the output, for the cache
+    QStringList m_readFiles; ///< Files read for the current page, for the cache
+    ManPageCache *m_cache; ///< Rendered pages
+    ManIndex *m_index; ///< All man pages, with their descriptions
+    QThreadPool m_renderPool; ///< Renders pages into the cache
+    QAtomicInt m_renderCancelled;
+    QAtomicInt m_renderPending; ///< Pages queued in m_renderPool
 };
 
 
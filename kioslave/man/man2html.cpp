@@ -170,12 +170,6 @@
 #define BD_LITERAL  1
 #define BD_INDENT   2
 
-static int s_nroff = 1; // NROFF mode by default
-
-static QByteArray mandoc_name;  // Nm can store the first used name
-
-static int mandoc_name_count = 0; /* Don't break on the first Nm */
-
 /* below this you should not change anything unless you know a lot
 ** about this program or about troff.
 */
@@ -221,29 +215,206 @@ class NumberDefinition
     // ### TODO: display form (.af)
 };
 
-/**
- * Map of character definitions
- */
-static QMap<QByteArray, StringDefinition> s_characterDefinitionMap;
+class TABLEROW;
 
 /**
- * Map of string variable and macro definitions
- * \note String variables and macros are the same thing!
+ * The state of the converter, formerly static variables, and the functions
+ * using it. Every Man2Html has its own, so that pages can be converted in
+ * parallel.
  */
-static QMap<QByteArray, StringDefinition> s_stringDefinitionMap;
+class Man2HtmlPrivate
+{
+  public:
+    Man2HtmlPrivate(Man2Html *qq);
+    ~Man2HtmlPrivate();
 
-/**
- * Map of number registers
- * \note Intern number registers (starting with a dot are not handled here)
- */
-static QMap<QByteArray, NumberDefinition> s_numberDefinitionMap;
+    void scan_man_page(const char *man_page);
+
+    // Wrappers for the callbacks
+    void output_real(const char *insert)
+    {
+      q->output(insert);
+    }
+    char *read_man_page(const char *filename)
+    {
+      return q->readManPage(filename);
+    }
+
+    void InitCharacterDefinitions(void);
+    void InitStringDefinitions(void);
+    void InitNumberDefinitions(void);
+    void fill_old_character_definitions(void);
+    void add_links(char *c);
+    void out_html(const char *c);
+    void checkListStack();
+    QByteArray set_font(const QByteArray& name);
+    QByteArray change_to_size(int nr);
+    QByteArray scan_named_character(char*& c);
+    QByteArray scan_named_string(char*& c);
+    QByteArray scan_dollar_parameter(char*& c);
+    int read_only_number_register(const QByteArray& name);
+    int getNumberRegisterValue(const QByteArray &name, int sign = 0);
+    int scan_number_register(char*& c);
+    QByteArray scan_name(char *&c);
+    QByteArray scan_named_font(char*& c);
+    QByteArray scan_number_code(char*& c);
+    char *scan_escape_direct(char *c, QByteArray& cstr);
+    char *scan_escape(char *c);
+    void clear_table(TABLEROW *table);
+    char *scan_format(char *c, TABLEROW **result, int *maxcol);
+    TABLEROW *next_row(TABLEROW *tr);
+    char *scan_table(char *c);
+    char *scan_expression(char *c, int *result, const unsigned int numLoop);
+    char *scan_expression(char *c, int *result);
+    void trans_char(char *c, char s, char t);
+    void getArguments(/* const */ char *&c, QList<QByteArray> &args, QList<char*> *argPointers = 0);
+    char *skip_till_newline(char *c);
+    void request_while(char*& c, int j, bool mdoc);
+    void request_mixed_fonts(char*& c, int j, const char* font1, const char* font2, const bool mode, const bool inFMode);
+    char* process_quote(char* c, int j, const char* open, const char* close);
+    bool is_mdoc_punctuation(const char ch);
+    bool is_identifier_char(const char c);
+    QByteArray scan_identifier(char*& c);
+    char *scan_request(char *c);
+    char *scan_troff(char *c, bool san, char **result);
+    char *scan_troff_mandoc(char *c, bool san, char **result);
+
+    Man2Html *q;
+
+    int s_nroff; // NROFF mode by default
+
+    QByteArray mandoc_name;  // Nm can store the first used name
+
+    int mandoc_name_count; /* Don't break on the first Nm */
+
+    /**
+     * Map of character definitions
+     */
+    QMap<QByteArray, StringDefinition> s_characterDefinitionMap;
+
+    /**
+     * Map of string variable and macro definitions
+     * \note String variables and macros are the same thing!
+     */
+    QMap<QByteArray, StringDefinition> s_stringDefinitionMap;
+
+    /**
+     * Map of number registers
+     * \note Intern number registers (starting with a dot are not handled here)
+     */
+    QMap<QByteArray, NumberDefinition> s_numberDefinitionMap;
+
+    /* char eqndelimopen, eqndelimclose; */
+    char escapesym, nobreaksym, controlsym, fieldsym, padsym;
+
+    char *buffer;
+    int buffpos, buffmax;
+    bool scaninbuff;
+    int itemdepth;
+    int in_div;
+    int dl_set[20];
+    QStack<QByteArray> listItemStack;
+    bool still_dd;
+    int tabstops[20];
+    int maxtstop;
+    int curpos;
+    bool break_the_while_loop;
+
+    QList<QByteArray> s_argumentList;
+
+    QByteArray cssPath, cssFile;
+
+    QByteArray s_dollarZero; // Value of $0
+
+    char outbuffer[NULL_TERMINATED(HUGE_STR_MAX)];
+    int obp;
+    int no_newline_output;
+    int newline_for_fun;
+    bool output_possible;
+
+    bool ignore_links;
+
+    QByteArray current_font;
+    int current_size;
+
+    /*
+     "fillout" is the mode of text output:
+     1 = fill mode (line breaks happen when the browser wants them. Normal HTML text)
+     0 = no-fill mode (preformatted text (<pre>..</pre>).
+         Input lines are output as-is, retaining line breaks and ignoring the current line length.
+    */
+    int fillout;
+
+    /* int asint; */
+    int intresult;
+
+    bool skip_escape;
+    bool single_escape;
+
+    char itemreset[20];
+
+    bool s_whileloop;
+
+    QStack<int> s_ifelseval;
+
+    // mdoc(7) stuff
+    bool mandoc_synopsis; /* True if we are in the synopsis section */
+    bool mandoc_command;  /* True if this is mdoc(7) page */
+    int mandoc_bd_options; /* Only copes with non-nested Bd's */
+    int function_argument; // Number of function argument (.Fo, .Fa, .Fc)
+
+    int contained_tab;
+    bool mandoc_line; // Signals whether to look for embedded mandoc commands.
+};
 
-static void fill_old_character_definitions(void);
+Man2HtmlPrivate::Man2HtmlPrivate(Man2Html *qq)
+  : q(qq),
+    s_nroff(1),
+    mandoc_name_count(0),
+    escapesym('\\'), nobreaksym('\''), controlsym('.'), fieldsym(0), padsym(0),
+    buffer(NULL), buffpos(0), buffmax(0),
+    scaninbuff(false),
+    itemdepth(0),
+    in_div(0),
+    still_dd(false),
+    maxtstop(12),
+    curpos(0),
+    break_the_while_loop(false),
+    obp(0),
+    no_newline_output(0),
+    newline_for_fun(0),
+    output_possible(false),
+    ignore_links(false),
+    current_size(0),
+    fillout(1),
+    intresult(0),
+    skip_escape(false),
+    single_escape(false),
+    s_whileloop(false),
+    mandoc_synopsis(false),
+    mandoc_command(false),
+    mandoc_bd_options(0),
+    function_argument(0),
+    contained_tab(0),
+    mandoc_line(false)
+{
+  for (int i = 0; i < 20; i++)
+  {
+    dl_set[i] = 0;
+    tabstops[i] = i < 12 ? (i + 1) * 8 : 0;
+  }
+  qstrcpy(itemreset, "\\fR\\s0");
+}
+
+Man2HtmlPrivate::~Man2HtmlPrivate()
+{
+  delete [] buffer;
+}
 
 /**
  * Initialize character variables
  */
-static void InitCharacterDefinitions(void)
+void Man2HtmlPrivate::InitCharacterDefinitions(void)
 {
   fill_old_character_definitions();
   // ### HACK: as we are converting to HTML too early, define characters with HTML references
@@ -258,7 +429,7 @@ static void InitCharacterDefinitions(void)
 /**
  * Initialize string variables
  */
-static void InitStringDefinitions(void)
+void Man2HtmlPrivate::InitStringDefinitions(void)
 {
   // mdoc-only, see mdoc.samples(7)
   s_stringDefinitionMap.insert("<=", StringDefinition(1, "&le;"));
@@ -299,7 +470,7 @@ static void InitStringDefinitions(void)
  * Initialize number registers
  * \note Internal read-only registers are not handled here
  */
-static void InitNumberDefinitions(void)
+void Man2HtmlPrivate::InitNumberDefinitions(void)
 {
   // As the date number registers are more for end-users, better choose local time.
   // Groff seems to support Gregorian dates only
@@ -643,43 +814,7 @@ static const StandardNames STANDARD_NAMES[] =
 /* default: print code */
 
 
-/* static char eqndelimopen=0, eqndelimclose=0; */
-static char escapesym = '\\', nobreaksym = '\'', controlsym = '.', fieldsym = 0, padsym = 0;
-
-static char *buffer = NULL;
-static int buffpos = 0, buffmax = 0;
-static bool scaninbuff = false;
-static int itemdepth = 0;
-static int in_div = 0;
-static int dl_set[20] = { 0 };
-static QStack<QByteArray> listItemStack;
-static bool still_dd = 0;
-static int tabstops[20] = { 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96 };
-static int maxtstop = 12;
-static int curpos = 0;
-static bool break_the_while_loop = false;
-
-static char *scan_troff(char *c, bool san, char **result);
-static char *scan_troff_mandoc(char *c, bool san, char **result);
-static int getNumberRegisterValue(const QByteArray &name, int sign = 0);
-
-static QList<QByteArray> s_argumentList;
-
-static QByteArray cssPath, cssFile;
-
-static QByteArray s_dollarZero; // Value of $0
-
-void setResourcePath(const QByteArray& _cssPath)
-{
-  cssPath = _cssPath;
-}
-
-void setCssFile(const QByteArray& _cssFile)
-{
-  cssFile = _cssFile;
-}
-
-static void fill_old_character_definitions(void)
+void Man2HtmlPrivate::fill_old_character_definitions(void)
 {
   for (size_t i = 0; i < sizeof(standardchar) / sizeof(CSTRDEF); i++)
   {
@@ -690,11 +825,6 @@ static void fill_old_character_definitions(void)
   }
 }
 
-static char outbuffer[NULL_TERMINATED(HUGE_STR_MAX)];
-static int no_newline_output = 0;
-static int newline_for_fun = 0;
-static bool output_possible = false;
-
 static const char * const includedirs[] =
 {
   "/usr/include",
@@ -708,9 +838,7 @@ static const char * const includedirs[] =
   0
 };
 
-static bool ignore_links = false;
-
-static void add_links(char *c)
+void Man2HtmlPrivate::add_links(char *c)
 {
   /*
   ** Add the links to the output.
@@ -1040,20 +1168,7 @@ static void add_links(char *c)
 
 //---------------------------------------------------------------------
 
-static QByteArray current_font;
-static int current_size = 0;
-
-/*
- "fillout" is the mode of text output:
- 1 = fill mode (line breaks happen when the browser wants them. Normal HTML text)
- 0 = no-fill mode (preformatted text (<pre>..</pre>).
-     Input lines are output as-is, retaining line breaks and ignoring the current line length.
-*/
-static int fillout = 1;
-
-//---------------------------------------------------------------------
-
-static void out_html(const char *c)
+void Man2HtmlPrivate::out_html(const char *c)
 {
   if ( !c || !*c ) return;
 
@@ -1061,8 +1176,6 @@ static void out_html(const char *c)
   char *c2 = qstrdup(c);
   char *c3 = c2;
 
-  static int obp = 0;
-
   if (no_newline_output)
   {
     int i = 0;
@@ -1111,7 +1224,7 @@ static void out_html(const char *c)
 
 //---------------------------------------------------------------------
 
-void checkListStack()  // see if we need to end a previously begun list item
+void Man2HtmlPrivate::checkListStack()  // see if we need to end a previously begun list item
 {
   if ( !listItemStack.isEmpty() && (listItemStack.size() == itemdepth) )
   {
@@ -1123,7 +1236,7 @@ void checkListStack()  // see if we need to end a previously begun list item
 
 //---------------------------------------------------------------------
 
-static QByteArray set_font(const QByteArray& name)
+QByteArray Man2HtmlPrivate::set_font(const QByteArray& name)
 {
   // Every font but R (Regular) creates <span> elements
   QByteArray markup;
@@ -1205,7 +1318,7 @@ static QByteArray set_font(const QByteArray& name)
 
 //---------------------------------------------------------------------
 
-static QByteArray change_to_size(int nr)
+QByteArray Man2HtmlPrivate::change_to_size(int nr)
 {
   switch (nr)
   {
@@ -1250,19 +1363,11 @@ static QByteArray change_to_size(int nr)
 
 //---------------------------------------------------------------------
 
-/* static int asint=0; */
-static int intresult = 0;
-
-static bool skip_escape = false;
-static bool single_escape = false;
-
-static char *scan_escape_direct(char *c, QByteArray& cstr);
-
 /**
  * scan a named character
  * param c position
  */
-static QByteArray scan_named_character(char*& c)
+QByteArray Man2HtmlPrivate::scan_named_character(char*& c)
 {
   QByteArray name;
   if (*c == '(')
@@ -1367,7 +1472,7 @@ static QByteArray scan_named_character(char*& c)
 
 //---------------------------------------------------------------------
 
-static QByteArray scan_named_string(char*& c)
+QByteArray Man2HtmlPrivate::scan_named_string(char*& c)
 {
   QByteArray name;
   if (*c == '(')
@@ -1448,7 +1553,7 @@ static QByteArray scan_named_string(char*& c)
 
 //---------------------------------------------------------------------
 
-static QByteArray scan_dollar_parameter(char*& c)
+QByteArray Man2HtmlPrivate::scan_dollar_parameter(char*& c)
 {
   int argno = 0; // No dollar argument number yet!
   if (*c == '0')
@@ -1543,7 +1648,7 @@ static QByteArray scan_dollar_parameter(char*& c)
 //---------------------------------------------------------------------
 /// return the value of read-only number registers
 
-static int read_only_number_register(const QByteArray& name)
+int Man2HtmlPrivate::read_only_number_register(const QByteArray& name)
 {
   // Internal read-only variables
   if (name == ".$")
@@ -1587,7 +1692,7 @@ static int read_only_number_register(const QByteArray& name)
 
 //---------------------------------------------------------------------
 
-static int getNumberRegisterValue(const QByteArray &name, int sign)
+int Man2HtmlPrivate::getNumberRegisterValue(const QByteArray &name, int sign)
 {
   if (name[0] == '.')
   {
@@ -1611,7 +1716,7 @@ static int getNumberRegisterValue(const QByteArray &name, int sign)
 //---------------------------------------------------------------------
 /// get the value of a number register and auto-increment if asked
 
-static int scan_number_register(char*& c)
+int Man2HtmlPrivate::scan_number_register(char*& c)
 {
   int sign = 0; // Sign for auto-increment (if any)
   switch (*c)
@@ -1687,7 +1792,7 @@ static int scan_number_register(char*& c)
 // [xxx] ... return xxx  (any chars)
 // after scanning, c points to the terminating char (0, \n or ])
 
-static QByteArray scan_name(char *&c)
+QByteArray Man2HtmlPrivate::scan_name(char *&c)
 {
   QByteArray name;
   if ( *c == '(' )
@@ -1710,7 +1815,7 @@ static QByteArray scan_name(char *&c)
 //---------------------------------------------------------------------
 /// get and set font
 
-static QByteArray scan_named_font(char*& c)
+QByteArray Man2HtmlPrivate::scan_named_font(char*& c)
 {
   QByteArray name;
   if (*c == '(')
@@ -1801,7 +1906,7 @@ static QByteArray scan_named_font(char*& c)
 
 //---------------------------------------------------------------------
 
-static QByteArray scan_number_code(char*& c)
+QByteArray Man2HtmlPrivate::scan_number_code(char*& c)
 {
   QByteArray number;
   if (*c != '\'')
@@ -1834,7 +1939,7 @@ static QByteArray scan_number_code(char*& c)
 // ### TODO known missing escapes from groff(7):
 // ### TODO \R
 
-static char *scan_escape_direct(char *c, QByteArray& cstr)
+char *Man2HtmlPrivate::scan_escape_direct(char *c, QByteArray& cstr)
 {
   bool exoutputp;
   bool exskipescape;
@@ -2115,7 +2220,7 @@ static char *scan_escape_direct(char *c, QByteArray& cstr)
 
 //---------------------------------------------------------------------
 
-static char *scan_escape(char *c)
+char *Man2HtmlPrivate::scan_escape(char *c)
 {
   QByteArray cstr;
   char* result = scan_escape_direct(c, cstr);
@@ -2249,10 +2354,10 @@ static const char * const tableopt[] = { "center", "expand", "box", "allbox",
                                        "doublebox", "tab", "linesize",
                                        "delim", NULL
                                        };
-static int tableoptl[] = { 6, 6, 3, 6, 9, 3, 8, 5, 0};
+static const int tableoptl[] = { 6, 6, 3, 6, 9, 3, 8, 5, 0};
 
 
-static void clear_table(TABLEROW *table)
+void Man2HtmlPrivate::clear_table(TABLEROW *table)
 {
   TABLEROW *tr1, *tr2;
 
@@ -2268,11 +2373,7 @@ static void clear_table(TABLEROW *table)
 
 //---------------------------------------------------------------------
 
-static char *scan_expression(char *c, int *result);
-
-//---------------------------------------------------------------------
-
-static char *scan_format(char *c, TABLEROW **result, int *maxcol)
+char *Man2HtmlPrivate::scan_format(char *c, TABLEROW **result, int *maxcol)
 {
   TABLEROW *layout, *currow;
   TABLEITEM *curfield;
@@ -2401,7 +2502,7 @@ static char *scan_format(char *c, TABLEROW **result, int *maxcol)
 
 //---------------------------------------------------------------------
 
-static TABLEROW *next_row(TABLEROW *tr)
+TABLEROW *Man2HtmlPrivate::next_row(TABLEROW *tr)
 {
   if (tr->next)
   {
@@ -2420,11 +2521,10 @@ static TABLEROW *next_row(TABLEROW *tr)
 
 //---------------------------------------------------------------------
 
-static char itemreset[20] = "\\fR\\s0";
 
 #define FORWARDCUR  do { curfield++; } while (currow->has(curfield) &&  currow->at(curfield).align=='S');
 
-static char *scan_table(char *c)
+char *Man2HtmlPrivate::scan_table(char *c)
 {
   char *h;
   char *g;
@@ -2772,7 +2872,7 @@ static char *scan_table(char *c)
 
 //---------------------------------------------------------------------
 
-static char *scan_expression(char *c, int *result, const unsigned int numLoop)
+char *Man2HtmlPrivate::scan_expression(char *c, int *result, const unsigned int numLoop)
 {
   int value = 0, value2, sign = 1, opex = 0;
   char oper = 'c';
@@ -2981,14 +3081,14 @@ static char *scan_expression(char *c, int *result, const unsigned int numLoop)
 
 //---------------------------------------------------------------------
 
-static char *scan_expression(char *c, int *result)
+char *Man2HtmlPrivate::scan_expression(char *c, int *result)
 {
   return scan_expression(c, result, 0);
 }
 
 //---------------------------------------------------------------------
 
-static void trans_char(char *c, char s, char t)
+void Man2HtmlPrivate::trans_char(char *c, char s, char t)
 {
   char *sl = c;
   int slash = 0;
@@ -3013,7 +3113,7 @@ static void trans_char(char *c, char s, char t)
 // (which is the char after the ending \n)
 // argPointers .. a list of pointers to the startchars of each arg pointing into the string given with c
 
-void getArguments(/* const */ char *&c, QList<QByteArray> &args, QList<char*> *argPointers = 0)
+void Man2HtmlPrivate::getArguments(/* const */ char *&c, QList<QByteArray> &args, QList<char*> *argPointers)
 {
   args.clear();
   if ( argPointers )
@@ -3329,7 +3429,7 @@ static const char *section_name(char *c)
   else return c;
 }
 
-static char *skip_till_newline(char *c)
+char *Man2HtmlPrivate::skip_till_newline(char *c)
 {
   int lvl = 0;
 
@@ -3358,10 +3458,8 @@ static char *skip_till_newline(char *c)
 
 //---------------------------------------------------------------------
 
-static bool s_whileloop = false;
-
 /// Processing the .while request
-static void request_while(char*& c, int j, bool mdoc)
+void Man2HtmlPrivate::request_while(char*& c, int j, bool mdoc)
 {
   // ### TODO: .continue
   kDebug(7107) << "Entering .while";
@@ -3418,7 +3516,7 @@ static void request_while(char*& c, int j, bool mdoc)
 //---------------------------------------------------------------------
 // Processing mixed fonts requests like .BI
 
-static void request_mixed_fonts(char*& c, int j, const char* font1, const char* font2, const bool mode, const bool inFMode)
+void Man2HtmlPrivate::request_mixed_fonts(char*& c, int j, const char* font1, const char* font2, const bool mode, const bool inFMode)
 {
   c += j;
   if (*c == '\n') c++;
@@ -3454,12 +3552,10 @@ static void request_mixed_fonts(char*& c, int j, const char* font1, const char*
 // &%(#@ c programs !!!
 //static int ifelseval=0;
 // If/else can be nested!
-static QStack<int> s_ifelseval;
-
 //---------------------------------------------------------------------
 
 // Process a (mdoc) request involving quotes
-static char* process_quote(char* c, int j, const char* open, const char* close)
+char* Man2HtmlPrivate::process_quote(char* c, int j, const char* open, const char* close)
 {
   trans_char(c, '"', '\a');
   c += j;
@@ -3480,7 +3576,7 @@ static char* process_quote(char* c, int j, const char* open, const char* close)
  * Is the char \p ch a puntuaction in sence of mdoc(7)
  */
 
-static bool is_mdoc_punctuation(const char ch)
+bool Man2HtmlPrivate::is_mdoc_punctuation(const char ch)
 {
   if ((ch >= '0' &&  ch <= '9') || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z'))
     return false;
@@ -3498,7 +3594,7 @@ static bool is_mdoc_punctuation(const char ch)
  * See info:/groff/Identifiers
  */
 
-static bool is_identifier_char(const char c)
+bool Man2HtmlPrivate::is_identifier_char(const char c)
 {
   if (c >= '!' && c <= '[')   // Include digits and upper case
     return true;
@@ -3511,7 +3607,7 @@ static bool is_identifier_char(const char c)
 
 //---------------------------------------------------------------------
 
-static QByteArray scan_identifier(char*& c)
+QByteArray Man2HtmlPrivate::scan_identifier(char*& c)
 {
   char* h = c; // help pointer
   // ### TODO Groff seems to eat nearly everything as identifier name (info:/groff/Identifiers)
@@ -3531,14 +3627,8 @@ static QByteArray scan_identifier(char*& c)
 
 //---------------------------------------------------------------------
 
-static char *scan_request(char *c)
+char *Man2HtmlPrivate::scan_request(char *c)
 {
-  // mdoc(7) stuff
-  static bool mandoc_synopsis = false; /* True if we are in the synopsis section */
-  static bool mandoc_command = false;  /* True if this is mdoc(7) page */
-  static int mandoc_bd_options; /* Only copes with non-nested Bd's */
-  static int function_argument = 0; // Number of function argument (.Fo, .Fa, .Fc)
-
   int i = 0;
   bool mode = false;
   char *h = 0;
@@ -5768,10 +5858,7 @@ static char *scan_request(char *c)
 
 //---------------------------------------------------------------------
 
-static int contained_tab = 0;
-static bool mandoc_line = false; // Signals whether to look for embedded mandoc commands.
-
-static char *scan_troff(char *c, bool san, char **result)
+char *Man2HtmlPrivate::scan_troff(char *c, bool san, char **result)
 {   /* san : stop at newline */
   QByteArray intbuff;
   intbuff.reserve(MED_STR_MAX);
@@ -5994,7 +6081,7 @@ static char *scan_troff(char *c, bool san, char **result)
 
 //---------------------------------------------------------------------
 
-static char *scan_troff_mandoc(char *c, bool san, char **result)
+char *Man2HtmlPrivate::scan_troff_mandoc(char *c, bool san, char **result)
 {
   char *ret;
   char *end = c;
@@ -6030,7 +6117,7 @@ static char *scan_troff_mandoc(char *c, bool san, char **result)
 //---------------------------------------------------------------------
 // Entry point
 
-void scan_man_page(const char *man_page)
+void Man2HtmlPrivate::scan_man_page(const char *man_page)
 {
   if (!man_page)
     return;
@@ -6147,6 +6234,72 @@ void scan_man_page(const char *man_page)
 
 //---------------------------------------------------------------------
 
+Man2Html::Man2Html()
+  : d(new Man2HtmlPrivate(this))
+{
+}
+
+Man2Html::~Man2Html()
+{
+  delete d;
+}
+
+void Man2Html::setResourcePath(const QByteArray& cssPath)
+{
+  d->cssPath = cssPath;
+}
+
+void Man2Html::setCssFile(const QByteArray& cssFile)
+{
+  d->cssFile = cssFile;
+}
+
+void Man2Html::scanManPage(const char *man_page)
+{
+  d->scan_man_page(man_page);
+}
+
+//---------------------------------------------------------------------
+
+namespace {
+/// The converter behind the functions, which calls output_real() and read_man_page()
+class GlobalMan2Html : public Man2Html
+{
+  protected:
+    virtual void output(const char *insert)
+    {
+      output_real(insert);
+    }
+    virtual char *readManPage(const char *filename)
+    {
+      return read_man_page(filename);
+    }
+};
+}
+
+static Man2Html *globalMan2Html()
+{
+  static GlobalMan2Html man2html;
+  return &man2html;
+}
+
+void scan_man_page(const char *man_page)
+{
+  globalMan2Html()->scanManPage(man_page);
+}
+
+void setResourcePath(const QByteArray& _cssPath)
+{
+  globalMan2Html()->setResourcePath(_cssPath);
+}
+
+void setCssFile(const QByteArray& _cssFile)
+{
+  globalMan2Html()->setCssFile(_cssFile);
+}
+
+//---------------------------------------------------------------------
+
 char *manPageToUtf8(const QByteArray &input, const QByteArray &dirName)
 {
   // as we do not know in which encoding the man source is, try to automatically
@@ -6258,7 +6411,7 @@ char *read_man_page(const char *filename)
 #ifndef KIO_MAN_TEST
 int main(int argc, char **argv)
 {
-  cssPath = "."; // krazy:exclude=doublequote_chars
+  setResourcePath("."); // krazy:exclude=doublequote_chars
   if (argc < 2)
   {
     std::cerr << "call: " << argv[0] << " <filename>\n";
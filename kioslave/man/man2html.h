@@ -9,7 +9,59 @@
 #ifndef MAN2HTML_H
 #define MAN2HTML_H
 
+#include <QtCore/QtGlobal>
+
 class QByteArray;
+class Man2HtmlPrivate;
+
+/**
+ * Converts man pages to HTML.
+ *
+ * Each instance has its own state, so different instances can convert
+ * pages in parallel threads. The functions below use a global instance.
+ */
+class Man2Html
+{
+  public:
+    Man2Html();
+    virtual ~Man2Html();
+
+    /**
+     * Set the paths to KDE resources
+     *
+     * \param cssPath Path to the KDE resources, encoded for CSS
+     */
+    void setResourcePath(const QByteArray& cssPath);
+
+    /**
+     * Sets the path to a CSS file that should be included with the generated
+     * HTML output.
+     *
+     * \param cssFile HTML-encoded path to the file to reference for stylesheets.
+     */
+    void setCssFile(const QByteArray& cssFile);
+
+    /**
+     * Converts the man page in the buffer, as returned by manPageToUtf8(),
+     * calling output() with the HTML
+     */
+    void scanManPage(const char *man_page);
+
+  protected:
+    /** Called with HTML contents */
+    virtual void output(const char *insert) = 0;
+
+    /**
+     * Called for requested man pages. filename can be a relative path!
+     * Return NULL on errors. The returned char array is freed by man2html
+     */
+    virtual char *readManPage(const char *filename) = 0;
+
+  private:
+    Q_DISABLE_COPY(Man2Html)
+    friend class Man2HtmlPrivate;
+    Man2HtmlPrivate * const d;
+};
 
 /**
   Try to detect the encoding of given man page content
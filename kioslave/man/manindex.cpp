@@ -0,0 +1,564 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "manindex.h"
+
+#include <QHash>
+#include <QPair>
+#include <QRegExp>
+#include <QTextStream>
+#include <QtAlgorithms>
+
+#include <kdebug.h>
+#include <kde_file.h>
+#include <KProcess>
+#include <ksavefile.h>
+#include <kstandarddirs.h>
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <time.h>
+
+#define INDEX_MAGIC 0x4b4d4958 // "KMIX"
+#define INDEX_VERSION 2
+
+/*
+ * The index file is a header, the stamps, the page records sorted by name
+ * and the strings they point to. The strings are UTF-8 and end with '\0',
+ * their offsets are from the start of the file.
+ */
+struct ManIndex::Header
+{
+    quint32 magic;
+    quint32 version;
+    qint64 buildTime;
+    quint32 rootCount;     ///< The first stamps are the directories the index covers
+    quint32 stampCount;
+    quint32 pageCount;
+    quint32 stringsOffset;
+};
+
+struct ManIndex::Stamp
+{
+    qint64 mtime;          ///< In nanoseconds, -1 if the path did not exist
+    quint32 path;
+    quint32 reserved;
+};
+
+struct ManIndex::Record
+{
+    quint32 name;
+    quint32 section;
+    quint32 path;
+    quint32 description;
+};
+
+namespace {
+
+/// Whatis descriptions of the pages with a given name, by section
+typedef QHash<QString, QList<QPair<QString, QString> > > WhatIs;
+
+struct PageEntry
+{
+    QString name;
+    QString section;
+    QString fileSection;
+    QString path;
+};
+
+bool pageLessThan(const PageEntry &p1, const PageEntry &p2)
+{
+    const QByteArray n1 = p1.name.toUtf8();
+    const QByteArray n2 = p2.name.toUtf8();
+    const int i = qstricmp(n1, n2);
+    if (i)
+        return i < 0;
+    return qstrcmp(n1, n2) < 0;
+}
+
+class StringPool
+{
+public:
+    StringPool(quint32 offset) : m_offset(offset) {}
+
+    quint32 add(const QString &string)
+    {
+        const QByteArray utf8 = string.toUtf8();
+        QHash<QByteArray, quint32>::const_iterator it = m_offsets.constFind(utf8);
+        if (it != m_offsets.constEnd())
+            return it.value();
+        const quint32 offset = m_offset + m_data.size();
+        m_data += utf8;
+        m_data += '\0';
+        m_offsets.insert(utf8, offset);
+        return offset;
+    }
+
+    const QByteArray &data() const { return m_data; }
+
+private:
+    quint32 m_offset;
+    QByteArray m_data;
+    QHash<QByteArray, quint32> m_offsets;
+};
+
+}
+
+/*
+ * Drop trailing ".section[.gz]" from name
+ */
+static
+void stripExtension( QString *name )
+{
+    int pos = name->length();
+
+    if ( name->indexOf(".gz", -3) != -1 )
+        pos -= 3;
+    else if ( name->indexOf(".z", -2, Qt::CaseInsensitive) != -1 )
+        pos -= 2;
+    else if ( name->indexOf(".bz2", -4) != -1 )
+        pos -= 4;
+    else if ( name->indexOf(".bz", -3) != -1 )
+        pos -= 3;
+    else if ( name->indexOf(".lzma", -5) != -1 )
+        pos -= 5;
+    else if ( name->indexOf(".xz", -3) != -1 )
+        pos -= 3;
+
+    if ( pos > 0 )
+        pos = name->lastIndexOf('.', pos-1);
+
+    if ( pos > 0 )
+        name->truncate( pos );
+}
+
+static qint64 modificationTime(const QString &path)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0)
+        return -1;
+    // Seconds would miss a change within the second the index was built in
+#ifdef Q_OS_MAC
+    return qint64(buff.st_mtime) * 1000000000 + buff.st_mtimespec.tv_nsec;
+#else
+    return qint64(buff.st_mtime) * 1000000000 + buff.st_mtim.tv_nsec;
+#endif
+}
+
+typedef QList<QPair<QString, qint64> > Stamps;
+
+/*
+ * Remembers the modification time of path, before it is read
+ */
+static void addStamp(Stamps &stamps, const QString &path)
+{
+    stamps += qMakePair(path, modificationTime(path));
+}
+
+static void parseWhatIs(WhatIs &whatis, QTextStream &t)
+{
+    QRegExp re("\\s+\\(([^)]+)\\)\\s+-\\s+");
+    QString l;
+    while ( !t.atEnd() )
+    {
+        l = t.readLine();
+        int pos = re.indexIn( l );
+        if (pos != -1)
+        {
+            const QString section = re.cap(1);
+            QString names = l.left(pos);
+            const QString descr = l.mid(pos + re.matchedLength());
+            while ((pos = names.indexOf(",")) != -1)
+            {
+                whatis[names.left(pos++)].append(qMakePair(section, descr));
+                while (names[pos] == ' ')
+                    pos++;
+                names = names.mid(pos);
+            }
+            whatis[names].append(qMakePair(section, descr));
+        }
+    }
+}
+
+static QString description(const WhatIs &whatis, const PageEntry &page)
+{
+    const QList<QPair<QString, QString> > entries = whatis.value(page.name);
+    // The file name is more precise, e.g. "3pm" for perl modules in man3
+    for (int i = 0; i < entries.count(); ++i) {
+        if (entries.at(i).first == page.fileSection)
+            return entries.at(i).second;
+    }
+    for (int i = 0; i < entries.count(); ++i) {
+        if (entries.at(i).first.startsWith(page.section, Qt::CaseInsensitive))
+            return entries.at(i).second;
+    }
+    return QString();
+}
+
+/*
+ * The sections matched by section, as in "man 3 printf", which also
+ * looks in 3p and such
+ */
+static QStringList sectionList(const QString &section)
+{
+    QStringList list;
+    if (section.isEmpty() || section == "*")
+        return list;
+    QString s = section.toLower();
+    list += s;
+    while (!s.isEmpty() && s.at(s.length() - 1).isLetter()) {
+        s.truncate(s.length() - 1);
+        list += s;
+    }
+    return list;
+}
+
+ManIndex::ManIndex()
+    : m_indexPath(KStandardDirs::locateLocal("cache", "kio_man/index")),
+      m_begin(0),
+      m_size(0)
+{
+}
+
+ManIndex::~ManIndex()
+{
+}
+
+void ManIndex::update(const QStringList &manDirs, const QStringList &whatisDirs)
+{
+    const QStringList roots = manDirs + whatisDirs;
+    if (m_begin && isCurrent(roots))
+        return;
+
+    // Perhaps another kio_man has built it meanwhile
+    m_begin = 0;
+    m_file.close();
+    m_data.clear();
+    if (mapFile(roots))
+        return;
+
+    kDebug(7107) << "building the index of" << roots;
+    m_data = build(manDirs, whatisDirs);
+
+    KSaveFile file(m_indexPath);
+    if (file.open() && file.write(m_data) == m_data.size() && file.finalize() && mapFile(roots)) {
+        m_data.clear();
+        return;
+    }
+    kWarning(7107) << "could not save the index to" << m_indexPath;
+    attach(m_data.constData(), m_data.size());
+}
+
+bool ManIndex::mapFile(const QStringList &roots)
+{
+    m_file.setFileName(m_indexPath);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar *map = m_file.map(0, m_file.size());
+    if (map && attach(reinterpret_cast<const char *>(map), m_file.size()) && isCurrent(roots))
+        return true;
+    m_begin = 0;
+    m_file.close();
+    return false;
+}
+
+bool ManIndex::attach(const char *begin, qint64 size)
+{
+    m_begin = 0;
+    if (size < qint64(sizeof(Header)))
+        return false;
+    const Header *h = reinterpret_cast<const Header *>(begin);
+    const qint64 stringsOffset = sizeof(Header) + qint64(h->stampCount) * sizeof(Stamp)
+                                 + qint64(h->pageCount) * sizeof(Record);
+    if (h->magic != INDEX_MAGIC || h->version != INDEX_VERSION || h->rootCount > h->stampCount
+        || h->stringsOffset != stringsOffset || stringsOffset >= size || begin[size - 1] != '\0')
+        return false;
+
+    // A damaged file must not make us read outside of it
+    const Stamp *s = reinterpret_cast<const Stamp *>(begin + sizeof(Header));
+    for (quint32 i = 0; i < h->stampCount; ++i) {
+        if (s[i].path < stringsOffset || s[i].path >= size)
+            return false;
+    }
+    const Record *r = reinterpret_cast<const Record *>(s + h->stampCount);
+    for (quint32 i = 0; i < h->pageCount; ++i) {
+        if (r[i].name < stringsOffset || r[i].name >= size
+            || r[i].section < stringsOffset || r[i].section >= size
+            || r[i].path < stringsOffset || r[i].path >= size
+            || r[i].description < stringsOffset || r[i].description >= size)
+            return false;
+    }
+
+    m_begin = begin;
+    m_size = size;
+    return true;
+}
+
+bool ManIndex::isCurrent(const QStringList &roots) const
+{
+    const Header *h = header();
+    if (h->rootCount != quint32(roots.count()))
+        return false;
+    const Stamp *s = stamps();
+    for (quint32 i = 0; i < h->rootCount; ++i) {
+        if (QString::fromUtf8(string(s[i].path)) != roots.at(i))
+            return false;
+    }
+    for (quint32 i = 0; i < h->stampCount; ++i) {
+        if (modificationTime(QString::fromUtf8(string(s[i].path))) != s[i].mtime)
+            return false;
+    }
+    return true;
+}
+
+QByteArray ManIndex::build(const QStringList &manDirs, const QStringList &whatisDirs) const
+{
+    const qint64 buildTime = ::time(0);
+    // Taken before reading, so that changes made meanwhile are found later
+    Stamps stamps;
+    foreach (const QString &root, manDirs + whatisDirs)
+        addStamp(stamps, root);
+    QList<PageEntry> pages;
+
+    //
+    // Sections = all sub directories "man*" and "sman*"
+    //
+    foreach (const QString &manDir, manDirs) {
+        DIR *dp = ::opendir( QFile::encodeName( manDir ) );
+        if ( !dp )
+            continue;
+
+        struct dirent *ep;
+        while ( (ep = ::readdir( dp )) != 0L ) {
+            const QString file = QFile::decodeName( ep->d_name );
+            PageEntry page;
+            if ( file.startsWith( "man" ) )
+                page.section = file.mid(3);
+            else if ( file.startsWith( "sman" ) )
+                page.section = file.mid(4);
+            else
+                continue;
+
+            const QString dir = manDir + '/' + file;
+            addStamp(stamps, dir);
+            DIR *sdp = ::opendir( QFile::encodeName( dir ) );
+            if ( !sdp )
+                continue;
+
+            struct dirent *sep;
+            while ( (sep = ::readdir( sdp )) != 0L ) {
+                if ( sep->d_name[0] == '.' )
+                    continue;
+                page.name = QFile::decodeName( sep->d_name );
+                page.path = dir + '/' + page.name;
+                stripExtension( &page.name );
+                // "ls.1.gz" is in section "1"
+                page.fileSection = QFile::decodeName( sep->d_name ).mid( page.name.length() + 1 ).section( '.', 0, 0 );
+                if ( !page.name.isEmpty() )
+                    pages += page;
+            }
+            ::closedir( sdp );
+        }
+        ::closedir( dp );
+    }
+
+    // The same page in several directories keeps the order of the directories
+    qStableSort(pages.begin(), pages.end(), pageLessThan);
+
+    //
+    // Descriptions, from the whatis databases
+    //
+    WhatIs whatis;
+    QStringList whatisPaths = manDirs;
+    foreach (const QString &dir, whatisDirs) {
+        if (!whatisPaths.contains(dir))
+            whatisPaths += dir;
+    }
+    const QStringList names = QStringList() << "whatis.db" << "whatis";
+    foreach (const QString &dir, whatisPaths) {
+        if ( !QFile::exists( dir ) )
+            continue;
+        bool found = false;
+        foreach (const QString &name, names) {
+            // Also when it is missing, so that the index is updated when it appears
+            QFile f(dir + '/' + name);
+            addStamp(stamps, f.fileName());
+            if (f.open(QIODevice::ReadOnly)) {
+                QTextStream t(&f);
+                parseWhatIs(whatis, t);
+                found = true;
+                break;
+            }
+        }
+        if ( !found ) {
+            KProcess proc;
+            proc << "whatis" << "-M" << dir << "-w" << "*";
+            proc.setOutputChannelMode( KProcess::OnlyStdoutChannel );
+            proc.execute();
+            QTextStream t( proc.readAllStandardOutput(), QIODevice::ReadOnly );
+            parseWhatIs(whatis, t);
+        }
+    }
+
+    //
+    // Write it all down
+    //
+    Header h;
+    h.magic = INDEX_MAGIC;
+    h.version = INDEX_VERSION;
+    h.buildTime = buildTime;
+    h.rootCount = manDirs.count() + whatisDirs.count();
+    h.stampCount = stamps.count();
+    h.pageCount = pages.count();
+    h.stringsOffset = sizeof(Header) + h.stampCount * sizeof(Stamp) + h.pageCount * sizeof(Record);
+
+    StringPool strings(h.stringsOffset);
+    QByteArray data;
+    data.reserve(h.stringsOffset);
+    data.append(reinterpret_cast<const char *>(&h), sizeof(h));
+    for (int i = 0; i < stamps.count(); ++i) {
+        Stamp s;
+        s.mtime = stamps.at(i).second;
+        s.path = strings.add(stamps.at(i).first);
+        s.reserved = 0;
+        data.append(reinterpret_cast<const char *>(&s), sizeof(s));
+    }
+    foreach (const PageEntry &page, pages) {
+        Record r;
+        r.name = strings.add(page.name);
+        r.section = strings.add(page.section);
+        r.path = strings.add(page.path);
+        r.description = strings.add(description(whatis, page));
+        data.append(reinterpret_cast<const char *>(&r), sizeof(r));
+    }
+    data += strings.data();
+    kDebug(7107) << pages.count() << "pages," << data.size() << "bytes";
+    return data;
+}
+
+const ManIndex::Header *ManIndex::header() const
+{
+    return reinterpret_cast<const Header *>(m_begin);
+}
+
+const ManIndex::Stamp *ManIndex::stamps() const
+{
+    return reinterpret_cast<const Stamp *>(m_begin + sizeof(Header));
+}
+
+const ManIndex::Record *ManIndex::records() const
+{
+    return reinterpret_cast<const Record *>(stamps() + header()->stampCount);
+}
+
+const char *ManIndex::string(quint32 offset) const
+{
+    return m_begin + offset;
+}
+
+const ManIndex::Record *ManIndex::lowerBound(const QByteArray &name) const
+{
+    const Record *first = records();
+    quint32 count = header()->pageCount;
+    while (count > 0) {
+        const quint32 half = count / 2;
+        const Record *middle = first + half;
+        if (qstricmp(string(middle->name), name) < 0) {
+            first = middle + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+ManIndex::Page ManIndex::page(const Record *record) const
+{
+    Page p;
+    p.name = QString::fromUtf8(string(record->name));
+    p.section = QString::fromUtf8(string(record->section));
+    p.path = QString::fromUtf8(string(record->path));
+    p.description = QString::fromUtf8(string(record->description));
+    return p;
+}
+
+static bool matches(const QStringList &sections, const char *section)
+{
+    return sections.isEmpty() || sections.contains(QString::fromUtf8(section).toLower());
+}
+
+QList<ManIndex::Page> ManIndex::pages(const QString &section, const QString &name) const
+{
+    QList<Page> list;
+    if (!m_begin)
+        return list;
+
+    const QStringList sections = sectionList(section);
+    const QByteArray key = name.toUtf8();
+    const Record *end = records() + header()->pageCount;
+    const Record *r = key.isEmpty() ? records() : lowerBound(key);
+    for (; r != end; ++r) {
+        if (!key.isEmpty()) {
+            const char *n = string(r->name);
+            if (qstricmp(n, key) != 0)
+                break;
+            if (qstrcmp(n, key) != 0)
+                continue;
+        }
+        if (matches(sections, string(r->section)))
+            list += page(r);
+    }
+    if (key.isEmpty())
+        return list;
+
+    // Like "man -a": the sections in the order they were asked for, otherwise
+    // in the order they are found, and each of them in the order of the man
+    // directories, which the index keeps
+    QStringList order = sections;
+    foreach (const Page &p, list) {
+        if (!order.contains(p.section.toLower()))
+            order += p.section.toLower();
+    }
+    QList<Page> sorted;
+    foreach (const QString &s, order) {
+        foreach (const Page &p, list) {
+            if (p.section.toLower() == s)
+                sorted += p;
+        }
+    }
+    return sorted;
+}
+
+QList<ManIndex::Page> ManIndex::pagesWithPrefix(const QString &section, const QString &prefix) const
+{
+    QList<Page> list;
+    if (!m_begin)
+        return list;
+
+    const QStringList sections = sectionList(section);
+    const QByteArray key = prefix.toUtf8();
+    const Record *end = records() + header()->pageCount;
+    for (const Record *r = lowerBound(key); r != end; ++r) {
+        if (qstrnicmp(string(r->name), key, key.length()) != 0)
+            break;
+        if (matches(sections, string(r->section)))
+            list += page(r);
+    }
+    return list;
+}
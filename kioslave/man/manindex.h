@@ -0,0 +1,89 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+#ifndef __manindex_h__
+#define __manindex_h__
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/**
+ * An index of all man pages, with their section and whatis description.
+ *
+ * The index is a table sorted by page name, kept in the cache directory
+ * and memory mapped. It remembers the modification times of the man
+ * directories, their section directories and the whatis databases, and
+ * is built again when one of them changed or a whatis database appeared.
+ */
+class ManIndex
+{
+public:
+    struct Page
+    {
+        QString name;        ///< Name of the page, e.g. "ls"
+        QString section;     ///< Section of the directory it is in, e.g. "1"
+        QString path;        ///< Full path of the page file
+        QString description; ///< Description from the whatis database, may be empty
+    };
+
+    ManIndex();
+    ~ManIndex();
+
+    /**
+     * Makes the index cover the man directories @p manDirs. The whatis
+     * databases are looked for in these and in @p whatisDirs.
+     */
+    void update(const QStringList &manDirs, const QStringList &whatisDirs);
+
+    /**
+     * Returns the pages named @p name, sorted by section, or all pages if
+     * @p name is empty, sorted by name. @p section also matches the sections
+     * it is a subsection of, which come after it, and an empty section
+     * matches all of them, like "man -a" does.
+     */
+    QList<Page> pages(const QString &section, const QString &name = QString()) const;
+    /// Returns the pages in @p section whose name starts with @p prefix, ignoring case
+    QList<Page> pagesWithPrefix(const QString &section, const QString &prefix) const;
+
+private:
+    struct Header;
+    struct Stamp;
+    struct Record;
+
+    bool mapFile(const QStringList &roots);
+    bool attach(const char *begin, qint64 size);
+    bool isCurrent(const QStringList &roots) const;
+    QByteArray build(const QStringList &manDirs, const QStringList &whatisDirs) const;
+
+    const Header *header() const;
+    const Stamp *stamps() const;
+    const Record *records() const;
+    const char *string(quint32 offset) const;
+    const Record *lowerBound(const QByteArray &name) const;
+    Page page(const Record *record) const;
+
+    QString m_indexPath;
+    QFile m_file;          ///< The mapped index file
+    QByteArray m_data;     ///< The index, if it could not be saved
+    const char *m_begin;   ///< Start of the index, in m_file or m_data
+    qint64 m_size;
+};
+
+#endif
@@ -0,0 +1,166 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "manpagecache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+#include <kdebug.h>
+#include <kde_file.h>
+#include <kdeversion.h>
+#include <kstandarddirs.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+ManPageCache::ManPageCache(const QByteArray &cssPath, const QByteArray &cssFile)
+    : m_cacheDir(KStandardDirs::locateLocal("cache", "kio_man/")),
+      // The footer of the pages has the version
+      m_config(cssPath + '\n' + cssFile + '\n' + KDE_VERSION_STRING)
+{
+}
+
+/*
+ * Returns a line with the modification time, size and path of the file at
+ * path, or an empty array if it does not exist
+ */
+static QByteArray fileKey(const QString &path)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0)
+        return QByteArray();
+    return QByteArray::number(qlonglong(buff.st_mtime)) + ' ' + QByteArray::number(qlonglong(buff.st_size))
+           + ' ' + QFile::encodeName(path) + '\n';
+}
+
+/*
+ * Returns the lines of fileKey() for the included files, a missing one is
+ * listed with just its path
+ */
+static QByteArray includesKey(const QStringList &includes)
+{
+    QByteArray key;
+    foreach (const QString &include, includes) {
+        const QByteArray line = fileKey(include);
+        key += line.isEmpty() ? "- - " + QFile::encodeName(include) + '\n' : line;
+    }
+    return key + '\n';
+}
+
+QString ManPageCache::entryPath(const QString &path) const
+{
+    const QByteArray key = fileKey(path);
+    if (key.isEmpty())
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(key);
+    hash.addData(m_config);
+    return m_cacheDir + QString::fromLatin1(hash.result().toHex()) + QLatin1String(".html.z");
+}
+
+/*
+ * Opens the entry of the man page at path and reads the list of included
+ * files. Returns false unless they are all as they were when it was written.
+ */
+bool ManPageCache::openEntry(const QString &path, QFile &file) const
+{
+    const QString entry = entryPath(path);
+    if (entry.isEmpty())
+        return false;
+    file.setFileName(entry);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray stored;
+    QStringList includes;
+    forever {
+        const QByteArray line = file.readLine();
+        if (line.isEmpty() || !line.endsWith('\n'))
+            return false;
+        stored += line;
+        if (line == "\n")
+            break;
+        // The path follows the modification time and the size
+        const int pos = line.indexOf(' ', line.indexOf(' ') + 1);
+        if (pos < 0)
+            return false;
+        includes.append(QFile::decodeName(line.mid(pos + 1, line.length() - pos - 2)));
+    }
+    return includesKey(includes) == stored;
+}
+
+bool ManPageCache::contains(const QString &path) const
+{
+    QFile file;
+    return openEntry(path, file);
+}
+
+bool ManPageCache::read(const QString &path, QByteArray &html) const
+{
+    QFile file;
+    if (!openEntry(path, file))
+        return false;
+    html = qUncompress(file.readAll());
+    if (html.isEmpty())
+        return false;
+    // The modification time tells prune() when the entry was used
+    ::utime(QFile::encodeName(file.fileName()), 0);
+    return true;
+}
+
+void ManPageCache::write(const QString &path, const QByteArray &html, const QStringList &includes) const
+{
+    const QString entry = entryPath(path);
+    if (entry.isEmpty() || html.isEmpty())
+        return;
+
+    // Several threads or slaves may render the same page
+    const QString tempPath = entry + QString::fromLatin1(".%1.%2")
+                             .arg(::getpid()).arg(quintptr(QThread::currentThreadId()));
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        kWarning(7107) << "Could not write" << tempPath;
+        return;
+    }
+    const QByteArray data = includesKey(includes) + qCompress(html);
+    if (file.write(data) != data.size()) {
+        file.remove();
+        return;
+    }
+    file.close();
+    if (KDE::rename(tempPath, entry) != 0)
+        QFile::remove(tempPath);
+}
+
+void ManPageCache::prune(qint64 maximumSize) const
+{
+    // Newest first
+    const QFileInfoList entries = QDir(m_cacheDir).entryInfoList(QStringList() << "*.html.z", QDir::Files, QDir::Time);
+    qint64 size = 0;
+    foreach (const QFileInfo &info, entries) {
+        size += info.size();
+        if (size > maximumSize)
+            QFile::remove(info.filePath());
+    }
+}
@@ -0,0 +1,59 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+#ifndef __manpagecache_h__
+#define __manpagecache_h__
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+class QFile;
+
+/**
+ * A cache of the HTML rendered for man pages.
+ *
+ * The entries are files in the cache directory, named after a hash of the
+ * path of the man page, its modification time and size, and the style
+ * sheets linked by the HTML. Each entry starts with the same for the files
+ * included by the page with .so, which have to match as well. So changed
+ * pages are simply rendered again. All methods may be called from any thread.
+ */
+class ManPageCache
+{
+public:
+    ManPageCache(const QByteArray &cssPath, const QByteArray &cssFile);
+
+    /// Returns true if there is an entry for the man page at @p path
+    bool contains(const QString &path) const;
+    /// Reads the HTML of the man page at @p path, returns false if it is not cached
+    bool read(const QString &path, QByteArray &html) const;
+    /// Stores the HTML of the man page at @p path, which has included the files @p includes
+    void write(const QString &path, const QByteArray &html, const QStringList &includes) const;
+
+    /// Removes the least recently used entries until the cache is below @p maximumSize bytes
+    void prune(qint64 maximumSize) const;
+
+private:
+    QString entryPath(const QString &path) const;
+    bool openEntry(const QString &path, QFile &file) const;
+
+    QString m_cacheDir;
+    QByteArray m_config;
+};
+
+#endif
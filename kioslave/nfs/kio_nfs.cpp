@@ -30,6 +30,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include <time.h>
 #include <unistd.h>
 
 #include <QFile>
@@ -44,6 +45,9 @@
 #include "nfsv2.h"
 #include "nfsv3.h"
 
+// The number of file handles to keep in the cache
+#define DEFAULT_MAX_CACHED_HANDLES 10000
+
 using namespace KIO;
 using namespace std;
 
@@ -480,7 +484,13 @@ void NFSFileHandle::setLinkSource(const nfs_fh& src)
 NFSProtocol::NFSProtocol(NFSSlave* slave)
     : m_slave(slave)
 {
+    m_handleCache.setMaxCost(m_slave->config()->readEntry("MaxCachedHandles", DEFAULT_MAX_CACHED_HANDLES));
 
+    // Same defaults as the NFS client in the kernel
+    m_acregmin = m_slave->config()->readEntry("AttributeCacheMinTimeout", 3);
+    m_acregmax = qMax(m_acregmin, m_slave->config()->readEntry("AttributeCacheMaxTimeout", 60));
+    m_acdirmin = m_slave->config()->readEntry("DirAttributeCacheMinTimeout", 30);
+    m_acdirmax = qMax(m_acdirmin, m_slave->config()->readEntry("DirAttributeCacheMaxTimeout", 60));
 }
 
 void NFSProtocol::copy(const KUrl& src, const KUrl& dest, int mode, KIO::JobFlags flags)
@@ -497,6 +507,14 @@ void NFSProtocol::copy(const KUrl& src, const KUrl& dest, int mode, KIO::JobFlag
 void NFSProtocol::addExportedDir(const QString& path)
 {
     m_exportedDirs.append(path);
+
+    // The handles of the exported dirs can't be looked up again, keep them out
+    // of the reach of the cache.
+    CacheEntry* cached = m_handleCache.object(path);
+    if (cached != 0) {
+        m_exportedHandles.insert(path, cached->handle);
+        m_handleCache.remove(path);
+    }
 }
 
 const QStringList& NFSProtocol::getExportedDirs()
@@ -528,11 +546,20 @@ bool NFSProtocol::isExportedDir(const QString& path)
 void NFSProtocol::removeExportedDir(const QString& path)
 {
     m_exportedDirs.removeOne(path);
+    m_exportedHandles.remove(path);
 }
 
 void NFSProtocol::addFileHandle(const QString& path, NFSFileHandle fh)
 {
-    m_handleCache.insert(path, fh);
+    if (m_exportedHandles.contains(path)) {
+        m_exportedHandles.insert(path, fh);
+        return;
+    }
+
+    CacheEntry* cached = new CacheEntry;
+    cached->handle = fh;
+    cached->attributesExpire = 0;
+    m_handleCache.insert(path, cached);
 }
 
 NFSFileHandle NFSProtocol::getFileHandle(const QString& path)
@@ -548,8 +575,14 @@ NFSFileHandle NFSProtocol::getFileHandle(const QString& path)
 
     // The handle may already be in the cache, check it now.
     // The exported dirs are always in the cache.
-    if (m_handleCache.contains(path)) {
-        return m_handleCache[path];
+    NFSFileHandleMap::const_iterator it = m_exportedHandles.constFind(path);
+    if (it != m_exportedHandles.constEnd()) {
+        return it.value();
+    }
+
+    const CacheEntry* cached = m_handleCache.object(path);
+    if (cached != 0) {
+        return cached->handle;
     }
 
     // Loop detected, abort.
@@ -560,7 +593,7 @@ NFSFileHandle NFSProtocol::getFileHandle(const QString& path)
     // Look up the file handle from the procotol
     NFSFileHandle childFH = lookupFileHandle(path);
     if (!childFH.isInvalid()) {
-        m_handleCache.insert(path, childFH);
+        addFileHandle(path, childFH);
     }
 
     return childFH;
@@ -571,6 +604,63 @@ void NFSProtocol::removeFileHandle(const QString& path)
     m_handleCache.remove(path);
 }
 
+void NFSProtocol::addFileAttributes(const QString& path, const KIO::UDSEntry& entry)
+{
+    CacheEntry* cached = m_handleCache.object(path);
+    if (cached == 0) {
+        return;
+    }
+
+    int minTimeout = m_acregmin;
+    int maxTimeout = m_acregmax;
+    if (entry.isDir()) {
+        minTimeout = m_acdirmin;
+        maxTimeout = m_acdirmax;
+    }
+
+    // Files which have not been modified for a while are not likely to be
+    // modified soon, so their attributes are kept longer.
+    const time_t now = time(0);
+    const time_t mtime = entry.numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, now);
+    const int timeout = qBound<time_t>(minTimeout, (now - mtime) / 10, maxTimeout);
+
+    cached->attributes = entry;
+    cached->attributesExpire = now + timeout;
+}
+
+bool NFSProtocol::getFileAttributes(const QString& path, KIO::UDSEntry& entry)
+{
+    CacheEntry* cached = m_handleCache.object(path);
+    if (cached == 0 || cached->attributesExpire == 0) {
+        return false;
+    }
+
+    if (time(0) >= cached->attributesExpire) {
+        cached->attributes.clear();
+        cached->attributesExpire = 0;
+        return false;
+    }
+
+    entry = cached->attributes;
+    return true;
+}
+
+void NFSProtocol::invalidateFileAttributes(const QString& path)
+{
+    CacheEntry* cached = m_handleCache.object(path);
+    if (cached != 0) {
+        cached->attributes.clear();
+        cached->attributesExpire = 0;
+    }
+
+    // The modification time of the parent dir changes as well
+    cached = m_handleCache.object(QFileInfo(path).path());
+    if (cached != 0) {
+        cached->attributes.clear();
+        cached->attributesExpire = 0;
+    }
+}
+
 bool NFSProtocol::isValidPath(const QString& path)
 {
     if (path.isEmpty() || path == QDir::separator()) {
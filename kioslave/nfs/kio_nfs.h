@@ -25,6 +25,7 @@
 #include <kio/global.h>
 #include <kconfiggroup.h>
 
+#include <QtCore/QCache>
 #include <QtCore/QHash>
 #include <QtCore/QMap>
 #include <QtCore/QString>
@@ -188,6 +189,14 @@ protected:
     NFSFileHandle getFileHandle(const QString& path);
     void removeFileHandle(const QString& path);
 
+    // Attribute cache functions. The attributes are stored along with the file
+    // handle and expire like the attribute cache of the NFS client in the kernel,
+    // see the acregmin, acregmax, acdirmin and acdirmax mount options.
+    void addFileAttributes(const QString& path, const KIO::UDSEntry& entry);
+    bool getFileAttributes(const QString& path, KIO::UDSEntry& entry);
+    // Drops the cached attributes of @p path and of its parent directory.
+    void invalidateFileAttributes(const QString& path);
+
     // Make sure that the path is actually a part of an nfs share.
     bool isValidPath(const QString& path);
     bool isValidLink(const QString& parentDir, const QString& linkDest);
@@ -199,10 +208,26 @@ protected:
     void createVirtualDirEntry(KIO::UDSEntry& entry);
 
 private:
+    struct CacheEntry {
+        NFSFileHandle handle;
+        KIO::UDSEntry attributes;
+        // The attributes are only valid until then, 0 if there are none
+        time_t attributesExpire;
+    };
+
     NFSSlave* m_slave;
 
-    NFSFileHandleMap m_handleCache;
+    // The least recently used handles are dropped when the cache is full,
+    // except for the handles of the exported dirs.
+    QCache<QString, CacheEntry> m_handleCache;
+    NFSFileHandleMap m_exportedHandles;
     QStringList m_exportedDirs;
+
+    // The attribute cache timeouts for files and directories, in seconds
+    int m_acregmin;
+    int m_acregmax;
+    int m_acdirmin;
+    int m_acdirmax;
 };
 
 #endif
@@ -53,11 +53,21 @@
 #include <kio/ioslave_defaults.h>
 
 #include "nfsv3.h"
+#include "rpcpipeline.h"
 
 // This ioslave is for NFS version 3.
 #define NFSPROG 100003UL
 #define NFSVERS 3UL
 
+// The default number of READ or WRITE calls in flight during a transfer
+#define DEFAULT_RPC_QUEUE_DEPTH 8
+#define MAX_RPC_QUEUE_DEPTH 64
+
+// The default amount of data in MiB after which UNSTABLE writes are committed.
+// The data is kept in memory until then, so the setting is limited.
+#define DEFAULT_COMMIT_INTERVAL 16
+#define MAX_COMMIT_INTERVAL 256
+
 #define NFS3_MAXDATA    32768
 #define NFS3_MAXPATHLEN PATH_MAX
 
@@ -454,6 +464,10 @@ void NFSProtocolV3::listDir(const KUrl& url)
                 completeUDSEntry(entry, dirEntry->name_attributes.post_op_attr_u.attributes);
             }
 
+            // READDIRPLUS returns the attributes anyway, so a stat right after
+            // listing the dir doesn't need to ask the server again.
+            addFileAttributes(filePath, entry);
+
             m_slave->listEntry(entry, false);
 
             lastEntry = dirEntry;
@@ -621,6 +635,8 @@ void NFSProtocolV3::listDirCompat(const KUrl& url)
             completeUDSEntry(entry, dirres.LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes);
         }
 
+        addFileAttributes(filePath, entry);
+
         m_slave->listEntry(entry, false);
     }
 
@@ -653,6 +669,13 @@ void NFSProtocolV3::stat(const KUrl& url)
         return;
     }
 
+    KIO::UDSEntry cachedEntry;
+    if (getFileAttributes(path, cachedEntry)) {
+        m_slave->statEntry(cachedEntry);
+        m_slave->finished();
+        return;
+    }
+
     int rpcStatus;
     GETATTR3res attrAndStat;
     if (!getAttr(path, rpcStatus, attrAndStat)) {
@@ -713,6 +736,8 @@ void NFSProtocolV3::stat(const KUrl& url)
         completeUDSEntry(entry, attrAndStat.GETATTR3res_u.resok.obj_attributes);
     }
 
+    addFileAttributes(path, entry);
+
     m_slave->statEntry(entry);
     m_slave->finished();
 }
@@ -779,6 +804,8 @@ void NFSProtocolV3::mkdir(const KUrl& url, int permissions)
         return;
     }
 
+    invalidateFileAttributes(path);
+
     m_slave->finished();
 }
 
@@ -845,6 +872,15 @@ void NFSProtocolV3::get(const KUrl& url)
         initPreferredSizes(fh);
     }
 
+    if (rpcQueueDepth() > 1) {
+        RPCPipeline pipeline(m_nfsClient, m_nfsSock, NFSPROG, NFSVERS, clnt_timeout, m_readBufferSize);
+        if (pipeline.isValid()) {
+            getPipelined(pipeline, url, fh);
+            finishPipeline(pipeline);
+            return;
+        }
+    }
+
     READ3args readArgs;
     memset(&readArgs, 0, sizeof(readArgs));
     fh.toFH(readArgs.file);
@@ -955,6 +991,20 @@ void NFSProtocolV3::put(const KUrl& url, int _mode, KIO::JobFlags flags)
     // We created the file successfully.
     destFH = createRes.CREATE3res_u.resok.obj.post_op_fh3_u.handle;
 
+    UnstableWrites unstable;
+    initUnstableWrites(unstable);
+
+    if (rpcQueueDepth() > 1) {
+        RPCPipeline pipeline(m_nfsClient, m_nfsSock, NFSPROG, NFSVERS, clnt_timeout, m_readBufferSize);
+        if (pipeline.isValid()) {
+            if (putPipelined(pipeline, destPath, destFH, unstable)) {
+                m_slave->finished();
+            }
+            finishPipeline(pipeline);
+            return;
+        }
+    }
+
     int result;
 
     WRITE3args writeArgs;
@@ -962,7 +1012,7 @@ void NFSProtocolV3::put(const KUrl& url, int _mode, KIO::JobFlags flags)
 
     destFH.toFH(writeArgs.file);
     writeArgs.offset = 0;
-    writeArgs.stable = FILE_SYNC;
+    writeArgs.stable = unstable.stable();
 
     WRITE3res writeRes;
     memset(&writeRes, 0, sizeof(writeRes));
@@ -1002,6 +1052,7 @@ void NFSProtocolV3::put(const KUrl& url, int _mode, KIO::JobFlags flags)
                 }
 
                 writeNow = writeRes.WRITE3res_u.resok.count;
+                trackWrite(unstable, writeArgs.offset, QByteArray::fromRawData(data, writeNow), writeRes.WRITE3res_u.resok);
 
                 bytesWritten += writeNow;
                 writeArgs.offset = bytesWritten;
@@ -1011,11 +1062,19 @@ void NFSProtocolV3::put(const KUrl& url, int _mode, KIO::JobFlags flags)
             } while (bytesToWrite > 0);
         }
 
+        if (!error && unstable.needsCommit()) {
+            error = !commitWrites(0, destFH, unstable, destPath);
+        }
+
         if (error) {
             break;
         }
     } while (result > 0);
 
+    if (!error) {
+        error = !commitWrites(0, destFH, unstable, destPath);
+    }
+
     if (!error) {
         m_slave->finished();
     }
@@ -1164,16 +1223,23 @@ void NFSProtocolV3::copySame(const KUrl& src, const KUrl& dest, int _mode, KIO::
         kDebug(7121) << "Resuming old transfer";
     }
 
+    if (m_readBufferSize == 0) {
+        initPreferredSizes(srcFH);
+    }
+
     // Check what buffer size we should use, always use the smallest one.
     const int bufferSize = (m_readBufferSize < m_writeBufferSize) ? m_readBufferSize : m_writeBufferSize;
 
+    UnstableWrites unstable;
+    initUnstableWrites(unstable);
+
     WRITE3args writeArgs;
     memset(&writeArgs, 0, sizeof(writeArgs));
 
     destFH.toFH(writeArgs.file);
     writeArgs.offset = 0;
     writeArgs.data.data_val = new char[bufferSize];
-    writeArgs.stable = FILE_SYNC;
+    writeArgs.stable = unstable.stable();
 
     READ3args readArgs;
     memset(&readArgs, 0, sizeof(readArgs));
@@ -1194,8 +1260,25 @@ void NFSProtocolV3::copySame(const KUrl& src, const KUrl& dest, int _mode, KIO::
     memset(&writeRes, 0, sizeof(WRITE3res));
 
     bool error = false;
+    bool pipelined = false;
+    if (rpcQueueDepth() > 1) {
+        RPCPipeline pipeline(m_nfsClient, m_nfsSock, NFSPROG, NFSVERS, clnt_timeout, m_readBufferSize);
+        if (pipeline.isValid()) {
+            pipelined = true;
+
+            uint64 offset = readArgs.offset;
+            error = !copyPipelined(pipeline, src, srcFH, destPath, destFH, bufferSize, offset, unstable);
+            readArgs.offset = offset;
+            writeArgs.offset = offset;
+            if (!finishPipeline(pipeline) && !error) {
+                m_slave->error(KIO::ERR_CONNECTION_BROKEN, m_currentHost);
+                error = true;
+            }
+        }
+    }
+
     int bytesRead = 0;
-    do {
+    while (!pipelined) {
         int clnt_stat = clnt_call(m_nfsClient, NFSPROC3_READ,
                                   (xdrproc_t) xdr_READ3args, reinterpret_cast<caddr_t>(&readArgs),
                                   (xdrproc_t) xdr_READ3res, reinterpret_cast<caddr_t>(&readRes),
@@ -1232,11 +1315,24 @@ void NFSProtocolV3::copySame(const KUrl& src, const KUrl& dest, int _mode, KIO::
                 break;
             }
 
+            trackWrite(unstable, writeArgs.offset, QByteArray::fromRawData(writeArgs.data.data_val, bytesRead), writeRes.WRITE3res_u.resok);
+            if (unstable.needsCommit() && !commitWrites(0, destFH, unstable, destPath)) {
+                error = true;
+                break;
+            }
+
             writeArgs.offset += bytesRead;
 
             m_slave->processedSize(readArgs.offset);
         }
-    } while (bytesRead > 0);
+
+        if (bytesRead <= 0) {
+            if (!commitWrites(0, destFH, unstable, destPath)) {
+                error = true;
+            }
+            break;
+        }
+    }
 
     delete [] writeArgs.data.data_val;
 
@@ -1606,7 +1702,10 @@ void NFSProtocolV3::copyTo(const KUrl& src, const KUrl& dest, int _mode, KIO::Jo
     memset(&writeArgs, 0, sizeof(writeArgs));
     destFH.toFH(writeArgs.file);
     writeArgs.data.data_val = new char[m_writeBufferSize];
-    writeArgs.stable = FILE_SYNC;
+
+    UnstableWrites unstable;
+    initUnstableWrites(unstable);
+    writeArgs.stable = unstable.stable();
     if (bResume) {
         writeArgs.offset = resumeOffset;
     } else {
@@ -1643,12 +1742,22 @@ void NFSProtocolV3::copyTo(const KUrl& src, const KUrl& dest, int _mode, KIO::Jo
                 break;
             }
 
+            trackWrite(unstable, writeArgs.offset, QByteArray::fromRawData(writeArgs.data.data_val, bytesRead), writeRes.WRITE3res_u.resok);
+            if (unstable.needsCommit() && !commitWrites(0, destFH, unstable, destPath)) {
+                error = true;
+                break;
+            }
+
             writeArgs.offset += bytesRead;
 
             m_slave->processedSize(writeArgs.offset);
         }
     } while (bytesRead > 0);
 
+    if (!error && !commitWrites(0, destFH, unstable, destPath)) {
+        error = true;
+    }
+
     delete [] writeArgs.data.data_val;
 
     if (error) {
@@ -1727,6 +1836,508 @@ void NFSProtocolV3::symlink(const QString& target, const KUrl& dest, KIO::JobFla
     m_slave->finished();
 }
 
+int NFSProtocolV3::rpcQueueDepth() const
+{
+    const int depth = m_slave->config()->readEntry("RPCQueueDepth", DEFAULT_RPC_QUEUE_DEPTH);
+    return qBound(1, depth, MAX_RPC_QUEUE_DEPTH);
+}
+
+void NFSProtocolV3::getPipelined(RPCPipeline& pipeline, const KUrl& url, const NFSFileHandle& fh)
+{
+    const QString path(url.path());
+    const int depth = rpcQueueDepth();
+
+    QQueue<PendingRead*> reads;
+
+    // Only one read is sent until we know the size of the file, so that small
+    // files do not cost more calls than before.
+    if (!sendRead(pipeline, fh, 0, m_readBufferSize, reads)) {
+        checkForError(RPC_CANTSEND, 0, path);
+        return;
+    }
+
+    uint64 nextOffset = m_readBufferSize;
+    uint64 fileSize = 0;
+    bool sizeKnown = false;
+
+    bool validRead = false;
+    bool hasError = false;
+    uint64 processed = 0;
+    while (!reads.isEmpty()) {
+        PendingRead* read = reads.dequeue();
+        const int clnt_stat = pipeline.wait(read->xid);
+
+        // We are trying to read a directory, fail quietly
+        if (clnt_stat == RPC_SUCCESS && read->res.status == NFS3ERR_ISDIR) {
+            delete read;
+            break;
+        }
+
+        if (!checkForError(clnt_stat, read->res.status, path)) {
+            delete read;
+            hasError = true;
+            break;
+        }
+
+        const READ3resok& resok = read->res.READ3res_u.resok;
+        const uint32 count = resok.count;
+
+        if (read->args.offset == 0) {
+            const QByteArray readBuffer = QByteArray::fromRawData(resok.data.data_val, count);
+            KMimeType::Ptr p_mimeType = KMimeType::findByNameAndContent(url.fileName(), readBuffer);
+            m_slave->mimeType(p_mimeType->name());
+
+            m_slave->totalSize(resok.file_attributes.post_op_attr_u.attributes.size);
+
+            if (resok.file_attributes.attributes_follow) {
+                fileSize = resok.file_attributes.post_op_attr_u.attributes.size;
+                sizeKnown = true;
+            }
+        }
+
+        // The reads are completed in order, so the data can be passed on directly
+        if (count > 0) {
+            validRead = true;
+            processed = read->args.offset + count;
+
+            m_slave->data(QByteArray::fromRawData(resok.data.data_val, count));
+            m_slave->processedSize(processed);
+        }
+
+        const bool eof = resok.eof || count == 0;
+        if (!eof && count < read->args.count) {
+            // A short read, the rest has to come before the reads in flight
+            if (!sendRead(pipeline, fh, read->args.offset + count, read->args.count - count, reads, true)) {
+                checkForError(RPC_CANTSEND, 0, path);
+                hasError = true;
+            }
+        }
+
+        delete read;
+
+        if (eof || hasError) {
+            break;
+        }
+
+        while (reads.count() < depth && (!sizeKnown || nextOffset < fileSize)) {
+            if (!sendRead(pipeline, fh, nextOffset, m_readBufferSize, reads)) {
+                checkForError(RPC_CANTSEND, 0, path);
+                hasError = true;
+                break;
+            }
+
+            nextOffset += m_readBufferSize;
+        }
+
+        if (hasError) {
+            break;
+        }
+    }
+
+    // Reads beyond the end of the file or after an error, their replies are
+    // dropped by the pipeline.
+    qDeleteAll(reads);
+
+    // Only send the read data to the slave if we have actually sent some.
+    if (validRead) {
+        m_slave->data(QByteArray());
+        m_slave->processedSize(processed);
+    }
+
+    if (!hasError) {
+        m_slave->finished();
+    }
+}
+
+bool NFSProtocolV3::putPipelined(RPCPipeline& pipeline, const QString& destPath, const NFSFileHandle& destFH,
+                                 UnstableWrites& unstable)
+{
+    const int depth = rpcQueueDepth();
+
+    QQueue<PendingWrite*> writes;
+
+    // Loop until we get 0 (end of data).
+    uint64 offset = 0;
+    bool error = false;
+    int result;
+    do {
+        QByteArray buffer;
+        m_slave->dataReq();
+        result = m_slave->readData(buffer);
+
+        for (int pos = 0; result > 0 && pos < buffer.size() && !error; pos += m_writeBufferSize) {
+            while (!error && writes.count() >= depth) {
+                error = !completeWrite(pipeline, destFH, writes, unstable, destPath);
+            }
+            if (!error && unstable.needsCommit()) {
+                error = !flushWrites(pipeline, destFH, writes, unstable, destPath);
+            }
+            if (error) {
+                break;
+            }
+
+            const QByteArray chunk = buffer.mid(pos, m_writeBufferSize);
+            if (!sendWrite(pipeline, destFH, offset, chunk, writes, unstable)) {
+                checkForError(RPC_CANTSEND, 0, destPath);
+                error = true;
+                break;
+            }
+
+            offset += chunk.size();
+        }
+    } while (result > 0 && !error);
+
+    if (!error) {
+        error = !flushWrites(pipeline, destFH, writes, unstable, destPath);
+    }
+
+    qDeleteAll(writes);
+
+    return !error;
+}
+
+bool NFSProtocolV3::copyPipelined(RPCPipeline& pipeline, const KUrl& src, const NFSFileHandle& srcFH,
+                                  const QString& destPath, const NFSFileHandle& destFH, uint32 bufferSize, uint64& offset,
+                                  UnstableWrites& unstable)
+{
+    const QString srcPath(src.path());
+    const int depth = rpcQueueDepth();
+    const uint64 startOffset = offset;
+
+    QQueue<PendingRead*> reads;
+    QQueue<PendingWrite*> writes;
+
+    if (!sendRead(pipeline, srcFH, startOffset, bufferSize, reads)) {
+        checkForError(RPC_CANTSEND, 0, srcPath);
+        return false;
+    }
+
+    uint64 nextOffset = startOffset + bufferSize;
+    uint64 fileSize = 0;
+    bool sizeKnown = false;
+
+    bool error = false;
+    while (!reads.isEmpty()) {
+        PendingRead* read = reads.dequeue();
+        const int clnt_stat = pipeline.wait(read->xid);
+
+        if (!checkForError(clnt_stat, read->res.status, srcPath)) {
+            delete read;
+            error = true;
+            break;
+        }
+
+        const READ3resok& resok = read->res.READ3res_u.resok;
+        const uint32 count = resok.count;
+        const bool eof = resok.eof || count == 0;
+
+        // We should only send out the total size and mimetype at the start of the transfer
+        if (read->args.offset == startOffset) {
+            KMimeType::Ptr p_mimeType = KMimeType::findByNameAndContent(src.fileName(), QByteArray::fromRawData(resok.data.data_val, count));
+            m_slave->mimeType(p_mimeType->name());
+
+            m_slave->totalSize(resok.file_attributes.post_op_attr_u.attributes.size);
+
+            if (resok.file_attributes.attributes_follow) {
+                fileSize = resok.file_attributes.post_op_attr_u.attributes.size;
+                sizeKnown = true;
+            }
+        }
+
+        if (!eof && count < read->args.count) {
+            // A short read, the rest has to come before the reads in flight
+            if (!sendRead(pipeline, srcFH, read->args.offset + count, read->args.count - count, reads, true)) {
+                checkForError(RPC_CANTSEND, 0, srcPath);
+                error = true;
+            }
+        }
+
+        if (count > 0 && !error) {
+            while (!error && writes.count() >= depth) {
+                error = !completeWrite(pipeline, destFH, writes, unstable, destPath);
+            }
+            if (!error && unstable.needsCommit()) {
+                error = !flushWrites(pipeline, destFH, writes, unstable, destPath);
+            }
+
+            // The write takes over the buffer of the read, no need to copy the data
+            read->buffer.resize(count);
+            if (!error && !sendWrite(pipeline, destFH, read->args.offset, read->buffer, writes, unstable)) {
+                checkForError(RPC_CANTSEND, 0, destPath);
+                error = true;
+            }
+
+            if (!error) {
+                offset = read->args.offset + count;
+                m_slave->processedSize(offset);
+            }
+        }
+
+        delete read;
+
+        if (eof || error) {
+            break;
+        }
+
+        while (reads.count() < depth && (!sizeKnown || nextOffset < fileSize)) {
+            if (!sendRead(pipeline, srcFH, nextOffset, bufferSize, reads)) {
+                checkForError(RPC_CANTSEND, 0, srcPath);
+                error = true;
+                break;
+            }
+
+            nextOffset += bufferSize;
+        }
+
+        if (error) {
+            break;
+        }
+    }
+
+    if (!error) {
+        error = !flushWrites(pipeline, destFH, writes, unstable, destPath);
+    }
+
+    qDeleteAll(reads);
+    qDeleteAll(writes);
+
+    return !error;
+}
+
+bool NFSProtocolV3::sendRead(RPCPipeline& pipeline, const NFSFileHandle& fh, uint64 offset, uint32 count,
+                             QQueue<PendingRead*>& reads, bool first)
+{
+    PendingRead* read = new PendingRead;
+    memset(&read->args, 0, sizeof(read->args));
+    memset(&read->res, 0, sizeof(read->res));
+    read->buffer.resize(count);
+
+    fh.toFH(read->args.file);
+    read->args.offset = offset;
+    read->args.count = count;
+
+    read->res.READ3res_u.resok.data.data_len = count;
+    read->res.READ3res_u.resok.data.data_val = read->buffer.data();
+
+    if (!pipeline.call(NFSPROC3_READ,
+                       (xdrproc_t) xdr_READ3args, reinterpret_cast<caddr_t>(&read->args),
+                       (xdrproc_t) xdr_READ3res, reinterpret_cast<caddr_t>(&read->res),
+                       read->xid)) {
+        delete read;
+        return false;
+    }
+
+    if (first) {
+        reads.prepend(read);
+    } else {
+        reads.enqueue(read);
+    }
+
+    return true;
+}
+
+bool NFSProtocolV3::sendWrite(RPCPipeline& pipeline, const NFSFileHandle& fh, uint64 offset, const QByteArray& data,
+                              QQueue<PendingWrite*>& writes, const UnstableWrites& unstable)
+{
+    PendingWrite* write = new PendingWrite;
+    memset(&write->args, 0, sizeof(write->args));
+    memset(&write->res, 0, sizeof(write->res));
+    write->buffer = data;
+
+    fh.toFH(write->args.file);
+    write->args.offset = offset;
+    write->args.count = write->buffer.size();
+    write->args.stable = unstable.stable();
+
+    // The data is only encoded, so it can be shared with the caller
+    write->args.data.data_len = write->buffer.size();
+    write->args.data.data_val = const_cast<char*>(write->buffer.constData());
+
+    if (!pipeline.call(NFSPROC3_WRITE,
+                       (xdrproc_t) xdr_WRITE3args, reinterpret_cast<caddr_t>(&write->args),
+                       (xdrproc_t) xdr_WRITE3res, reinterpret_cast<caddr_t>(&write->res),
+                       write->xid)) {
+        delete write;
+        return false;
+    }
+
+    writes.enqueue(write);
+    return true;
+}
+
+bool NFSProtocolV3::completeWrite(RPCPipeline& pipeline, const NFSFileHandle& fh, QQueue<PendingWrite*>& writes,
+                                  UnstableWrites& unstable, const QString& path)
+{
+    PendingWrite* write = writes.dequeue();
+    const int clnt_stat = pipeline.wait(write->xid);
+
+    bool ok = checkForError(clnt_stat, write->res.status, path);
+    if (ok) {
+        const uint32 written = write->res.WRITE3res_u.resok.count;
+        if (written == 0 && write->args.count > 0) {
+            m_slave->error(KIO::ERR_COULD_NOT_WRITE, path);
+            ok = false;
+        } else {
+            trackWrite(unstable, write->args.offset, write->buffer.left(written), write->res.WRITE3res_u.resok);
+
+            if (written < write->args.count &&
+                !sendWrite(pipeline, fh, write->args.offset + written, write->buffer.mid(written), writes, unstable)) {
+                checkForError(RPC_CANTSEND, 0, path);
+                ok = false;
+            }
+        }
+    }
+
+    delete write;
+    return ok;
+}
+
+bool NFSProtocolV3::flushWrites(RPCPipeline& pipeline, const NFSFileHandle& fh, QQueue<PendingWrite*>& writes,
+                                UnstableWrites& unstable, const QString& path)
+{
+    while (!writes.isEmpty()) {
+        if (!completeWrite(pipeline, fh, writes, unstable, path)) {
+            return false;
+        }
+    }
+
+    return commitWrites(&pipeline, fh, unstable, path);
+}
+
+void NFSProtocolV3::initUnstableWrites(UnstableWrites& writes) const
+{
+    writes.enabled = m_slave->config()->readEntry("UnstableWrites", false);
+    const int interval = m_slave->config()->readEntry("CommitInterval", DEFAULT_COMMIT_INTERVAL);
+    writes.interval = static_cast<uint64>(qBound(1, interval, MAX_COMMIT_INTERVAL)) * 1024 * 1024;
+}
+
+void NFSProtocolV3::trackWrite(UnstableWrites& writes, uint64 offset, const QByteArray& data, const WRITE3resok& resok)
+{
+    // The server may decide to write the data stable anyway
+    if (!writes.enabled || resok.committed == FILE_SYNC || data.isEmpty()) {
+        return;
+    }
+
+    if (!writes.hasVerifier) {
+        memcpy(writes.verifier, resok.verf, NFS3_WRITEVERFSIZE);
+        writes.hasVerifier = true;
+    } else if (memcmp(writes.verifier, resok.verf, NFS3_WRITEVERFSIZE) != 0) {
+        writes.verifierChanged = true;
+    }
+
+    writes.data.append(qMakePair(offset, QByteArray(data.constData(), data.size())));
+    writes.size += data.size();
+}
+
+bool NFSProtocolV3::commitWrites(RPCPipeline* pipeline, const NFSFileHandle& fh, UnstableWrites& writes, const QString& path)
+{
+    if (!writes.enabled || writes.data.isEmpty()) {
+        return true;
+    }
+
+    // Commit the whole file, a count of 0 means up to the end
+    COMMIT3args commitArgs;
+    memset(&commitArgs, 0, sizeof(commitArgs));
+    fh.toFH(commitArgs.file);
+    commitArgs.offset = 0;
+    commitArgs.count = 0;
+
+    COMMIT3res commitRes;
+    memset(&commitRes, 0, sizeof(commitRes));
+
+    int clnt_stat = callSync(pipeline, NFSPROC3_COMMIT,
+                             (xdrproc_t) xdr_COMMIT3args, reinterpret_cast<caddr_t>(&commitArgs),
+                             (xdrproc_t) xdr_COMMIT3res, reinterpret_cast<caddr_t>(&commitRes));
+
+    if (!checkForError(clnt_stat, commitRes.status, path)) {
+        return false;
+    }
+
+    // The server restarted since some of the data was written and may have
+    // lost it, so write everything since the last commit again, stable this time.
+    if (writes.verifierChanged || memcmp(writes.verifier, commitRes.COMMIT3res_u.resok.verf, NFS3_WRITEVERFSIZE) != 0) {
+        kDebug(7121) << "Write verifier changed, writing" << writes.size << "bytes again";
+
+        WRITE3args writeArgs;
+        memset(&writeArgs, 0, sizeof(writeArgs));
+        fh.toFH(writeArgs.file);
+        writeArgs.stable = FILE_SYNC;
+
+        WRITE3res writeRes;
+
+        for (int i = 0; i < writes.data.count(); ++i) {
+            const uint64 offset = writes.data.at(i).first;
+            const QByteArray& data = writes.data.at(i).second;
+
+            uint32 written = 0;
+            while (written < static_cast<uint32>(data.size())) {
+                writeArgs.offset = offset + written;
+                writeArgs.count = data.size() - written;
+                writeArgs.data.data_len = writeArgs.count;
+                writeArgs.data.data_val = const_cast<char*>(data.constData()) + written;
+
+                memset(&writeRes, 0, sizeof(writeRes));
+                clnt_stat = callSync(pipeline, NFSPROC3_WRITE,
+                                     (xdrproc_t) xdr_WRITE3args, reinterpret_cast<caddr_t>(&writeArgs),
+                                     (xdrproc_t) xdr_WRITE3res, reinterpret_cast<caddr_t>(&writeRes));
+
+                if (!checkForError(clnt_stat, writeRes.status, path)) {
+                    return false;
+                }
+
+                if (writeRes.WRITE3res_u.resok.count == 0) {
+                    m_slave->error(KIO::ERR_COULD_NOT_WRITE, path);
+                    return false;
+                }
+
+                written += writeRes.WRITE3res_u.resok.count;
+            }
+        }
+    }
+
+    writes.data.clear();
+    writes.size = 0;
+    writes.hasVerifier = false;
+    writes.verifierChanged = false;
+
+    return true;
+}
+
+bool NFSProtocolV3::finishPipeline(RPCPipeline& pipeline)
+{
+    pipeline.drain();
+    if (!pipeline.isBroken()) {
+        return true;
+    }
+
+    // The handles stay valid, only the connection of the NFS client is replaced
+    kDebug(7121) << "Reconnecting the NFS client";
+    if (m_nfsSock >= 0) {
+        ::close(m_nfsSock);
+        m_nfsSock = -1;
+    }
+    if (m_nfsClient != 0) {
+        CLNT_DESTROY(m_nfsClient);
+        m_nfsClient = 0;
+    }
+
+    return NFSProtocol::openConnection(m_currentHost, NFSPROG, NFSVERS, m_nfsClient, m_nfsSock) == 0;
+}
+
+int NFSProtocolV3::callSync(RPCPipeline* pipeline, u_long proc, xdrproc_t xargs, caddr_t args, xdrproc_t xres, caddr_t res)
+{
+    if (pipeline == 0) {
+        return clnt_call(m_nfsClient, proc, xargs, args, xres, res, clnt_timeout);
+    }
+
+    u_int32_t xid;
+    if (!pipeline->call(proc, xargs, args, xres, res, xid)) {
+        return RPC_CANTSEND;
+    }
+
+    return pipeline->wait(xid);
+}
+
 void NFSProtocolV3::initPreferredSizes(const NFSFileHandle& fh)
 {
     FSINFO3args fsArgs;
@@ -1802,6 +2413,8 @@ bool NFSProtocolV3::create(const QString& path, int mode, int& rpcStatus, CREATE
                           (xdrproc_t) xdr_CREATE3res, reinterpret_cast<caddr_t>(&result),
                           clnt_timeout);
 
+    invalidateFileAttributes(path);
+
     return (rpcStatus == RPC_SUCCESS && result.status == NFS3_OK);
 }
 
@@ -1961,6 +2574,7 @@ bool NFSProtocolV3::remove(const QString& path, int& rpcStatus, REMOVE3res& resu
     bool ret = (rpcStatus == RPC_SUCCESS && result.status == NFS3_OK);
     if (ret) {
         // Remove it from the cache as well
+        invalidateFileAttributes(path);
         removeFileHandle(path);
     }
 
@@ -2024,6 +2638,9 @@ bool NFSProtocolV3::rename(const QString& src, const QString& dest, int& rpcStat
 
     bool ret = (rpcStatus == RPC_SUCCESS && result.status == NFS3_OK);
     if (ret) {
+        invalidateFileAttributes(src);
+        invalidateFileAttributes(dest);
+
         // Can we actually find the new handle?
         int lookupStatus;
         LOOKUP3res lookupRes;
@@ -2060,6 +2677,8 @@ bool NFSProtocolV3::setAttr(const QString& path, const sattr3& attributes, int&
                           (xdrproc_t) xdr_SETATTR3res, reinterpret_cast<caddr_t>(&result),
                           clnt_timeout);
 
+    invalidateFileAttributes(path);
+
     return (rpcStatus == RPC_SUCCESS && result.status == NFS3_OK);
 }
 
@@ -2097,6 +2716,8 @@ bool NFSProtocolV3::symLink(const QString& target, const QString& dest, int& rpc
                           (xdrproc_t) xdr_SYMLINK3res, reinterpret_cast<caddr_t>(&result),
                           clnt_timeout);
 
+    invalidateFileAttributes(dest);
+
     // Add the new handle to the cache
     NFSFileHandle destFH = getFileHandle(dest);
     if (!destFH.isInvalid()) {
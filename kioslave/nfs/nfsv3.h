@@ -29,6 +29,12 @@
 #include <netinet/in.h>
 #include <sys/time.h>
 
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QQueue>
+
+class RPCPipeline;
+
 class NFSProtocolV3 : public NFSProtocol
 {
 public:
@@ -88,6 +94,93 @@ private:
     // Initialises the optimal read, write and read dir buffer sizes
     void initPreferredSizes(const NFSFileHandle& fh);
 
+    // A READ or WRITE call which has been sent through a RPCPipeline, the
+    // buffer holds the data until the reply arrived.
+    struct PendingRead {
+        READ3args args;
+        READ3res res;
+        QByteArray buffer;
+        u_int32_t xid;
+    };
+
+    struct PendingWrite {
+        WRITE3args args;
+        WRITE3res res;
+        QByteArray buffer;
+        u_int32_t xid;
+    };
+
+    // The data written UNSTABLE since the last COMMIT. The server may lose it
+    // until it is committed, which shows by a changed write verifier, so it is
+    // kept to write it again in that case.
+    struct UnstableWrites {
+        UnstableWrites()
+            : enabled(false), interval(0), size(0), hasVerifier(false), verifierChanged(false)
+        {
+        }
+
+        stable_how stable() const
+        {
+            return enabled ? UNSTABLE : FILE_SYNC;
+        }
+
+        // True if enough data has been written to commit it now
+        bool needsCommit() const
+        {
+            return enabled && size >= interval;
+        }
+
+        bool enabled;
+        uint64 interval;
+        uint64 size;
+        bool hasVerifier;
+        bool verifierChanged;
+        writeverf3 verifier;
+        QList<QPair<uint64, QByteArray> > data;
+    };
+
+    // Reads the UnstableWrites and CommitInterval settings
+    void initUnstableWrites(UnstableWrites& writes) const;
+
+    // Remembers the data of a successful WRITE until it is committed, @p data is copied.
+    void trackWrite(UnstableWrites& writes, uint64 offset, const QByteArray& data, const WRITE3resok& resok);
+
+    // Commits the data written so far and writes it again if the server lost it.
+    // No WRITE may be in flight when this is called.
+    bool commitWrites(RPCPipeline* pipeline, const NFSFileHandle& fh, UnstableWrites& writes, const QString& path);
+
+    // Reads the remaining replies of @p pipeline. If it failed in the middle of
+    // a record, the NFS client is reconnected, returns false if that failed.
+    bool finishPipeline(RPCPipeline& pipeline);
+
+    // Does a single call, through @p pipeline if it is not null
+    int callSync(RPCPipeline* pipeline, u_long proc, xdrproc_t xargs, caddr_t args, xdrproc_t xres, caddr_t res);
+
+    // The number of READ or WRITE calls to keep in flight, 1 disables pipelining
+    int rpcQueueDepth() const;
+
+    // Pipelined versions of the data transfer loops of get, put and copySame,
+    // used if the connection supports it.
+    void getPipelined(RPCPipeline& pipeline, const KUrl& url, const NFSFileHandle& fh);
+    bool putPipelined(RPCPipeline& pipeline, const QString& destPath, const NFSFileHandle& destFH,
+                      UnstableWrites& unstable);
+    bool copyPipelined(RPCPipeline& pipeline, const KUrl& src, const NFSFileHandle& srcFH,
+                       const QString& destPath, const NFSFileHandle& destFH, uint32 bufferSize, uint64& offset,
+                       UnstableWrites& unstable);
+
+    bool sendRead(RPCPipeline& pipeline, const NFSFileHandle& fh, uint64 offset, uint32 count,
+                  QQueue<PendingRead*>& reads, bool first = false);
+    bool sendWrite(RPCPipeline& pipeline, const NFSFileHandle& fh, uint64 offset, const QByteArray& data,
+                   QQueue<PendingWrite*>& writes, const UnstableWrites& unstable);
+
+    // Waits for the oldest write and resends the part the server did not write
+    bool completeWrite(RPCPipeline& pipeline, const NFSFileHandle& fh, QQueue<PendingWrite*>& writes,
+                       UnstableWrites& unstable, const QString& path);
+
+    // Waits for all writes in flight and commits them
+    bool flushWrites(RPCPipeline& pipeline, const NFSFileHandle& fh, QQueue<PendingWrite*>& writes,
+                     UnstableWrites& unstable, const QString& path);
+
     // UDS helper functions
     void completeUDSEntry(KIO::UDSEntry& entry, const fattr3& attributes);
     void completeBadLinkUDSEntry(KIO::UDSEntry& entry, const fattr3& attributes);
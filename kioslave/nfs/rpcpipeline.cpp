@@ -0,0 +1,296 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "rpcpipeline.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QtCore/QtEndian>
+
+#include <KDebug>
+
+// Space reserved for the RPC header and the credentials of a call
+#define RPC_HEADER_SIZE 512
+// Space for the RPC header, the verifier and the attributes of a READ or WRITE reply
+#define REPLY_HEADER_SIZE 1024
+// Record marking of RPC over TCP, see RFC 5531 section 11
+#define LAST_FRAGMENT 0x80000000U
+
+RPCPipeline::RPCPipeline(CLIENT* client, int sock, u_long prog, u_long vers, const timeval& timeout, u_int maxData)
+    : m_client(client),
+      m_sock(sock),
+      m_prog(prog),
+      m_vers(vers),
+      m_timeout(timeout.tv_sec * 1000 + timeout.tv_usec / 1000),
+      m_valid(false),
+      m_broken(false),
+      m_nextXid(0),
+      m_maxRecord(maxData + REPLY_HEADER_SIZE)
+{
+    if (m_client == 0 || m_sock < 0) {
+        return;
+    }
+
+    int type = 0;
+    socklen_t length = sizeof(type);
+    if (getsockopt(m_sock, SOL_SOCKET, SO_TYPE, &type, &length) == 0 && type == SOCK_STREAM) {
+        m_valid = true;
+    }
+
+    // Start somewhere else than the client does, the xids only have to be
+    // unique among the calls which are pending at the same time.
+    timeval now;
+    gettimeofday(&now, 0);
+    m_nextXid = (getpid() << 16) ^ now.tv_usec ^ 0x5a5a0000U;
+}
+
+RPCPipeline::~RPCPipeline()
+{
+    drain();
+}
+
+void RPCPipeline::drain()
+{
+    QHash<u_int32_t, PendingCall>::iterator it = m_pending.begin();
+    while (it != m_pending.end()) {
+        if (it->done) {
+            it = m_pending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    while (m_valid && !m_pending.isEmpty()) {
+        QByteArray record;
+        if (!readRecord(record) || record.size() < 4) {
+            fail();
+            break;
+        }
+
+        m_pending.remove(qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(record.constData())));
+    }
+}
+
+bool RPCPipeline::call(u_long proc, xdrproc_t xargs, caddr_t args, xdrproc_t xres, caddr_t res, u_int32_t& xid)
+{
+    if (!m_valid) {
+        return false;
+    }
+
+    // Find out how big the arguments are, mostly the data of WRITE calls
+    const unsigned long argsSize = xdr_sizeof(xargs, args);
+    QByteArray buffer(4 + RPC_HEADER_SIZE + argsSize, 0);
+
+    XDR xdrs;
+    xdrmem_create(&xdrs, buffer.data() + 4, buffer.size() - 4, XDR_ENCODE);
+
+    xid = m_nextXid++;
+
+    struct rpc_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.rm_xid = xid;
+    msg.rm_direction = CALL;
+    msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+    msg.rm_call.cb_prog = m_prog;
+    msg.rm_call.cb_vers = m_vers;
+
+    const bool encoded = xdr_callhdr(&xdrs, &msg) &&
+                         xdr_u_long(&xdrs, &proc) &&
+                         AUTH_MARSHALL(m_client->cl_auth, &xdrs) &&
+                         (*xargs)(&xdrs, args);
+    const u_int length = XDR_GETPOS(&xdrs);
+    xdr_destroy(&xdrs);
+
+    if (!encoded) {
+        kDebug(7121) << "Could not encode call" << proc;
+        return false;
+    }
+
+    // A single fragment holds the whole call
+    qToBigEndian<quint32>(length | LAST_FRAGMENT, reinterpret_cast<uchar*>(buffer.data()));
+    if (!writeFully(buffer.constData(), length + 4)) {
+        fail();
+        return false;
+    }
+
+    PendingCall pending;
+    pending.xres = xres;
+    pending.res = res;
+    pending.done = false;
+    pending.status = RPC_SUCCESS;
+    m_pending.insert(xid, pending);
+
+    return true;
+}
+
+int RPCPipeline::wait(u_int32_t xid)
+{
+    while (m_valid && m_pending.contains(xid) && !m_pending.value(xid).done) {
+        QByteArray record;
+        if (!readRecord(record) || record.size() < 4) {
+            fail();
+            break;
+        }
+
+        const u_int32_t replyXid = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(record.constData()));
+        QHash<u_int32_t, PendingCall>::iterator it = m_pending.find(replyXid);
+        if (it == m_pending.end()) {
+            kDebug(7121) << "Ignoring reply for unknown xid" << replyXid;
+            continue;
+        }
+
+        struct rpc_msg reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.acpted_rply.ar_verf = _null_auth;
+        reply.acpted_rply.ar_results.where = it->res;
+        reply.acpted_rply.ar_results.proc = it->xres;
+
+        XDR xdrs;
+        xdrmem_create(&xdrs, record.data(), record.size(), XDR_DECODE);
+        if (!xdr_replymsg(&xdrs, &reply)) {
+            it->status = RPC_CANTDECODERES;
+        } else if (reply.rm_reply.rp_stat != MSG_ACCEPTED) {
+            it->status = RPC_AUTHERROR;
+        } else {
+            switch (reply.acpted_rply.ar_stat) {
+            case SUCCESS:
+                it->status = RPC_SUCCESS;
+                break;
+            case PROG_UNAVAIL:
+                it->status = RPC_PROGUNAVAIL;
+                break;
+            case PROG_MISMATCH:
+                it->status = RPC_PROGVERSMISMATCH;
+                break;
+            case PROC_UNAVAIL:
+                it->status = RPC_PROCUNAVAIL;
+                break;
+            case GARBAGE_ARGS:
+                it->status = RPC_CANTDECODEARGS;
+                break;
+            default:
+                it->status = RPC_SYSTEMERROR;
+                break;
+            }
+        }
+        xdr_destroy(&xdrs);
+
+        it->done = true;
+    }
+
+    if (!m_pending.contains(xid)) {
+        return RPC_CANTRECV;
+    }
+
+    const PendingCall pending = m_pending.take(xid);
+    return pending.done ? pending.status : RPC_CANTRECV;
+}
+
+bool RPCPipeline::readRecord(QByteArray& record)
+{
+    record.clear();
+
+    for (;;) {
+        uchar marker[4];
+        if (!readFully(reinterpret_cast<char*>(marker), sizeof(marker))) {
+            return false;
+        }
+
+        const quint32 header = qFromBigEndian<quint32>(marker);
+        const quint32 length = header & ~LAST_FRAGMENT;
+        const int offset = record.size();
+        if (length > m_maxRecord - offset) {
+            kDebug(7121) << "Reply of" << offset + length << "bytes is bigger than" << m_maxRecord;
+            return false;
+        }
+        record.resize(offset + length);
+        if (!readFully(record.data() + offset, length)) {
+            return false;
+        }
+
+        if (header & LAST_FRAGMENT) {
+            return true;
+        }
+    }
+}
+
+bool RPCPipeline::readFully(char* buf, size_t len)
+{
+    while (len > 0) {
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        const int ready = ::poll(&pfd, 1, m_timeout);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            kDebug(7121) << "Timeout or error while waiting for a reply";
+            return false;
+        }
+
+        const ssize_t bytesRead = ::read(m_sock, buf, len);
+        if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+
+        buf += bytesRead;
+        len -= bytesRead;
+    }
+
+    return true;
+}
+
+bool RPCPipeline::writeFully(const char* buf, size_t len)
+{
+    while (len > 0) {
+        const ssize_t written = ::write(m_sock, buf, len);
+        if (written < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+
+        buf += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+void RPCPipeline::fail()
+{
+    kDebug(7121) << "Connection failed, dropping" << m_pending.count() << "pending calls";
+    m_valid = false;
+    m_broken = true;
+    m_pending.clear();
+
+    // Whatever is left of the current record must not reach clnt_call
+    ::shutdown(m_sock, SHUT_RDWR);
+}
@@ -0,0 +1,104 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KIO_NFS_RPCPIPELINE_H
+#define KIO_NFS_RPCPIPELINE_H
+
+#define PORTMAP  //this seems to be required to compile on Solaris
+#include <rpc/rpc.h>
+#include <sys/time.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+
+// Sends several RPC calls over the TCP connection of a CLIENT without waiting
+// for the replies in between, which clnt_call always does. The replies are
+// matched to their calls by the transaction id (xid), so they may arrive in
+// any order.
+//
+// The pipeline uses the socket of the client directly, so clnt_call must not
+// be used while calls are pending. Pending calls are drained on destruction.
+// If the connection fails in the middle of a record the client can not be used
+// anymore, see @ref isBroken.
+class RPCPipeline
+{
+public:
+    // @p maxData is the largest amount of data a reply may carry, replies
+    // bigger than that and their headers fail the connection.
+    RPCPipeline(CLIENT* client, int sock, u_long prog, u_long vers, const timeval& timeout, u_int maxData);
+    ~RPCPipeline();
+
+    // True if the client uses TCP, UDP clients can not be pipelined.
+    bool isValid() const
+    {
+        return m_valid;
+    }
+
+    // True if reading or writing a record failed, so that the connection is
+    // out of step and the client has to be reconnected.
+    bool isBroken() const
+    {
+        return m_broken;
+    }
+
+    // The number of calls waiting for their reply.
+    int pendingCount() const
+    {
+        return m_pending.count();
+    }
+
+    // Encodes and sends a call. The result is decoded into @p res when its
+    // reply arrives, so it must stay valid until @ref wait returned for @p xid.
+    // Returns false if the call could not be sent.
+    bool call(u_long proc, xdrproc_t xargs, caddr_t args, xdrproc_t xres, caddr_t res, u_int32_t& xid);
+
+    // Waits until the reply of the call @p xid arrived, decoding other replies
+    // on the way. Returns the RPC status of the call.
+    int wait(u_int32_t xid);
+
+    // Reads the replies of all pending calls, so that the next clnt_call on
+    // the same connection does not get them.
+    void drain();
+
+private:
+    struct PendingCall {
+        xdrproc_t xres;
+        caddr_t res;
+        bool done;
+        int status;
+    };
+
+    bool readRecord(QByteArray& record);
+    bool readFully(char* buf, size_t len);
+    bool writeFully(const char* buf, size_t len);
+    void fail();
+
+    CLIENT* m_client;
+    int m_sock;
+    u_long m_prog;
+    u_long m_vers;
+    int m_timeout;
+    bool m_valid;
+    bool m_broken;
+    u_int32_t m_nextXid;
+    u_int m_maxRecord;
+
+    QHash<u_int32_t, PendingCall> m_pending;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <QCoreApplication>
 #include <QDBusInterface>
-#include <QFileInfo>
+#include <QFile>
+#include <QtConcurrentMap>
 
 #include <KDebug>
 #include <KComponentData>
@@ -8,10 +9,13 @@
 #include <KDirWatch>
 #include <KDesktopFile>
 #include <KStandardDirs>
-#include <KIO/Job>
-#include <KIO/NetAccess>
+#include <KUser>
+#include <kde_file.h>
 
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "recentdocuments.h"
 
@@ -38,6 +42,32 @@ bool isRootUrl(const KUrl& url)
            (path.isEmpty() || path == QLatin1String("/")));
 }
 
+struct LocalFileStat
+{
+    QByteArray path;
+    KDE_struct_stat buff;
+    QByteArray linkDest;
+    bool exists;
+    bool deleted;
+};
+
+// Called on several threads at once
+static void statLocalFile(LocalFileStat& file)
+{
+    file.exists = (KDE_lstat(file.path.constData(), &file.buff) == 0);
+    file.deleted = (!file.exists && errno == ENOENT);
+    if (file.exists && S_ISLNK(file.buff.st_mode)) {
+        char buffer[PATH_MAX + 1];
+        const int n = readlink(file.path.constData(), buffer, PATH_MAX);
+        if (n > 0)
+            file.linkDest = QByteArray(buffer, n);
+        // A link pointing nowhere is shown as the link
+        KDE_struct_stat target;
+        if (KDE_stat(file.path.constData(), &target) == 0)
+            file.buff = target;
+    }
+}
+
 RecentDocuments::RecentDocuments(const QByteArray& pool, const QByteArray& app):
         ForwardingSlaveBase("recentdocuments", pool, app)
 {
@@ -55,12 +85,12 @@ bool RecentDocuments::rewriteUrl(const KUrl& url, KUrl& newUrl)
     if (isRootUrl(url)) {
         return false;
     } else {
-        QString desktopFilePath = QString("%1/%2.desktop").arg(KRecentDocument::recentDocumentDirectory()).arg(url.path(KUrl::RemoveTrailingSlash));
-        if (KDesktopFile::isDesktopFile(desktopFilePath)) {
-            KDesktopFile file(desktopFilePath);
-            if (file.hasLinkType())
-                newUrl = KUrl(file.readUrl());
-        }
+        QString fileName = url.path(KUrl::RemoveTrailingSlash);
+        if (fileName.startsWith(QLatin1Char('/')))
+            fileName.remove(0, 1);
+        RecentDocumentsIndex::Document document;
+        if (m_index.document(fileName + QLatin1String(".desktop"), document))
+            newUrl = KUrl(document.url);
 
         return !newUrl.isEmpty();
     }
@@ -73,43 +103,60 @@ void RecentDocuments::listDir(const KUrl& url)
         // flush
         listEntry(KIO::UDSEntry(), true);
 
-        QStringList list = KRecentDocument::recentDocuments();
-        KIO::UDSEntryList udslist;
+        // The .desktop files are parsed only when they changed, and local
+        // files are stat'ed directly, several at once
+        const QList<RecentDocumentsIndex::Document> documents = m_index.documents();
+        QList<RecentDocumentsIndex::Document> listed;
+        QList<KUrl> urls;
+        QVector<LocalFileStat> localFiles;
         QSet<QString> urlSet;
-        Q_FOREACH(const QString & entry, list) {
-            if (KDesktopFile::isDesktopFile(entry)) {
-                QFileInfo info(entry);
-                KDesktopFile file(entry);
-
-                KUrl urlInside(file.readUrl());
-                QString prettyUrl = urlInside.prettyUrl();
-                if (urlInside.protocol() == "recentdocuments" || urlSet.contains(prettyUrl))
-                    continue;
+        Q_FOREACH(const RecentDocumentsIndex::Document & document, documents) {
+            KUrl urlInside(document.url);
+            QString prettyUrl = urlInside.prettyUrl();
+            if (urlInside.protocol() == "recentdocuments" || urlSet.contains(prettyUrl))
+                continue;
 
-                KIO::UDSEntry uds;
-                if (urlInside.isLocalFile()) {
-                    KIO::StatJob* job = KIO::stat(urlInside, KIO::HideProgressInfo);
-                    // we do not want to wait for the event loop to delete the job
-                    QScopedPointer<KIO::StatJob> sp(job);
-                    job->setAutoDelete(false);
-                    if (KIO::NetAccess::synchronousRun(job, 0)) {
-                        uds = job->statResult();
-                    }
-                }
+            urlSet.insert(prettyUrl);
+            listed.append(document);
+            urls.append(urlInside);
+            if (urlInside.isLocalFile()) {
+                LocalFileStat file;
+                file.path = QFile::encodeName(urlInside.toLocalFile());
+                localFiles.append(file);
+            }
+        }
+        QtConcurrent::blockingMap(localFiles, statLocalFile);
 
-                urlSet.insert(prettyUrl);
-                uds.insert(KIO::UDSEntry::UDS_NAME, info.completeBaseName());
+        KIO::UDSEntryList udslist;
+        int localIndex = 0;
+        for (int i = 0; i < listed.count(); ++i) {
+            const RecentDocumentsIndex::Document &document = listed.at(i);
+            const KUrl &urlInside = urls.at(i);
+            const QString prettyUrl = urlInside.prettyUrl();
 
-                if (urlInside.isLocalFile()) {
-                    uds.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, urlInside.toLocalFile());
-                    uds.insert(KIO::UDSEntry::UDS_LOCAL_PATH, urlInside.path());
-                } else {
-                    uds.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, prettyUrl);
-                    uds.insert(KIO::UDSEntry::UDS_ICON_NAME, file.readIcon());
+            KIO::UDSEntry uds;
+            if (urlInside.isLocalFile()) {
+                const LocalFileStat &file = localFiles.at(localIndex++);
+                if (file.deleted) {
+                    // Like KRecentDocument::recentDocuments(), forget deleted files
+                    QFile::remove(KRecentDocument::recentDocumentDirectory() + QLatin1Char('/') + document.fileName);
+                    continue;
                 }
-                uds.insert(KIO::UDSEntry::UDS_TARGET_URL, prettyUrl);
-                udslist << uds;
+                if (file.exists)
+                    uds = localFileEntry(file);
+            }
+
+            uds.insert(KIO::UDSEntry::UDS_NAME, document.fileName.left(document.fileName.length() - 8));
+
+            if (urlInside.isLocalFile()) {
+                uds.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, urlInside.toLocalFile());
+                uds.insert(KIO::UDSEntry::UDS_LOCAL_PATH, urlInside.path());
+            } else {
+                uds.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, prettyUrl);
+                uds.insert(KIO::UDSEntry::UDS_ICON_NAME, document.icon);
             }
+            uds.insert(KIO::UDSEntry::UDS_TARGET_URL, prettyUrl);
+            udslist << uds;
         }
         listEntries(udslist);
 
@@ -120,6 +167,28 @@ void RecentDocuments::listDir(const KUrl& url)
         error(KIO::ERR_DOES_NOT_EXIST, url.prettyUrl());
 }
 
+KIO::UDSEntry RecentDocuments::localFileEntry(const LocalFileStat& file)
+{
+    KIO::UDSEntry uds;
+    uds.insert(KIO::UDSEntry::UDS_FILE_TYPE, file.buff.st_mode & S_IFMT);
+    uds.insert(KIO::UDSEntry::UDS_ACCESS, file.buff.st_mode & 07777);
+    uds.insert(KIO::UDSEntry::UDS_SIZE, file.buff.st_size);
+    uds.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, file.buff.st_mtime);
+    uds.insert(KIO::UDSEntry::UDS_ACCESS_TIME, file.buff.st_atime);
+    if (!file.linkDest.isEmpty())
+        uds.insert(KIO::UDSEntry::UDS_LINK_DEST, QFile::decodeName(file.linkDest));
+
+    QHash<uint, QString>::const_iterator user = m_userNames.constFind(file.buff.st_uid);
+    if (user == m_userNames.constEnd())
+        user = m_userNames.insert(file.buff.st_uid, KUser(file.buff.st_uid).loginName());
+    uds.insert(KIO::UDSEntry::UDS_USER, *user);
+    QHash<uint, QString>::const_iterator group = m_groupNames.constFind(file.buff.st_gid);
+    if (group == m_groupNames.constEnd())
+        group = m_groupNames.insert(file.buff.st_gid, KUserGroup(file.buff.st_gid).name());
+    uds.insert(KIO::UDSEntry::UDS_GROUP, *group);
+    return uds;
+}
+
 void RecentDocuments::prepareUDSEntry(KIO::UDSEntry& entry, bool listing) const
 {
     ForwardingSlaveBase::prepareUDSEntry(entry, listing);
@@ -3,7 +3,10 @@
 
 #include <KIO/ForwardingSlaveBase>
 
+#include "recentdocumentsindex.h"
+
 class KDirWatch;
+struct LocalFileStat;
 
 class RecentDocuments : public KIO::ForwardingSlaveBase
 {
@@ -20,7 +23,12 @@ protected:
     virtual void mimetype(const KUrl& url);
     virtual void del(const KUrl& url, bool isfile);
 private:
+    KIO::UDSEntry localFileEntry(const LocalFileStat& file);
+
     KDirWatch* m_recentDocWatch;
+    RecentDocumentsIndex m_index;
+    QHash<uint, QString> m_userNames;
+    QHash<uint, QString> m_groupNames;
 };
 
 #endif
@@ -0,0 +1,177 @@
+#include "recentdocumentsindex.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QUrl>
+
+#include <KDebug>
+#include <KDesktopFile>
+#include <KRecentDocument>
+#include <KSaveFile>
+#include <KStandardDirs>
+#include <kde_file.h>
+
+// The index has a first line "R1", then "<mtime> <file name> <url> <icon>"
+// for each .desktop file, with all but the mtime percent encoded.
+#define INDEX_NAME "recentdocuments-index"
+#define INDEX_VERSION "R1"
+
+static qint64 modificationTime(const QString &path)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0)
+        return -1;
+    return buff.st_mtime;
+}
+
+static bool moreRecent(const RecentDocumentsIndex::Document &a, const RecentDocumentsIndex::Document &b)
+{
+    if (a.mtime != b.mtime)
+        return a.mtime > b.mtime;
+    return a.fileName < b.fileName;
+}
+
+RecentDocumentsIndex::RecentDocumentsIndex()
+    : m_directory(KRecentDocument::recentDocumentDirectory()),
+      m_indexPath(KStandardDirs::locateLocal("cache", INDEX_NAME)),
+      m_indexMtime(-1),
+      m_changed(false)
+{
+}
+
+QList<RecentDocumentsIndex::Document> RecentDocumentsIndex::documents()
+{
+    refresh();
+
+    QDir dir(m_directory, "*.desktop", QDir::NoSort, QDir::Files | QDir::Readable | QDir::Hidden);
+    const QFileInfoList infos = dir.entryInfoList();
+    QSet<QString> fileNames;
+    Q_FOREACH(const QFileInfo & info, infos) {
+        const QString fileName = info.fileName();
+        fileNames.insert(fileName);
+        update(fileName, info.lastModified().toTime_t());
+    }
+
+    QHash<QString, Document>::iterator it = m_documents.begin();
+    while (it != m_documents.end()) {
+        if (fileNames.contains(it.key())) {
+            ++it;
+        } else {
+            it = m_documents.erase(it);
+            m_changed = true;
+        }
+    }
+
+    if (m_changed)
+        save();
+
+    QList<Document> documents;
+    Q_FOREACH(const Document & document, m_documents) {
+        if (!document.url.isEmpty())
+            documents.append(document);
+    }
+    qSort(documents.begin(), documents.end(), moreRecent);
+    return documents;
+}
+
+bool RecentDocumentsIndex::document(const QString &fileName, Document &document)
+{
+    if (fileName.contains(QLatin1Char('/')))
+        return false;
+
+    const qint64 mtime = modificationTime(m_directory + QLatin1Char('/') + fileName);
+    if (mtime == -1)
+        return false;
+
+    refresh();
+    update(fileName, mtime);
+    document = m_documents.value(fileName);
+    return !document.url.isEmpty();
+}
+
+void RecentDocumentsIndex::refresh()
+{
+    // Pick up what other processes added to the index
+    const qint64 indexMtime = modificationTime(m_indexPath);
+    if (indexMtime != -1 && indexMtime != m_indexMtime)
+        load();
+}
+
+void RecentDocumentsIndex::update(const QString &fileName, qint64 mtime)
+{
+    QHash<QString, Document>::const_iterator it = m_documents.constFind(fileName);
+    if (it != m_documents.constEnd() && it->mtime == mtime)
+        return;
+
+    // Files which are not links are kept too, so that they are not read again
+    Document document;
+    document.fileName = fileName;
+    document.mtime = mtime;
+    const QString path = m_directory + QLatin1Char('/') + fileName;
+    if (KDesktopFile::isDesktopFile(path)) {
+        KDesktopFile file(path);
+        if (file.hasLinkType()) {
+            document.url = file.readUrl();
+            document.icon = file.readIcon();
+        }
+    }
+    m_documents.insert(fileName, document);
+    m_changed = true;
+}
+
+void RecentDocumentsIndex::load()
+{
+    QFile file(m_indexPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    // A broken index is not read again, it is replaced on the next change
+    m_indexMtime = modificationTime(m_indexPath);
+    if (file.readLine() != INDEX_VERSION "\n")
+        return;
+
+    QHash<QString, Document> documents;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        if (!line.endsWith('\n'))
+            return; // truncated
+        line.chop(1);
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.count() != 4)
+            return;
+        Document document;
+        bool isOk = false;
+        document.mtime = fields.at(0).toLongLong(&isOk);
+        if (!isOk)
+            return;
+        document.fileName = QFile::decodeName(QByteArray::fromPercentEncoding(fields.at(1)));
+        document.url = QUrl::fromPercentEncoding(fields.at(2));
+        document.icon = QUrl::fromPercentEncoding(fields.at(3));
+        documents.insert(document.fileName, document);
+    }
+
+    m_documents = documents;
+    m_changed = false;
+}
+
+void RecentDocumentsIndex::save()
+{
+    KSaveFile file(m_indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        kWarning() << "Could not write" << m_indexPath;
+        return;
+    }
+
+    file.write(INDEX_VERSION "\n");
+    Q_FOREACH(const Document & document, m_documents) {
+        file.write(QByteArray::number(document.mtime) + ' ' +
+                   QFile::encodeName(document.fileName).toPercentEncoding() + ' ' +
+                   QUrl::toPercentEncoding(document.url) + ' ' +
+                   QUrl::toPercentEncoding(document.icon) + '\n');
+    }
+    if (file.finalize()) {
+        m_indexMtime = modificationTime(m_indexPath);
+        m_changed = false;
+    }
+}
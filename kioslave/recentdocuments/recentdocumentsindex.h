@@ -0,0 +1,54 @@
+#ifndef RECENTDOCUMENTSINDEX_H
+#define RECENTDOCUMENTSINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+/**
+ * The URL and icon of every .desktop file in the recent documents directory.
+ *
+ * A .desktop file is only parsed again when its modification time changed.
+ * The index is saved in the cache directory, where the recent documents
+ * notifier keeps it up to date, so that a newly started slave does not have
+ * to parse all of them.
+ */
+class RecentDocumentsIndex
+{
+public:
+    struct Document
+    {
+        QString fileName;   ///< Name of the .desktop file
+        qint64 mtime;       ///< Modification time of the .desktop file
+        QString url;        ///< Empty if the file is not a link
+        QString icon;
+    };
+
+    RecentDocumentsIndex();
+
+    /**
+     * Brings the index up to date with the recent documents directory and
+     * returns the documents, the most recently used first.
+     */
+    QList<Document> documents();
+
+    /**
+     * Looks up the document of the .desktop file @p fileName, checking
+     * only this file. Returns false if it does not exist or is not a link.
+     */
+    bool document(const QString &fileName, Document &document);
+
+private:
+    void refresh();
+    void update(const QString &fileName, qint64 mtime);
+    void load();
+    void save();
+
+    QString m_directory;
+    QString m_indexPath;
+    QHash<QString, Document> m_documents;
+    qint64 m_indexMtime;   ///< Modification time of the index file when it was last loaded or saved
+    bool m_changed;        ///< Documents were read since the index was saved
+};
+
+#endif
@@ -22,11 +22,17 @@ RecentDocumentsNotifier::RecentDocumentsNotifier(QObject *parent, const QList<QV
     connect(dirWatch, SIGNAL(created(QString)), this, SLOT(dirty(QString)));
     connect(dirWatch, SIGNAL(deleted(QString)), this, SLOT(dirty(QString)));
     connect(dirWatch, SIGNAL(dirty(QString)), this, SLOT(dirty(QString)));
+
+    index.documents();
 }
 
 void RecentDocumentsNotifier::dirty(const QString &path)
 {
     if (path.endsWith(".desktop")) {
+        // Keep the index of the slaves up to date, so that they do not
+        // have to read the .desktop file themselves
+        index.documents();
+
         // Emitting FilesAdded forces a re-read of the dir
         KUrl url("recentdocuments:/");
         QFileInfo info(path);
@@ -4,6 +4,8 @@
 #include <KDEDModule>
 #include <QtDBus/QtDBus>
 
+#include "recentdocumentsindex.h"
+
 class KDirWatch;
 
 class RecentDocumentsNotifier : public KDEDModule
@@ -19,6 +21,7 @@ private slots:
 
 private:
     KDirWatch *dirWatch;
+    RecentDocumentsIndex index;
 };
 
 #endif
@@ -30,11 +30,16 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QBuffer>
 #include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
 #include <QtCore/QObject>
+#include <QtCore/QScopedPointer>
 #include <QtCore/QString>
 #include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
 
 #include <kapplication.h>
 #include <kuser.h>
@@ -61,6 +66,30 @@
 // Maximum amount of data which can be sent from the KIOSlave in one chunk
 // see TransferJob::slotDataReq (max_size variable) for the value
 #define MAX_TRANSFER_SIZE (14 * 1024 * 1024)
+// Bounds of the number of parallel read requests, see sftpProtocol::ReadWindow
+#define MIN_PENDING_READS 2
+#define MAX_PENDING_READS 64
+// Upper bound of the receive buffer of a GetRequest
+#define MAX_READ_BUFFER_SIZE (MAX_PENDING_READS * MAX_XFER_BUF_SIZE)
+// Number of directory entries whose symlinks are resolved with one BatchRequest
+#define LIST_BATCH_SIZE 128
+// Seconds a stat() may be answered from the entries of the last listDir(),
+// can be changed with the AttributeCacheTimeout config entry (0 disables it)
+#define DEFAULT_ATTRIBUTE_CACHE_TIMEOUT 3
+#define MAX_CACHED_ENTRIES 20000
+// Files up to this size are moved in memory by copyFiles, bigger ones one by one
+#define SMALL_FILE_SIZE (1024 * 1024)
+// Number of files copyFiles handles per channel and round trip
+#define FILES_PER_ROUND 16
+// Default number of SFTP channels used by copyFiles (CopyChannels config entry)
+#define DEFAULT_COPY_CHANNELS 4
+// Size of the read and write requests of copyFiles, accepted by every server
+#define COPY_CHUNK_SIZE (32 * 1024)
+// Commands of sftpProtocol::special
+#define SFTP_SPECIAL_COPY_FILES 1
+// Default number of unacknowledged write requests during uploads, can be
+// changed with the MaxPendingWrites and WriteChunkSize config entries.
+#define DEFAULT_MAX_PENDING_WRITES 16
 
 using namespace KIO;
 extern "C"
@@ -447,7 +476,7 @@ QString sftpProtocol::canonicalizePath(const QString &path) {
 
 sftpProtocol::sftpProtocol(const QByteArray &pool_socket, const QByteArray &app_socket)
              : SlaveBase("kio_sftp", pool_socket, app_socket),
-               mConnected(false), mPort(-1), mSession(NULL), mSftp(NULL), mPublicKeyAuthInfo(0) {
+               mConnected(false), mPort(-1), mSession(NULL), mSftp(NULL), mPublicKeyAuthInfo(0), mBatch(0) {
 #ifndef Q_WS_WIN
   kDebug(KIO_SFTP_DB) << "pid = " << getpid();
 
@@ -909,6 +938,10 @@ void sftpProtocol::openConnection() {
 void sftpProtocol::closeConnection() {
   kDebug(KIO_SFTP_DB);
 
+  delete mBatch;
+  mBatch = 0;
+  mAttributeCache.clear();
+
   if (mSftp) {
     sftp_free(mSftp);
     mSftp = NULL;
@@ -919,11 +952,34 @@ void sftpProtocol::closeConnection() {
     mSession = NULL;
   }
 
+  mReadWindow.reset();
   mConnected = false;
 }
 
-void sftpProtocol::special(const QByteArray &) {
+void sftpProtocol::special(const QByteArray &data) {
     int rc;
+
+    if (!data.isEmpty()) {
+        QDataStream stream(data);
+        int command;
+        stream >> command;
+
+        switch (command) {
+        case SFTP_SPECIAL_COPY_FILES: {
+            // KUrl::List sources, KUrl::List destinations, int permissions, int flags
+            KUrl::List sources, destinations;
+            int permissions, flags;
+            stream >> sources >> destinations >> permissions >> flags;
+            copyFiles(sources, destinations, permissions, KIO::JobFlags(QFlag(flags)));
+            break;
+        }
+        default:
+            error(KIO::ERR_UNSUPPORTED_ACTION, QString::number(command));
+            break;
+        }
+        return;
+    }
+
     kDebug(KIO_SFTP_DB) << "special(): polling";
 
     if (!mSftp)
@@ -988,6 +1044,10 @@ void sftpProtocol::open(const KUrl &url, QIODevice::OpenMode mode) {
   KIO::filesize_t fileSize = sb->size;
   sftp_attributes_free(sb);
 
+  if (mode & QIODevice::WriteOnly) {
+    mAttributeCache.clear();
+  }
+
   int flags = 0;
 
   if (mode & QIODevice::ReadOnly) {
@@ -1212,7 +1272,7 @@ sftpProtocol::StatusCode sftpProtocol::sftpGet(const KUrl& url, int& errorCode,
   }
 
   bytesread = 0;
-  sftpProtocol::GetRequest request(file, sb);
+  sftpProtocol::GetRequest request(file, sb, mReadWindow);
 
   for (;;) {
     // Enqueue get requests
@@ -1245,6 +1305,7 @@ sftpProtocol::StatusCode sftpProtocol::sftpGet(const KUrl& url, int& errorCode,
     processedSize(totalbytesread);
   }
 
+  reportReadWindow();
   if (fd == -1)
       data(QByteArray());
 
@@ -1279,6 +1340,9 @@ sftpProtocol::StatusCode sftpProtocol::sftpPut(const KUrl& url, int permissions,
                       << ", overwrite =" << (flags & KIO::Overwrite)
                       << ", resume =" << (flags & KIO::Resume);
 
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
   if (!sftpLogin()) {
     return sftpProtocol::ServerError;
   }
@@ -1346,8 +1410,11 @@ sftpProtocol::StatusCode sftpProtocol::sftpPut(const KUrl& url, int permissions,
   QByteArray dest;
   int result = -1;
   sftp_file file = NULL;
+  QScopedPointer<sftpProtocol::PutRequest> request;
   StatusCode cs = sftpProtocol::Success;
   KIO::fileoffset_t totalBytesSent = 0;
+  const int maxPendingWrites = qBound(1, config()->readEntry("MaxPendingWrites", DEFAULT_MAX_PENDING_WRITES), 256);
+  const int writeChunkSize = qBound(1024, config()->readEntry("WriteChunkSize", MAX_XFER_BUF_SIZE), MAX_XFER_BUF_SIZE);
 
   // Loop until we got 0 (end of data)
   do {
@@ -1420,20 +1487,34 @@ sftpProtocol::StatusCode sftpProtocol::sftpPut(const KUrl& url, int permissions,
           result = -1;
           continue;
         } // file
+
+        request.reset(new sftpProtocol::PutRequest(file, maxPendingWrites, writeChunkSize));
       } // dest.isEmpty
 
-      ssize_t bytesWritten = sftp_write(file, buffer.data(), buffer.size());
+      const qint64 bytesWritten = request->writeChunks(buffer.constData(), buffer.size());
       if (bytesWritten < 0) {
         errorCode = KIO::ERR_COULD_NOT_WRITE;
         result = -1;
       } else {
-        totalBytesSent += bytesWritten;
-        emit processedSize(totalBytesSent);
+        emit processedSize(totalBytesSent + bytesWritten);
       }
     } // result
   } while (result > 0);
   sftp_attributes_free(sb);
 
+  // Wait for the outstanding write requests before closing the file
+  if (result == 0 && request) {
+    const qint64 bytesWritten = request->flush();
+    if (bytesWritten < 0) {
+      errorCode = KIO::ERR_COULD_NOT_WRITE;
+      result = -1;
+    } else {
+      totalBytesSent += bytesWritten;
+      emit processedSize(totalBytesSent);
+    }
+  }
+  request.reset();
+
   // An error occurred deal with it.
   if (result < 0) {
     kDebug(KIO_SFTP_DB) << "Error during 'put'. Aborting.";
@@ -1547,6 +1628,9 @@ void sftpProtocol::copy(const KUrl &src, const KUrl &dest, int permissions, KIO:
     cs = sftpCopyPut(dest, sCopyFile, permissions, flags, errorCode);
     if (cs == sftpProtocol::ServerError)
         sCopyFile = dest.url();
+  } else if (!isSourceLocal && !isDestinationLocal) {          // sftp -> sftp on the same host
+    sCopyFile = dest.url();
+    cs = sftpCopySame(src, dest, permissions, flags, errorCode);
   } else {
     errorCode = KIO::ERR_UNSUPPORTED_ACTION;
     sCopyFile.clear();
@@ -1707,6 +1791,521 @@ sftpProtocol::StatusCode sftpProtocol::sftpCopyPut(const KUrl& url, const QStrin
   return ret;
 }
 
+sftpProtocol::StatusCode sftpProtocol::sftpCopySame(const KUrl& src, const KUrl& dest, int permissions, JobFlags flags, int& errorCode)
+{
+  kDebug(KIO_SFTP_DB) << src << "->" << dest << ", permissions=" << permissions << ", flags" << flags;
+
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
+  if (!sftpLogin()) {
+    return sftpProtocol::ServerError;
+  }
+
+  const QByteArray srcPath = src.path().toUtf8();
+  const QByteArray destPath = dest.path().toUtf8();
+
+  sftp_attributes sb = sftp_stat(mSftp, srcPath.constData());
+  if (sb == NULL) {
+    errorCode = toKIOError(sftp_get_error(mSftp));
+    return sftpProtocol::ServerError;
+  }
+
+  if (sb->type == SSH_FILEXFER_TYPE_DIRECTORY) {
+    errorCode = KIO::ERR_IS_DIRECTORY;
+    sftp_attributes_free(sb);
+    return sftpProtocol::ServerError;
+  }
+
+  sftp_attributes destSb = sftp_lstat(mSftp, destPath.constData());
+  if (destSb != NULL) {
+    const bool isDir = (destSb->type == SSH_FILEXFER_TYPE_DIRECTORY);
+    sftp_attributes_free(destSb);
+
+    if (isDir) {
+      errorCode = KIO::ERR_DIR_ALREADY_EXIST;
+    } else if (!(flags & KIO::Overwrite)) {
+      errorCode = KIO::ERR_FILE_ALREADY_EXIST;
+    }
+    if (errorCode) {
+      sftp_attributes_free(sb);
+      return sftpProtocol::ServerError;
+    }
+  }
+
+  const KIO::filesize_t size = sb->size;
+  totalSize(size);
+
+  if (sftpServerCopy(srcPath, destPath, permissions, flags)) {
+    sftp_attributes_free(sb);
+  } else {
+    // The server can not copy by itself, move the data through the slave
+    sftp_file srcFile = sftp_open(mSftp, srcPath.constData(), O_RDONLY, 0);
+    if (srcFile == NULL) {
+      errorCode = KIO::ERR_CANNOT_OPEN_FOR_READING;
+      sftp_attributes_free(sb);
+      return sftpProtocol::ServerError;
+    }
+
+    const mode_t initialMode = (permissions != -1 ? (permissions | S_IWUSR | S_IRUSR) : 0644);
+    sftp_file destFile = sftp_open(mSftp, destPath.constData(), O_CREAT | O_TRUNC | O_WRONLY, initialMode);
+    if (destFile == NULL) {
+      if (sftp_get_error(mSftp) == SSH_FX_PERMISSION_DENIED) {
+        errorCode = KIO::ERR_WRITE_ACCESS_DENIED;
+      } else {
+        errorCode = KIO::ERR_CANNOT_OPEN_FOR_WRITING;
+      }
+      sftp_close(srcFile);
+      sftp_attributes_free(sb);
+      return sftpProtocol::ServerError;
+    }
+
+    const int maxPendingWrites = qBound(1, config()->readEntry("MaxPendingWrites", DEFAULT_MAX_PENDING_WRITES), 256);
+    const int writeChunkSize = qBound(1024, config()->readEntry("WriteChunkSize", MAX_XFER_BUF_SIZE), MAX_XFER_BUF_SIZE);
+    StatusCode cs = sftpProtocol::Success;
+    {
+      // GetRequest closes srcFile and frees sb
+      sftpProtocol::GetRequest getRequest(srcFile, sb, mReadWindow);
+      sftpProtocol::PutRequest putRequest(destFile, maxPendingWrites, writeChunkSize);
+      QByteArray buffer;
+
+      for (;;) {
+        if (!getRequest.enqueueChunks()) {
+          errorCode = KIO::ERR_COULD_NOT_READ;
+          cs = sftpProtocol::ServerError;
+          break;
+        }
+
+        const int bytesread = getRequest.readChunks(buffer);
+        if (bytesread == -1) {
+          errorCode = KIO::ERR_COULD_NOT_READ;
+          cs = sftpProtocol::ServerError;
+          break;
+        } else if (bytesread == 0) {
+          if (srcFile->eof)
+            break;
+          else
+            continue;
+        }
+
+        const qint64 bytesWritten = putRequest.writeChunks(buffer.constData(), bytesread);
+        if (bytesWritten < 0) {
+          errorCode = KIO::ERR_COULD_NOT_WRITE;
+          cs = sftpProtocol::ServerError;
+          break;
+        }
+        processedSize(bytesWritten);
+      }
+
+      reportReadWindow();
+      if (cs == sftpProtocol::Success && putRequest.flush() < 0) {
+        errorCode = KIO::ERR_COULD_NOT_WRITE;
+        cs = sftpProtocol::ServerError;
+      }
+    }
+
+    if (sftp_close(destFile) < 0 && cs == sftpProtocol::Success) {
+      errorCode = KIO::ERR_COULD_NOT_WRITE;
+      cs = sftpProtocol::ServerError;
+    }
+
+    if (cs != sftpProtocol::Success) {
+      sftp_unlink(mSftp, destPath.constData());
+      return cs;
+    }
+  }
+
+  processedSize(size);
+
+  // set final permissions
+  if (permissions != -1) {
+    kDebug(KIO_SFTP_DB) << "Trying to set final permissions of " << dest << " to " << QString::number(permissions);
+    if (sftp_chmod(mSftp, destPath.constData(), permissions) < 0) {
+      errorCode = -1;  // force copy to call sftpSendWarning...
+      return sftpProtocol::ServerError;
+    }
+  }
+
+  return sftpProtocol::Success;
+}
+
+bool sftpProtocol::sftpServerCopy(const QByteArray& src, const QByteArray& dest, int permissions, JobFlags flags)
+{
+  BatchRequest *batch = batchRequest();
+  if (batch == NULL) {
+    return false;
+  }
+
+  // copy-file: string source, string destination, bool overwrite
+  if (batch->hasExtension("copy-file")) {
+    QByteArray data;
+    appendString(data, src);
+    appendString(data, dest);
+    data.append(char((flags & KIO::Overwrite) ? 1 : 0));
+
+    const quint32 id = batch->extended("copy-file", data);
+    if (batch->exec() && batch->status(id) == SSH_FX_OK) {
+      kDebug(KIO_SFTP_DB) << "copied on the server with copy-file";
+      return true;
+    }
+  }
+
+  if (!batch->isValid() || !batch->hasExtension("copy-data")) {
+    return false;
+  }
+
+  const int initialMode = (permissions != -1 ? (permissions | S_IWUSR | S_IRUSR) : 0644);
+  const quint32 readId = batch->open(src, SSH_FXF_READ);
+  const quint32 writeId = batch->open(dest, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC, initialMode);
+  if (!batch->exec()) {
+    return false;
+  }
+
+  const QByteArray readHandle = batch->handle(readId);
+  const QByteArray writeHandle = batch->handle(writeId);
+  bool copied = false;
+
+  // copy-data: string read handle, uint64 read offset, uint64 length (0 until EOF),
+  //            string write handle, uint64 write offset
+  if (!readHandle.isNull() && !writeHandle.isNull()) {
+    QByteArray data;
+    appendString(data, readHandle);
+    appendUint64(data, 0);
+    appendUint64(data, 0);
+    appendString(data, writeHandle);
+    appendUint64(data, 0);
+
+    const quint32 id = batch->extended("copy-data", data);
+    copied = batch->exec() && batch->status(id) == SSH_FX_OK;
+  }
+
+  quint32 closeId = 0;
+  if (!readHandle.isNull()) {
+    batch->close(readHandle);
+  }
+  if (!writeHandle.isNull()) {
+    closeId = batch->close(writeHandle);
+  }
+  if (!batch->exec() || (closeId != 0 && batch->status(closeId) != SSH_FX_OK)) {
+    copied = false;
+  }
+
+  kDebug(KIO_SFTP_DB) << "copied on the server with copy-data:" << copied;
+  return copied;
+}
+
+namespace {
+/**
+ * A file transferred by sftpProtocol::copyFiles
+ */
+struct CopyItem {
+  bool upload;
+  KUrl remote;
+  QString local;
+  QByteArray path;
+  KIO::filesize_t size;
+  bool large;
+  bool failed;
+  int channel;
+  quint32 statId;
+  quint32 openId;
+  QList<quint32> ids;
+  QByteArray handle;
+  QByteArray data;
+};
+}
+
+// Sends the requests of all channels before waiting for the first reply,
+// so that the channels are processed by the server at the same time
+bool sftpProtocol::execAll(const QList<BatchRequest*>& channels)
+{
+  bool ok = true;
+  foreach (BatchRequest *channel, channels) {
+    ok = channel->send() && ok;
+  }
+  foreach (BatchRequest *channel, channels) {
+    ok = channel->receive() && ok;
+  }
+  return ok;
+}
+
+void sftpProtocol::copyFiles(const KUrl::List& sources, const KUrl::List& destinations, int permissions, JobFlags flags)
+{
+  kDebug(KIO_SFTP_DB) << sources.count() << "files, permissions=" << permissions << ", flags" << flags;
+
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
+  if (!sftpLogin()) {
+    return;
+  }
+
+  if (sources.count() != destinations.count()) {
+    error(KIO::ERR_INTERNAL, i18n("The number of sources and destinations differs."));
+    return;
+  }
+
+  QList<CopyItem> items;
+  for (int i = 0; i < sources.count(); ++i) {
+    const KUrl &src = sources.at(i);
+    const KUrl &dest = destinations.at(i);
+    CopyItem item;
+
+    if (src.isLocalFile() == dest.isLocalFile()) {
+      error(KIO::ERR_UNSUPPORTED_ACTION, src.prettyUrl());
+      return;
+    }
+
+    item.upload = src.isLocalFile();
+    item.remote = (item.upload ? dest : src);
+    item.local = (item.upload ? src.toLocalFile() : dest.toLocalFile());
+    item.path = item.remote.path().toUtf8();
+    item.size = 0;
+    item.large = false;
+    item.failed = false;
+    item.channel = -1;
+    item.statId = item.openId = 0;
+
+    const QFileInfo info(item.local);
+    if (item.upload) {
+      if (!info.exists()) {
+        error(KIO::ERR_DOES_NOT_EXIST, item.local);
+        return;
+      }
+      if (info.isDir()) {
+        error(KIO::ERR_IS_DIRECTORY, item.local);
+        return;
+      }
+      item.size = info.size();
+      item.large = (item.size > SMALL_FILE_SIZE);
+    } else if (info.exists() && !(flags & KIO::Overwrite)) {
+      error(info.isDir() ? KIO::ERR_DIR_ALREADY_EXIST : KIO::ERR_FILE_ALREADY_EXIST, item.local);
+      return;
+    }
+
+    items.append(item);
+  }
+
+  // Every channel gets its own sftp-server process on the remote side
+  const int channelCount = qBound(1, config()->readEntry("CopyChannels", DEFAULT_COPY_CHANNELS), 16);
+  QList<BatchRequest*> channels;
+  while (channels.count() < channelCount) {
+    BatchRequest *channel = new BatchRequest(mSession);
+    if (!channel->isValid()) {
+      delete channel;
+      break;
+    }
+    channels.append(channel);
+  }
+  kDebug(KIO_SFTP_DB) << "using" << channels.count() << "channels";
+
+  const mode_t initialMode = (permissions != -1 ? (permissions | S_IWUSR | S_IRUSR) : 0644);
+  KIO::filesize_t processed = 0;
+  int errorCode = 0;
+  QString errorUrl;
+  int next = 0;
+
+  while (next < items.count() && errorCode == 0 && !channels.isEmpty()) {
+    QList<int> round;
+
+    // Assign the next small files to the channels and open them
+    for (int c = 0; c < channels.count(); ++c) {
+      int assigned = 0;
+      while (next < items.count() && assigned < FILES_PER_ROUND) {
+        CopyItem &item = items[next++];
+        if (item.large) {
+          continue;
+        }
+
+        item.channel = c;
+        if (item.upload) {
+          quint32 openFlags = SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC;
+          if (!(flags & KIO::Overwrite)) {
+            openFlags |= SSH_FXF_EXCL;
+          }
+          item.openId = channels.at(c)->open(item.path, openFlags, initialMode);
+        } else {
+          item.statId = channels.at(c)->stat(item.path);
+          item.openId = channels.at(c)->open(item.path, SSH_FXF_READ);
+        }
+        round.append(next - 1);
+        ++assigned;
+      }
+    }
+
+    if (round.isEmpty()) {
+      continue;
+    }
+
+    if (!execAll(channels)) {
+      errorCode = KIO::ERR_CONNECTION_BROKEN;
+      errorUrl = items.at(round.first()).remote.prettyUrl();
+      break;
+    }
+
+    // Queue the data transfer
+    foreach (int i, round) {
+      CopyItem &item = items[i];
+      BatchRequest *channel = channels.at(item.channel);
+
+      item.handle = channel->handle(item.openId);
+      if (item.handle.isNull()) {
+        const int status = channel->status(item.openId);
+        if (status == SSH_FX_PERMISSION_DENIED) {
+          errorCode = (item.upload ? KIO::ERR_WRITE_ACCESS_DENIED : KIO::ERR_ACCESS_DENIED);
+        } else if (status == SSH_FX_FILE_ALREADY_EXISTS || (item.upload && status == SSH_FX_FAILURE && !(flags & KIO::Overwrite))) {
+          errorCode = KIO::ERR_FILE_ALREADY_EXIST;
+        } else {
+          errorCode = (item.upload ? KIO::ERR_CANNOT_OPEN_FOR_WRITING : KIO::ERR_CANNOT_OPEN_FOR_READING);
+        }
+        errorUrl = item.remote.prettyUrl();
+        item.failed = true;
+        continue;
+      }
+
+      if (item.upload) {
+        QFile file(item.local);
+        if (!file.open(QIODevice::ReadOnly)) {
+          errorCode = KIO::ERR_CANNOT_OPEN_FOR_READING;
+          errorUrl = item.local;
+          item.failed = true;
+          continue;
+        }
+        item.data = file.readAll();
+        for (int offset = 0; offset < item.data.size(); offset += COPY_CHUNK_SIZE) {
+          const int len = qMin(COPY_CHUNK_SIZE, item.data.size() - offset);
+          item.ids.append(channel->write(item.handle, offset, item.data.constData() + offset, len));
+        }
+      } else {
+        sftp_attributes sb = channel->takeAttributes(item.statId);
+        if (sb == NULL || sb->type == SSH_FILEXFER_TYPE_DIRECTORY) {
+          errorCode = (sb == NULL ? KIO::ERR_DOES_NOT_EXIST : KIO::ERR_IS_DIRECTORY);
+          errorUrl = item.remote.prettyUrl();
+          item.failed = true;
+        } else {
+          item.size = sb->size;
+          item.large = (item.size > SMALL_FILE_SIZE);
+        }
+        sftp_attributes_free(sb);
+
+        for (KIO::filesize_t offset = 0; !item.failed && !item.large && offset < item.size; offset += COPY_CHUNK_SIZE) {
+          const quint32 len = qMin<KIO::filesize_t>(COPY_CHUNK_SIZE, item.size - offset);
+          item.ids.append(channel->read(item.handle, offset, len));
+        }
+      }
+    }
+
+    if (!execAll(channels)) {
+      errorCode = KIO::ERR_CONNECTION_BROKEN;
+      errorUrl = items.at(round.first()).remote.prettyUrl();
+      break;
+    }
+
+    // Collect the results and close the files
+    foreach (int i, round) {
+      CopyItem &item = items[i];
+      BatchRequest *channel = channels.at(item.channel);
+
+      if (item.handle.isNull()) {
+        continue;
+      }
+
+      if (!item.failed && item.upload) {
+        foreach (quint32 id, item.ids) {
+          if (channel->status(id) != SSH_FX_OK) {
+            errorCode = KIO::ERR_COULD_NOT_WRITE;
+            errorUrl = item.remote.prettyUrl();
+            item.failed = true;
+            break;
+          }
+        }
+      } else if (!item.failed && !item.large) {
+        item.data.clear();
+        for (int j = 0; j < item.ids.count(); ++j) {
+          const QByteArray chunk = channel->data(item.ids.at(j));
+          const int expected = qMin<KIO::filesize_t>(COPY_CHUNK_SIZE, item.size - KIO::filesize_t(j) * COPY_CHUNK_SIZE);
+          if (chunk.size() != expected) {
+            // Short read or file changed meanwhile, transfer it one by one
+            item.large = true;
+            break;
+          }
+          item.data.append(chunk);
+        }
+
+        if (!item.large) {
+          QFile file(item.local);
+          if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+              file.write(item.data) != item.data.size()) {
+            errorCode = (file.error() == QFile::OpenError ? KIO::ERR_CANNOT_OPEN_FOR_WRITING : KIO::ERR_COULD_NOT_WRITE);
+            errorUrl = item.local;
+            item.failed = true;
+          } else if (permissions != -1) {
+            ::chmod(QFile::encodeName(item.local).constData(), permissions);
+          }
+        }
+      }
+
+      item.ids.clear();
+      item.ids.append(channel->close(item.handle));
+    }
+
+    if (!execAll(channels)) {
+      errorCode = KIO::ERR_CONNECTION_BROKEN;
+      errorUrl = items.at(round.first()).remote.prettyUrl();
+      break;
+    }
+
+    foreach (int i, round) {
+      CopyItem &item = items[i];
+      if (item.handle.isNull() || item.failed || item.large) {
+        continue;
+      }
+
+      if (item.upload && channels.at(item.channel)->status(item.ids.first()) != SSH_FX_OK) {
+        errorCode = KIO::ERR_COULD_NOT_WRITE;
+        errorUrl = item.remote.prettyUrl();
+        item.failed = true;
+        continue;
+      }
+
+      processed += item.size;
+      item.data.clear();
+    }
+    processedSize(processed);
+  }
+
+  qDeleteAll(channels);
+
+  // Big files and the ones which could not be handled above
+  for (int i = 0; i < items.count() && errorCode == 0; ++i) {
+    CopyItem &item = items[i];
+    if (!channels.isEmpty() && !item.large) {
+      continue;
+    }
+
+    int copyError = 0;
+    StatusCode cs;
+    if (item.upload) {
+      cs = sftpCopyPut(item.remote, item.local, permissions, flags, copyError);
+    } else {
+      cs = sftpCopyGet(item.remote, item.local, permissions, flags, copyError);
+    }
+
+    if (copyError < 0) {
+      sftpSendWarning(copyError, item.remote.prettyUrl());
+    } else if (cs != sftpProtocol::Success) {
+      errorCode = (copyError ? copyError : KIO::ERR_INTERNAL);
+      errorUrl = (cs == sftpProtocol::ServerError ? item.remote.prettyUrl() : item.local);
+    }
+  }
+
+  if (errorCode) {
+    error(errorCode, errorUrl);
+    return;
+  }
+
+  finished();
+}
 
 void sftpProtocol::stat(const KUrl& url) {
   kDebug(KIO_SFTP_DB) << url;
@@ -1745,6 +2344,13 @@ void sftpProtocol::stat(const KUrl& url) {
   const int details = sDetails.isEmpty() ? 2 : sDetails.toInt();
 
   UDSEntry entry;
+  if (cachedEntry(path, details, entry)) {
+    kDebug(KIO_SFTP_DB) << "using cached entry for" << path;
+    statEntry(entry);
+    finished();
+    return;
+  }
+
   entry.clear();
   if (!createUDSEntry(url.fileName(), path, entry, details)) {
     error(KIO::ERR_DOES_NOT_EXIST, url.prettyUrl());
@@ -1812,105 +2418,225 @@ void sftpProtocol::listDir(const KUrl& url) {
   sftp_attributes dirent = NULL;
   const QString sDetails = metaData(QLatin1String("details"));
   const int details = sDetails.isEmpty() ? 2 : sDetails.toInt();
-  UDSEntry entry;
+  QList<sftp_attributes> dirents;
+  bool done = false;
 
   kDebug(KIO_SFTP_DB) << "readdir: " << path << ", details: " << QString::number(details);
 
-  for (;;) {
-    mode_t access;
-    mode_t type;
-    char *link;
-
+  // Entries are listed in batches so that the symlinks of a whole batch can
+  // be resolved at once
+  while (!done) {
     dirent = sftp_readdir(mSftp, dp);
     if (dirent == NULL) {
-      break;
+      done = true;
+    } else {
+      dirents.append(dirent);
     }
 
-    entry.clear();
-    entry.insert(KIO::UDSEntry::UDS_NAME, QFile::decodeName(dirent->name));
+    if (dirents.count() >= LIST_BATCH_SIZE || (done && !dirents.isEmpty())) {
+      const bool ok = listBatch(path, dirents, details);
+      dirents.clear(); // freed by listBatch
+      if (!ok) {
+        sftp_closedir(dp);
+        return;
+      }
+    }
+  }
+  sftp_closedir(dp);
+  listEntry(UDSEntry(), true); // ready
 
-    if (dirent->type == SSH_FILEXFER_TYPE_SYMLINK) {
-      QByteArray file = path + '/' + QFile::decodeName(dirent->name).toUtf8();
+  finished();
+}
 
-      entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
+sftpProtocol::BatchRequest *sftpProtocol::batchRequest() {
+  if (mBatch == NULL) {
+    mBatch = new BatchRequest(mSession);
+  }
+  return mBatch->isValid() ? mBatch : 0;
+}
 
-      link = sftp_readlink(mSftp, file.constData());
-      if (link == NULL) {
-        sftp_attributes_free(dirent);
-        error(KIO::ERR_INTERNAL, i18n("Could not read link: %1", QString::fromUtf8(file)));
-        return;
+bool sftpProtocol::listBatch(const QByteArray &path, const QList<sftp_attributes> &dirents, int details) {
+  const int count = dirents.count();
+  const bool batched = config()->readEntry("BatchListing", true);
+  const bool cached = config()->readEntry("AttributeCacheTimeout", DEFAULT_ATTRIBUTE_CACHE_TIMEOUT) > 0;
+  QVector<QByteArray> files(count);
+  QVector<QByteArray> links(count);
+  QVector<sftp_attributes> targets(count, NULL);
+  QVector<bool> resolved(count, false);
+  bool ok = true;
+
+  for (int i = 0; i < count; ++i) {
+    files[i] = path;
+    if (!path.endsWith('/')) {
+      files[i] += '/';
+    }
+    files[i] += QFile::decodeName(dirents.at(i)->name).toUtf8();
+  }
+
+  BatchRequest *batch = batched ? batchRequest() : 0;
+  if (batch) {
+    QVector<quint32> linkIds(count, 0);
+    QVector<quint32> statIds(count, 0);
+
+    for (int i = 0; i < count; ++i) {
+      if (dirents.at(i)->type == SSH_FILEXFER_TYPE_SYMLINK) {
+        linkIds[i] = batch->readlink(files.at(i));
+        // A symlink -> follow it only if details > 1
+        if (details > 1) {
+          statIds[i] = batch->stat(files.at(i));
+        }
       }
-      entry.insert(KIO::UDSEntry::UDS_LINK_DEST, QFile::decodeName(link));
-      delete link;
-      // A symlink -> follow it only if details > 1
-      if (details > 1) {
-        sftp_attributes sb = sftp_stat(mSftp, file.constData());
-        if (sb == NULL) {
-          // It is a link pointing to nowhere
-          type = S_IFMT - 1;
-          access = S_IRWXU | S_IRWXG | S_IRWXO;
-          entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, type);
-          entry.insert( KIO::UDSEntry::UDS_ACCESS, access);
-          entry.insert( KIO::UDSEntry::UDS_SIZE, 0LL );
+    }
 
-          goto notype;
+    if (!batch->isEmpty()) {
+      if (batch->exec()) {
+        for (int i = 0; i < count; ++i) {
+          if (linkIds.at(i) != 0) {
+            links[i] = batch->link(linkIds.at(i));
+            if (statIds.at(i) != 0) {
+              targets[i] = batch->takeAttributes(statIds.at(i));
+            }
+            resolved[i] = true;
+          }
         }
-        sftp_attributes_free(dirent);
-        dirent = sb;
+      } else {
+        kDebug(KIO_SFTP_DB) << "batch request failed, resolving links one by one";
       }
     }
+  }
 
-    switch (dirent->type) {
-      case SSH_FILEXFER_TYPE_REGULAR:
-        entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
-        break;
-      case SSH_FILEXFER_TYPE_DIRECTORY:
-        entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFDIR);
-        break;
-      case SSH_FILEXFER_TYPE_SYMLINK:
-        entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFLNK);
-        break;
-      case SSH_FILEXFER_TYPE_SPECIAL:
-      case SSH_FILEXFER_TYPE_UNKNOWN:
+  for (int i = 0; i < count; ++i) {
+    sftp_attributes dirent = dirents.at(i);
+    sftp_attributes sb = dirent;
+    bool hasType = true;
+    UDSEntry entry;
+
+    entry.insert(KIO::UDSEntry::UDS_NAME, QFile::decodeName(dirent->name));
+
+    if (dirent->type == SSH_FILEXFER_TYPE_SYMLINK) {
+      entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
+
+      if (!resolved.at(i)) {
+        char *link = sftp_readlink(mSftp, files.at(i).constData());
+        if (link != NULL) {
+          links[i] = QByteArray(link);
+          free(link);
+        }
+        if (details > 1) {
+          targets[i] = sftp_stat(mSftp, files.at(i).constData());
+        }
+      }
+
+      if (links.at(i).isNull()) {
+        error(KIO::ERR_INTERNAL, i18n("Could not read link: %1", QString::fromUtf8(files.at(i))));
+        ok = false;
         break;
+      }
+      entry.insert(KIO::UDSEntry::UDS_LINK_DEST, QFile::decodeName(links.at(i)));
+      // A symlink -> follow it only if details > 1
+      if (details > 1) {
+        if (targets.at(i) == NULL) {
+          // It is a link pointing to nowhere
+          entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFMT - 1);
+          entry.insert(KIO::UDSEntry::UDS_ACCESS, S_IRWXU | S_IRWXG | S_IRWXO);
+          entry.insert(KIO::UDSEntry::UDS_SIZE, 0LL);
+          hasType = false;
+        } else {
+          sb = targets.at(i);
+        }
+      }
     }
 
-    access = dirent->permissions & 07777;
-    entry.insert(KIO::UDSEntry::UDS_ACCESS, access);
+    if (hasType) {
+      switch (sb->type) {
+        case SSH_FILEXFER_TYPE_REGULAR:
+          entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG);
+          break;
+        case SSH_FILEXFER_TYPE_DIRECTORY:
+          entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFDIR);
+          break;
+        case SSH_FILEXFER_TYPE_SYMLINK:
+          entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, S_IFLNK);
+          break;
+        case SSH_FILEXFER_TYPE_SPECIAL:
+        case SSH_FILEXFER_TYPE_UNKNOWN:
+          break;
+      }
 
-    entry.insert(KIO::UDSEntry::UDS_SIZE, dirent->size);
+      entry.insert(KIO::UDSEntry::UDS_ACCESS, sb->permissions & 07777);
+      entry.insert(KIO::UDSEntry::UDS_SIZE, sb->size);
+    }
 
-notype:
     if (details > 0) {
-      if (dirent->owner) {
-          entry.insert(KIO::UDSEntry::UDS_USER, QString::fromUtf8(dirent->owner));
+      if (sb->owner) {
+          entry.insert(KIO::UDSEntry::UDS_USER, QString::fromUtf8(sb->owner));
       } else {
-          entry.insert(KIO::UDSEntry::UDS_USER, QString::number(dirent->uid));
+          entry.insert(KIO::UDSEntry::UDS_USER, QString::number(sb->uid));
       }
 
-      if (dirent->group) {
-          entry.insert(KIO::UDSEntry::UDS_GROUP, QString::fromUtf8(dirent->group));
+      if (sb->group) {
+          entry.insert(KIO::UDSEntry::UDS_GROUP, QString::fromUtf8(sb->group));
       } else {
-          entry.insert(KIO::UDSEntry::UDS_GROUP, QString::number(dirent->gid));
+          entry.insert(KIO::UDSEntry::UDS_GROUP, QString::number(sb->gid));
       }
 
-      entry.insert(KIO::UDSEntry::UDS_ACCESS_TIME, dirent->atime);
-      entry.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, dirent->mtime);
-      entry.insert(KIO::UDSEntry::UDS_CREATION_TIME, dirent->createtime);
+      entry.insert(KIO::UDSEntry::UDS_ACCESS_TIME, sb->atime);
+      entry.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, sb->mtime);
+      entry.insert(KIO::UDSEntry::UDS_CREATION_TIME, sb->createtime);
     }
 
-    sftp_attributes_free(dirent);
+    if (cached) {
+      cacheEntry(files.at(i), entry, details);
+    }
     listEntry(entry, false);
-  } // for ever
-  sftp_closedir(dp);
-  listEntry(entry, true); // ready
+  }
 
-  finished();
+  for (int i = 0; i < count; ++i) {
+    sftp_attributes_free(dirents.at(i));
+    sftp_attributes_free(targets.at(i));
+  }
+
+  return ok;
+}
+
+void sftpProtocol::cacheEntry(const QByteArray &path, const UDSEntry &entry, int details) {
+  if (mAttributeCache.count() >= MAX_CACHED_ENTRIES) {
+    mAttributeCache.clear();
+  }
+
+  CachedEntry &cachedEntry = mAttributeCache[path];
+  cachedEntry.entry = entry;
+  cachedEntry.details = details;
+  cachedEntry.age.start();
+}
+
+bool sftpProtocol::cachedEntry(const QByteArray &path, int details, UDSEntry &entry) {
+  QHash<QByteArray, CachedEntry>::iterator it = mAttributeCache.find(path);
+  if (it == mAttributeCache.end()) {
+    return false;
+  }
+
+  const int timeout = config()->readEntry("AttributeCacheTimeout", DEFAULT_ATTRIBUTE_CACHE_TIMEOUT);
+  if (it->age.hasExpired(timeout * 1000)) {
+    mAttributeCache.erase(it);
+    return false;
+  }
+
+  // Entries listed with less details can not answer this request
+  if (it->details < details) {
+    return false;
+  }
+
+  entry = it->entry;
+  return true;
 }
 
 void sftpProtocol::mkdir(const KUrl &url, int permissions) {
   kDebug(KIO_SFTP_DB) << "create directory: " << url;
 
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
   if (!sftpLogin()) {
     return;
   }
@@ -1960,6 +2686,9 @@ void sftpProtocol::mkdir(const KUrl &url, int permissions) {
 void sftpProtocol::rename(const KUrl& src, const KUrl& dest, KIO::JobFlags flags) {
   kDebug(KIO_SFTP_DB) << "rename " << src << " to " << dest << flags;
 
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
   if (!sftpLogin()) {
     return;
   }
@@ -2007,6 +2736,9 @@ void sftpProtocol::symlink(const QString &target, const KUrl &dest, KIO::JobFlag
                       << ", overwrite = " << (flags & KIO::Overwrite)
                       << ", resume = " << (flags & KIO::Resume);
 
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
   if (!sftpLogin()) {
     return;
   }
@@ -2044,6 +2776,9 @@ void sftpProtocol::symlink(const QString &target, const KUrl &dest, KIO::JobFlag
 void sftpProtocol::chmod(const KUrl& url, int permissions) {
   kDebug(KIO_SFTP_DB) << "change permission of " << url << " to " << QString::number(permissions);
 
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
   if (!sftpLogin()) {
     return;
   }
@@ -2061,6 +2796,9 @@ void sftpProtocol::chmod(const KUrl& url, int permissions) {
 void sftpProtocol::del(const KUrl &url, bool isfile){
   kDebug(KIO_SFTP_DB) << "deleting " << (isfile ? "file: " : "directory: ") << url;
 
+  // Cached entries may not be valid anymore
+  mAttributeCache.clear();
+
   if (!sftpLogin()) {
     return;
   }
@@ -2084,12 +2822,93 @@ void sftpProtocol::del(const KUrl &url, bool isfile){
 
 void sftpProtocol::slave_status() {
   kDebug(KIO_SFTP_DB) << "connected to " << mHost << "?: " << mConnected;
+  if (mConnected) {
+    kDebug(KIO_SFTP_DB) << "read window:" << mReadWindow.size() << "requests,"
+                        << "min rtt:" << mReadWindow.minRtt() << "us,"
+                        << "bandwidth:" << mReadWindow.bandwidth() << "bytes/s";
+  }
   slaveStatus((mConnected ? mHost : QString()), mConnected);
 }
 
-sftpProtocol::GetRequest::GetRequest(sftp_file file, sftp_attributes sb, ushort maxPendingRequests)
-    :mFile(file), mSb(sb), mMaxPendingRequests(maxPendingRequests) {
+void sftpProtocol::reportReadWindow() {
+  setMetaData(QLatin1String("sftp-read-window"), QString::number(mReadWindow.size()));
+  setMetaData(QLatin1String("sftp-min-rtt"), QString::number(mReadWindow.minRtt()));
+  setMetaData(QLatin1String("sftp-bandwidth"), QString::number(mReadWindow.bandwidth()));
+}
+
+sftpProtocol::ReadWindow::ReadWindow() {
+  reset();
+}
+
+void sftpProtocol::ReadWindow::reset() {
+  mSize = MIN_PENDING_READS;
+  mThreshold = MAX_PENDING_READS;
+  mAcked = 0;
+  mMinRtt = 0;
+  mLastRtt = 0;
+  mMaxRate = 0;
+  mRoundStart = -1;
+  mRoundBytes = 0;
+  mLastDecrease = -1;
+}
+
+void sftpProtocol::ReadWindow::ack(quint32 bytes, qint64 rtt, qint64 now) {
+  rtt = qMax<qint64>(rtt, 1);
+  mLastRtt = rtt;
+  if (mMinRtt == 0 || rtt < mMinRtt) {
+    mMinRtt = rtt;
+  }
+
+  // Sample the delivery rate once per round trip and keep a slowly
+  // decaying maximum of it.
+  if (mRoundStart < 0) {
+    mRoundStart = now;
+  }
+  mRoundBytes += bytes;
+  if (now - mRoundStart >= mMinRtt) {
+    const qint64 rate = mRoundBytes * 1000000 / qMax<qint64>(now - mRoundStart, 1);
+    mMaxRate = qMax(rate, mMaxRate - mMaxRate / 8);
+    mRoundStart = now;
+    mRoundBytes = 0;
+
+    // The requests are queued somewhere instead of being processed
+    if (mLastRtt > 2 * mMinRtt && (mLastDecrease < 0 || now - mLastDecrease >= mLastRtt)) {
+      mLastDecrease = now;
+      decrease();
+      return;
+    }
+  }
+
+  if (mSize < mThreshold) {
+    ++mSize;
+  } else if (++mAcked >= mSize) {
+    ++mSize;
+    mAcked = 0;
+  }
+
+  // Twice the bandwidth-delay product leaves room for the estimate to grow
+  const qint64 bdp = mMaxRate * mMinRtt / 1000000 / MAX_XFER_BUF_SIZE;
+  const qint64 limit = qBound<qint64>(MIN_PENDING_READS, 2 * bdp + 2, MAX_PENDING_READS);
+  mSize = qMin<qint64>(mSize, limit);
+}
+
+void sftpProtocol::ReadWindow::timeout() {
+  decrease();
+}
+
+void sftpProtocol::ReadWindow::decrease() {
+  mThreshold = qMax(mSize / 2, MIN_PENDING_READS);
+  mSize = mThreshold;
+  mAcked = 0;
+}
 
+sftpProtocol::GetRequest::GetRequest(sftp_file file, sftp_attributes sb, ReadWindow &window)
+    :mFile(file), mSb(sb), mWindow(window) {
+  mClock.start();
+}
+
+qint64 sftpProtocol::GetRequest::now() const {
+  return mClock.nsecsElapsed() / 1000;
 }
 
 bool sftpProtocol::GetRequest::enqueueChunks() {
@@ -2097,9 +2916,15 @@ bool sftpProtocol::GetRequest::enqueueChunks() {
 
   kDebug(KIO_SFTP_DB) << "enqueueChunks";
 
-  while (pendingRequests.count() < mMaxPendingRequests) {
+  while (pendingRequests.count() < mWindow.size()) {
+    // Do not ask for more than the rest of the file. Once the known end is
+    // reached, a full chunk is requested to detect EOF or a grown file.
     request.expectedLength = MAX_XFER_BUF_SIZE;
+    if (mFile->offset < mSb->size) {
+      request.expectedLength = qMin<uint64_t>(MAX_XFER_BUF_SIZE, mSb->size - mFile->offset);
+    }
     request.startOffset = mFile->offset;
+    request.sentAt = now();
     request.id = sftp_async_read_begin(mFile, request.expectedLength);
     if (request.id < 0) {
       if (pendingRequests.isEmpty()) {
@@ -2129,27 +2954,34 @@ int sftpProtocol::GetRequest::readChunks(QByteArray &data) {
   int totalRead = 0;
   ssize_t bytesread = 0;
 
+  // Make room for all pending requests once instead of resizing per chunk.
+  // Requests which do not fit are read by the next call.
+  const int bufferSize = qMin(pendingRequests.count() * MAX_XFER_BUF_SIZE, MAX_READ_BUFFER_SIZE);
+  if (mBuffer.size() < bufferSize) {
+    mBuffer.resize(bufferSize);
+    if (mBuffer.size() < bufferSize) {
+      // Could not allocate enough memory
+      return -1;
+    }
+  }
+  char *buffer = mBuffer.data();
+
   while (!pendingRequests.isEmpty()) {
     sftpProtocol::GetRequest::Request &request = pendingRequests.head();
-    int dataSize = data.size() + request.expectedLength;
-
-    data.resize(dataSize);
-    if (data.size() < dataSize) {
-      // Could not allocate enough memory - skip current chunk
-      data.resize(dataSize - request.expectedLength);
+    if (totalRead + request.expectedLength > static_cast<uint32_t>(mBuffer.size())) {
       break;
     }
 
-    bytesread = sftp_async_read(mFile, data.data() + totalRead, request.expectedLength, request.id);
+    bytesread = sftp_async_read(mFile, buffer + totalRead, request.expectedLength, request.id);
 
     // kDebug(KIO_SFTP_DB) << "bytesread=" << QString::number(bytesread);
 
     if (bytesread == 0 || bytesread == SSH_AGAIN) {
       // Done reading or timeout
-      data.resize(data.size() - request.expectedLength);
-
       if (bytesread == 0) {
-        pendingRequests.dequeue(); // This frees QByteArray &data!
+        pendingRequests.dequeue();
+      } else {
+        mWindow.timeout();
       }
 
       break;
@@ -2158,16 +2990,18 @@ int sftpProtocol::GetRequest::readChunks(QByteArray &data) {
     }
 
     totalRead += bytesread;
+    const qint64 ackedAt = now();
+    mWindow.ack(bytesread, ackedAt - request.sentAt, ackedAt);
 
     if (bytesread < request.expectedLength) {
       int rc;
 
       // If less data is read than expected - requeue the request
-      data.resize(data.size() - (request.expectedLength - bytesread));
 
       // Modify current request
       request.expectedLength -= bytesread;
       request.startOffset += bytesread;
+      request.sentAt = ackedAt;
 
       rc = sftp_seek64(mFile, request.startOffset);
       if (rc < 0) {
@@ -2182,12 +3016,13 @@ int sftpProtocol::GetRequest::readChunks(QByteArray &data) {
         return -1;
       }
 
-      return totalRead;
+      break;
     }
 
     pendingRequests.dequeue();
   }
 
+  data = QByteArray::fromRawData(mBuffer.constData(), totalRead);
   return totalRead;
 }
 
@@ -2206,6 +3041,479 @@ sftpProtocol::GetRequest::~GetRequest() {
   sftp_attributes_free(mSb);
 }
 
+// Helpers to encode and decode the SFTP wire format of BatchRequest
+static void appendUint32(QByteArray &packet, quint32 value)
+{
+  uchar buf[4];
+  qToBigEndian<quint32>(value, buf);
+  packet.append(reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+static void appendUint64(QByteArray &packet, quint64 value)
+{
+  uchar buf[8];
+  qToBigEndian<quint64>(value, buf);
+  packet.append(reinterpret_cast<const char *>(buf), sizeof(buf));
+}
+
+static void appendString(QByteArray &packet, const char *buf, quint32 len)
+{
+  appendUint32(packet, len);
+  packet.append(buf, len);
+}
+
+static void appendString(QByteArray &packet, const QByteArray &value)
+{
+  appendString(packet, value.constData(), value.size());
+}
+
+static bool readUint32(const QByteArray &packet, int &pos, quint32 &value)
+{
+  if (pos + 4 > packet.size()) {
+    return false;
+  }
+  value = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(packet.constData() + pos));
+  pos += 4;
+  return true;
+}
+
+static bool readUint64(const QByteArray &packet, int &pos, quint64 &value)
+{
+  if (pos + 8 > packet.size()) {
+    return false;
+  }
+  value = qFromBigEndian<quint64>(reinterpret_cast<const uchar *>(packet.constData() + pos));
+  pos += 8;
+  return true;
+}
+
+static bool readString(const QByteArray &packet, int &pos, QByteArray &value)
+{
+  quint32 length;
+  if (!readUint32(packet, pos, length) || length > quint32(packet.size() - pos)) {
+    return false;
+  }
+  value = packet.mid(pos, length);
+  pos += length;
+  return true;
+}
+
+// Decodes version 3 file attributes like libssh does for sftp_stat
+static sftp_attributes readAttributes(const QByteArray &packet, int &pos)
+{
+  quint32 flags;
+  if (!readUint32(packet, pos, flags)) {
+    return NULL;
+  }
+
+  sftp_attributes attr = (sftp_attributes) calloc(1, sizeof(struct sftp_attributes_struct));
+  if (attr == NULL) {
+    return NULL;
+  }
+  attr->flags = flags;
+
+  bool ok = true;
+  if (flags & SSH_FILEXFER_ATTR_SIZE) {
+    quint64 size = 0;
+    ok = readUint64(packet, pos, size);
+    attr->size = size;
+  }
+  if (ok && (flags & SSH_FILEXFER_ATTR_UIDGID)) {
+    quint32 uid = 0, gid = 0;
+    ok = readUint32(packet, pos, uid) && readUint32(packet, pos, gid);
+    attr->uid = uid;
+    attr->gid = gid;
+  }
+  if (ok && (flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
+    quint32 permissions = 0;
+    ok = readUint32(packet, pos, permissions);
+    attr->permissions = permissions;
+  }
+  if (ok && (flags & SSH_FILEXFER_ATTR_ACMODTIME)) {
+    quint32 atime = 0, mtime = 0;
+    ok = readUint32(packet, pos, atime) && readUint32(packet, pos, mtime);
+    attr->atime = atime;
+    attr->mtime = mtime;
+  }
+
+  if (!ok) {
+    sftp_attributes_free(attr);
+    return NULL;
+  }
+
+  if (flags & SSH_FILEXFER_ATTR_PERMISSIONS) {
+    switch (attr->permissions & SSH_S_IFMT) {
+      case SSH_S_IFREG:
+        attr->type = SSH_FILEXFER_TYPE_REGULAR;
+        break;
+      case SSH_S_IFDIR:
+        attr->type = SSH_FILEXFER_TYPE_DIRECTORY;
+        break;
+      case SSH_S_IFLNK:
+        attr->type = SSH_FILEXFER_TYPE_SYMLINK;
+        break;
+      default:
+        attr->type = SSH_FILEXFER_TYPE_SPECIAL;
+        break;
+    }
+  } else {
+    attr->type = SSH_FILEXFER_TYPE_UNKNOWN;
+  }
+
+  return attr;
+}
+
+sftpProtocol::BatchRequest::BatchRequest(ssh_session session)
+    :mSftp(NULL), mNextId(1) {
+  // sftp_new opens a new channel on the existing ssh session
+  mSftp = sftp_new(session);
+  if (mSftp == NULL) {
+    kDebug(KIO_SFTP_DB) << "Could not open sftp channel for batch requests";
+    return;
+  }
+
+  if (sftp_init(mSftp) < 0) {
+    kDebug(KIO_SFTP_DB) << "Could not initialize sftp channel for batch requests";
+    sftp_free(mSftp);
+    mSftp = NULL;
+  }
+}
+
+sftpProtocol::BatchRequest::~BatchRequest() {
+  if (mSftp) {
+    sftp_free(mSftp);
+  }
+}
+
+bool sftpProtocol::BatchRequest::isValid() const {
+  return mSftp != NULL;
+}
+
+bool sftpProtocol::BatchRequest::isEmpty() const {
+  return mPendingIds.isEmpty();
+}
+
+bool sftpProtocol::BatchRequest::hasExtension(const char *name) const {
+  if (mSftp == NULL) {
+    return false;
+  }
+
+  const unsigned int count = sftp_extensions_get_count(mSftp);
+  for (unsigned int i = 0; i < count; ++i) {
+    const char *extension = sftp_extensions_get_name(mSftp, i);
+    if (extension != NULL && qstrcmp(extension, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+quint32 sftpProtocol::BatchRequest::readlink(const QByteArray &path) {
+  QByteArray payload;
+  appendString(payload, path);
+  return queue(SSH_FXP_READLINK, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::stat(const QByteArray &path) {
+  QByteArray payload;
+  appendString(payload, path);
+  return queue(SSH_FXP_STAT, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::open(const QByteArray &path, quint32 flags, int permissions) {
+  QByteArray payload;
+  appendString(payload, path);
+  appendUint32(payload, flags);
+  if (permissions != -1) {
+    appendUint32(payload, SSH_FILEXFER_ATTR_PERMISSIONS);
+    appendUint32(payload, permissions);
+  } else {
+    appendUint32(payload, 0);
+  }
+  return queue(SSH_FXP_OPEN, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::read(const QByteArray &handle, quint64 offset, quint32 length) {
+  QByteArray payload;
+  appendString(payload, handle);
+  appendUint64(payload, offset);
+  appendUint32(payload, length);
+  return queue(SSH_FXP_READ, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::write(const QByteArray &handle, quint64 offset, const char *buf, quint32 len) {
+  QByteArray payload;
+  payload.reserve(handle.size() + len + 16);
+  appendString(payload, handle);
+  appendUint64(payload, offset);
+  appendString(payload, buf, len);
+  return queue(SSH_FXP_WRITE, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::close(const QByteArray &handle) {
+  QByteArray payload;
+  appendString(payload, handle);
+  return queue(SSH_FXP_CLOSE, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::extended(const char *name, const QByteArray &data) {
+  QByteArray payload;
+  appendString(payload, name, qstrlen(name));
+  payload.append(data);
+  return queue(SSH_FXP_EXTENDED, payload);
+}
+
+quint32 sftpProtocol::BatchRequest::queue(quint8 type, const QByteArray &payload) {
+  const quint32 id = mNextId++;
+
+  // uint32 length, byte type, uint32 id, payload
+  appendUint32(mRequests, 5 + payload.size());
+  mRequests.append(char(type));
+  appendUint32(mRequests, id);
+  mRequests.append(payload);
+
+  mPendingIds.append(id);
+  return id;
+}
+
+bool sftpProtocol::BatchRequest::send() {
+  if (mSftp == NULL) {
+    return false;
+  }
+
+  const char *buf = mRequests.constData();
+  int len = mRequests.size();
+  while (len > 0) {
+    const int written = ssh_channel_write(mSftp->channel, buf, len);
+    if (written <= 0) {
+      fail();
+      return false;
+    }
+    buf += written;
+    len -= written;
+  }
+  mRequests.clear();
+
+  return true;
+}
+
+bool sftpProtocol::BatchRequest::receive() {
+  if (mSftp == NULL) {
+    return false;
+  }
+
+  mReplies.clear();
+
+  while (!mPendingIds.isEmpty()) {
+    QByteArray packet;
+    int pos = 1;
+    quint32 id;
+
+    if (!readPacket(packet) || !readUint32(packet, pos, id)) {
+      fail();
+      return false;
+    }
+
+    if (!mPendingIds.removeOne(id)) {
+      kDebug(KIO_SFTP_DB) << "Ignoring reply for unknown request" << id;
+      continue;
+    }
+
+    mReplies.insert(id, packet);
+  }
+
+  return true;
+}
+
+bool sftpProtocol::BatchRequest::exec() {
+  return send() && receive();
+}
+
+void sftpProtocol::BatchRequest::fail() {
+  kDebug(KIO_SFTP_DB) << "Batch request failed:" << ssh_get_error(mSftp->session);
+  mRequests.clear();
+  mPendingIds.clear();
+  mReplies.clear();
+  sftp_free(mSftp);
+  mSftp = NULL;
+}
+
+bool sftpProtocol::BatchRequest::readPacket(QByteArray &packet) {
+  uchar header[4];
+  char *buf = reinterpret_cast<char *>(header);
+  quint32 len = sizeof(header);
+
+  for (int i = 0; i < 2; ++i) {
+    while (len > 0) {
+      const int bytesread = ssh_channel_read(mSftp->channel, buf, len, 0);
+      if (bytesread <= 0) {
+        return false;
+      }
+      buf += bytesread;
+      len -= bytesread;
+    }
+
+    if (i == 0) {
+      len = qFromBigEndian<quint32>(header);
+      // The largest replies are DATA packets of at most MAX_XFER_BUF_SIZE bytes
+      if (len < 5 || len > 256 * 1024) {
+        return false;
+      }
+      packet.resize(len);
+      buf = packet.data();
+    }
+  }
+
+  return true;
+}
+
+int sftpProtocol::BatchRequest::status(quint32 id) const {
+  const QByteArray packet = mReplies.value(id);
+  if (packet.isEmpty()) {
+    return SSH_FX_FAILURE;
+  }
+
+  if (quint8(packet.at(0)) != SSH_FXP_STATUS) {
+    return SSH_FX_OK;
+  }
+
+  int pos = 5;
+  quint32 code;
+  if (!readUint32(packet, pos, code)) {
+    return SSH_FX_BAD_MESSAGE;
+  }
+  return code;
+}
+
+QByteArray sftpProtocol::BatchRequest::link(quint32 id) const {
+  const QByteArray packet = mReplies.value(id);
+  int pos = 5;
+  quint32 count;
+  QByteArray link;
+
+  if (packet.isEmpty() || quint8(packet.at(0)) != SSH_FXP_NAME ||
+      !readUint32(packet, pos, count) || count == 0 || !readString(packet, pos, link)) {
+    return QByteArray();
+  }
+  return link;
+}
+
+QByteArray sftpProtocol::BatchRequest::handle(quint32 id) const {
+  const QByteArray packet = mReplies.value(id);
+  int pos = 5;
+  QByteArray handle;
+
+  if (packet.isEmpty() || quint8(packet.at(0)) != SSH_FXP_HANDLE || !readString(packet, pos, handle)) {
+    return QByteArray();
+  }
+  return handle;
+}
+
+QByteArray sftpProtocol::BatchRequest::data(quint32 id) const {
+  const QByteArray packet = mReplies.value(id);
+  int pos = 5;
+  QByteArray data;
+
+  if (packet.isEmpty() || quint8(packet.at(0)) != SSH_FXP_DATA || !readString(packet, pos, data)) {
+    return QByteArray();
+  }
+  return data;
+}
+
+sftp_attributes sftpProtocol::BatchRequest::takeAttributes(quint32 id) {
+  const QByteArray packet = mReplies.take(id);
+  int pos = 5;
+
+  if (packet.isEmpty() || quint8(packet.at(0)) != SSH_FXP_ATTRS) {
+    return NULL;
+  }
+  return readAttributes(packet, pos);
+}
+
+sftpProtocol::PutRequest::PutRequest(sftp_file file, ushort maxPendingRequests, uint chunkSize)
+    :mFile(file), mMaxPendingRequests(maxPendingRequests), mChunkSize(chunkSize), mBytesWritten(0) {
+#ifdef HAVE_SFTP_AIO
+  // sftp_aio_begin_write refuses requests bigger than the server limit
+  sftp_limits_t limits = sftp_limits(mFile->sftp);
+  if (limits != NULL) {
+    if (limits->max_write_length > 0 && mChunkSize > limits->max_write_length) {
+      mChunkSize = limits->max_write_length;
+    }
+    sftp_limits_free(limits);
+  }
+#else
+  Q_UNUSED(mMaxPendingRequests);
+#endif
+}
+
+qint64 sftpProtocol::PutRequest::writeChunks(const char *buf, size_t len) {
+  while (len > 0) {
+    const size_t chunkLength = qMin<size_t>(len, mChunkSize);
+
+#ifdef HAVE_SFTP_AIO
+    if (pendingRequests.count() >= mMaxPendingRequests && !waitForHead()) {
+      return -1;
+    }
+
+    sftp_aio aio = NULL;
+    if (sftp_aio_begin_write(mFile, buf, chunkLength, &aio) < 0) {
+      return -1;
+    }
+    pendingRequests.enqueue(aio);
+#else
+    // Without the aio API every write request waits for its acknowledgement
+    const ssize_t bytesWritten = sftp_write(mFile, buf, chunkLength);
+    if (bytesWritten < 0) {
+      return -1;
+    }
+    mBytesWritten += bytesWritten;
+#endif
+
+    buf += chunkLength;
+    len -= chunkLength;
+  }
+
+  return mBytesWritten;
+}
+
+qint64 sftpProtocol::PutRequest::flush() {
+#ifdef HAVE_SFTP_AIO
+  while (!pendingRequests.isEmpty()) {
+    if (!waitForHead()) {
+      return -1;
+    }
+  }
+#endif
+
+  return mBytesWritten;
+}
+
+#ifdef HAVE_SFTP_AIO
+bool sftpProtocol::PutRequest::waitForHead() {
+  sftp_aio aio = pendingRequests.dequeue();
+
+  // sftp_aio_wait_write frees the aio handle on success and on error
+  const ssize_t bytesWritten = sftp_aio_wait_write(&aio);
+  if (bytesWritten < 0) {
+    kDebug(KIO_SFTP_DB) << "write request failed:" << ssh_get_error(mFile->sftp->session);
+    return false;
+  }
+
+  mBytesWritten += bytesWritten;
+  return true;
+}
+#endif
+
+sftpProtocol::PutRequest::~PutRequest() {
+#ifdef HAVE_SFTP_AIO
+  // Collect the replies of requests which are still in flight
+  while (!pendingRequests.isEmpty()) {
+    sftp_aio aio = pendingRequests.dequeue();
+    sftp_aio_wait_write(&aio);
+  }
+#endif
+}
+
 void sftpProtocol::requiresUserNameRedirection()
 {
     KUrl redirectUrl;
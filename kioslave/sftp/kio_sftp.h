@@ -30,8 +30,16 @@
 #include <libssh/sftp.h>
 #include <libssh/callbacks.h>
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtCore/QQueue>
 
+// libssh 0.11 added the sftp_aio API which allows to pipeline write requests.
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 11, 0)
+#define HAVE_SFTP_AIO 1
+#endif
+
 namespace KIO {
   class AuthInfo;
 }
@@ -64,6 +72,12 @@ public:
   virtual void write(const QByteArray &data);
   virtual void seek(KIO::filesize_t offset);
   virtual void close();
+  /**
+   * Without data the connection is polled. Otherwise the data starts with
+   * an int command: 1 copies several files between the local host and this
+   * server (KUrl::List sources, KUrl::List destinations, int permissions,
+   * int flags) using several SFTP channels.
+   */
   virtual void special(const QByteArray &data);
 
   // libssh authentication callback (note that this is called by the
@@ -127,6 +141,55 @@ private: // Private variables
    */
   KIO::AuthInfo* mPublicKeyAuthInfo;
 
+  /**
+   * ReadWindow holds the number of read requests GetRequest keeps in flight.
+   * It is kept per connection so that each download starts with the window
+   * the previous one ended with.
+   *
+   * The window grows like a TCP congestion window (doubling per round trip,
+   * then by one request per round trip) but never beyond twice the estimated
+   * bandwidth-delay product. It is halved when the round trip time rises well
+   * above the minimum seen, which means requests only wait in queues, or when
+   * a read times out.
+   */
+  class ReadWindow {
+  public:
+    ReadWindow();
+    /** Forgets everything learned about the connection. */
+    void reset();
+    /**
+     * Updates the window with a completed request.
+     * @param bytes the number of bytes the request returned.
+     * @param rtt the time between sending the request and reading its reply in microseconds.
+     * @param now the current time in microseconds.
+     */
+    void ack(quint32 bytes, qint64 rtt, qint64 now);
+    /** Shrinks the window after a timeout. */
+    void timeout();
+
+    /** The number of requests which should be in flight. */
+    ushort size() const { return mSize; }
+    /** The smallest round trip time seen in microseconds, 0 if unknown. */
+    qint64 minRtt() const { return mMinRtt; }
+    /** The estimated throughput in bytes per second. */
+    qint64 bandwidth() const { return mMaxRate; }
+  private:
+    void decrease();
+
+    ushort mSize;
+    ushort mThreshold;
+    ushort mAcked;
+    qint64 mMinRtt;
+    qint64 mLastRtt;
+    qint64 mMaxRate;
+    qint64 mRoundStart;
+    qint64 mRoundBytes;
+    qint64 mLastDecrease;
+  };
+
+  /** The read window of the current connection. */
+  ReadWindow mReadWindow;
+
   /**
    * GetRequest encapsulates several SFTP get requests into a single object.
    * As SFTP messages are limited to MAX_XFER_BUF_SIZE several requests
@@ -138,11 +201,10 @@ private: // Private variables
      * Creates a new GetRequest object.
      * @param file the sftp_file object which should be transferred.
      * @param sb the attributes of that sftp_file object.
-     * @param maxPendingRequests the maximum number of parallel requests to start with.
-     *                            The number will be adjusted automatically depending
-     *                            on the connection speed.
+     * @param window the read window of the connection. The number of parallel
+     *               requests is adjusted through it while reading.
      */
-    GetRequest(sftp_file file, sftp_attributes sb, ushort maxPendingRequests = 1);
+    GetRequest(sftp_file file, sftp_attributes sb, ReadWindow &window);
     /**
      * Removes all pending requests and closes the SFTP channel and attributes
      * in order to avoid memory leaks.
@@ -150,13 +212,15 @@ private: // Private variables
     ~GetRequest();
 
     /**
-     * Starts up to maxPendingRequests file requests. Reading is performed in the
-     * via the readChunks method.
+     * Starts as many file requests as the read window allows. Reading is
+     * performed via the readChunks method.
      */
     bool enqueueChunks();
     /**
-     * Attemps to read all pending chunks in the given QByteArray.
-     * @param data the array into which the data should be saved (it should be empty).
+     * Attemps to read all pending chunks.
+     * @param data is set to the data read. It refers to a receive buffer owned
+     *             by the GetRequest which is reused by the next call, so it has
+     *             to be consumed before readChunks is called again.
      * @return 0 on EOF or timeout, -1 on error and the number of bytes read otherwise.
      */
     int readChunks(QByteArray &data);
@@ -168,12 +232,166 @@ private: // Private variables
       uint32_t expectedLength;
       /** The SSH start offset when this request was made */
       uint64_t startOffset;
+      /** The time the request was sent in microseconds */
+      qint64 sentAt;
     };
   private:
+    qint64 now() const;
+
     sftp_file mFile;
     sftp_attributes mSb;
-    ushort mMaxPendingRequests;
+    ReadWindow &mWindow;
     QQueue<Request> pendingRequests;
+    /**
+     * Receive buffer, grows with the read window up to MAX_READ_BUFFER_SIZE.
+     * It is overwritten by each readChunks call.
+     */
+    QByteArray mBuffer;
+    QElapsedTimer mClock;
+  };
+
+  /**
+   * BatchRequest sends many SFTP requests at once and collects their replies
+   * afterwards, so resolving the symlinks of a directory or opening a group
+   * of files costs one round trip instead of one per request.
+   *
+   * libssh has no asynchronous variants of most requests, so they are encoded
+   * here and sent over an SFTP channel of their own which is not used by
+   * libssh after the version handshake.
+   */
+  class BatchRequest {
+  public:
+    /**
+     * Opens the SFTP channel for the batch requests.
+     * @param session the ssh session of the connection.
+     */
+    explicit BatchRequest(ssh_session session);
+    /**
+     * Closes the SFTP channel.
+     */
+    ~BatchRequest();
+
+    /** True if the SFTP channel could be opened and did not fail since. */
+    bool isValid() const;
+    /** True if no request is waiting for its reply. */
+    bool isEmpty() const;
+    /** True if the server announced the given protocol extension. */
+    bool hasExtension(const char *name) const;
+
+    /**
+     * Queue requests, the returned identifiers are used to fetch the replies.
+     */
+    quint32 readlink(const QByteArray &path);
+    quint32 stat(const QByteArray &path);
+    quint32 open(const QByteArray &path, quint32 flags, int permissions = -1);
+    quint32 read(const QByteArray &handle, quint64 offset, quint32 length);
+    quint32 write(const QByteArray &handle, quint64 offset, const char *buf, quint32 len);
+    quint32 close(const QByteArray &handle);
+    quint32 extended(const char *name, const QByteArray &data);
+
+    /**
+     * Sends all queued requests without waiting for their replies. This
+     * allows several BatchRequests to keep the server busy at the same time.
+     * @return false if the channel failed.
+     */
+    bool send();
+    /**
+     * Waits for the replies of all requests which were sent.
+     * @return false if the channel failed.
+     */
+    bool receive();
+    /**
+     * Sends all queued requests and waits for their replies.
+     * @return false if the channel failed, the BatchRequest is unusable afterwards.
+     */
+    bool exec();
+
+    /**
+     * Returns the status code of a request, SSH_FX_OK for requests which
+     * returned data.
+     */
+    int status(quint32 id) const;
+    /** Returns the link target read by a READLINK request or a null array. */
+    QByteArray link(quint32 id) const;
+    /** Returns the handle returned by an OPEN request or a null array. */
+    QByteArray handle(quint32 id) const;
+    /** Returns the data returned by a READ request or a null array on EOF or error. */
+    QByteArray data(quint32 id) const;
+    /**
+     * Returns the attributes read by a STAT request or NULL if the request
+     * failed. The caller has to free them with sftp_attributes_free.
+     */
+    sftp_attributes takeAttributes(quint32 id);
+  private:
+    quint32 queue(quint8 type, const QByteArray &payload);
+    bool readPacket(QByteArray &packet);
+    void fail();
+
+    sftp_session mSftp;
+    quint32 mNextId;
+    QByteArray mRequests;
+    QList<quint32> mPendingIds;
+    QHash<quint32, QByteArray> mReplies;
+  };
+
+  /** Batch requests for listDir and copy, created on first use. */
+  BatchRequest *mBatch;
+
+  /**
+   * An entry created by listDir, which is reused by the following stat of
+   * the same path for AttributeCacheTimeout seconds.
+   */
+  struct CachedEntry {
+    KIO::UDSEntry entry;
+    int details;
+    QElapsedTimer age;
+  };
+
+  /** Attribute cache of the connection, keyed by path. */
+  QHash<QByteArray, CachedEntry> mAttributeCache;
+
+  /**
+   * PutRequest is the upload counterpart of GetRequest. The data passed to
+   * writeChunks is split into SFTP write requests and several of them are
+   * kept in flight instead of waiting for the acknowledgement of each one.
+   */
+  class PutRequest {
+  public:
+    /**
+     * Creates a new PutRequest object.
+     * @param file the sftp_file object which should be written to. It is not
+     *             closed by the PutRequest.
+     * @param maxPendingRequests the maximum number of unacknowledged write requests.
+     * @param chunkSize the maximum size of a single write request. It is lowered
+     *                  to the limit announced by the server if necessary.
+     */
+    PutRequest(sftp_file file, ushort maxPendingRequests, uint chunkSize);
+    /**
+     * Waits for all pending requests in order to avoid memory leaks.
+     */
+    ~PutRequest();
+
+    /**
+     * Sends write requests for the given buffer at the current file offset.
+     * Blocks only while the maximum number of requests is pending.
+     * @return the number of bytes acknowledged by the server so far or -1 on error.
+     */
+    qint64 writeChunks(const char *buf, size_t len);
+    /**
+     * Waits until all pending requests have been acknowledged.
+     * @return the number of bytes acknowledged by the server or -1 on error.
+     */
+    qint64 flush();
+  private:
+#ifdef HAVE_SFTP_AIO
+    bool waitForHead();
+
+    QQueue<sftp_aio> pendingRequests;
+#endif
+    sftp_file mFile;
+    ushort mMaxPendingRequests;
+    uint mChunkSize;
+    qint64 mBytesWritten;
   };
 
 
@@ -182,9 +400,15 @@ private: // private methods
   int authenticateKeyboardInteractive(KIO::AuthInfo &info);
 
   void reportError(const KUrl &url, const int err);
+  /** Passes the state of mReadWindow to the job as sftp-* meta data. */
+  void reportReadWindow();
 
   bool createUDSEntry(const QString &filename, const QByteArray &path,
                       KIO::UDSEntry &entry, short int details);
+  BatchRequest *batchRequest();
+  bool listBatch(const QByteArray &path, const QList<sftp_attributes> &dirents, int details);
+  void cacheEntry(const QByteArray &path, const KIO::UDSEntry &entry, int details);
+  bool cachedEntry(const QByteArray &path, int details, KIO::UDSEntry &entry);
 
   QString canonicalizePath(const QString &path);
   void requiresUserNameRedirection();
@@ -208,6 +432,11 @@ private: // private methods
 
   StatusCode sftpCopyGet(const KUrl& url, const QString& src, int permissions, KIO::JobFlags flags, int& errorCode);
   StatusCode sftpCopyPut(const KUrl& url, const QString& dest, int permissions, KIO::JobFlags flags, int& errorCode);
+  StatusCode sftpCopySame(const KUrl& src, const KUrl& dest, int permissions, KIO::JobFlags flags, int& errorCode);
+  bool sftpServerCopy(const QByteArray& src, const QByteArray& dest, int permissions, KIO::JobFlags flags);
+
+  void copyFiles(const KUrl::List& sources, const KUrl::List& destinations, int permissions, KIO::JobFlags flags);
+  static bool execAll(const QList<BatchRequest*>& channels);
 };
 
 #endif
@@ -1,2 +1,8 @@
 /* Define to 1 if you have the <utime.h> header file. */
 #cmakedefine HAVE_UTIME_H 1
+
+/* Define to 1 if libsmbclient has smbc_readdirplus2() (Samba 4.12 and later). */
+#cmakedefine HAVE_SMBC_READDIRPLUS2 1
+
+/* Define to 1 if libsmbclient can copy on the server with smbc_splice (Samba 4.3 and later). */
+#cmakedefine HAVE_SMBC_SPLICE 1
@@ -61,6 +61,7 @@
 #include <errno.h>
 #include <time.h>
 #include <QObject>
+#include <QHash>
 
 //-------------------------------
 // Samba client library includes
@@ -77,6 +78,8 @@ extern "C"
 
 #define MAX_XFER_BUF_SIZE           65534
 #define KIO_SMB                     7106
+#define STAT_CACHE_TTL              5
+#define STAT_CACHE_MAX_ENTRIES      50000
 
 using namespace KIO;
 
@@ -119,6 +122,18 @@ private:
      */
     struct stat st;
 
+    /**
+     * Stats that came with the last directory listings, keyed by their
+     * smbc url. Entries expire after STAT_CACHE_TTL seconds and the whole
+     * cache is dropped by any operation that changes something on the server.
+     */
+    struct CachedStat
+    {
+        struct stat st;
+        time_t time;
+    };
+    QHash<QByteArray, CachedStat> m_statCache;
+
 protected:
     //---------------------------------------------
     // Authentication functions (kio_smb_auth.cpp)
@@ -136,11 +151,24 @@ protected:
 
 
     //---------------------------------------------
-    // Cache functions (kio_smb_auth.cpp)
+    // Cache functions (kio_smb_browse.cpp)
     //---------------------------------------------
+    // (please prefix functions with cache)
 
     //Stat methods
 
+    /**
+     * Description :  Remember the stat of a url, e.g. one that came with
+     *                a directory listing
+     */
+    void cache_insert(const SMBUrl& url, const struct stat& st);
+
+    /**
+     * Description :  Forget all remembered stats. Called before anything
+     *                is changed on the server
+     */
+    void cache_clear();
+
     //-----------------------------------------
     // Browsing functions (kio_smb_browse.cpp)
     //-----------------------------------------
@@ -156,7 +184,14 @@ protected:
     bool browse_stat_path(const SMBUrl& url, UDSEntry& udsentry, bool ignore_errors);
 
     /**
-     * Description :  call smbc_stat and return stats of the url
+     * Description :  Pack the stat of a file or directory in UDSEntry.
+     *                UDSEntry will not be cleared
+     */
+    void browse_stat_entry(const struct stat& st, UDSEntry& udsentry);
+
+    /**
+     * Description :  call smbc_stat and return stats of the url, unless
+     *                they are in the stat cache
      * Parameter :    SMBUrl the url to stat
      * Return :       stat* of the url
      * Note :         it has some problems with stat in method, looks like
@@ -260,6 +295,13 @@ public:
 
 private:
     void smbCopy(const KUrl& src, const KUrl &dest, int permissions, KIO::JobFlags flags);
+    /**
+     * Description :  Copies within one server with SRV_COPYCHUNK, so the
+     *                data does not travel through this machine
+     * Return :       false if the server could not copy the file. dstflags
+     *                loses O_EXCL once the destination was created
+     */
+    bool smbCopySplice(const SMBUrl& src, const SMBUrl& dst, int& dstflags, mode_t initialmode, KIO::filesize_t size);
     void smbCopyGet(const KUrl& src, const KUrl& dest, int permissions, KIO::JobFlags flags);
     void smbCopyPut(const KUrl& src, const KUrl& dest, int permissions, KIO::JobFlags flags);
 
@@ -41,8 +41,37 @@
 
 using namespace KIO;
 
+void SMBSlave::cache_insert(const SMBUrl &url, const struct stat &st)
+{
+    if (m_statCache.count() >= STAT_CACHE_MAX_ENTRIES)
+        m_statCache.clear();
+
+    CachedStat cached;
+    cached.st = st;
+    cached.time = time(0);
+    m_statCache.insert(url.toSmbcUrl(), cached);
+}
+
+//---------------------------------------------------------------------------
+void SMBSlave::cache_clear()
+{
+    m_statCache.clear();
+}
+
+//---------------------------------------------------------------------------
 int SMBSlave::cache_stat(const SMBUrl &url, struct stat* st )
 {
+    const QHash<QByteArray, CachedStat>::iterator it = m_statCache.find(url.toSmbcUrl());
+    if (it != m_statCache.end()) {
+        const time_t age = time(0) - it->time;
+        if (age >= 0 && age < STAT_CACHE_TTL) {
+            *st = it->st;
+            kDebug(KIO_SMB) << "cached, size " << (KIO::filesize_t)st->st_size;
+            return 0;
+        }
+        m_statCache.erase(it);
+    }
+
     int cacheStatErr;
     int result = smbc_stat( url.toSmbcUrl(), st);
     if (result == 0){
@@ -71,30 +100,7 @@ bool SMBSlave::browse_stat_path(const SMBUrl& _url, UDSEntry& udsentry, bool ign
          return false;
       }
 
-      udsentry.insert(KIO::UDSEntry::UDS_FILE_TYPE, st.st_mode & S_IFMT);
-      udsentry.insert(KIO::UDSEntry::UDS_SIZE, st.st_size);
-
-      QString str;
-      uid_t uid = st.st_uid;
-      struct passwd *user = getpwuid( uid );
-      if ( user )
-          str = user->pw_name;
-      else
-          str = QString::number( uid );
-      udsentry.insert(KIO::UDSEntry::UDS_USER, str);
-
-      gid_t gid = st.st_gid;
-      struct group *grp = getgrgid( gid );
-      if ( grp )
-          str = grp->gr_name;
-      else
-          str = QString::number( gid );
-      udsentry.insert(KIO::UDSEntry::UDS_GROUP, str);
-
-      udsentry.insert(KIO::UDSEntry::UDS_ACCESS, st.st_mode & 07777);
-      udsentry.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, st.st_mtime);
-      udsentry.insert(KIO::UDSEntry::UDS_ACCESS_TIME, st.st_atime);
-      // No, st_ctime is not UDS_CREATION_TIME...
+      browse_stat_entry(st, udsentry);
    }
    else
    {
@@ -116,6 +122,35 @@ bool SMBSlave::browse_stat_path(const SMBUrl& _url, UDSEntry& udsentry, bool ign
    return true;
 }
 
+//---------------------------------------------------------------------------
+void SMBSlave::browse_stat_entry(const struct stat& st, UDSEntry& udsentry)
+{
+   udsentry.insert(KIO::UDSEntry::UDS_FILE_TYPE, st.st_mode & S_IFMT);
+   udsentry.insert(KIO::UDSEntry::UDS_SIZE, st.st_size);
+
+   QString str;
+   uid_t uid = st.st_uid;
+   struct passwd *user = getpwuid( uid );
+   if ( user )
+       str = user->pw_name;
+   else
+       str = QString::number( uid );
+   udsentry.insert(KIO::UDSEntry::UDS_USER, str);
+
+   gid_t gid = st.st_gid;
+   struct group *grp = getgrgid( gid );
+   if ( grp )
+       str = grp->gr_name;
+   else
+       str = QString::number( gid );
+   udsentry.insert(KIO::UDSEntry::UDS_GROUP, str);
+
+   udsentry.insert(KIO::UDSEntry::UDS_ACCESS, st.st_mode & 07777);
+   udsentry.insert(KIO::UDSEntry::UDS_MODIFICATION_TIME, st.st_mtime);
+   udsentry.insert(KIO::UDSEntry::UDS_ACCESS_TIME, st.st_atime);
+   // No, st_ctime is not UDS_CREATION_TIME...
+}
+
 //===========================================================================
 void SMBSlave::stat( const KUrl& kurl )
 {
@@ -320,6 +355,39 @@ void SMBSlave::listDir( const KUrl& kurl )
    kDebug(KIO_SMB) << "open " << m_current_url.toSmbcUrl() << " " << m_current_url.getType() << " " << dirfd;
    if(dirfd >= 0)
    {
+#ifdef HAVE_SMBC_READDIRPLUS2
+       // Within a share the stats of the files and directories come with
+       // the listing, so it is listed in one pass without a stat per entry
+       if (m_current_url.getType() == SMBURLTYPE_SHARE_OR_PATH) {
+           struct stat entryStat;
+           const struct libsmb_file_info *info;
+           while ((info = smbc_readdirplus2(dirfd, &entryStat)) != 0) {
+               const QString name = QString::fromUtf8(info->name);
+               // Like SMBC_UNKNOWN entries below, others than files and directories are left out
+               if (name == "." || name == ".." ||
+                   (!S_ISDIR(entryStat.st_mode) && !S_ISREG(entryStat.st_mode)))
+                   continue;
+
+               udsentry.insert(KIO::UDSEntry::UDS_NAME, name);
+               if (name.endsWith(QLatin1Char('$')))
+                   udsentry.insert(KIO::UDSEntry::UDS_HIDDEN, 1);
+               browse_stat_entry(entryStat, udsentry);
+               listEntry(udsentry, false);
+               udsentry.clear();
+
+               // So that a stat() right after the listing needs no round trip either
+               SMBUrl entryUrl = m_current_url;
+               entryUrl.addPath(name);
+               cache_insert(entryUrl, entryStat);
+           }
+           smbc_closedir(dirfd);
+
+           listEntry(udsentry, true);
+           finished();
+           return;
+       }
+#endif
+
        do {
            kDebug(KIO_SMB) << "smbc_readdir ";
            dirp = smbc_readdir(dirfd);
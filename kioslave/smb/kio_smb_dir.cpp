@@ -31,6 +31,7 @@
 
 #include "kio_smb.h"
 #include "kio_smb_internal.h"
+#include "kio_smb_transfer.h"
 
 #include <QFile>
 #include <QFileInfo>
@@ -47,6 +48,8 @@ void SMBSlave::copy(const KUrl& src, const KUrl& dst, int permissions, KIO::JobF
     const bool isSourceLocal = src.isLocalFile();
     const bool isDestinationLocal = dst.isLocalFile();
 
+    cache_clear();
+
     if (!isSourceLocal && isDestinationLocal) {
         smbCopyGet(src, dst, permissions, flags);
     } else if (isSourceLocal && !isDestinationLocal) {
@@ -68,7 +71,8 @@ void SMBSlave::smbCopy(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO:
     int             dstfd = -1;
     int             errNum = 0;
     KIO::filesize_t processed_size = 0;
-    unsigned char   buf[MAX_XFER_BUF_SIZE];
+    KIO::filesize_t srcSize;
+    QByteArray      piece;
 
     kDebug(KIO_SMB) << "SMBSlave::copy with src = " << ksrc << "and dest = " << kdst;
 
@@ -95,7 +99,8 @@ void SMBSlave::smbCopy(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO:
         error( KIO::ERR_IS_DIRECTORY, src.prettyUrl() );
         return;
     }
-    totalSize(st.st_size);
+    srcSize = st.st_size;
+    totalSize(srcSize);
 
     // Check to se if the destination exists
     errNum = cache_stat(dst, &st);
@@ -113,6 +118,29 @@ void SMBSlave::smbCopy(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO:
 	}
     }
 
+    // Determine initial creation mode
+    if(permissions != -1)
+    {
+        initialmode = permissions | S_IWUSR;
+    }
+    else
+    {
+        initialmode = 0 | S_IWUSR;//0666;
+    }
+
+    dstflags = O_CREAT | O_TRUNC | O_WRONLY;
+    if(!(flags & KIO::Overwrite))
+    {
+        dstflags |= O_EXCL;
+    }
+
+    // Within one server, let the server copy the data itself
+    if (smbCopySplice(src, dst, dstflags, initialmode, srcSize))
+    {
+        finished();
+        return;
+    }
+
     // Open the source file
     srcfd = smbc_open(src.toSmbcUrl(), O_RDONLY, 0);
     if (srcfd < 0){
@@ -134,23 +162,7 @@ void SMBSlave::smbCopy(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO:
 	return;
     }
 
-    // Determine initial creation mode
-    if(permissions != -1)
-    {
-        initialmode = permissions | S_IWUSR;
-    }
-    else
-    {
-        initialmode = 0 | S_IWUSR;//0666;
-    }
-
-
     // Open the destination file
-    dstflags = O_CREAT | O_TRUNC | O_WRONLY;
-    if(!(flags & KIO::Overwrite))
-    {
-        dstflags |= O_EXCL;
-    }
     dstfd = smbc_open(dst.toSmbcUrl(), dstflags, initialmode);
     if (dstfd < 0){
         errNum = errno;
@@ -177,31 +189,30 @@ void SMBSlave::smbCopy(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO:
     }
 
 
-    // Perform copy
-    while(1)
+    // Perform copy. Both ends use libsmbclient, so the reads can not
+    // be done on a thread of their own.
     {
-        n = smbc_read(srcfd, buf, MAX_XFER_BUF_SIZE );
-        if(n > 0)
+        SMBTransfer transfer(srcfd, srcSize, false);
+        bool isErr = false;
+
+        while (transfer.next(piece))
         {
-            n = smbc_write(dstfd, buf, n);
+            n = smbc_write(dstfd, const_cast<char *>(piece.constData()), piece.size());
             if(n == -1)
             {
 	        kDebug(KIO_SMB) << "SMBSlave::copy copy now KIO::ERR_COULD_NOT_WRITE";
                 error( KIO::ERR_COULD_NOT_WRITE, dst.prettyUrl());
+                isErr = true;
                 break;
             }
 
             processed_size += n;
 	    processedSize(processed_size);
-	}
-        else if(n == 0)
-	{
-	      break; // finished
-	}
-	else
-	{
+        }
+
+        if (!isErr && transfer.error())
+        {
             error( KIO::ERR_COULD_NOT_READ, src.prettyUrl());
-	    break;
         }
     }
 
@@ -230,6 +241,73 @@ void SMBSlave::smbCopy(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO:
     finished();
 }
 
+#ifdef HAVE_SMBC_SPLICE
+static int spliceProgress(off_t n, void *priv)
+{
+    static_cast<SMBSlave *>(priv)->processedSize(n);
+    return 1;
+}
+#endif
+
+bool SMBSlave::smbCopySplice(const SMBUrl& src, const SMBUrl& dst, int& dstflags, mode_t initialmode, KIO::filesize_t size)
+{
+#ifdef HAVE_SMBC_SPLICE
+    // The server can only copy between files of one session
+    if (size == 0 ||
+        QString::compare(src.host(), dst.host(), Qt::CaseInsensitive) != 0 ||
+        src.port() != dst.port() || src.user() != dst.user())
+    {
+        return false;
+    }
+
+    SMBCCTX *context = smbc_set_context(NULL);
+    if (!context)
+        return false;
+
+    smbc_open_fn openFile = smbc_getFunctionOpen(context);
+    smbc_close_fn closeFile = smbc_getFunctionClose(context);
+    smbc_splice_fn splice = smbc_getFunctionSplice(context);
+    if (!openFile || !closeFile || !splice)
+        return false;
+
+    SMBCFILE *srcFile = openFile(context, src.toSmbcUrl(), O_RDONLY, 0);
+    if (!srcFile)
+        return false;
+
+    SMBCFILE *dstFile = openFile(context, dst.toSmbcUrl(), dstflags, initialmode);
+    if (!dstFile)
+    {
+        closeFile(context, srcFile);
+        return false;
+    }
+    // The destination exists now, a fallback copy has to overwrite it
+    dstflags &= ~O_EXCL;
+
+    const off_t copied = splice(context, srcFile, dstFile, size, spliceProgress, this);
+    const int spliceErr = errno;
+
+    closeFile(context, srcFile);
+    const bool isClosed = (closeFile(context, dstFile) == 0);
+
+    if (copied != static_cast<off_t>(size) || !isClosed)
+    {
+        kDebug(KIO_SMB) << "server side copy failed, copied" << copied << "of" << size << strerror(spliceErr);
+        return false;
+    }
+
+    kDebug(KIO_SMB) << "server side copy of" << size << "bytes";
+    processedSize(size);
+    return true;
+#else
+    Q_UNUSED(src);
+    Q_UNUSED(dst);
+    Q_UNUSED(dstflags);
+    Q_UNUSED(initialmode);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
 void SMBSlave::smbCopyGet(const KUrl& ksrc, const KUrl& kdst, int permissions, KIO::JobFlags flags)
 {
     kDebug(KIO_SMB) << "src = " << ksrc << ", dest = " << kdst;
@@ -359,30 +437,29 @@ void SMBSlave::smbCopyGet(const KUrl& ksrc, const KUrl& kdst, int permissions, K
         return;
     }
 
-    // Perform the copy
-    char buf[MAX_XFER_BUF_SIZE];
+    // Perform the copy, reading from the server while writing to the disk
     bool isErr = false;
-
-    while (1) {
-        const ssize_t bytesRead = smbc_read(srcfd, buf, MAX_XFER_BUF_SIZE);
-        if (bytesRead <= 0) {
-            if (bytesRead < 0) {
-                error( KIO::ERR_COULD_NOT_READ, src.prettyUrl());
+    {
+        SMBTransfer transfer(srcfd, st.st_size - processed_size, true);
+        QByteArray piece;
+
+        while (transfer.next(piece)) {
+            const qint64 bytesWritten = file.write(piece);
+            if (bytesWritten != piece.size()) {
+                kDebug(KIO_SMB) << "copy now KIO::ERR_COULD_NOT_WRITE";
+                error( KIO::ERR_COULD_NOT_WRITE, kdst.prettyUrl());
                 isErr = true;
+                break;
             }
-            break;
+
+            processed_size += bytesWritten;
+            processedSize(processed_size);
         }
 
-        const qint64 bytesWritten = file.write(buf, bytesRead);
-        if (bytesWritten == -1) {
-            kDebug(KIO_SMB) << "copy now KIO::ERR_COULD_NOT_WRITE";
-            error( KIO::ERR_COULD_NOT_WRITE, kdst.prettyUrl());
+        if (!isErr && transfer.error()) {
+            error( KIO::ERR_COULD_NOT_READ, src.prettyUrl());
             isErr = true;
-            break;
         }
-
-        processed_size += bytesWritten;
-        processedSize(processed_size);
     }
 
     // FINISHED
@@ -549,20 +626,12 @@ void SMBSlave::smbCopyPut(const KUrl& ksrc, const KUrl& kdst, int permissions, K
     bool isErr = false;
 
     if (processed_size == 0 || srcFile.seek(processed_size)) {
-        // Perform the copy
-        char buf[MAX_XFER_BUF_SIZE];
-
-        while (1) {
-            const ssize_t bytesRead = srcFile.read(buf, MAX_XFER_BUF_SIZE);
-            if (bytesRead <= 0) {
-                if (bytesRead < 0) {
-                    error(KIO::ERR_COULD_NOT_READ, ksrc.prettyUrl());
-                    isErr = true;
-                }
-                break;
-            }
+        // Perform the copy, reading from the disk while writing to the server
+        SMBTransfer transfer(&srcFile, srcInfo.size() - processed_size);
+        QByteArray piece;
 
-            const qint64 bytesWritten = smbc_write(dstfd, buf, bytesRead);
+        while (transfer.next(piece)) {
+            const qint64 bytesWritten = smbc_write(dstfd, const_cast<char *>(piece.constData()), piece.size());
             if (bytesWritten == -1) {
                 error(KIO::ERR_COULD_NOT_WRITE, kdst.prettyUrl());
                 isErr = true;
@@ -572,6 +641,11 @@ void SMBSlave::smbCopyPut(const KUrl& ksrc, const KUrl& kdst, int permissions, K
             processed_size += bytesWritten;
             processedSize(processed_size);
         }
+
+        if (!isErr && transfer.error()) {
+            error(KIO::ERR_COULD_NOT_READ, ksrc.prettyUrl());
+            isErr = true;
+        }
     } else {
         isErr = true;
         error(KIO::ERR_COULD_NOT_SEEK, ksrc.prettyUrl());
@@ -632,6 +706,8 @@ void SMBSlave::del( const KUrl &kurl, bool isfile)
     int errNum = 0;
     int retVal = 0;
 
+    cache_clear();
+
     if(isfile)
     {
         // Delete file
@@ -673,6 +749,8 @@ void SMBSlave::mkdir( const KUrl &kurl, int permissions )
     int retVal = 0;
     m_current_url = kurl;
 
+    cache_clear();
+
     retVal = smbc_mkdir(m_current_url.toSmbcUrl(), 0777);
     if( retVal < 0 ){
         errNum = errno;
@@ -725,6 +803,8 @@ void SMBSlave::rename( const KUrl& ksrc, const KUrl& kdest, KIO::JobFlags flags
     src = ksrc;
     dst = kdest;
 
+    cache_clear();
+
     // Check to se if the destination exists
 
     kDebug(KIO_SMB) << "stat dst";
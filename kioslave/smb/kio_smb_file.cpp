@@ -32,6 +32,7 @@
 
 #include "kio_smb.h"
 #include "kio_smb_internal.h"
+#include "kio_smb_transfer.h"
 
 #include <QVarLengthArray>
 #include <QDateTime>
@@ -41,10 +42,8 @@
 //===========================================================================
 void SMBSlave::get( const KUrl& kurl )
 {
-    char        buf[MAX_XFER_BUF_SIZE];
     int         filefd          = 0;
     int         errNum          = 0;
-    ssize_t     bytesread       = 0;
     // time_t      curtime         = 0;
     time_t      lasttime        = 0;
     time_t      starttime       = 0;
@@ -90,38 +89,34 @@ void SMBSlave::get( const KUrl& kurl )
     if(filefd >= 0)
     {
         bool isFirstPacket = true;
+        bool isErr = false;
         lasttime = starttime = time(NULL);
-        while(1)
         {
-            bytesread = smbc_read(filefd, buf, MAX_XFER_BUF_SIZE);
-            if(bytesread == 0)
+            SMBTransfer transfer(filefd, st.st_size, true);
+            while (transfer.next(filedata))
             {
-                // All done reading
-                break;
+                if (isFirstPacket)
+                {
+                    KMimeType::Ptr p_mimeType = KMimeType::findByNameAndContent(url.fileName(), filedata);
+                    mimeType(p_mimeType->name());
+                    isFirstPacket = false;
+                }
+                data( filedata );
+
+                // increment total bytes read
+                totalbytesread += filedata.size();
+
+                processedSize(totalbytesread);
             }
-            else if(bytesread < 0)
-            {
-                error( KIO::ERR_COULD_NOT_READ, url.prettyUrl());
-                return;
-            }
-
-            filedata = QByteArray::fromRawData(buf,bytesread);
-            if (isFirstPacket)
-            {
-                KMimeType::Ptr p_mimeType = KMimeType::findByNameAndContent(url.fileName(), filedata);
-                mimeType(p_mimeType->name());
-                isFirstPacket = false;
-            }
-            data( filedata );
-            filedata.clear();
-
-            // increment total bytes read
-            totalbytesread += bytesread;
-
-            processedSize(totalbytesread);
+            isErr = transfer.error();
         }
 
         smbc_close(filefd);
+        if (isErr)
+        {
+            error( KIO::ERR_COULD_NOT_READ, url.prettyUrl());
+            return;
+        }
         data( QByteArray() );
         processedSize(static_cast<KIO::filesize_t>(st.st_size));
 
@@ -163,6 +158,9 @@ void SMBSlave::open( const KUrl& kurl, QIODevice::OpenMode mode)
     // or else this assignment fails
     m_openUrl = kurl;
 
+    if (mode & QIODevice::WriteOnly)
+        cache_clear();
+
     // Stat
     errNum = cache_stat(m_openUrl,&st);
     if( errNum != 0 )
@@ -269,6 +267,8 @@ void SMBSlave::write(const QByteArray &fileData)
 {
     Q_ASSERT(m_openFd != -1);
 
+    cache_clear();
+
     QByteArray buf(fileData);
 
     ssize_t size = smbc_write(m_openFd, buf.data(), buf.size());
@@ -307,9 +307,6 @@ void SMBSlave::put( const KUrl& kurl,
                     KIO::JobFlags flags )
 {
 
-    void *buf;
-    size_t bufsize;
-
     m_current_url = kurl;
 
     int         filefd;
@@ -318,9 +315,12 @@ void SMBSlave::put( const KUrl& kurl,
     off_t       retValLSeek = 0;
     mode_t      mode;
     QByteArray  filedata;
+    QByteArray  pending;
 
     kDebug(KIO_SMB) << kurl;
 
+    cache_clear();
+
     errNum = cache_stat(m_current_url, &st);
     exists = (errNum == 0);
     if ( exists &&  !(flags & KIO::Overwrite) && !(flags & KIO::Resume))
@@ -398,22 +398,32 @@ void SMBSlave::put( const KUrl& kurl,
         return;
     }
 
-    // Loop until we got 0 (end of data)
-    while(1)
+    // Loop until we got 0 (end of data). The data comes in small pieces,
+    // collect them so that libsmbclient gets large writes it can pipeline.
+    pending.reserve(TRANSFER_SEGMENT_SIZE);
+    bool isEnd = false;
+    while(!isEnd)
     {
         kDebug(KIO_SMB) << "request data ";
         dataReq(); // Request for data
-        kDebug(KIO_SMB) << "write " << m_current_url.toSmbcUrl();
 
         if (readData(filedata) <= 0)
         {
             kDebug(KIO_SMB) << "readData <= 0";
-            break;
+            isEnd = true;
         }
+        else
+        {
+            pending += filedata;
+            if (pending.size() < TRANSFER_SEGMENT_SIZE)
+                continue;
+        }
+
+        if (pending.isEmpty())
+            continue;
+
         kDebug(KIO_SMB) << "write " << m_current_url.toSmbcUrl();
-	buf = filedata.data();
-	bufsize = filedata.size();
-        ssize_t size = smbc_write(filefd, buf, bufsize);
+        ssize_t size = smbc_write(filefd, pending.data(), pending.size());
         if ( size < 0)
         {
             kDebug(KIO_SMB) << "error " << kurl << "could not write !!";
@@ -421,6 +431,8 @@ void SMBSlave::put( const KUrl& kurl,
             return;
         }
         kDebug(KIO_SMB ) << "wrote " << size;
+        pending.clear();
+        pending.reserve(TRANSFER_SEGMENT_SIZE);
     }
     kDebug(KIO_SMB) << "close " << m_current_url.toSmbcUrl();
 
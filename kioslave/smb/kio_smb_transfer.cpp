@@ -0,0 +1,193 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Project:     SMB kioslave for KDE
+//
+// File:        kio_smb_transfer.cpp
+//
+// Abstract:    Reads files in large pieces, ahead of their consumer
+//
+//---------------------------------------------------------------------------
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Lesser General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with this program; see the file COPYING.  If not, please obtain
+//     a copy from http://www.gnu.org/copyleft/gpl.html
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "kio_smb_transfer.h"
+#include "kio_smb.h"
+
+#include <QIODevice>
+#include <QThread>
+
+#include <string.h>
+
+class SMBTransfer::Reader : public QThread
+{
+public:
+    Reader(SMBTransfer *transfer) : m_transfer(transfer) {}
+
+protected:
+    virtual void run() { m_transfer->readAll(); }
+
+private:
+    SMBTransfer *m_transfer;
+};
+
+//===========================================================================
+SMBTransfer::SMBTransfer(int fd, KIO::filesize_t size, bool threaded)
+    : m_fd(fd), m_device(0)
+{
+    init(size, threaded);
+}
+
+//===========================================================================
+SMBTransfer::SMBTransfer(QIODevice *device, KIO::filesize_t size)
+    : m_fd(-1), m_device(device)
+{
+    init(size, true);
+}
+
+//===========================================================================
+SMBTransfer::~SMBTransfer()
+{
+    if (m_reader) {
+        m_mutex.lock();
+        m_cancelled = true;
+        m_segmentFreed.wakeAll();
+        m_mutex.unlock();
+
+        m_reader->wait();
+        delete m_reader;
+    }
+}
+
+//===========================================================================
+void SMBTransfer::init(KIO::filesize_t size, bool threaded)
+{
+    // Small files are read in one go
+    m_segmentSize = qBound(qint64(MAX_XFER_BUF_SIZE), qint64(size), qint64(TRANSFER_SEGMENT_SIZE));
+
+    m_head = 0;
+    m_tail = 0;
+    m_filled = 0;
+    m_holding = false;
+    m_ended = false;
+    m_error = false;
+    m_cancelled = false;
+    m_reader = 0;
+
+    if (threaded) {
+        m_reader = new Reader(this);
+        m_reader->start();
+    }
+}
+
+//===========================================================================
+bool SMBTransfer::next(QByteArray &piece)
+{
+    piece.clear();
+
+    if (!m_reader) {
+        if (m_ended)
+            return false;
+
+        Segment &segment = m_segments[0];
+        const qint64 bytesRead = readSegment(segment);
+        if (bytesRead <= 0) {
+            m_ended = true;
+            m_error = (bytesRead < 0);
+            return false;
+        }
+        piece = QByteArray::fromRawData(segment.buffer.constData(), segment.size);
+        return true;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    // Give back the segment handed out by the last call
+    if (m_holding) {
+        m_holding = false;
+        m_tail = (m_tail + 1) % TRANSFER_SEGMENTS;
+        --m_filled;
+        m_segmentFreed.wakeAll();
+    }
+
+    while (m_filled == 0 && !m_ended)
+        m_segmentFilled.wait(&m_mutex);
+
+    if (m_filled == 0)
+        return false;
+
+    const Segment &segment = m_segments[m_tail];
+    piece = QByteArray::fromRawData(segment.buffer.constData(), segment.size);
+    m_holding = true;
+    return true;
+}
+
+//===========================================================================
+bool SMBTransfer::error() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_error;
+}
+
+//===========================================================================
+qint64 SMBTransfer::readSegment(Segment &segment)
+{
+    if (segment.buffer.size() < m_segmentSize)
+        segment.buffer.resize(m_segmentSize);
+
+    qint64 bytesRead;
+    if (m_device) {
+        bytesRead = m_device->read(segment.buffer.data(), m_segmentSize);
+    } else {
+        bytesRead = smbc_read(m_fd, segment.buffer.data(), m_segmentSize);
+        if (bytesRead < 0)
+            kDebug(KIO_SMB) << "smbc_read failed:" << strerror(errno);
+    }
+
+    segment.size = qMax(bytesRead, qint64(0));
+    return bytesRead;
+}
+
+//===========================================================================
+void SMBTransfer::readAll()
+{
+    forever {
+        m_mutex.lock();
+        while (m_filled == TRANSFER_SEGMENTS && !m_cancelled)
+            m_segmentFreed.wait(&m_mutex);
+        if (m_cancelled) {
+            m_mutex.unlock();
+            return;
+        }
+        // The segment at m_head is neither filled nor handed out, so it
+        // can be read into without holding the lock
+        Segment &segment = m_segments[m_head];
+        m_mutex.unlock();
+
+        const qint64 bytesRead = readSegment(segment);
+
+        QMutexLocker locker(&m_mutex);
+        if (bytesRead <= 0) {
+            m_ended = true;
+            m_error = (bytesRead < 0);
+            m_segmentFilled.wakeAll();
+            return;
+        }
+        m_head = (m_head + 1) % TRANSFER_SEGMENTS;
+        ++m_filled;
+        m_segmentFilled.wakeAll();
+    }
+}
@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// Project:     SMB kioslave for KDE
+//
+// File:        kio_smb_transfer.h
+//
+// Abstract:    Reads files in large pieces, ahead of their consumer
+//
+//---------------------------------------------------------------------------
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation; either version 2.1 of the License, or
+// (at your option) any later version.
+//
+//     This program is distributed in the hope that it will be useful,
+//     but WITHOUT ANY WARRANTY; without even the implied warranty of
+//     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//     GNU Lesser General Public License for more details.
+//
+//     You should have received a copy of the GNU General Public License
+//     along with this program; see the file COPYING.  If not, please obtain
+//     a copy from http://www.gnu.org/copyleft/gpl.html
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef KIO_SMB_TRANSFER_H_INCLUDED
+#define KIO_SMB_TRANSFER_H_INCLUDED
+
+#include <kio/global.h>
+
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+class QIODevice;
+
+// Large enough for libsmbclient to keep several maximum size requests in
+// flight, small enough to report progress a few times per second.
+#define TRANSFER_SEGMENT_SIZE       (4 * 1024 * 1024)
+#define TRANSFER_SEGMENTS           4
+
+/**
+ *   Reads a file in pieces of up to 4 MiB into a ring of buffers.
+ *
+ *   libsmbclient splits a large smbc_read() or smbc_write() into requests
+ *   of the size negotiated with the server and keeps several of them in
+ *   flight, so large pieces are what make a transfer use the link well.
+ *   When the reads are done on a thread of their own, reading the next
+ *   pieces also overlaps with writing the current one.
+ *
+ *   libsmbclient must not be used on another thread at the same time, so
+ *   the reading thread is only for transfers where the other side is a
+ *   local file or the slave connection.
+ */
+class SMBTransfer
+{
+public:
+    /**
+     * Reads from the libsmbclient file @p fd, starting at its current
+     * position. @p size is the size of the file, 0 if unknown.
+     */
+    SMBTransfer(int fd, KIO::filesize_t size, bool threaded);
+
+    /**
+     * Reads from the open local file @p device on a thread of its own
+     */
+    SMBTransfer(QIODevice *device, KIO::filesize_t size);
+
+    /**
+     * Stops the reading thread, even if the file was not read to its end
+     */
+    ~SMBTransfer();
+
+    /**
+     * Returns the next piece of the file in @p piece. The piece stays
+     * valid until the next call. Returns false at the end of the file
+     * or when reading failed.
+     */
+    bool next(QByteArray &piece);
+
+    /**
+     * Returns true if reading failed
+     */
+    bool error() const;
+
+private:
+    class Reader;
+
+    struct Segment
+    {
+        QByteArray buffer;
+        qint64 size;
+    };
+
+    void init(KIO::filesize_t size, bool threaded);
+    qint64 readSegment(Segment &segment);
+    void readAll();
+
+    int m_fd;
+    QIODevice *m_device;
+    qint64 m_segmentSize;
+
+    Segment m_segments[TRANSFER_SEGMENTS];
+    int m_head;                 ///< Next segment to read into
+    int m_tail;                 ///< Next segment to hand out
+    int m_filled;               ///< Segments read but not handed out and given back
+    bool m_holding;             ///< The segment at m_tail is handed out
+    bool m_ended;               ///< Reading stopped at the end or on an error
+    bool m_error;
+    bool m_cancelled;
+
+    Reader *m_reader;
+    mutable QMutex m_mutex;     ///< Guards the ring when there is a reader
+    QWaitCondition m_segmentFilled;
+    QWaitCondition m_segmentFreed;
+};
+
+#endif
@@ -19,6 +19,7 @@
 */
 
 #include "imagecreator.h"
+#include "imagedecoder.h"
 
 #include <assert.h>
 
@@ -34,10 +35,10 @@ extern "C"
     }
 }
 
-bool ImageCreator::create(const QString &path, int, int, QImage &img)
+bool ImageCreator::create(const QString &path, int width, int height, QImage &img)
 {
-    // create image preview
-    if (!img.load( path ))
+    // create image preview, decoded only as large as needed
+    if (!ImageDecoder::load( path, width, height, img ))
 	return false;
     if (img.depth() != 32)
 	img = img.convertToFormat(img.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
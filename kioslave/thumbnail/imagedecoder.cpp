@@ -0,0 +1,304 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include "imagedecoder.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QSize>
+#include <QtCore/QVector>
+#include <QImage>
+#include <QImageReader>
+
+// A box sums the channels of this many pixels in 16 bit lanes, see spread()
+#define MAX_LANE_PIXELS 257
+
+static quint16 get16(const uchar* data, bool bigEndian)
+{
+    return bigEndian ? (data[0] << 8) | data[1]
+                     : (data[1] << 8) | data[0];
+}
+
+static quint32 get32(const uchar* data, bool bigEndian)
+{
+    return bigEndian ? (quint32(get16(data, true)) << 16) | get16(data + 2, true)
+                     : (quint32(get16(data + 2, false)) << 16) | get16(data, false);
+}
+
+// Returns the entry with tag in the IFD at offset ifd of the TIFF structure
+// of size bytes, or 0 if there is none
+static const uchar* findEntry(const uchar* tiff, quint32 size, bool bigEndian, quint32 ifd, quint16 tag)
+{
+    if (ifd == 0 || ifd > size - 2) {
+        return 0;
+    }
+    const int count = get16(tiff + ifd, bigEndian);
+    if (ifd + 2 + count * 12 > size) {
+        return 0;
+    }
+    for (int i = 0; i < count; ++i) {
+        const uchar* entry = tiff + ifd + 2 + i * 12;
+        if (get16(entry, bigEndian) == tag) {
+            return entry;
+        }
+    }
+    return 0;
+}
+
+// Returns the value of a SHORT or LONG entry, or -1 if there is no entry
+static qint64 entryValue(const uchar* entry, bool bigEndian)
+{
+    if (!entry) {
+        return -1;
+    }
+    const quint16 type = get16(entry + 2, bigEndian);
+    return (type == 3) ? get16(entry + 8, bigEndian) : get32(entry + 8, bigEndian);
+}
+
+// Returns the text of an ASCII entry, like "2011:06:05 12:34:56" of a date,
+// or an empty array if there is no entry
+static QByteArray entryText(const uchar* tiff, quint32 size, bool bigEndian, const uchar* entry)
+{
+    if (!entry || get16(entry + 2, bigEndian) != 2) {
+        return QByteArray();
+    }
+    const quint32 count = get32(entry + 4, bigEndian);
+    const uchar* data = entry + 8;
+    if (count > 4) {
+        const quint32 offset = get32(entry + 8, bigEndian);
+        if (offset > size || count > size - offset) {
+            return QByteArray();
+        }
+        data = tiff + offset;
+    }
+    QByteArray text(reinterpret_cast<const char*>(data), count);
+    const int end = text.indexOf('\0');
+    if (end >= 0) {
+        text.truncate(end);
+    }
+    return text;
+}
+
+// Spreads the four channels of a pixel into the 16 bit lanes of a 64 bit
+// integer, blue, red, green and alpha from the lowest lane on. So the sum of
+// up to MAX_LANE_PIXELS pixels is done with one addition per pixel.
+static inline quint64 spread(QRgb pixel)
+{
+    return quint64(pixel & 0x00ff00ff) | (quint64(pixel & 0xff00ff00) << 24);
+}
+
+bool ImageDecoder::load(const QString& path, int width, int height, QImage& img)
+{
+    QImageReader reader(path);
+    const QSize size = reader.size();
+
+    if (size.isValid() && reader.format() == "jpeg" &&
+        loadExifThumbnail(path, size, width, height, img)) {
+        return true;
+    }
+
+    // The JPEG plugin of Qt decodes at a reduced scale for this, other
+    // plugins would decode all of the image and then scale it smoothly
+    if (size.isValid() && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        const QSize scaledSize = size.scaled(width, height, Qt::KeepAspectRatio);
+        if (scaledSize.width() < size.width() && !scaledSize.isEmpty()) {
+            reader.setScaledSize(scaledSize);
+        }
+    }
+
+    if (!reader.read(&img)) {
+        return false;
+    }
+    boxScale(img, width, height);
+    return true;
+}
+
+bool ImageDecoder::loadExifThumbnail(const QString& path, const QSize& imageSize,
+                                     int width, int height, QImage& img)
+{
+    if (imageSize.isEmpty()) {
+        return false;
+    }
+    const QSize scaledSize = imageSize.scaled(width, height, Qt::KeepAspectRatio);
+    if (scaledSize.width() >= imageSize.width()) {
+        return false;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.read(2) != "\xff\xd8") {
+        return false;
+    }
+
+    // The EXIF data is in an APP1 segment, which comes before the image
+    // data together with the other APPn and COM segments
+    QByteArray exif;
+    while (exif.isEmpty()) {
+        uchar marker[4];
+        if (file.read(reinterpret_cast<char*>(marker), 4) != 4 || marker[0] != 0xff ||
+            !((marker[1] >= 0xe0 && marker[1] <= 0xef) || marker[1] == 0xfe)) {
+            return false;
+        }
+        const int length = ((marker[2] << 8) | marker[3]) - 2;
+        if (length < 0) {
+            return false;
+        }
+        if (marker[1] == 0xe1) {
+            const QByteArray segment = file.read(length);
+            if (segment.size() != length) {
+                return false;
+            }
+            if (segment.startsWith(QByteArray("Exif\0\0", 6))) {
+                exif = segment.mid(6);
+            }
+        } else if (!file.seek(file.pos() + length)) {
+            return false;
+        }
+    }
+
+    // The TIFF structure of the EXIF data, the second IFD describes the thumbnail
+    const uchar* tiff = reinterpret_cast<const uchar*>(exif.constData());
+    const quint32 size = exif.size();
+    if (size < 8 || (qstrncmp(exif.constData(), "MM", 2) && qstrncmp(exif.constData(), "II", 2))) {
+        return false;
+    }
+    const bool bigEndian = (tiff[0] == 'M');
+
+    const quint32 ifd0 = get32(tiff + 4, bigEndian);
+    if (ifd0 > size - 2) {
+        return false;
+    }
+    const quint32 next = ifd0 + 2 + get16(tiff + ifd0, bigEndian) * 12;
+    if (next > size - 4) {
+        return false;
+    }
+    const quint32 ifd1 = get32(tiff + next, bigEndian);
+
+    const qint64 offset = entryValue(findEntry(tiff, size, bigEndian, ifd1, 0x0201), bigEndian); // JPEGInterchangeFormat
+    const qint64 length = entryValue(findEntry(tiff, size, bigEndian, ifd1, 0x0202), bigEndian); // JPEGInterchangeFormatLength
+    if (offset <= 0 || length <= 0 || offset > size || length > size - offset) {
+        return false;
+    }
+
+    // Editors which keep the old thumbnail show up in the date or the size
+    // of the image, then it has to be decoded
+    const qint64 exifIfd = entryValue(findEntry(tiff, size, bigEndian, ifd0, 0x8769), bigEndian); // ExifIFDPointer
+    const QByteArray dateTime = entryText(tiff, size, bigEndian, findEntry(tiff, size, bigEndian, ifd0, 0x0132)); // DateTime
+    const QByteArray thumbnailDateTime = entryText(tiff, size, bigEndian, findEntry(tiff, size, bigEndian, ifd1, 0x0132));
+    if (!thumbnailDateTime.isEmpty()) {
+        if (thumbnailDateTime != dateTime) {
+            return false;
+        }
+    } else if (exifIfd > 0) {
+        const QByteArray original = entryText(tiff, size, bigEndian, findEntry(tiff, size, bigEndian, exifIfd, 0x9003)); // DateTimeOriginal
+        if (!original.isEmpty() && original != dateTime) {
+            return false;
+        }
+    }
+    if (exifIfd > 0) {
+        const qint64 pixelWidth = entryValue(findEntry(tiff, size, bigEndian, exifIfd, 0xa002), bigEndian); // PixelXDimension
+        const qint64 pixelHeight = entryValue(findEntry(tiff, size, bigEndian, exifIfd, 0xa003), bigEndian); // PixelYDimension
+        if ((pixelWidth >= 0 && pixelWidth != imageSize.width()) ||
+            (pixelHeight >= 0 && pixelHeight != imageSize.height())) {
+            return false;
+        }
+    }
+
+    QImage thumbnail;
+    if (!thumbnail.loadFromData(tiff + offset, int(length), "JPEG")) {
+        return false;
+    }
+
+    // The size IFD1 gives for the thumbnail, if any, has to be its real one
+    const qint64 thumbnailWidth = entryValue(findEntry(tiff, size, bigEndian, ifd1, 0x0100), bigEndian); // ImageWidth
+    const qint64 thumbnailHeight = entryValue(findEntry(tiff, size, bigEndian, ifd1, 0x0101), bigEndian); // ImageLength
+    if ((thumbnailWidth >= 0 && thumbnailWidth != thumbnail.width()) ||
+        (thumbnailHeight >= 0 && thumbnailHeight != thumbnail.height())) {
+        return false;
+    }
+
+    // Cameras put thumbnails of other aspect ratios into black borders
+    const qint64 thumbnailArea = qint64(thumbnail.width()) * imageSize.height();
+    if (qAbs(thumbnailArea - qint64(thumbnail.height()) * imageSize.width()) * 50 > thumbnailArea) {
+        return false;
+    }
+    if (thumbnail.width() < scaledSize.width() - 1 || thumbnail.height() < scaledSize.height() - 1) {
+        return false;
+    }
+
+    img = thumbnail;
+    return true;
+}
+
+void ImageDecoder::boxScale(QImage& img, int width, int height)
+{
+    if (img.isNull() || width <= 0 || height <= 0) {
+        return;
+    }
+
+    // The largest box which still leaves enough pixels to scale the image
+    // down to width x height
+    const int factor = qMax(img.width() / width, img.height() / height);
+    if (factor < 2) {
+        return;
+    }
+
+    const bool alpha = img.hasAlphaChannel();
+    const QImage::Format format = img.format();
+    // Averaging needs premultiplied pixels, or transparent ones would bleed their color
+    const QImage source = img.convertToFormat(alpha ? QImage::Format_ARGB32_Premultiplied
+                                                    : QImage::Format_RGB32);
+    const int outWidth = source.width() / factor;
+    const int outHeight = source.height() / factor;
+    QImage result(outWidth, outHeight, source.format());
+
+    const quint32 area = factor * factor;
+    QVector<quint32> sums(outWidth * 4);
+    for (int y = 0; y < outHeight; ++y) {
+        sums.fill(0);
+        for (int row = 0; row < factor; ++row) {
+            const QRgb* in = reinterpret_cast<const QRgb*>(source.constScanLine(y * factor + row));
+            quint32* sum = sums.data();
+            for (int x = 0; x < outWidth; ++x, sum += 4) {
+                for (int start = 0; start < factor; start += MAX_LANE_PIXELS) {
+                    const int end = qMin(factor, start + MAX_LANE_PIXELS);
+                    quint64 lanes = 0;
+                    for (int i = start; i < end; ++i) {
+                        lanes += spread(in[i]);
+                    }
+                    sum[0] += lanes & 0xffff;
+                    sum[1] += (lanes >> 16) & 0xffff;
+                    sum[2] += (lanes >> 32) & 0xffff;
+                    sum[3] += lanes >> 48;
+                }
+                in += factor;
+            }
+        }
+
+        QRgb* out = reinterpret_cast<QRgb*>(result.scanLine(y));
+        const quint32* sum = sums.constData();
+        for (int x = 0; x < outWidth; ++x, sum += 4) {
+            const quint32 blue = (sum[0] + area / 2) / area;
+            const quint32 red = (sum[1] + area / 2) / area;
+            const quint32 green = (sum[2] + area / 2) / area;
+            const quint32 alphaValue = alpha ? (sum[3] + area / 2) / area : 0xff;
+            out[x] = (alphaValue << 24) | (red << 16) | (green << 8) | blue;
+        }
+    }
+
+    img = (alpha && format != QImage::Format_ARGB32_Premultiplied)
+          ? result.convertToFormat(QImage::Format_ARGB32) : result;
+}
@@ -0,0 +1,58 @@
+/*  This file is part of the KDE libraries
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _IMAGEDECODER_H_
+#define _IMAGEDECODER_H_
+
+class QImage;
+class QSize;
+class QString;
+
+/**
+ * Helpers for the image thumbnail creators, which only decode as much of
+ * an image as the thumbnail needs.
+ */
+class ImageDecoder
+{
+public:
+    /**
+     * Loads the image at \p path so that it is not much larger than
+     * \p width x \p height pixels. JPEG images are taken from their EXIF
+     * thumbnail or decoded at a reduced scale, other formats are decoded
+     * and reduced with boxScale().
+     */
+    static bool load(const QString& path, int width, int height, QImage& img);
+
+    /**
+     * Loads the thumbnail embedded in the EXIF data of the JPEG image at \p path
+     * of \p imageSize pixels. Fails unless it has the aspect ratio of the image and
+     * it is large enough for a thumbnail of \p width x \p height pixels, or if
+     * the dates and sizes in the EXIF data show that the image was changed later.
+     */
+    static bool loadExifThumbnail(const QString& path, const QSize& imageSize,
+                                  int width, int height, QImage& img);
+
+    /**
+     * Reduces \p img by averaging boxes of pixels, until it is less than twice
+     * as large as needed for a thumbnail of \p width x \p height pixels. The
+     * remaining scaling is cheap enough for QImage::scaled().
+     */
+    static void boxScale(QImage& img, int width, int height);
+};
+
+#endif
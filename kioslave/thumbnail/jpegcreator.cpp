@@ -19,12 +19,15 @@
 
 #include "jpegcreator.h"
 
+#include <cmath>
 #include <cstdio>
 #include <csetjmp>
+#include "imagedecoder.h"
 #include "jpegcreatorsettings.h"
 #include <QCheckBox>
 #include <QFile>
 #include <QImage>
+#include <QMutex>
 #include <kdemacros.h>
 #include <klocale.h>
 
@@ -160,6 +163,8 @@ QTransform JpegCreator::orientationMatrix(int exivOrientation) const
  *         jpegDecompress.dct_method (JDCT_IFAST, JDCT_ISLOW, JDCT_IFLOAT)
  * and the resampling parameter of QImage.
  *
+ * If the EXIF data of the image has a thumbnail which is large enough, that one is used instead.
+ *
  * Important: We do not need to scaled to exact dimesions, as thumbnail.cpp will check dimensions and
  * rescale anyway.
  */
@@ -193,68 +198,85 @@ bool JpegCreator::create(const QString &path, int width, int height, QImage &ima
 #endif
     jpeg_read_header(&jpegDecompress, TRUE);
 
-    const double ratioWidth = jpegDecompress.image_width / (double)width;
-    const double ratioHeight = jpegDecompress.image_height / (double)height;
-    int scale = 1;
-    if (ratioWidth > 7 || ratioHeight > 7) {
-        scale = 8;
-    } else if (ratioWidth > 3.5 || ratioHeight > 3.5) {
-        scale = 4;
-    } else if (ratioWidth > 1.75 || ratioHeight > 1.75) {
-        scale = 2;
-    }
-
-    // set jpeglib decompression parameters
-    jpegDecompress.scale_num           = 1;
-    jpegDecompress.scale_denom         = scale;
-    jpegDecompress.do_fancy_upsampling = FALSE;
-    jpegDecompress.do_block_smoothing  = FALSE;
-    jpegDecompress.dct_method          = JDCT_IFAST;
-    jpegDecompress.err->error_exit     = jpeg_custom_error_callback;
-    jpegDecompress.out_color_space     = JCS_RGB;
-
-    jpeg_calc_output_dimensions(&jpegDecompress);
-
-    if (setjmp(jpegError.setjmp_buffer)) {
-        jpeg_abort_decompress(&jpegDecompress);
+    const QSize imageSize(jpegDecompress.image_width, jpegDecompress.image_height);
+    if (ImageDecoder::loadExifThumbnail(path, imageSize, width, height, img)) {
+        // The thumbnail of the camera is large enough, the image is not decoded at all
+        jpeg_destroy_decompress(&jpegDecompress);
         fclose(jpegFile);
-        // libjpeg version failed, fall back to direct loading of QImage
-        if (!img.load(path)) {
-            return false;
-        }
-        if (img.depth() != 32) {
-            img = img.convertToFormat(QImage::Format_RGB32);
-        }
     } else {
-        jpeg_start_decompress(&jpegDecompress);
-        img = QImage(jpegDecompress.output_width, jpegDecompress.output_height, QImage::Format_RGB32);
-        uchar *buffer = img.bits();
-        const int bpl = img.bytesPerLine();
-        while (jpegDecompress.output_scanline < jpegDecompress.output_height) {
-            // advance line-pointer to next line
-            uchar *line = buffer + jpegDecompress.output_scanline * bpl;
-            jpeg_read_scanlines(&jpegDecompress, &line, 1);
+        // Decode at the smallest scale which still covers the thumbnail
+        const double scale = qMin(width / double(imageSize.width()), height / double(imageSize.height()));
+#if JPEG_LIB_VERSION >= 70 || defined(LIBJPEG_TURBO_VERSION)
+        // libjpeg 7 and libjpeg-turbo scale by N/8
+        jpegDecompress.scale_num       = qBound(1, int(std::ceil(scale * 8)), 8);
+        jpegDecompress.scale_denom     = 8;
+#else
+        int denominator = 1;
+        while (denominator < 8 && scale * denominator * 2 <= 1) {
+            denominator *= 2;
         }
-        jpeg_finish_decompress(&jpegDecompress);
-
-        // align correctly for QImage
-        // code copied from Gwenview and digiKam
-        for (int i = 0; i < int(jpegDecompress.output_height); ++i) {
-            uchar *in = img.scanLine(i) + jpegDecompress.output_width * 3;
-            QRgb *out = (QRgb*)img.scanLine(i);
-            for (int j = jpegDecompress.output_width - 1; j >= 0; --j) {
-                in -= 3;
-                out[j] = qRgb(in[0], in[1], in[2]);
+        jpegDecompress.scale_num       = 1;
+        jpegDecompress.scale_denom     = denominator;
+#endif
+
+        // set jpeglib decompression parameters
+        jpegDecompress.do_fancy_upsampling = FALSE;
+        jpegDecompress.do_block_smoothing  = FALSE;
+        jpegDecompress.dct_method          = JDCT_IFAST;
+        jpegDecompress.err->error_exit     = jpeg_custom_error_callback;
+        jpegDecompress.out_color_space     = JCS_RGB;
+
+        jpeg_calc_output_dimensions(&jpegDecompress);
+
+        if (setjmp(jpegError.setjmp_buffer)) {
+            jpeg_abort_decompress(&jpegDecompress);
+            fclose(jpegFile);
+            // libjpeg version failed, fall back to direct loading of QImage
+            if (!img.load(path)) {
+                return false;
+            }
+            if (img.depth() != 32) {
+                img = img.convertToFormat(QImage::Format_RGB32);
             }
+        } else {
+            jpeg_start_decompress(&jpegDecompress);
+            img = QImage(jpegDecompress.output_width, jpegDecompress.output_height, QImage::Format_RGB32);
+            uchar *buffer = img.bits();
+            const int bpl = img.bytesPerLine();
+            while (jpegDecompress.output_scanline < jpegDecompress.output_height) {
+                // advance line-pointer to next line
+                uchar *line = buffer + jpegDecompress.output_scanline * bpl;
+                jpeg_read_scanlines(&jpegDecompress, &line, 1);
+            }
+            jpeg_finish_decompress(&jpegDecompress);
+
+            // align correctly for QImage
+            // code copied from Gwenview and digiKam
+            for (int i = 0; i < int(jpegDecompress.output_height); ++i) {
+                uchar *in = img.scanLine(i) + jpegDecompress.output_width * 3;
+                QRgb *out = (QRgb*)img.scanLine(i);
+                for (int j = jpegDecompress.output_width - 1; j >= 0; --j) {
+                    in -= 3;
+                    out[j] = qRgb(in[0], in[1], in[2]);
+                }
+            }
+            fclose(jpegFile);
+            jpeg_destroy_decompress(&jpegDecompress);
         }
-        fclose(jpegFile);
-        jpeg_destroy_decompress(&jpegDecompress);
     }
 
+    // Cheaper than the smooth scaling of the slave, which only does the rest
+    ImageDecoder::boxScale(img, width, height);
+
 #ifdef HAVE_EXIV2
+    // The thumbnail slave may call create() from several threads at once
+    static QMutex settingsMutex;
+    settingsMutex.lock();
     JpegCreatorSettings* settings = JpegCreatorSettings::self();
     settings->readConfig();
-    if (settings->rotate()) {
+    const bool rotate = settings->rotate();
+    settingsMutex.unlock();
+    if (rotate) {
         //Handle exif rotation
         try {
             Exiv2::Image::AutoPtr exivImg = Exiv2::ImageFactory::open(name.constData());
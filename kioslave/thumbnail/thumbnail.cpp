@@ -31,14 +31,20 @@
 #include <sys/shm.h>
 #endif
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QBuffer>
 #include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTime>
+#include <QtCore/QWaitCondition>
 #include <QBitmap>
 #include <QImage>
 #include <QPainter>
 #include <QPixmap>
 
-#include <kcodecs.h>
 #include <kurl.h>
 #include <kapplication.h>
 #include <kcmdlineargs.h>
@@ -53,7 +59,6 @@
 #include <kservicetypetrader.h>
 #include <kmimetypetrader.h>
 #include <kstandarddirs.h>
-#include <ktemporaryfile.h>
 #include <kfilemetainfo.h>
 #include <klocale.h>
 #include <kde_file.h>
@@ -76,6 +81,7 @@
 #endif
 
 #include "imagefilter.h"
+#include "thumbnailcache.h"
 
 // Recognized metadata entries:
 // mimeType     - the mime type of the file, used for the overlay icon if any
@@ -94,9 +100,121 @@
 //                    int height
 //                    int depth
 //                Otherwise, the data returned is the image in PNG format.
+//
+// Batch mode, for creating the thumbnails of many files with one job:
+// special() with the command 1, followed by a KUrl::List of the files and a
+// QStringList of their MIME types. The width, height, iconSize, iconAlpha and
+// sequence-index entries apply to all files, plugin is ignored. shmid must be
+// given, the segment is used as a ring buffer:
+//                    quint32 readPos  - moved on by the application
+//                    quint32 writePos - moved on by the slave
+//                    (8 bytes reserved)
+//                    the image data, of which the largest power of two bytes
+//                    that fit (at most 2 GiB) are used
+// For each file, in the order the thumbnails are done, the slave returns
+//                    int index        - of the file in the list
+//                    bool created
+// and if the thumbnail was created, followed by
+//                    int width
+//                    int height
+//                    quint8 format
+//                    quint32 offset   - of the image in the image data
+//                    quint32 next     - the readPos once the image is copied
+// The application copies the image and then stores next into readPos. The
+// slave waits for that when the ring buffer is full.
 
 using namespace KIO;
 
+// Command of ThumbnailProtocol::special
+#define BATCH_COMMAND 1
+// Size of the ring buffer header in the shared memory segment
+#define RING_HEADER_SIZE 16
+// How long to wait for the application to make room in the ring buffer
+#define RING_TIMEOUT 30000 // 30s
+
+namespace {
+
+// Header of the ring buffer of the batch mode
+struct RingHeader
+{
+    QBasicAtomicInt readPos;
+    QBasicAtomicInt writePos;
+};
+
+struct BatchResult
+{
+    int index;
+    bool created;
+    QImage image;
+};
+
+// Thumbnails created by the thread pool, for the slave thread to send them
+class BatchResults
+{
+public:
+    void add(const BatchResult& result)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_results.enqueue(result);
+        m_ready.wakeOne();
+    }
+
+    // Waits for a result if \p wait is set and there is none yet
+    bool take(BatchResult& result, bool wait)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_results.isEmpty() && wait) {
+            m_ready.wait(&m_mutex);
+        }
+        if (m_results.isEmpty()) {
+            return false;
+        }
+        result = m_results.dequeue();
+        return true;
+    }
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_ready;
+    QQueue<BatchResult> m_results;
+};
+
+class ThumbnailTask : public QRunnable
+{
+public:
+    ThumbnailTask(ThumbCreator* creator, ThumbnailCache* cache, int index, const QString& path,
+                  const QString& mimeType, int width, int height, BatchResults* results)
+        : m_creator(creator), m_cache(cache), m_index(index), m_path(path), m_mimeType(mimeType),
+          m_width(width), m_height(height), m_results(results)
+    {
+    }
+
+    virtual void run()
+    {
+        BatchResult result;
+        result.index = m_index;
+        result.created = ThumbnailProtocol::createCachedThumbnail(m_creator, m_cache, m_path, m_mimeType,
+                                                                  m_width, m_height, result.image);
+        if (result.created) {
+            // The expensive part of the decoration, the rest is done by the slave
+            ThumbnailProtocol::scaleDownImage(result.image, m_width, m_height);
+        }
+        m_results->add(result);
+    }
+
+private:
+    ThumbCreator* m_creator;
+    ThumbnailCache* m_cache;
+    int m_index;
+    QString m_path;
+    QString m_mimeType;
+    int m_width;
+    int m_height;
+    BatchResults* m_results;
+};
+
+}
+
 extern "C"
 {
     KDE_EXPORT int kdemain(int argc, char **argv);
@@ -141,7 +259,11 @@ int kdemain(int argc, char **argv)
 ThumbnailProtocol::ThumbnailProtocol(const QByteArray &pool, const QByteArray &app)
     : SlaveBase("thumbnail", pool, app),
       m_iconSize(0),
-      m_maxFileSize(0)
+      m_pluginPropertiesRead(false),
+      m_cache(0),
+      m_maxFileSize(0),
+      m_useFileThumbnails(true),
+      m_settingsRead(false)
 {
 
 }
@@ -150,6 +272,7 @@ ThumbnailProtocol::~ThumbnailProtocol()
 {
     qDeleteAll( m_creators );
     m_creators.clear();
+    delete m_cache;
 }
 
 void ThumbnailProtocol::get(const KUrl &url)
@@ -216,101 +339,23 @@ void ThumbnailProtocol::get(const KUrl &url)
     m_iconAlpha = metaData("iconAlpha").toInt();
 
     QImage img;
-
-    KConfigGroup group( KGlobal::config(), "PreviewSettings" );
-
-    // ### KFMI
-    bool kfmiThumb = false;
-    if (group.readEntry( "UseFileThumbnails", true)) {
-        KService::Ptr service =
-            KMimeTypeTrader::self()->preferredService( m_mimeType, "KFilePlugin");
-
-        if (service && service->isValid() &&
-            service->property("SupportsThumbnail").toBool()) {
-            // was:  KFileMetaInfo info(url.path(), m_mimeType, KFileMetaInfo::Thumbnail);
-            // but m_mimeType and WhatFlags are now unused in KFileMetaInfo, and not present in the
-            // call that takes a KUrl
-            KFileMetaInfo info(url);
-            if (info.isValid()) {
-                KFileMetaInfoItem item = info.item("thumbnail");
-                if (item.isValid() && item.value().type() == QVariant::Image) {
-                    img = item.value().value<QImage>();
-                    kDebug(7115) << "using KFMI for the thumbnail\n";
-                    kfmiThumb = true;
-                }
-            }
-        }
-    }
     ThumbCreator::Flags flags = ThumbCreator::None;
-
-    if (!kfmiThumb) {
-        QString plugin = metaData("plugin");
-        if ((plugin.isEmpty() || plugin == "directorythumbnail") && m_mimeType == "inode/directory") {
-            img = thumbForDirectory(url);
-            if(img.isNull()) {
-              error(KIO::ERR_INTERNAL, i18n("Cannot create thumbnail for directory"));
-              return;
-            }
-        } else {
+    QString plugin = metaData("plugin");
 #ifdef THUMBNAIL_HACK
-            if (plugin.isEmpty()) {
-                plugin = pluginForMimeType(m_mimeType);
-            }
-
-            kDebug(7115) << "Guess plugin: " << plugin;
-#endif
-            if (plugin.isEmpty()) {
-                error(KIO::ERR_INTERNAL, i18n("No plugin specified."));
-                return;
-            }
-
-            ThumbCreator* creator = getThumbCreator(plugin);
-            if(!creator) {
-                error(KIO::ERR_INTERNAL, i18n("Cannot load ThumbCreator %1", plugin));
-                return;
-            }
-
-            ThumbSequenceCreator* sequenceCreator = dynamic_cast<ThumbSequenceCreator*>(creator);
-            if(sequenceCreator)
-                sequenceCreator->setSequenceIndex(sequenceIndex());
-
-            if (!creator->create(url.path(), m_width, m_height, img)) {
-                error(KIO::ERR_INTERNAL, i18n("Cannot create thumbnail for %1", url.path()));
-                return;
-            }
-            flags = creator->flags();
-        }
+    if (plugin.isEmpty() && m_mimeType != "inode/directory") {
+        plugin = pluginForMimeType(m_mimeType);
     }
 
-    scaleDownImage(img, m_width, m_height);
+    kDebug(7115) << "Guess plugin: " << plugin;
+#endif
 
-    if (flags & ThumbCreator::DrawFrame) {
-        int x2 = img.width() - 1;
-        int y2 = img.height() - 1;
-        // paint a black rectangle around the "page"
-        QPainter p;
-        p.begin( &img );
-        p.setPen( QColor( 48, 48, 48 ));
-        p.drawLine( x2, 0, x2, y2 );
-        p.drawLine( 0, y2, x2, y2 );
-        p.setPen( QColor( 215, 215, 215 ));
-        p.drawLine( 0, 0, x2, 0 );
-        p.drawLine( 0, 0, 0, y2 );
-        p.end();
+    QString errorText;
+    if (!createThumbnail(url, plugin, img, flags, errorText)) {
+        error(KIO::ERR_INTERNAL, errorText);
+        return;
     }
 
-    if ((flags & ThumbCreator::BlendIcon) && KIconLoader::global()->alphaBlending(KIconLoader::Desktop)) {
-        // blending the mimetype icon in
-        QImage icon = getIcon();
-
-        int x = img.width() - icon.width() - 4;
-        x = qMax( x, 0 );
-        int y = img.height() - icon.height() - 6;
-        y = qMax( y, 0 );
-        QPainter p(&img);
-        p.setOpacity(m_iconAlpha/255.0);
-        p.drawImage(x, y, icon);
-    }
+    decorateThumbnail(img, flags);
 
     if (img.isNull()) {
         error(KIO::ERR_INTERNAL, i18n("Failed to create a thumbnail."));
@@ -372,11 +417,354 @@ void ThumbnailProtocol::get(const KUrl &url)
     finished();
 }
 
+void ThumbnailProtocol::special(const QByteArray &data)
+{
+    QDataStream stream(data);
+    int command;
+    stream >> command;
+
+    switch (command) {
+    case BATCH_COMMAND: {
+        KUrl::List urls;
+        QStringList mimeTypes;
+        stream >> urls >> mimeTypes;
+        const QString shmid = metaData("shmid");
+        if (shmid.isEmpty() || urls.count() != mimeTypes.count()) {
+            error(KIO::ERR_INTERNAL, i18n("Invalid thumbnail batch."));
+            return;
+        }
+        createThumbnails(urls, mimeTypes, shmid.toInt());
+        break;
+    }
+    default:
+        kWarning(7115) << "Unknown command in special():" << command;
+        error(KIO::ERR_UNSUPPORTED_ACTION, QString::number(command));
+        break;
+    }
+}
+
+void ThumbnailProtocol::readSettings()
+{
+    if (m_settingsRead) {
+        return;
+    }
+
+    const KConfigGroup globalConfig(KGlobal::config(), "PreviewSettings");
+    m_useFileThumbnails = globalConfig.readEntry("UseFileThumbnails", true);
+    // Directories that the directory preview will be propagated into if there is no direct sub-directories
+    m_propagationDirectories = globalConfig.readEntry("PropagationDirectories", QStringList() << "VIDEO_TS").toSet();
+    m_maxFileSize = globalConfig.readEntry("MaximumSize", 5 * 1024 * 1024); // 5 MByte default
+    m_enabledPlugins = globalConfig.readEntry("Plugins", QStringList()
+                                                         << "imagethumbnail"
+                                                         << "jpegthumbnail"
+                                                         << "videopreview");
+    m_cache = new ThumbnailCache(globalConfig.readEntry("MaximumCacheSize", Q_INT64_C(256 * 1024 * 1024)));
+    m_settingsRead = true;
+}
+
+bool ThumbnailProtocol::createThumbnail(const KUrl& url, const QString& plugin, QImage& img,
+                                        ThumbCreator::Flags& flags, QString& errorText)
+{
+    readSettings();
+    flags = ThumbCreator::None;
+
+    // ### KFMI
+    if (m_useFileThumbnails) {
+        QHash<QString, bool>::const_iterator it = m_fileThumbnailTypes.constFind(m_mimeType);
+        if (it == m_fileThumbnailTypes.constEnd()) {
+            KService::Ptr service =
+                KMimeTypeTrader::self()->preferredService( m_mimeType, "KFilePlugin");
+            it = m_fileThumbnailTypes.insert(m_mimeType, service && service->isValid() &&
+                                                         service->property("SupportsThumbnail").toBool());
+        }
+
+        if (it.value()) {
+            // was:  KFileMetaInfo info(url.path(), m_mimeType, KFileMetaInfo::Thumbnail);
+            // but m_mimeType and WhatFlags are now unused in KFileMetaInfo, and not present in the
+            // call that takes a KUrl
+            KFileMetaInfo info(url);
+            if (info.isValid()) {
+                KFileMetaInfoItem item = info.item("thumbnail");
+                if (item.isValid() && item.value().type() == QVariant::Image) {
+                    img = item.value().value<QImage>();
+                    kDebug(7115) << "using KFMI for the thumbnail\n";
+                    return true;
+                }
+            }
+        }
+    }
+
+    if ((plugin.isEmpty() || plugin == "directorythumbnail") && m_mimeType == "inode/directory") {
+        img = thumbForDirectory(url);
+        if(img.isNull()) {
+          errorText = i18n("Cannot create thumbnail for directory");
+          return false;
+        }
+        return true;
+    }
+
+    if (plugin.isEmpty()) {
+        errorText = i18n("No plugin specified.");
+        return false;
+    }
+
+    ThumbCreator* creator = getThumbCreator(plugin);
+    if(!creator) {
+        errorText = i18n("Cannot load ThumbCreator %1", plugin);
+        return false;
+    }
+
+    ThumbSequenceCreator* sequenceCreator = dynamic_cast<ThumbSequenceCreator*>(creator);
+    if(sequenceCreator)
+        sequenceCreator->setSequenceIndex(sequenceIndex());
+
+    // Only the plain first thumbnail is cached, the frame and icon are added later
+    flags = creator->flags();
+    ThumbnailCache* cache = (isCached(plugin) && flags == ThumbCreator::None && sequenceIndex() == 0) ? m_cache : 0;
+
+    if (!createCachedThumbnail(creator, cache, url.path(), m_mimeType, m_width, m_height, img)) {
+        errorText = i18n("Cannot create thumbnail for %1", url.path());
+        return false;
+    }
+    return true;
+}
+
+bool ThumbnailProtocol::createCachedThumbnail(ThumbCreator* creator, ThumbnailCache* cache,
+                                              const QString& path, const QString& mimeType,
+                                              int width, int height, QImage& img)
+{
+    const int cacheSize = cache ? ThumbnailCache::cacheSize(width, height) : 0;
+    if (!cacheSize) {
+        return creator->create(path, width, height, img);
+    }
+
+    if (cache->load(path, cacheSize, img)) {
+        return true;
+    }
+    if (cache->hasFailed(path)) {
+        return false;
+    }
+
+    // Created in the size of the cache, so that it fits other requests too
+    if (!creator->create(path, cacheSize, cacheSize, img)) {
+        cache->setFailed(path);
+        return false;
+    }
+    scaleDownImage(img, cacheSize, cacheSize);
+    cache->save(path, mimeType, cacheSize, img);
+    return true;
+}
+
+void ThumbnailProtocol::decorateThumbnail(QImage& img, ThumbCreator::Flags flags)
+{
+    scaleDownImage(img, m_width, m_height);
+
+    if (flags & ThumbCreator::DrawFrame) {
+        int x2 = img.width() - 1;
+        int y2 = img.height() - 1;
+        // paint a black rectangle around the "page"
+        QPainter p;
+        p.begin( &img );
+        p.setPen( QColor( 48, 48, 48 ));
+        p.drawLine( x2, 0, x2, y2 );
+        p.drawLine( 0, y2, x2, y2 );
+        p.setPen( QColor( 215, 215, 215 ));
+        p.drawLine( 0, 0, x2, 0 );
+        p.drawLine( 0, 0, 0, y2 );
+        p.end();
+    }
+
+    if ((flags & ThumbCreator::BlendIcon) && KIconLoader::global()->alphaBlending(KIconLoader::Desktop)) {
+        // blending the mimetype icon in
+        QImage icon = getIcon();
+
+        int x = img.width() - icon.width() - 4;
+        x = qMax( x, 0 );
+        int y = img.height() - icon.height() - 6;
+        y = qMax( y, 0 );
+        QPainter p(&img);
+        p.setOpacity(m_iconAlpha/255.0);
+        p.drawImage(x, y, icon);
+    }
+}
+
+void ThumbnailProtocol::createThumbnails(const KUrl::List& urls, const QStringList& mimeTypes, int shmid)
+{
+#ifndef Q_WS_WIN
+    m_width = metaData("width").toInt();
+    m_height = metaData("height").toInt();
+    if (m_width <= 0 || m_height <= 0) {
+        error(KIO::ERR_INTERNAL, i18n("No or invalid size specified."));
+        return;
+    }
+
+    int iconSize = metaData("iconSize").toInt();
+    if (!iconSize) {
+        iconSize = KIconLoader::global()->currentSize(KIconLoader::Desktop);
+    }
+    if (iconSize != m_iconSize) {
+        m_iconDict.clear();
+    }
+    m_iconSize = iconSize;
+    m_iconAlpha = metaData("iconAlpha").toInt();
+
+    struct shmid_ds shmInfo;
+    if (shmctl(shmid, IPC_STAT, &shmInfo) == -1 || shmInfo.shm_segsz <= RING_HEADER_SIZE) {
+        error(KIO::ERR_INTERNAL, i18n("Failed to attach to shared memory segment %1", shmid));
+        return;
+    }
+    void *shmaddr = shmat(shmid, 0, 0);
+    if (shmaddr == (void *)-1) {
+        error(KIO::ERR_INTERNAL, i18n("Failed to attach to shared memory segment %1", shmid));
+        return;
+    }
+    RingHeader* ring = static_cast<RingHeader*>(shmaddr);
+    char* ringData = static_cast<char*>(shmaddr) + RING_HEADER_SIZE;
+    // The positions are free running, the size has to divide 2^32 so that
+    // the offsets do not jump when they wrap around
+    const quint64 dataSize = qMin<quint64>(shmInfo.shm_segsz - RING_HEADER_SIZE, Q_UINT64_C(0x80000000));
+    quint32 ringSize = 1;
+    while (ringSize * quint64(2) <= dataSize)
+        ringSize *= 2;
+
+    // Thread safe creators run in the pool, the others and everything
+    // which needs the slave, like directories, run right here
+    QThreadPool* pool = QThreadPool::globalInstance();
+    const int maxPending = pool->maxThreadCount() * 2;
+    BatchResults results;
+    int pending = 0;
+    int next = 0;
+    bool failed = false;
+
+    while (!failed && (next < urls.count() || pending > 0)) {
+        BatchResult result;
+        if (next < urls.count() && pending < maxPending) {
+            const int index = next++;
+            const KUrl& url = urls.at(index);
+            m_mimeType = mimeTypes.at(index);
+
+            readSettings();
+            QString plugin;
+            if (m_mimeType != "inode/directory") {
+                plugin = pluginForMimeType(m_mimeType);
+                // PreviewJob only asks for the plugins enabled in the settings
+                if (!m_enabledPlugins.contains(plugin)) {
+                    plugin.clear();
+                }
+            }
+            bool fileThumbnail = m_useFileThumbnails;
+            if (fileThumbnail) {
+                QHash<QString, bool>::const_iterator it = m_fileThumbnailTypes.constFind(m_mimeType);
+                // Not known yet means it has to be looked up by createThumbnail() anyway
+                fileThumbnail = it == m_fileThumbnailTypes.constEnd() || it.value();
+            }
+
+            ThumbCreator* creator = (plugin.isEmpty() || fileThumbnail) ? 0 : getThumbCreator(plugin);
+            if (creator && isThreadSafe(plugin) && !dynamic_cast<ThumbSequenceCreator*>(creator)) {
+                ThumbnailCache* cache = (isCached(plugin) && creator->flags() == ThumbCreator::None) ? m_cache : 0;
+                pool->start(new ThumbnailTask(creator, cache, index, url.path(), m_mimeType,
+                                              m_width, m_height, &results));
+                ++pending;
+                continue;
+            }
+
+            ThumbCreator::Flags flags;
+            QString errorText;
+            result.index = index;
+            result.created = createThumbnail(url, plugin, result.image, flags, errorText);
+            if (result.created) {
+                decorateThumbnail(result.image, flags);
+            } else {
+                kDebug(7115) << errorText;
+            }
+        } else if (results.take(result, true)) {
+            --pending;
+            m_mimeType = mimeTypes.at(result.index);
+            if (result.created) {
+                ThumbCreator* creator = getThumbCreator(pluginForMimeType(m_mimeType));
+                decorateThumbnail(result.image, creator ? creator->flags() : ThumbCreator::None);
+            }
+        } else {
+            continue;
+        }
+
+        QByteArray imgData;
+        QDataStream stream(&imgData, QIODevice::WriteOnly);
+        if (result.created && !result.image.isNull()) {
+            QImage& img = result.image;
+            if (img.format() != QImage::Format_ARGB32) {
+                img = img.convertToFormat(QImage::Format_ARGB32);
+            }
+
+            // An image is never split, if it does not fit in before the
+            // end of the ring buffer it goes to its start
+            const quint32 size = img.numBytes();
+            const quint32 writePos = quint32(int(ring->writePos));
+            quint32 offset = writePos % ringSize;
+            quint32 needed = size;
+            if (offset + size > ringSize) {
+                needed += ringSize - offset;
+                offset = 0;
+            }
+
+            bool fits = needed <= ringSize;
+            QTime waited;
+            waited.start();
+            while (fits && ringSize - (writePos - quint32(int(ring->readPos))) < needed) {
+                if (wasKilled() || waited.elapsed() > RING_TIMEOUT) {
+                    failed = true;
+                    break;
+                }
+                usleep(5000);
+            }
+
+            if (fits && !failed) {
+                memcpy(ringData + offset, img.bits(), size);
+                ring->writePos.fetchAndStoreRelease(int(writePos + needed));
+                // Keep in sync with kdelibs/kio/kio/previewjob.cpp
+                stream << result.index << true << img.width() << img.height() << quint8(img.format())
+                       << offset << quint32(writePos + needed);
+            } else {
+                stream << result.index << false;
+            }
+        } else {
+            stream << result.index << false;
+        }
+
+        if (!failed) {
+            mimeType("application/octet-stream");
+            data(imgData);
+        }
+    }
+
+    // The tasks use the results and the creators
+    pool->waitForDone();
+    shmdt((char*)shmaddr);
+
+    if (failed) {
+        error(KIO::ERR_INTERNAL, i18n("Timeout while waiting for the thumbnails to be read"));
+        return;
+    }
+    finished();
+#else
+    Q_UNUSED(urls);
+    Q_UNUSED(mimeTypes);
+    Q_UNUSED(shmid);
+    error(KIO::ERR_UNSUPPORTED_ACTION, QString::number(BATCH_COMMAND));
+#endif
+}
+
 QString ThumbnailProtocol::pluginForMimeType(const QString& mimeType) {
+    QHash<QString, QString>::const_iterator cached = m_plugins.constFind(mimeType);
+    if (cached != m_plugins.constEnd()) {
+        return cached.value();
+    }
+
     KService::List offers = KMimeTypeTrader::self()->query( mimeType, QLatin1String("ThumbCreator"));
     if (!offers.isEmpty()) {
         KService::Ptr serv;
         serv = offers.first();
+        m_plugins.insert(mimeType, serv->library());
         return serv->library();
     }
 
@@ -388,12 +776,15 @@ QString ThumbnailProtocol::pluginForMimeType(const QString& mimeType) {
         foreach(QString mime, mimeTypes) {
             if(mime.endsWith('*')) {
                 mime = mime.left(mime.length()-1);
-                if(mimeType.startsWith(mime))
+                if(mimeType.startsWith(mime)) {
+                    m_plugins.insert(mimeType, plugin->library());
                     return plugin->library();
+                }
             }
         }
     }
 
+    m_plugins.insert(mimeType, QString());
     return QString();
 }
 
@@ -473,12 +864,7 @@ void ThumbnailProtocol::drawPictureFrame(QPainter *painter, const QPoint &center
 QImage ThumbnailProtocol::thumbForDirectory(const KUrl& directory)
 {
     QImage img;
-    if (m_propagationDirectories.isEmpty()) {
-        // Directories that the directory preview will be propagated into if there is no direct sub-directories
-        const KConfigGroup globalConfig(KGlobal::config(), "PreviewSettings");
-        m_propagationDirectories = globalConfig.readEntry("PropagationDirectories", QStringList() << "VIDEO_TS").toSet();
-        m_maxFileSize = globalConfig.readEntry("MaximumSize", 5 * 1024 * 1024); // 5 MByte default
-    }
+    readSettings();
 
     const int tiles = 2; //Count of items shown on each dimension
     const int spacing = 1;
@@ -670,6 +1056,36 @@ ThumbCreator* ThumbnailProtocol::getThumbCreator(const QString& plugin)
     return creator;
 }
 
+void ThumbnailProtocol::readPluginProperties()
+{
+    if (m_pluginPropertiesRead) {
+        return;
+    }
+
+    const KService::List plugins = KServiceTypeTrader::self()->query("ThumbCreator");
+    foreach (const KService::Ptr& service, plugins) {
+        if (service->property("ThreadSafe").toBool()) {
+            m_threadSafePlugins.insert(service->library());
+        }
+        if (service->property("CacheThumbnail").toBool()) {
+            m_cachedPlugins.insert(service->library());
+        }
+    }
+    m_pluginPropertiesRead = true;
+}
+
+bool ThumbnailProtocol::isThreadSafe(const QString& plugin)
+{
+    readPluginProperties();
+    return m_threadSafePlugins.contains(plugin);
+}
+
+bool ThumbnailProtocol::isCached(const QString& plugin)
+{
+    readPluginProperties();
+    return m_cachedPlugins.contains(plugin);
+}
+
 
 const QImage ThumbnailProtocol::getIcon()
 {
@@ -688,16 +1104,11 @@ const QImage ThumbnailProtocol::getIcon()
 bool ThumbnailProtocol::createSubThumbnail(QImage& thumbnail, const QString& filePath,
                                            int segmentWidth, int segmentHeight)
 {
-    if (m_enabledPlugins.isEmpty()) {
-        const KConfigGroup globalConfig(KGlobal::config(), "PreviewSettings");
-        m_enabledPlugins = globalConfig.readEntry("Plugins", QStringList()
-                                                             << "imagethumbnail"
-                                                             << "jpegthumbnail"
-                                                             << "videopreview");
-    }
+    readSettings();
 
     const KUrl fileName = filePath;
-    const QString subPlugin = pluginForMimeType(KMimeType::findByUrl(fileName)->name());
+    const QString subMimeType = KMimeType::findByUrl(fileName)->name();
+    const QString subPlugin = pluginForMimeType(subMimeType);
     if (subPlugin.isEmpty() || !m_enabledPlugins.contains(subPlugin)) {
         return false;
     }
@@ -708,57 +1119,9 @@ bool ThumbnailProtocol::createSubThumbnail(QImage& thumbnail, const QString& fil
         return false;
     }
 
-    if ((segmentWidth <= 256) && (segmentHeight <= 256)) {
-        // check whether a cached version of the file is available for
-        // 128 x 128 or 256 x 256 pixels
-        int cacheSize = 0;
-        KMD5 md5(QFile::encodeName(fileName.url()));
-        const QString thumbName = QFile::encodeName(md5.hexDigest()) + ".png";
-        if (m_thumbBasePath.isEmpty()) {
-            m_thumbBasePath = QDir::homePath() + "/.thumbnails/";
-            KStandardDirs::makeDir(m_thumbBasePath + "normal/", 0700);
-            KStandardDirs::makeDir(m_thumbBasePath + "large/", 0700);
-        }
-
-        QString thumbPath = m_thumbBasePath;
-        if ((segmentWidth <= 128) && (segmentHeight <= 128)) {
-            cacheSize = 128;
-            thumbPath += "normal/";
-        } else {
-            cacheSize = 256;
-            thumbPath += "large/";
-        }
-        if (!thumbnail.load(thumbPath + thumbName)) {
-            // no cached version is available, a new thumbnail must be created
-
-            QString tempFileName;
-            bool savedCorrectly = false;
-            if (subCreator->create(filePath, cacheSize, cacheSize, thumbnail)) {
-                scaleDownImage(thumbnail, cacheSize, cacheSize);
-
-                // The thumbnail has been created successfully. Store the thumbnail
-                // to the cache for future access.
-                KTemporaryFile temp;
-                temp.setPrefix(thumbPath + "kde-tmp-");
-                temp.setSuffix(".png");
-                temp.setAutoRemove(false);
-                if (temp.open()) {
-                    tempFileName = temp.fileName();
-                    savedCorrectly = thumbnail.save(tempFileName, "PNG");
-                }
-            } else {
-                return false;
-            }
-            if(savedCorrectly)
-            {
-                Q_ASSERT(!tempFileName.isEmpty());
-                KDE::rename(tempFileName, thumbPath + thumbName);
-            }
-        }
-    } else if (!subCreator->create(filePath, segmentWidth, segmentHeight, thumbnail)) {
-        return false;
-    }
-    return true;
+    // The sub thumbnails are drawn without frame, so they are always cached
+    return createCachedThumbnail(subCreator, m_cache, filePath, subMimeType,
+                                 segmentWidth, segmentHeight, thumbnail);
 }
 
 void ThumbnailProtocol::scaleDownImage(QImage& img, int maxWidth, int maxHeight)
@@ -21,11 +21,13 @@
 #define _THUMBNAIL_H_
 
 #include <QtCore/QHash>
+#include <QtCore/QSet>
 
 #include <kio/slavebase.h>
+#include <kio/thumbcreator.h>
 
-class ThumbCreator;
 class QImage;
+class ThumbnailCache;
 
 class ThumbnailProtocol : public KIO::SlaveBase
 {
@@ -34,9 +36,26 @@ public:
     virtual ~ThumbnailProtocol();
 
     virtual void get(const KUrl &url);
+    virtual void special(const QByteArray &data);
+
+    /**
+     * Scales down the image \p img in a way that it fits into the
+     * given maximum width and height.
+     */
+    static void scaleDownImage(QImage& img, int maxWidth, int maxHeight);
+
+    /**
+     * Creates a thumbnail of \p width x \p height pixels with \p creator,
+     * or takes it from \p cache if it is given and has an up to date one.
+     */
+    static bool createCachedThumbnail(ThumbCreator* creator, ThumbnailCache* cache,
+                                      const QString& path, const QString& mimeType,
+                                      int width, int height, QImage& img);
 
 protected:
     ThumbCreator* getThumbCreator(const QString& plugin);
+    bool isThreadSafe(const QString& plugin);
+    bool isCached(const QString& plugin);
     const QImage getIcon();
     bool isOpaque(const QImage &image) const;
     void drawPictureFrame(QPainter *painter, const QPoint &pos, const QImage &image,
@@ -47,6 +66,31 @@ protected:
     float sequenceIndex() const;
 
 private:
+    /**
+     * Reads the PreviewSettings, once per slave.
+     */
+    void readSettings();
+    void readPluginProperties();
+
+    /**
+     * Creates the thumbnail for \p url with \p plugin, or by the file meta
+     * info or for a directory. On failure \p errorText tells why.
+     */
+    bool createThumbnail(const KUrl& url, const QString& plugin, QImage& img,
+                         ThumbCreator::Flags& flags, QString& errorText);
+
+    /**
+     * Scales the thumbnail down and adds the frame and icon overlay the
+     * creator asked for in \p flags.
+     */
+    void decorateThumbnail(QImage& img, ThumbCreator::Flags flags);
+
+    /**
+     * Creates the thumbnails of \p urls and writes them into the ring
+     * buffer in the shared memory segment \p shmid, see thumbnail.cpp.
+     */
+    void createThumbnails(const KUrl::List& urls, const QStringList& mimeTypes, int shmid);
+
     /**
      * Creates a sub thumbnail for the directory thumbnail. If a cached
      * version of the sub thumbnail is available, the cached version will be used.
@@ -56,12 +100,6 @@ private:
     bool createSubThumbnail(QImage& thumbnail, const QString& filePath,
                             int segmentWidth, int segmentHeight);
 
-    /**
-     * Scales down the image \p img in a way that it fits into the
-     * given maximum width and height.
-     */
-    void scaleDownImage(QImage& img, int maxWidth, int maxHeight);
-
     /**
      * Create and draw the SubThumbnail
      **/
@@ -75,12 +113,23 @@ private:
     int m_iconAlpha;
     // Thumbnail creators
     QHash<QString, ThumbCreator*> m_creators;
+    // Plugins whose creators may be used by several threads at once,
+    // and those whose thumbnails may be cached
+    QSet<QString> m_threadSafePlugins;
+    QSet<QString> m_cachedPlugins;
+    bool m_pluginPropertiesRead;
+    // freedesktop.org thumbnail cache
+    ThumbnailCache* m_cache;
+    // Plugin for each MIME type, and whether the file meta info has a thumbnail
+    QHash<QString, QString> m_plugins;
+    QHash<QString, bool> m_fileThumbnailTypes;
     // transparent icon cache
     QHash<QString, QImage> m_iconDict;
     QStringList m_enabledPlugins;
     QSet<QString> m_propagationDirectories;
-    QString m_thumbBasePath;
     qint64 m_maxFileSize;
+    bool m_useFileThumbnails;
+    bool m_settingsRead;
 };
 
 #endif
@@ -0,0 +1,214 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "thumbnailcache.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <utime.h>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QImage>
+#include <QImageReader>
+
+#include <kcodecs.h>
+#include <kdebug.h>
+#include <kde_file.h>
+#include <kstandarddirs.h>
+#include <ktemporaryfile.h>
+#include <kurl.h>
+
+// Name of the fail cache of this slave, see the thumbnail specification
+#define FAIL_CACHE_NAME "kde-thumbnail-4"
+// Hits on thumbnails older than this move them to the end of the LRU order
+#define TOUCH_INTERVAL (24 * 60 * 60) // 1 day
+// How often the cache is checked for its size, by all slaves together
+#define CLEAN_INTERVAL (60 * 60) // 1 hour
+
+static bool lessRecentlyUsed(const QFileInfo& a, const QFileInfo& b)
+{
+    return a.lastModified() < b.lastModified();
+}
+
+ThumbnailCache::ThumbnailCache(qint64 maxSize)
+    : m_maxSize(maxSize)
+{
+    m_basePath = QDir::homePath() + "/.thumbnails/";
+    m_failPath = m_basePath + "fail/" FAIL_CACHE_NAME "/";
+    KStandardDirs::makeDir(m_basePath + "normal/", 0700);
+    KStandardDirs::makeDir(m_basePath + "large/", 0700);
+    KStandardDirs::makeDir(m_failPath, 0700);
+}
+
+int ThumbnailCache::cacheSize(int width, int height)
+{
+    if (width <= 128 && height <= 128) {
+        return 128;
+    } else if (width <= 256 && height <= 256) {
+        return 256;
+    }
+    return 0;
+}
+
+QString ThumbnailCache::thumbName(const QString& path)
+{
+    KMD5 md5(QFile::encodeName(KUrl(path).url()));
+    return QFile::encodeName(md5.hexDigest()) + ".png";
+}
+
+bool ThumbnailCache::load(const QString& path, int cacheSize, QImage& thumbnail)
+{
+    const QString thumbPath = m_basePath + (cacheSize == 128 ? "normal/" : "large/") + thumbName(path);
+    if (!readThumbnail(thumbPath, path, &thumbnail)) {
+        return false;
+    }
+
+    // The modification time of the thumbnail is used for the LRU order
+    KDE_struct_stat buff;
+    const time_t now = time(0);
+    if (KDE::stat(thumbPath, &buff) == 0 && buff.st_mtime + TOUCH_INTERVAL < now) {
+        struct utimbuf times;
+        times.actime = now;
+        times.modtime = now;
+        ::utime(QFile::encodeName(thumbPath), &times);
+    }
+    return true;
+}
+
+void ThumbnailCache::save(const QString& path, const QString& mimeType, int cacheSize, QImage thumbnail)
+{
+    const QString thumbPath = m_basePath + (cacheSize == 128 ? "normal/" : "large/") + thumbName(path);
+    writeThumbnail(thumbPath, path, mimeType, thumbnail);
+
+    if (!m_cleaned.fetchAndStoreRelaxed(1)) {
+        clean();
+    }
+}
+
+bool ThumbnailCache::hasFailed(const QString& path)
+{
+    return readThumbnail(m_failPath + thumbName(path), path, 0);
+}
+
+void ThumbnailCache::setFailed(const QString& path)
+{
+    QImage empty(1, 1, QImage::Format_ARGB32);
+    empty.fill(0);
+    writeThumbnail(m_failPath + thumbName(path), path, QString(), empty);
+}
+
+bool ThumbnailCache::readThumbnail(const QString& thumbPath, const QString& path, QImage* thumbnail)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0) {
+        return false;
+    }
+
+    // The text chunks come before the image data, so an outdated thumbnail
+    // is not decoded at all
+    QImageReader reader(thumbPath, "png");
+    if (!reader.canRead() ||
+        reader.text("Thumb::URI") != KUrl(path).url() ||
+        reader.text("Thumb::MTime") != QString::number(buff.st_mtime)) {
+        return false;
+    }
+    const QString size = reader.text("Thumb::Size");
+    if (!size.isEmpty() && size != QString::number(buff.st_size)) {
+        return false;
+    }
+
+    return thumbnail == 0 || reader.read(thumbnail);
+}
+
+void ThumbnailCache::writeThumbnail(const QString& thumbPath, const QString& path, const QString& mimeType,
+                                    QImage thumbnail)
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(path, &buff) != 0) {
+        return;
+    }
+
+    thumbnail.setText("Thumb::URI", KUrl(path).url());
+    thumbnail.setText("Thumb::MTime", QString::number(buff.st_mtime));
+    thumbnail.setText("Thumb::Size", QString::number(buff.st_size));
+    if (!mimeType.isEmpty()) {
+        thumbnail.setText("Thumb::Mimetype", mimeType);
+    }
+    thumbnail.setText("Software", "KDE Thumbnail Generator");
+
+    // Written under another name and renamed, so that nobody reads a
+    // half written thumbnail
+    KTemporaryFile temp;
+    temp.setPrefix(QFileInfo(thumbPath).path() + "/kde-tmp-");
+    temp.setSuffix(".png");
+    if (!temp.open() || !thumbnail.save(&temp, "PNG")) {
+        kDebug(7115) << "Could not write thumbnail" << thumbPath;
+        return;
+    }
+    temp.flush();
+    if (KDE::rename(temp.fileName(), thumbPath) == 0) {
+        temp.setAutoRemove(false);
+    }
+}
+
+void ThumbnailCache::clean()
+{
+    if (m_maxSize <= 0) {
+        return;
+    }
+
+    // Scanning the cache is not free, leave it to one slave once in a while
+    const QString stampPath = KStandardDirs::locateLocal("cache", "kio_thumbnail-cleaned");
+    const QFileInfo stamp(stampPath);
+    if (stamp.exists() && stamp.lastModified().secsTo(QDateTime::currentDateTime()) < CLEAN_INTERVAL) {
+        return;
+    }
+    QFile stampFile(stampPath);
+    if (!stampFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return;
+    }
+    stampFile.close();
+
+    const QStringList filter = QStringList() << "*.png";
+    QFileInfoList thumbnails = QDir(m_basePath + "normal/").entryInfoList(filter, QDir::Files);
+    thumbnails += QDir(m_basePath + "large/").entryInfoList(filter, QDir::Files);
+
+    qint64 size = 0;
+    foreach (const QFileInfo& info, thumbnails) {
+        size += info.size();
+    }
+    if (size <= m_maxSize) {
+        return;
+    }
+
+    // Remove the least recently used thumbnails until the cache is 10% below its limit
+    qSort(thumbnails.begin(), thumbnails.end(), lessRecentlyUsed);
+    const qint64 target = m_maxSize - m_maxSize / 10;
+    int removed = 0;
+    for (int i = 0; i < thumbnails.count() && size > target; ++i) {
+        if (QFile::remove(thumbnails.at(i).absoluteFilePath())) {
+            size -= thumbnails.at(i).size();
+            ++removed;
+        }
+    }
+    kDebug(7115) << "Removed" << removed << "thumbnails from the cache";
+}
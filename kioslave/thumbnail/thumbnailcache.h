@@ -0,0 +1,89 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _THUMBNAILCACHE_H_
+#define _THUMBNAILCACHE_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QString>
+
+class QImage;
+
+/**
+ * The thumbnail cache of the freedesktop.org thumbnail specification in
+ * ~/.thumbnails, which is shared with KIO::PreviewJob and other desktops.
+ *
+ * Thumbnails are stored as PNG named after the MD5 sum of the URI of the file,
+ * with its URI and modification time in the Thumb::URI and Thumb::MTime keys.
+ * Files which could not be thumbnailed get an entry in the fail cache, so that
+ * they are not tried again until they change.
+ *
+ * The methods may be called from several threads at once.
+ */
+class ThumbnailCache
+{
+public:
+    /**
+     * @p maxSize is the size in bytes the normal and large thumbnails may
+     * take together, the least recently used ones are removed beyond that.
+     */
+    explicit ThumbnailCache(qint64 maxSize);
+
+    /**
+     * \return the size of the cached thumbnails which fits a thumbnail of
+     * \p width x \p height pixels, 128 or 256, or 0 if it is too big for the cache.
+     */
+    static int cacheSize(int width, int height);
+
+    /**
+     * Loads the thumbnail of the file at \p path from the cache. Fails if there
+     * is none or if the file changed since it was created.
+     */
+    bool load(const QString& path, int cacheSize, QImage& thumbnail);
+
+    /**
+     * Stores the thumbnail of the file at \p path in the cache.
+     */
+    void save(const QString& path, const QString& mimeType, int cacheSize, QImage thumbnail);
+
+    /**
+     * \return whether creating a thumbnail for the file at \p path failed before.
+     */
+    bool hasFailed(const QString& path);
+
+    /**
+     * Remembers that no thumbnail can be created for the file at \p path.
+     */
+    void setFailed(const QString& path);
+
+private:
+    bool readThumbnail(const QString& thumbPath, const QString& path, QImage* thumbnail);
+    void writeThumbnail(const QString& thumbPath, const QString& path, const QString& mimeType,
+                        QImage thumbnail);
+    void clean();
+
+    static QString thumbName(const QString& path);
+
+    QString m_basePath;
+    QString m_failPath;
+    qint64 m_maxSize;
+    // Set once the cache was cleaned by this slave
+    QAtomicInt m_cleaned;
+};
+
+#endif
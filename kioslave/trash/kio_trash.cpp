@@ -69,6 +69,11 @@ TrashProtocol::TrashProtocol( const QByteArray& protocol, const QByteArray &pool
     struct group *grp = getgrgid( getgid() );
     if ( grp )
         m_groupName = QString::fromLatin1(grp->gr_name);
+
+    connect( &impl, SIGNAL(emptyTrashTotalSize(qulonglong)),
+             this, SLOT(slotEmptyTrashTotalSize(qulonglong)) );
+    connect( &impl, SIGNAL(emptyTrashProcessedSize(qulonglong)),
+             this, SLOT(slotEmptyTrashProcessedSize(qulonglong)) );
 }
 
 TrashProtocol::~TrashProtocol()
@@ -492,6 +497,16 @@ void TrashProtocol::special( const QByteArray & data )
     }
 }
 
+void TrashProtocol::slotEmptyTrashTotalSize( qulonglong size )
+{
+    totalSize( size );
+}
+
+void TrashProtocol::slotEmptyTrashProcessedSize( qulonglong size )
+{
+    processedSize( size );
+}
+
 void TrashProtocol::put( const KUrl& url, int /*permissions*/, KIO::JobFlags )
 {
     INIT_IMPL;
@@ -56,6 +56,8 @@ private Q_SLOTS:
     void slotData( KIO::Job*, const QByteArray& );
     void slotMimetype( KIO::Job*, const QString& );
     void jobFinished( KJob* job );
+    void slotEmptyTrashTotalSize( qulonglong size );
+    void slotEmptyTrashProcessedSize( qulonglong size );
 
 private:
     typedef enum { Copy, Move } CopyOrMove;
@@ -0,0 +1,176 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "trashemptier.h"
+#include "trashtestdir.h"
+
+#include <kio/global.h>
+
+#include <QDir>
+#include <QFile>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Longer than PATH_MAX below the files directory, so that it cannot be entered
+#define DEEP_TREE_LEVELS 30
+#define DEEP_TREE_NAME_LENGTH 200
+
+class TrashEmptierTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void testParallelDeletion();
+    void testUnremovableKeepsInfo();
+
+private:
+    QStringList entries( const QString &subDir ) const;
+
+    TrashTestDir m_trashDir;
+};
+
+// Paths this deep cannot be created or removed by absolute path
+static bool createDeepTree( int parentFd, const QByteArray &name, int levels )
+{
+    if ( ::mkdirat( parentFd, name.constData(), 0700 ) != 0 )
+        return false;
+    if ( levels == 1 )
+        return true;
+    const int fd = ::openat( parentFd, name.constData(), O_RDONLY | O_DIRECTORY );
+    if ( fd == -1 )
+        return false;
+    const bool ok = createDeepTree( fd, QByteArray( DEEP_TREE_NAME_LENGTH, 'd' ), levels - 1 );
+    ::close( fd );
+    return ok;
+}
+
+static void removeTree( int parentFd, const char *name )
+{
+    const int fd = ::openat( parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW );
+    DIR *dir = fd == -1 ? 0 : ::fdopendir( fd );
+    if ( !dir ) {
+        if ( fd != -1 )
+            ::close( fd );
+        ::unlinkat( parentFd, name, 0 );
+        return;
+    }
+    struct dirent *ep;
+    while ( ( ep = ::readdir( dir ) ) != 0 ) {
+        if ( qstrcmp( ep->d_name, "." ) != 0 && qstrcmp( ep->d_name, ".." ) != 0 )
+            removeTree( fd, ep->d_name );
+    }
+    ::closedir( dir );
+    ::unlinkat( parentFd, name, AT_REMOVEDIR );
+}
+
+void TrashEmptierTest::init()
+{
+    QVERIFY(m_trashDir.init());
+}
+
+void TrashEmptierTest::cleanup()
+{
+    const int fd = ::open( QFile::encodeName( m_trashDir.path() + "files" ).constData(), O_RDONLY | O_DIRECTORY );
+    if ( fd != -1 ) {
+        removeTree( fd, "deep" );
+        ::close( fd );
+    }
+    m_trashDir.cleanup();
+}
+
+QStringList TrashEmptierTest::entries( const QString &subDir ) const
+{
+    return QDir(m_trashDir.path() + subDir).entryList(QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden);
+}
+
+void TrashEmptierTest::testParallelDeletion()
+{
+    // More items and subdirectories than threads, so that they are deleted in parallel
+    qulonglong expectedSize = 0;
+    for (int i = 0; i < 20; ++i) {
+        const QString item = QString::fromLatin1("item%1").arg(i);
+        m_trashDir.trashedInfo(item, "/home/user/" + item.toLatin1());
+        if (i % 2) {
+            m_trashDir.trashedFile(item, i);
+            expectedSize += i;
+            continue;
+        }
+        QVERIFY(QDir().mkdir(m_trashDir.path() + "files/" + item));
+        for (int j = 0; j < 5; ++j) {
+            const QString subDir = item + QString::fromLatin1("/sub%1").arg(j);
+            QVERIFY(QDir().mkdir(m_trashDir.path() + "files/" + subDir));
+            m_trashDir.trashedFile(subDir + "/file", 100);
+            expectedSize += 100;
+        }
+    }
+    // Deleting needs write access to the directory (#130780)
+    QVERIFY(QFile::setPermissions(m_trashDir.path() + "files/item0/sub0", QFile::ReadOwner | QFile::ExeOwner));
+
+    TrashEmptier emptier;
+    const int trashDirectory = emptier.addTrashDirectory(QDir::cleanPath(m_trashDir.path()));
+    QCOMPARE(trashDirectory, 0);
+    for (int i = 0; i < 20; ++i) {
+        emptier.add(trashDirectory, QString::fromLatin1("item%1").arg(i));
+    }
+    // Deleting something which is gone already is fine
+    emptier.add(trashDirectory, "missing");
+    while (!emptier.waitForDone(100)) {
+    }
+
+    QCOMPARE(emptier.errorCode(), 0);
+    QVERIFY(emptier.unremovableFiles().isEmpty());
+    QCOMPARE(emptier.processedSize(), expectedSize);
+    QCOMPARE(entries("files"), QStringList());
+    QCOMPARE(entries("info"), QStringList());
+}
+
+void TrashEmptierTest::testUnremovableKeepsInfo()
+{
+    m_trashDir.trashedFile("a", 10);
+    m_trashDir.trashedInfo("a", "/home/user/a");
+    m_trashDir.trashedInfo("deep", "/home/user/deep");
+    const int fd = ::open( QFile::encodeName( m_trashDir.path() + "files" ).constData(), O_RDONLY | O_DIRECTORY );
+    QVERIFY(fd != -1);
+    const bool created = createDeepTree( fd, "deep", DEEP_TREE_LEVELS );
+    ::close( fd );
+    QVERIFY(created);
+
+    TrashEmptier emptier;
+    const int trashDirectory = emptier.addTrashDirectory(QDir::cleanPath(m_trashDir.path()));
+    emptier.add(trashDirectory, "a");
+    emptier.add(trashDirectory, "deep");
+    while (!emptier.waitForDone(100)) {
+    }
+
+    QCOMPARE(emptier.errorCode(), int(KIO::ERR_CANNOT_ENTER_DIRECTORY));
+    QCOMPARE(emptier.unremovableFiles(), QSet<QString>() << m_trashDir.path() + "files/deep");
+    QCOMPARE(entries("files"), QStringList() << "deep");
+    // The item is still listed in the trash, "a" is gone completely
+    QCOMPARE(entries("info"), QStringList() << "deep.trashinfo");
+}
+
+QTEST_MAIN(TrashEmptierTest)
+
+#include "trashemptiertest.moc"
@@ -0,0 +1,146 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "trashinfoindex.h"
+#include "trashtestdir.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+class TrashInfoIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void testReadInfoFile();
+    void testEntries();
+    void testReusedFileId();
+    void testSharedIndex();
+    void benchmarkList();
+
+private:
+    TrashTestDir m_trashDir;
+};
+
+void TrashInfoIndexTest::init()
+{
+    QVERIFY(m_trashDir.init());
+}
+
+void TrashInfoIndexTest::cleanup()
+{
+    m_trashDir.cleanup();
+}
+
+void TrashInfoIndexTest::testReadInfoFile()
+{
+    m_trashDir.trashedInfo("a", "/home/user/a%20b%C3%A9");
+    TrashInfoIndex::Entry entry;
+    QVERIFY(TrashInfoIndex::readInfoFile(m_trashDir.path() + "info/a.trashinfo", entry));
+    QCOMPARE(entry.path, QString::fromUtf8("/home/user/a b\xc3\xa9"));
+    QCOMPARE(entry.deletionDate, QDateTime(QDate(2011, 6, 5), QTime(12, 34, 56)));
+
+    QFile file(m_trashDir.path() + "info/b.trashinfo");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("[Other]\nPath=/b\n");
+    file.close();
+    QVERIFY(!TrashInfoIndex::readInfoFile(file.fileName(), entry));
+    QVERIFY(!TrashInfoIndex::readInfoFile(m_trashDir.path() + "info/c.trashinfo", entry));
+}
+
+void TrashInfoIndexTest::testEntries()
+{
+    m_trashDir.trashedInfo("a", "/a");
+    m_trashDir.trashedInfo("b 1", "/dir/b%201");
+
+    TrashInfoIndex index(m_trashDir.path());
+    QCOMPARE(index.entries().count(), 2);
+    QCOMPARE(index.entries().value("b 1").path, QString("/dir/b 1"));
+
+    QFile::remove(m_trashDir.path() + "info/a.trashinfo");
+    m_trashDir.trashedInfo("c", "/c");
+    QCOMPARE(index.entries().count(), 2);
+    QVERIFY(!index.entries().contains("a"));
+    QCOMPARE(index.entries().value("c").path, QString("/c"));
+}
+
+void TrashInfoIndexTest::testReusedFileId()
+{
+    m_trashDir.trashedInfo("a", "/a");
+    QTest::qSleep(1100);
+    {
+        TrashInfoIndex index(m_trashDir.path());
+        QCOMPARE(index.entries().value("a").path, QString("/a"));
+    }
+    QTest::qSleep(1100);
+
+    // "a" is restored, and another item is trashed with the same fileId,
+    // likely with the same inode and size
+    QVERIFY(QFile::remove(m_trashDir.path() + "info/a.trashinfo"));
+    m_trashDir.trashedInfo("a", "/b");
+
+    TrashInfoIndex index(m_trashDir.path());
+    QCOMPARE(index.entries().count(), 1);
+    QCOMPARE(index.entries().value("a").path, QString("/b"));
+
+    // Within the second of the check too
+    QVERIFY(QFile::remove(m_trashDir.path() + "info/a.trashinfo"));
+    m_trashDir.trashedInfo("a", "/c");
+    QCOMPARE(index.entries().value("a").path, QString("/c"));
+}
+
+void TrashInfoIndexTest::testSharedIndex()
+{
+    m_trashDir.trashedInfo("a", "/a%20b");
+    {
+        TrashInfoIndex index(m_trashDir.path());
+        QCOMPARE(index.entries().count(), 1);
+    }
+    QVERIFY(QFileInfo(m_trashDir.path() + "kde-infoindex").exists());
+
+    // Another process takes the entries from the index, not from the info file
+    TrashInfoIndex index(m_trashDir.path());
+    QCOMPARE(index.entries().value("a").path, QString("/a b"));
+    QCOMPARE(index.entries().value("a").deletionDate, QDateTime(QDate(2011, 6, 5), QTime(12, 34, 56)));
+}
+
+void TrashInfoIndexTest::benchmarkList()
+{
+    for (int i = 0; i < 10000; ++i) {
+        m_trashDir.trashedInfo(QString::number(i), "/home/user/file" + QByteArray::number(i));
+    }
+    QTest::qSleep(1100);
+    {
+        TrashInfoIndex index(m_trashDir.path());
+        QCOMPARE(index.entries().count(), 10000);
+    }
+
+    QBENCHMARK {
+        TrashInfoIndex index(m_trashDir.path());
+        QCOMPARE(index.entries().count(), 10000);
+    }
+}
+
+QTEST_MAIN(TrashInfoIndexTest)
+
+#include "trashinfoindextest.moc"
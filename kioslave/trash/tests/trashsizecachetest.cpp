@@ -0,0 +1,168 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <qtest.h>
+
+#include "trashsizecache.h"
+#include "trashtestdir.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <time.h>
+
+class TrashSizeCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void testCalculateSize();
+    void testSharedJournal();
+    void testCompaction();
+    void testDirectorySizes();
+    void testChangedBehindOurBack();
+    void benchmarkSizeCheck();
+
+private:
+    TrashTestDir m_trashDir;
+};
+
+void TrashSizeCacheTest::init()
+{
+    QVERIFY(m_trashDir.init());
+}
+
+void TrashSizeCacheTest::cleanup()
+{
+    m_trashDir.cleanup();
+}
+
+void TrashSizeCacheTest::testCalculateSize()
+{
+    m_trashDir.trashedFile("a", 10);
+    m_trashDir.trashedFile("b", 20);
+    QVERIFY(QDir().mkdir(m_trashDir.path() + "files/dir"));
+    m_trashDir.trashedFile("dir/c", 5);
+
+    TrashSizeCache cache(m_trashDir.path());
+    QCOMPARE(cache.calculateSize(), qulonglong(35));
+
+    cache.add(m_trashDir.trashedFile("d", 7), 7, false);
+    QCOMPARE(cache.calculateSize(), qulonglong(42));
+
+    QFile::remove(m_trashDir.path() + "files/a");
+    cache.remove("a");
+    QCOMPARE(cache.calculateSize(), qulonglong(32));
+
+    cache.clear();
+    QCOMPARE(cache.calculateSize(), qulonglong(32));
+}
+
+void TrashSizeCacheTest::testSharedJournal()
+{
+    TrashSizeCache cache1(m_trashDir.path());
+    TrashSizeCache cache2(m_trashDir.path());
+    QCOMPARE(cache1.calculateSize(), qulonglong(0));
+    QCOMPARE(cache2.calculateSize(), qulonglong(0));
+
+    cache1.add(m_trashDir.trashedFile("a", 10), 10, false);
+    QCOMPARE(cache2.calculateSize(), qulonglong(10));
+    cache2.add(m_trashDir.trashedFile("b", 20), 20, false);
+    QCOMPARE(cache1.calculateSize(), qulonglong(30));
+
+    QFile::remove(m_trashDir.path() + "files/a");
+    cache2.remove("a");
+    QCOMPARE(cache1.calculateSize(), qulonglong(20));
+}
+
+void TrashSizeCacheTest::testCompaction()
+{
+    TrashSizeCache cache1(m_trashDir.path());
+    TrashSizeCache cache2(m_trashDir.path());
+    cache1.add(m_trashDir.trashedFile("a", 10), 10, false);
+    QCOMPARE(cache2.calculateSize(), qulonglong(10));
+
+    const QString journalPath = m_trashDir.path() + "kde-sizejournal";
+    for (int i = 0; i < 2000; ++i) {
+        cache1.add("b", 1, false);
+        cache1.remove("b");
+    }
+    // Without compaction it would have 8000 lines
+    QVERIFY(QFileInfo(journalPath).size() < 20000);
+
+    QCOMPARE(cache2.calculateSize(), qulonglong(10));
+    cache2.add(m_trashDir.trashedFile("c", 5), 5, false);
+    QCOMPARE(cache1.calculateSize(), qulonglong(15));
+}
+
+void TrashSizeCacheTest::testDirectorySizes()
+{
+    TrashSizeCache cache(m_trashDir.path());
+    QCOMPARE(cache.calculateSize(), qulonglong(0));
+
+    QVERIFY(QDir().mkdir(m_trashDir.path() + "files/dir"));
+    m_trashDir.trashedFile("dir/a", 12);
+    cache.add("dir", 12, true);
+    QCOMPARE(cache.calculateSize(), qulonglong(12));
+
+    QFile dirCache(m_trashDir.path() + "directorysizes");
+    QVERIFY(dirCache.open(QIODevice::ReadOnly));
+    const QByteArray line = dirCache.readLine();
+    QVERIFY(line.startsWith("12 "));
+    QVERIFY(line.endsWith(" dir\n"));
+    QVERIFY(dirCache.atEnd());
+}
+
+void TrashSizeCacheTest::testChangedBehindOurBack()
+{
+    TrashSizeCache cache(m_trashDir.path());
+    cache.add(m_trashDir.trashedFile("a", 10), 10, false);
+    QCOMPARE(cache.calculateSize(), qulonglong(10));
+
+    // Another implementation of the trash, which knows nothing about the journal.
+    // The time is set as the file system may only store seconds.
+    m_trashDir.trashedFile("b", 100);
+    QVERIFY(m_trashDir.setModificationTime("files", time(0) - 60));
+    QCOMPARE(cache.calculateSize(), qulonglong(110));
+}
+
+void TrashSizeCacheTest::benchmarkSizeCheck()
+{
+    // A trash with 100000 items, the size check must not depend on that
+    TrashSizeCache cache(m_trashDir.path());
+    QCOMPARE(cache.calculateSize(), qulonglong(0));
+    for (int i = 0; i < 100000; ++i) {
+        cache.add(QString::number(i), 1000, false);
+    }
+
+    qulonglong size = 0;
+    QBENCHMARK {
+        cache.add("new", 1000, false);
+        size = cache.calculateSize();
+        cache.remove("new");
+    }
+    QCOMPARE(size, qulonglong(100001000));
+}
+
+QTEST_MAIN(TrashSizeCacheTest)
+
+#include "trashsizecachetest.moc"
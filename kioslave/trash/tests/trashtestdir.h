@@ -0,0 +1,105 @@
+/* This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef TRASHTESTDIR_H
+#define TRASHTESTDIR_H
+
+#include <ktempdir.h>
+
+#include <QDir>
+#include <QFile>
+
+#include <sys/types.h>
+#include <utime.h>
+
+/**
+ * A temporary trash directory with its files and info directories,
+ * for the tests of the parts of the trash which work on a single one.
+ */
+class TrashTestDir
+{
+public:
+    TrashTestDir() : m_tempDir( 0 ) {}
+    ~TrashTestDir() { cleanup(); }
+
+    /**
+     * Creates a new, empty trash directory.
+     * @return false if that failed
+     */
+    bool init()
+    {
+        cleanup();
+        m_tempDir = new KTempDir;
+        return QDir().mkdir( path() + "files" ) && QDir().mkdir( path() + "info" );
+    }
+
+    /**
+     * Removes the trash directory with everything in it.
+     */
+    void cleanup()
+    {
+        delete m_tempDir;
+        m_tempDir = 0;
+    }
+
+    /**
+     * The path of the trash directory, ending with a slash.
+     */
+    QString path() const { return m_tempDir->name(); }
+
+    /**
+     * Creates the file @p fileId with @p size bytes in the files directory.
+     * @return @p fileId
+     */
+    QString trashedFile( const QString &fileId, int size ) const
+    {
+        QFile file( path() + "files/" + fileId );
+        if ( file.open( QIODevice::WriteOnly ) ) {
+            file.write( QByteArray( size, 'x' ) );
+        }
+        return fileId;
+    }
+
+    /**
+     * Writes the .trashinfo file of @p fileId, for the percent encoded original @p path.
+     */
+    void trashedInfo( const QString &fileId, const QByteArray &path ) const
+    {
+        QFile file( this->path() + "info/" + fileId + ".trashinfo" );
+        if ( file.open( QIODevice::WriteOnly ) ) {
+            file.write( "[Trash Info]\nPath=" + path + "\nDeletionDate=2011-06-05T12:34:56\n" );
+        }
+    }
+
+    /**
+     * Sets the access and modification time of @p relativePath to @p time,
+     * instead of waiting for the clock to move on.
+     */
+    bool setModificationTime( const QString &relativePath, time_t time ) const
+    {
+        struct utimbuf times;
+        times.actime = time;
+        times.modtime = time;
+        return ::utime( QFile::encodeName( path() + relativePath ).constData(), &times ) == 0;
+    }
+
+private:
+    KTempDir *m_tempDir;
+};
+
+#endif
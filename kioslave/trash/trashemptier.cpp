@@ -0,0 +1,257 @@
+/*
+   This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "trashemptier.h"
+
+#include <kdebug.h>
+#include <kio/global.h>
+#include <QFile>
+#include <QThread>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Deleting is bound by the file system, more threads than this do not help
+#define MAXIMUM_THREADS 8
+
+struct TrashEmptier::TrashDirectory
+{
+    QString filesPath;
+    int filesFd;
+    int infoFd;
+};
+
+// A trashed item, or a directory in one. Its pending count is the listing
+// of the directory plus its subdirectories not deleted yet.
+struct TrashEmptier::Node
+{
+    Node( TrashDirectory *trashDir, Node *parent, const QByteArray &path )
+        : trashDir( trashDir ), parent( parent ), path( path ), isDirectory( true ), pending( 1 ), failed( 0 ) {}
+
+    TrashDirectory *trashDir;
+    Node *parent; // 0 for the trashed item itself
+    QByteArray path; // relative to the files directory
+    bool isDirectory;
+    QAtomicInt pending;
+    QAtomicInt failed;
+};
+
+class TrashEmptier::Task : public QRunnable
+{
+public:
+    Task( TrashEmptier *emptier, Node *node ) : mEmptier( emptier ), mNode( node ) {}
+    virtual void run() { mEmptier->remove( mNode ); }
+
+private:
+    TrashEmptier *mEmptier;
+    Node *mNode;
+};
+
+TrashEmptier::TrashEmptier()
+    : mProcessedSize( 0 ),
+      mErrorCode( 0 )
+{
+    mPool.setMaxThreadCount( qBound( 2, QThread::idealThreadCount(), MAXIMUM_THREADS ) );
+}
+
+TrashEmptier::~TrashEmptier()
+{
+    mPool.waitForDone();
+    foreach ( TrashDirectory *trashDir, mTrashDirectories ) {
+        ::close( trashDir->filesFd );
+        ::close( trashDir->infoFd );
+        delete trashDir;
+    }
+}
+
+int TrashEmptier::addTrashDirectory( const QString &path )
+{
+    const int filesFd = ::open( QFile::encodeName( path + QString::fromLatin1( "/files" ) ), O_RDONLY | O_DIRECTORY );
+    if ( filesFd == -1 )
+        return -1;
+    const int infoFd = ::open( QFile::encodeName( path + QString::fromLatin1( "/info" ) ), O_RDONLY | O_DIRECTORY );
+    if ( infoFd == -1 ) {
+        ::close( filesFd );
+        return -1;
+    }
+
+    TrashDirectory *trashDir = new TrashDirectory;
+    trashDir->filesPath = path + QString::fromLatin1( "/files/" );
+    trashDir->filesFd = filesFd;
+    trashDir->infoFd = infoFd;
+    mTrashDirectories.append( trashDir );
+    return mTrashDirectories.count() - 1;
+}
+
+void TrashEmptier::add( int trashDirectory, const QString &fileId )
+{
+    Node *node = new Node( mTrashDirectories.at( trashDirectory ), 0, QFile::encodeName( fileId ) );
+    mPool.start( new Task( this, node ) );
+}
+
+bool TrashEmptier::waitForDone( int msecs )
+{
+    return mPool.waitForDone( msecs );
+}
+
+qulonglong TrashEmptier::processedSize() const
+{
+    QMutexLocker locker( &mMutex );
+    return mProcessedSize;
+}
+
+QSet<QString> TrashEmptier::unremovableFiles() const
+{
+    QMutexLocker locker( &mMutex );
+    return mUnremovableFiles;
+}
+
+int TrashEmptier::errorCode() const
+{
+    QMutexLocker locker( &mMutex );
+    return mErrorCode;
+}
+
+QString TrashEmptier::errorMessage() const
+{
+    QMutexLocker locker( &mMutex );
+    return mErrorMessage;
+}
+
+void TrashEmptier::remove( Node *node )
+{
+    const int filesFd = node->trashDir->filesFd;
+    struct stat buff;
+    if ( !node->parent ) {
+        // Only the trashed item itself may be something else than a directory
+        if ( ::fstatat( filesFd, node->path.constData(), &buff, AT_SYMLINK_NOFOLLOW ) == -1 ) {
+            node->isDirectory = false;
+            if ( errno != ENOENT ) // already gone is fine
+                setError( node, KIO::ERR_CANNOT_DELETE, node->path );
+            finish( node );
+            return;
+        }
+        if ( !S_ISDIR( buff.st_mode ) ) {
+            node->isDirectory = false;
+            if ( ::unlinkat( filesFd, node->path.constData(), 0 ) == 0 )
+                addProcessedSize( buff.st_size );
+            else
+                setError( node, errno == EACCES || errno == EPERM ? KIO::ERR_ACCESS_DENIED : KIO::ERR_CANNOT_DELETE, node->path );
+            finish( node );
+            return;
+        }
+    }
+
+    int fd = ::openat( filesFd, node->path.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW );
+    if ( fd == -1 && errno == EACCES &&
+         ::fstatat( filesFd, node->path.constData(), &buff, AT_SYMLINK_NOFOLLOW ) == 0 &&
+         ::fchmodat( filesFd, node->path.constData(), ( buff.st_mode & 07777 ) | S_IRWXU, 0 ) == 0 ) {
+        fd = ::openat( filesFd, node->path.constData(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW );
+    }
+    DIR *dir = fd == -1 ? 0 : ::fdopendir( fd );
+    if ( !dir ) {
+        if ( fd != -1 )
+            ::close( fd );
+        setError( node, KIO::ERR_CANNOT_ENTER_DIRECTORY, node->path );
+        finish( node );
+        return;
+    }
+
+    // Deleting entries needs write access to the directory (#130780)
+    if ( ::fstat( fd, &buff ) == 0 && ( buff.st_mode & S_IRWXU ) != S_IRWXU )
+        ::fchmod( fd, ( buff.st_mode & 07777 ) | S_IRWXU );
+
+    QList<Node*> children;
+    qulonglong size = 0;
+    struct dirent *ep;
+    while ( ( ep = ::readdir( dir ) ) != 0 ) {
+        const char *name = ep->d_name;
+        if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) )
+            continue;
+        if ( ep->d_type == DT_DIR ) {
+            children.append( new Node( node->trashDir, node, node->path + '/' + name ) );
+            continue;
+        }
+        if ( ::fstatat( fd, name, &buff, AT_SYMLINK_NOFOLLOW ) == -1 )
+            continue;
+        if ( S_ISDIR( buff.st_mode ) ) {
+            children.append( new Node( node->trashDir, node, node->path + '/' + name ) );
+        } else if ( ::unlinkat( fd, name, 0 ) == 0 ) {
+            size += buff.st_size;
+        } else {
+            setError( node, errno == EACCES || errno == EPERM ? KIO::ERR_ACCESS_DENIED : KIO::ERR_CANNOT_DELETE,
+                      node->path + '/' + name );
+        }
+    }
+    ::closedir( dir );
+    addProcessedSize( size );
+
+    node->pending.fetchAndAddOrdered( children.count() );
+    foreach ( Node *child, children )
+        mPool.start( new Task( this, child ) );
+    finish( node );
+}
+
+void TrashEmptier::finish( Node *node )
+{
+    while ( !node->pending.deref() ) {
+        // Everything below the node is done
+        const int filesFd = node->trashDir->filesFd;
+        if ( node->isDirectory && !node->failed && ::unlinkat( filesFd, node->path.constData(), AT_REMOVEDIR ) == -1 &&
+             ( node->parent || errno != ENOENT ) ) {
+            setError( node, KIO::ERR_COULD_NOT_RMDIR, node->path );
+        }
+
+        Node *parent = node->parent;
+        if ( !parent ) {
+            if ( !node->failed ) {
+                const QByteArray infoName = node->path + ".trashinfo";
+                ::unlinkat( node->trashDir->infoFd, infoName.constData(), 0 );
+            } else {
+                QMutexLocker locker( &mMutex );
+                mUnremovableFiles.insert( node->trashDir->filesPath + QFile::decodeName( node->path ) );
+                kDebug() << "Unremoveable:" << QFile::decodeName( node->path );
+            }
+            delete node;
+            return;
+        }
+        if ( node->failed )
+            parent->failed.fetchAndStoreOrdered( 1 );
+        delete node;
+        node = parent;
+    }
+}
+
+void TrashEmptier::addProcessedSize( qulonglong size )
+{
+    QMutexLocker locker( &mMutex );
+    mProcessedSize += size;
+}
+
+void TrashEmptier::setError( Node *node, int errorCode, const QByteArray &path )
+{
+    node->failed.fetchAndStoreOrdered( 1 );
+    QMutexLocker locker( &mMutex );
+    mErrorCode = errorCode;
+    mErrorMessage = node->trashDir->filesPath + QFile::decodeName( path );
+}
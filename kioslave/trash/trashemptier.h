@@ -0,0 +1,99 @@
+/*
+   This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef TRASHEMPTIER_H
+#define TRASHEMPTIER_H
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QThreadPool>
+
+/**
+ * @short Deletes trashed items with a pool of threads.
+ *
+ * Each directory found while deleting is a task of its own, so a single
+ * large directory tree is deleted by all threads as well. Everything is done
+ * relative to file descriptors of the files and info directories of the trash
+ * directories, without building absolute paths or going through KIO jobs.
+ *
+ * The .trashinfo file of an item is only deleted once all of the item could
+ * be deleted (#116371).
+ */
+class TrashEmptier
+{
+    public:
+        TrashEmptier();
+        ~TrashEmptier();
+
+        /**
+         * Opens the files and info directories of the trash directory @p path.
+         * @return the index to pass to add(), or -1 if they cannot be opened
+         */
+        int addTrashDirectory( const QString &path );
+
+        /**
+         * Starts deleting the item @p fileId of the trash directory @p trashDirectory.
+         */
+        void add( int trashDirectory, const QString &fileId );
+
+        /**
+         * Waits up to @p msecs milliseconds for all items to be deleted.
+         * @return true if they are
+         */
+        bool waitForDone( int msecs );
+
+        /**
+         * Returns the size of the files deleted so far.
+         */
+        qulonglong processedSize() const;
+
+        /**
+         * Returns the paths of the items which could not be deleted.
+         */
+        QSet<QString> unremovableFiles() const;
+
+        /**
+         * Returns the KIO error code of the last failure, 0 if there was none.
+         */
+        int errorCode() const;
+        QString errorMessage() const;
+
+    private:
+        struct TrashDirectory;
+        struct Node;
+        class Task;
+
+        void remove( Node *node );
+        void finish( Node *node );
+        void addProcessedSize( qulonglong size );
+        void setError( Node *node, int errorCode, const QByteArray &path );
+
+        QThreadPool mPool;
+        QList<TrashDirectory*> mTrashDirectories;
+
+        mutable QMutex mMutex; // for the members below
+        qulonglong mProcessedSize;
+        QSet<QString> mUnremovableFiles;
+        int mErrorCode;
+        QString mErrorMessage;
+};
+
+#endif
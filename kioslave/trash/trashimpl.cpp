@@ -21,6 +21,8 @@
 
 #include "trashimpl.h"
 #include "discspaceutil.h"
+#include "trashemptier.h"
+#include "trashinfoindex.h"
 #include "trashsizecache.h"
 
 #include <klocale.h>
@@ -59,6 +61,9 @@
 #include <solid/block.h>
 #include <solid/storageaccess.h>
 
+// How often the progress of emptying the trash is reported, in milliseconds
+#define PROGRESS_INTERVAL 200
+
 TrashImpl::TrashImpl() :
     QObject(),
     m_lastErrorCode( 0 ),
@@ -77,6 +82,12 @@ TrashImpl::TrashImpl() :
     }
 }
 
+TrashImpl::~TrashImpl()
+{
+    qDeleteAll( m_trashSizeCaches );
+    qDeleteAll( m_trashInfoIndexes );
+}
+
 /**
  * Test if a directory exists, create otherwise
  * @param _name full path of the directory
@@ -425,10 +436,7 @@ bool TrashImpl::moveToTrash( const QString& origPath, int trashId, const QString
         return false;
     }
 
-    if (QFileInfo(dest).isDir()) {
-        TrashSizeCache trashSize( trashDirectoryPath( trashId ) );
-        trashSize.add( fileId, pathSize );
-    }
+    trashSizeCache( trashId )->add( fileId, pathSize, QFileInfo(dest).isDir() );
 
     fileAdded();
     return true;
@@ -444,8 +452,10 @@ bool TrashImpl::moveFromTrash( const QString& dest, int trashId, const QString&
     if ( !move( src, dest ) )
         return false;
 
-    TrashSizeCache trashSize( trashDirectoryPath( trashId ) );
-    trashSize.remove( fileId );
+    if ( relativePath.isEmpty() )
+        trashSizeCache( trashId )->remove( fileId );
+    else // the trashed directory got smaller
+        trashSizeCache( trashId )->add( fileId, DiscSpaceUtil::sizeOfPath( filesPath( trashId, fileId ) ), true );
 
     return true;
 }
@@ -496,10 +506,7 @@ bool TrashImpl::copyToTrash( const QString& origPath, int trashId, const QString
     if ( !copy( origPath, dest ) )
         return false;
 
-    if (QFileInfo(dest).isDir()) {
-        TrashSizeCache trashSize( trashDirectoryPath( trashId ) );
-        trashSize.add( fileId, pathSize );
-    }
+    trashSizeCache( trashId )->add( fileId, pathSize, QFileInfo(dest).isDir() );
 
     fileAdded();
     return true;
@@ -600,10 +607,7 @@ bool TrashImpl::del( int trashId, const QString& fileId )
     if ( !synchronousDel( file, true, isDir ) )
         return false;
 
-    if (isDir) {
-        TrashSizeCache trashSize( trashDirectoryPath( trashId ) );
-        trashSize.remove( fileId );
-    }
+    trashSizeCache( trashId )->remove( fileId );
 
     QFile::remove( info );
     fileRemoved();
@@ -652,36 +656,59 @@ bool TrashImpl::emptyTrash()
     // On the other hand, we certainly want to remove any file that has no associated
     // .trashinfo file for some reason (#167051)
 
-    QSet<QString> unremoveableFiles;
+    const TrashedFileInfoList fileInfoList = list();
+
+    // Only known if no trash directory has to be walked for it
+    qulonglong totalSize = 0;
+    bool totalSizeKnown = true;
+    TrashDirMap::const_iterator trit = m_trashDirectories.constBegin();
+    for (; trit != m_trashDirectories.constEnd() && totalSizeKnown ; ++trit) {
+        qulonglong size = 0;
+        totalSizeKnown = trashSizeCache( trit.key() )->cachedSize( size );
+        totalSize += size;
+    }
+    if ( totalSizeKnown )
+        emit emptyTrashTotalSize( totalSize );
 
     int myErrorCode = 0;
     QString myErrorMsg;
-    const TrashedFileInfoList fileInfoList = list();
 
+    // The items are deleted by a pool of threads, while they are still being queued
+    TrashEmptier emptier;
+    QMap<int, int> trashDirectoryIndexes;
     TrashedFileInfoList::const_iterator it = fileInfoList.begin();
     const TrashedFileInfoList::const_iterator end = fileInfoList.end();
     for ( ; it != end ; ++it ) {
         const TrashedFileInfo& info = *it;
-        const QString filesPath = info.physicalPath;
-        if ( synchronousDel( filesPath, true, true ) || m_lastErrorCode == KIO::ERR_DOES_NOT_EXIST) {
-            QFile::remove( infoPath( info.trashId, info.fileId ) );
-        } else {
-            // error code is set by synchronousDel, let's remember it
-            // (so that successfully removing another file doesn't erase the error)
-            myErrorCode = m_lastErrorCode;
-            myErrorMsg = m_lastErrorMessage;
-            // and remember not to remove this file
-            unremoveableFiles.insert(filesPath);
-            kDebug() << "Unremoveable:" << filesPath;
+        QMap<int, int>::iterator indexIt = trashDirectoryIndexes.find( info.trashId );
+        if ( indexIt == trashDirectoryIndexes.end() )
+            indexIt = trashDirectoryIndexes.insert( info.trashId, emptier.addTrashDirectory( trashDirectoryPath( info.trashId ) ) );
+        if ( *indexIt == -1 ) {
+            myErrorCode = KIO::ERR_CANNOT_ENTER_DIRECTORY;
+            myErrorMsg = trashDirectoryPath( info.trashId );
+            continue;
         }
+        emptier.add( *indexIt, info.fileId );
+    }
+    while ( !emptier.waitForDone( PROGRESS_INTERVAL ) ) {
+        emit emptyTrashProcessedSize( emptier.processedSize() );
+    }
+    emit emptyTrashProcessedSize( emptier.processedSize() );
 
-        TrashSizeCache trashSize( trashDirectoryPath( info.trashId ) );
-        trashSize.clear();
+    QSet<QString> unremoveableFiles = emptier.unremovableFiles();
+    // Trash directories which could not be opened keep all their files
+    for ( it = fileInfoList.begin() ; it != end ; ++it ) {
+        if ( trashDirectoryIndexes.value( it->trashId ) == -1 )
+            unremoveableFiles.insert( it->physicalPath );
+    }
+
+    if ( emptier.errorCode() ) {
+        myErrorCode = emptier.errorCode();
+        myErrorMsg = emptier.errorMessage();
     }
 
     // Now do the orphaned-files cleanup
-    TrashDirMap::const_iterator trit = m_trashDirectories.constBegin();
-    for (; trit != m_trashDirectories.constEnd() ; ++trit) {
+    for (trit = m_trashDirectories.constBegin(); trit != m_trashDirectories.constEnd() ; ++trit) {
         //const int trashId = trit.key();
         QString filesDir = trit.value();
         filesDir += QString::fromLatin1("/files");
@@ -696,6 +723,11 @@ bool TrashImpl::emptyTrash()
         }
     }
 
+    // The size of whatever could not be removed is calculated again when needed
+    for (trit = m_trashDirectories.constBegin(); trit != m_trashDirectories.constEnd() ; ++trit) {
+        trashSizeCache( trit.key() )->clear();
+    }
+
     m_lastErrorCode = myErrorCode;
     m_lastErrorMessage = myErrorMsg;
 
@@ -714,31 +746,28 @@ TrashImpl::TrashedFileInfoList TrashImpl::list()
     // For each known trash directory...
     TrashDirMap::const_iterator it = m_trashDirectories.constBegin();
     for ( ; it != m_trashDirectories.constEnd() ; ++it ) {
-        const int trashId = it.key();
-        QString infoPath = it.value();
-        infoPath += QString::fromLatin1("/info");
-        // Code taken from kio_file
-        const QStringList entryNames = listDir( infoPath );
-        //char path_buffer[PATH_MAX];
-        //getcwd(path_buffer, PATH_MAX - 1);
-        //if ( chdir( infoPathEnc ) )
-        //    continue;
-        for ( QStringList::const_iterator entryIt = entryNames.constBegin(), entryEnd = entryNames.constEnd();
-              entryIt != entryEnd ; ++entryIt )
-        {
-            QString fileName = *entryIt;
-            if ( fileName == QLatin1String(".") || fileName == QLatin1String("..") )
-                continue;
-            if ( !fileName.endsWith( QLatin1String(".trashinfo") ) ) {
-                kWarning() << "Invalid info file found in " << infoPath << " : " << fileName ;
-                continue;
-            }
-            fileName.truncate( fileName.length() - 10 );
+        lst += list( it.key() );
+    }
+    return lst;
+}
 
-            TrashedFileInfo info;
-            if ( infoForFile( trashId, fileName, info ) )
-                lst << info;
-        }
+TrashImpl::TrashedFileInfoList TrashImpl::list( int trashId )
+{
+    TrashedFileInfoList lst;
+    // The index only parses the info files which are new since the last time
+    const TrashInfoIndex::EntryHash& entries = trashInfoIndex( trashId )->entries();
+    const QString topdir = trashId == 0 ? QString() : topDirectoryPath( trashId ); // includes trailing slash
+    TrashInfoIndex::EntryHash::const_iterator it = entries.constBegin();
+    for ( ; it != entries.constEnd() ; ++it ) {
+        if ( it->path.isEmpty() )
+            continue; // path is mandatory...
+        TrashedFileInfo info;
+        info.trashId = trashId;
+        info.fileId = it.key();
+        info.physicalPath = filesPath( trashId, it.key() );
+        info.origPath = topdir + it->path;
+        info.deletionDate = it->deletionDate;
+        lst << info;
     }
     return lst;
 }
@@ -761,13 +790,12 @@ bool TrashImpl::infoForFile( int trashId, const QString& fileId, TrashedFileInfo
 
 bool TrashImpl::readInfoFile( const QString& infoPath, TrashedFileInfo& info, int trashId )
 {
-    KConfig cfg( infoPath, KConfig::SimpleConfig);
-    if ( !cfg.hasGroup( "Trash Info" ) ) {
+    TrashInfoIndex::Entry entry;
+    if ( !TrashInfoIndex::readInfoFile( infoPath, entry ) ) {
         error( KIO::ERR_CANNOT_OPEN_FOR_READING, infoPath );
         return false;
     }
-    const KConfigGroup group = cfg.group( "Trash Info" );
-    info.origPath = QUrl::fromPercentEncoding( group.readEntry( "Path" ).toLatin1() );
+    info.origPath = entry.path;
     if ( info.origPath.isEmpty() )
         return false; // path is mandatory...
     if ( trashId == 0 ) {
@@ -776,10 +804,7 @@ bool TrashImpl::readInfoFile( const QString& infoPath, TrashedFileInfo& info, in
         const QString topdir = topDirectoryPath( trashId ); // includes trailing slash
         info.origPath.prepend( topdir );
     }
-    const QString line = group.readEntry( "DeletionDate" );
-    if ( !line.isEmpty() ) {
-        info.deletionDate = QDateTime::fromString( line, Qt::ISODate );
-    }
+    info.deletionDate = entry.deletionDate;
     return true;
 }
 
@@ -1228,12 +1253,9 @@ bool TrashImpl::adaptTrashSize( const QString& origPath, int trashId )
         const int maxDays = group.readEntry( "Days", 7 );
         const QDateTime currentDate = QDateTime::currentDateTime();
 
-        const TrashedFileInfoList trashedFiles = list();
+        const TrashedFileInfoList trashedFiles = list( trashId );
         for ( int i = 0; i < trashedFiles.count(); ++i ) {
             struct TrashedFileInfo info = trashedFiles.at( i );
-            if ( info.trashId != trashId )
-                continue;
-
             if ( info.deletionDate.daysTo( currentDate ) > maxDays )
               del( info.trashId, info.fileId );
         }
@@ -1247,9 +1269,9 @@ bool TrashImpl::adaptTrashSize( const QString& origPath, int trashId )
 #ifdef Q_OS_MAC
         createTrashInfraStructure(trashId);
 #endif
-        TrashSizeCache trashSize( trashPath );
+        TrashSizeCache* trashSize = trashSizeCache( trashId );
         DiscSpaceUtil util(trashPath + QString::fromLatin1("/files/"));
-        if ( util.usage( trashSize.calculateSize() + additionalSize ) >= percent ) {
+        if ( util.usage( trashSize->calculateSize() + additionalSize ) >= percent ) {
             if ( actionType == 0 ) { // warn the user only
                 m_lastErrorCode = KIO::ERR_SLAVE_DEFINED;
                 m_lastErrorMessage = i18n( "The trash has reached its maximum size!\nCleanup the trash manually." );
@@ -1285,8 +1307,8 @@ bool TrashImpl::adaptTrashSize( const QString& origPath, int trashId )
 
                     del( trashId, info.fileName() ); // delete trashed file
 
-                    TrashSizeCache trashSize( trashPath );
-                    if ( util.usage( trashSize.calculateSize() + additionalSize ) < percent ) // check whether we have enough space now
+                    // del() updated the cache, so this does not look at the files again
+                    if ( util.usage( trashSize->calculateSize() + additionalSize ) < percent ) // check whether we have enough space now
                          deleteFurther = false;
                 }
             }
@@ -1296,4 +1318,20 @@ bool TrashImpl::adaptTrashSize( const QString& origPath, int trashId )
     return true;
 }
 
+TrashInfoIndex* TrashImpl::trashInfoIndex( int trashId )
+{
+    TrashInfoIndex*& index = m_trashInfoIndexes[trashId];
+    if ( !index )
+        index = new TrashInfoIndex( trashDirectoryPath( trashId ) );
+    return index;
+}
+
+TrashSizeCache* TrashImpl::trashSizeCache( int trashId )
+{
+    TrashSizeCache*& cache = m_trashSizeCaches[trashId];
+    if ( !cache )
+        cache = new TrashSizeCache( trashDirectoryPath( trashId ) );
+    return cache;
+}
+
 #include "trashimpl.moc"
@@ -27,6 +27,9 @@
 #include <QMap>
 #include <assert.h>
 
+class TrashInfoIndex;
+class TrashSizeCache;
+
 /**
  * Implementation of all low-level operations done by kio_trash
  * The structure of the trash directory follows the freedesktop.org standard <TODO URL>
@@ -36,6 +39,7 @@ class TrashImpl : public QObject
     Q_OBJECT
 public:
     TrashImpl();
+    ~TrashImpl();
 
     /// Check the "home" trash directory
     /// This MUST be called before doing anything else
@@ -84,6 +88,8 @@ public:
     /// List trashed files
     typedef QList<TrashedFileInfo> TrashedFileInfoList;
     TrashedFileInfoList list();
+    /// List the files trashed in the trash directory @p trashId
+    TrashedFileInfoList list( int trashId );
 
     /// Return the info for a given trashed file
     bool infoForFile( int trashId, const QString& fileId, TrashedFileInfo& info );
@@ -112,6 +118,10 @@ public:
 
 Q_SIGNALS:
     void leaveModality();
+    /// Emitted by emptyTrash() before deleting, with the size of the trash
+    void emptyTrashTotalSize( qulonglong size );
+    /// Emitted by emptyTrash() while deleting, with the size deleted so far
+    void emptyTrashProcessedSize( qulonglong size );
 
 private:
     /// Helper method. Moves a file or directory using the appropriate method.
@@ -124,6 +134,8 @@ private:
     void fileRemoved();
 
     bool adaptTrashSize( const QString& origPath, int trashId );
+    TrashSizeCache* trashSizeCache( int trashId );
+    TrashInfoIndex* trashInfoIndex( int trashId );
 
     // Warning, returns error code, not a bool
     int testDir( const QString& name ) const;
@@ -188,6 +200,11 @@ private:
     // If we want to start caching data - and avoiding some race conditions -,
     // we should turn this class into a kded module and use DCOP to talk to it
     // from the kioslave.
+    // The only exceptions are the sizes of the trash directories and the
+    // contents of their info files, which TrashSizeCache and TrashInfoIndex
+    // share with the other processes through files in the trash directories.
+    QMap<int, TrashSizeCache*> m_trashSizeCaches;
+    QMap<int, TrashInfoIndex*> m_trashInfoIndexes;
 };
 
 #endif
@@ -0,0 +1,220 @@
+/*
+   This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "trashinfoindex.h"
+
+#include <ksavefile.h>
+#include <kde_file.h>
+#include <kdebug.h>
+#include <QDir>
+#include <QFile>
+#include <QSet>
+#include <QUrl>
+
+#include <time.h>
+
+// The index has a first line "I2 <mtime of the info directory> <time of the check>",
+// then "<fileId> <inode> <mtime> <size> <deletion date> <path>" for each item, with
+// fileId and path percent encoded and "-" for a missing deletion date. The inode,
+// mtime and size are those of the .trashinfo file.
+#define INDEX_NAME "kde-infoindex"
+
+TrashInfoIndex::TrashInfoIndex( const QString &path )
+    : mIndexPath( path + QString::fromLatin1( "/" INDEX_NAME ) ),
+      mInfoPath( path + QString::fromLatin1( "/info" ) ),
+      mInfoMtime( -1 ),
+      mCheckTime( -1 ),
+      mLoaded( false )
+{
+}
+
+const TrashInfoIndex::EntryHash &TrashInfoIndex::entries()
+{
+    if (!mLoaded) {
+        load();
+        mLoaded = true;
+    }
+
+    // A file added in the same second as the last check would not change the
+    // modification time, so such a check does not count
+    const qint64 mtime = infoModificationTime();
+    if (mtime != -1 && mtime == mInfoMtime && mInfoMtime < mCheckTime) {
+        return mEntries;
+    }
+
+    const qint64 checkTime = ::time(0);
+    const QStringList entryNames = QDir( mInfoPath ).entryList( QDir::Dirs | QDir::Files | QDir::Hidden );
+    QSet<QString> fileIds;
+    bool changed = false;
+    foreach (const QString &fileName, entryNames) {
+        if ( fileName == QLatin1String(".") || fileName == QLatin1String("..") )
+            continue;
+        if ( !fileName.endsWith( QLatin1String(".trashinfo") ) ) {
+            kWarning() << "Invalid info file found in " << mInfoPath << " : " << fileName ;
+            continue;
+        }
+        const QString fileId = fileName.left( fileName.length() - 10 );
+        fileIds.insert( fileId );
+
+        // Only the new items are read, and those whose fileId was used again
+        // after the previous item was restored or deleted
+        const QString infoPath = mInfoPath + QLatin1Char('/') + fileName;
+        KDE_struct_stat buff;
+        if ( KDE::stat( infoPath, &buff ) != 0 )
+            continue;
+        EntryHash::const_iterator existing = mEntries.constFind( fileId );
+        if ( existing != mEntries.constEnd() && existing->inode == qint64( buff.st_ino ) &&
+             existing->mtime == qint64( buff.st_mtime ) && existing->size == qint64( buff.st_size ) )
+            continue;
+
+        Entry entry;
+        if ( readInfoFile( infoPath, entry ) ) {
+            entry.inode = buff.st_ino;
+            entry.mtime = buff.st_mtime < checkTime ? qint64( buff.st_mtime ) : -1;
+            entry.size = buff.st_size;
+            mEntries.insert( fileId, entry );
+            changed = true;
+        }
+    }
+
+    EntryHash::iterator it = mEntries.begin();
+    while ( it != mEntries.end() ) {
+        if ( fileIds.contains( it.key() ) ) {
+            ++it;
+        } else {
+            it = mEntries.erase( it );
+            changed = true;
+        }
+    }
+
+    const bool stampChanged = (mtime != mInfoMtime);
+    mInfoMtime = mtime;
+    mCheckTime = checkTime;
+    if ( changed || stampChanged )
+        save();
+    return mEntries;
+}
+
+bool TrashInfoIndex::readInfoFile( const QString &infoPath, Entry &entry )
+{
+    QFile file( infoPath );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    bool hasGroup = false;
+    bool inGroup = false;
+    QByteArray path;
+    QByteArray deletionDate;
+    while ( !file.atEnd() ) {
+        const QByteArray line = file.readLine().trimmed();
+        if ( line.isEmpty() || line.startsWith( '#' ) )
+            continue;
+        if ( line.startsWith( '[' ) ) {
+            inGroup = ( line == "[Trash Info]" );
+            hasGroup = hasGroup || inGroup;
+            continue;
+        }
+        const int equalPos = line.indexOf( '=' );
+        if ( !inGroup || equalPos == -1 )
+            continue;
+        const QByteArray key = line.left( equalPos ).trimmed();
+        if ( key == "Path" )
+            path = line.mid( equalPos + 1 ).trimmed();
+        else if ( key == "DeletionDate" )
+            deletionDate = line.mid( equalPos + 1 ).trimmed();
+    }
+    if ( !hasGroup )
+        return false;
+
+    entry.path = QUrl::fromPercentEncoding( path );
+    entry.deletionDate = deletionDate.isEmpty() ? QDateTime()
+                         : QDateTime::fromString( QString::fromLatin1( deletionDate ), Qt::ISODate );
+    return true;
+}
+
+void TrashInfoIndex::load()
+{
+    QFile file( mIndexPath );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return;
+
+    QByteArray line = file.readLine();
+    line.chop( 1 );
+    const QList<QByteArray> header = line.split( ' ' );
+    if ( header.count() != 3 || header.at( 0 ) != "I2" )
+        return;
+
+    EntryHash entries;
+    while ( !file.atEnd() ) {
+        line = file.readLine();
+        if ( !line.endsWith( '\n' ) )
+            return; // truncated
+        line.chop( 1 );
+        int spaces[5];
+        int pos = -1;
+        for ( int i = 0; i < 5; ++i ) {
+            pos = line.indexOf( ' ', pos + 1 );
+            if ( pos == -1 )
+                return;
+            spaces[i] = pos;
+        }
+        Entry entry;
+        entry.inode = line.mid( spaces[0] + 1, spaces[1] - spaces[0] - 1 ).toLongLong();
+        entry.mtime = line.mid( spaces[1] + 1, spaces[2] - spaces[1] - 1 ).toLongLong();
+        entry.size = line.mid( spaces[2] + 1, spaces[3] - spaces[2] - 1 ).toLongLong();
+        const QByteArray deletionDate = line.mid( spaces[3] + 1, spaces[4] - spaces[3] - 1 );
+        if ( deletionDate != "-" )
+            entry.deletionDate = QDateTime::fromString( QString::fromLatin1( deletionDate ), Qt::ISODate );
+        entry.path = QUrl::fromPercentEncoding( line.mid( spaces[4] + 1 ) );
+        entries.insert( QFile::decodeName( QByteArray::fromPercentEncoding( line.left( spaces[0] ) ) ), entry );
+    }
+
+    mEntries = entries;
+    mInfoMtime = header.at( 1 ).toLongLong();
+    mCheckTime = header.at( 2 ).toLongLong();
+}
+
+void TrashInfoIndex::save()
+{
+    KSaveFile file( mIndexPath );
+    if ( !file.open( QIODevice::WriteOnly ) ) {
+        kWarning() << "Could not write" << mIndexPath;
+        return;
+    }
+
+    file.write( "I2 " + QByteArray::number( mInfoMtime ) + ' ' + QByteArray::number( mCheckTime ) + '\n' );
+    EntryHash::const_iterator it = mEntries.constBegin();
+    for ( ; it != mEntries.constEnd() ; ++it ) {
+        const QByteArray deletionDate = it->deletionDate.isValid()
+                                        ? it->deletionDate.toString( Qt::ISODate ).toLatin1() : QByteArray( "-" );
+        file.write( QFile::encodeName( it.key() ).toPercentEncoding() + ' ' +
+                    QByteArray::number( it->inode ) + ' ' + QByteArray::number( it->mtime ) + ' ' +
+                    QByteArray::number( it->size ) + ' ' + deletionDate + ' ' +
+                    QUrl::toPercentEncoding( it->path, "/" ) + '\n' );
+    }
+    file.finalize();
+}
+
+qint64 TrashInfoIndex::infoModificationTime() const
+{
+    KDE_struct_stat buff;
+    if ( KDE::stat( mInfoPath, &buff ) != 0 )
+        return -1;
+    return buff.st_mtime;
+}
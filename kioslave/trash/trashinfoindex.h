@@ -0,0 +1,86 @@
+/*
+   This file is part of the KDE project
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef TRASHINFOINDEX_H
+#define TRASHINFOINDEX_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+/**
+ * @short An index of the .trashinfo files of a trash directory.
+ *
+ * Listing the trash needs the original path and the deletion date of every
+ * trashed item. Instead of parsing all .trashinfo files each time, they are
+ * kept in an index file in the trash directory, which is shared by all processes.
+ *
+ * The index is valid for a given modification time of the info directory.
+ * When the info directory changed, only the names in it are compared with the
+ * index, and just the new .trashinfo files, or those which were replaced since
+ * they were read, are parsed.
+ */
+class TrashInfoIndex
+{
+    public:
+        struct Entry {
+            QString path; // as in the .trashinfo file, relative to the top directory for other partitions
+            QDateTime deletionDate;
+            // Identity of the .trashinfo file the entry was read from, so that
+            // a fileId used again for another item is noticed
+            qint64 inode;
+            qint64 mtime; // -1 when written in the second it was read, to read it again
+            qint64 size;
+        };
+        typedef QHash<QString, Entry> EntryHash;
+
+        /**
+         * Creates the index for the given trash @p path.
+         */
+        TrashInfoIndex( const QString &path );
+
+        /**
+         * Returns the entries of all trashed items by their fileId,
+         * after bringing the index up to date with the info directory.
+         */
+        const EntryHash &entries();
+
+        /**
+         * Reads the .trashinfo file at @p infoPath, without the overhead of
+         * KConfig for the two keys it has.
+         * @return false if it could not be read or has no [Trash Info] group
+         */
+        static bool readInfoFile( const QString &infoPath, Entry &entry );
+
+    private:
+        void load();
+        void save();
+        qint64 infoModificationTime() const;
+
+        QString mIndexPath;
+        QString mInfoPath;
+        EntryHash mEntries;
+        // Modification time of the info directory the entries are valid for, -1 if unknown
+        qint64 mInfoMtime;
+        // When the info directory was last compared with the entries
+        qint64 mCheckTime;
+        bool mLoaded;
+};
+
+#endif
@@ -32,127 +32,369 @@
 #include <QDateTime>
 #include <kdebug.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+// The journal has lines of these kinds:
+//   "J <generation>"              first line, unique for each time the journal is written
+//   "F <size> <fileId>"           a file was trashed
+//   "D <size> <mtime> <fileId>"   a directory was trashed, or its size changed
+//   "- <fileId>"                  an item was removed from the trash
+//   "M <mtime>"                   modification time of the files directory afterwards,
+//                                 in nanoseconds
+// The fileId is percent encoded and the mtime of the other lines is the one of the
+// .trashinfo file in milliseconds, like in directorysizes.
+#define JOURNAL_NAME "kde-sizejournal"
+// The journal is compacted when it has more lines than this and than twice its entries
+#define COMPACT_MINIMUM_LINES 1000
+// Longer than any first line of the journal
+#define GENERATION_MAXIMUM_LENGTH 64
+
 TrashSizeCache::TrashSizeCache( const QString &path )
     : mTrashSizeCachePath( path + QString::fromLatin1( "/directorysizes" ) ),
-      mTrashPath( path )
+      mJournalPath( path + QString::fromLatin1( "/" JOURNAL_NAME ) ),
+      mTrashPath( path ),
+      mTotal( 0 ),
+      mFilesMtime( -1 ),
+      mJournalOffset( 0 ),
+      mJournalLines( 0 )
 {
     kDebug() << "CACHE:" << mTrashSizeCachePath;
 }
 
-void TrashSizeCache::add( const QString &directoryName, qulonglong directorySize )
+void TrashSizeCache::add( const QString &fileId, qulonglong size, bool isDir )
 {
-    kDebug() << directoryName << directorySize;
-    const QByteArray encodedDir = QFile::encodeName(directoryName).toPercentEncoding();
-    const QByteArray spaceAndDirAndNewline = ' ' + encodedDir + '\n';
-    QFile file( mTrashSizeCachePath );
-    KSaveFile out( mTrashSizeCachePath );
-    if (out.open(QIODevice::WriteOnly)) {
-        if (file.open(QIODevice::ReadOnly)) {
-            while (!file.atEnd()) {
-                const QByteArray line = file.readLine();
-                if (line.endsWith(spaceAndDirAndNewline)) {
-                    // Already there!
-                    out.abort();
-                    kDebug() << "already there!";
-                    return;
-                }
-                out.write(line);
-            }
+    kDebug() << fileId << size << isDir;
+    const QByteArray encodedName = QFile::encodeName(fileId).toPercentEncoding();
+    if (!isDir) {
+        appendToJournal("F " + QByteArray::number(size) + ' ' + encodedName + '\n');
+        return;
+    }
+
+    const QString fileInfoPath = mTrashPath + "/info/" + fileId + ".trashinfo";
+    const qint64 mtime = QFileInfo(fileInfoPath).lastModified().toMSecsSinceEpoch();
+    const QByteArray sizeAndMtime = QByteArray::number(size) + ' ' + QByteArray::number(mtime);
+
+    // Appended instead of rewritten, the entries of removed directories
+    // are dropped when the journal is compacted
+    const QHash<QByteArray, Entry>::const_iterator it = mEntries.constFind(encodedName);
+    if (it == mEntries.constEnd() || it->size != size || it->mtime != mtime) {
+        QFile file( mTrashSizeCachePath );
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            file.write(sizeAndMtime + ' ' + encodedName + '\n');
         }
+    }
+    appendToJournal("D " + sizeAndMtime + ' ' + encodedName + '\n');
+}
+
+void TrashSizeCache::remove( const QString &fileId )
+{
+    kDebug() << fileId;
+    appendToJournal("- " + QFile::encodeName(fileId).toPercentEncoding() + '\n');
+}
 
-        const QString fileInfoPath = mTrashPath + "/info/" + directoryName + ".trashinfo";
-        QDateTime mtime = QFileInfo(fileInfoPath).lastModified();
-        QByteArray newLine = QByteArray::number(directorySize) + ' ' + QByteArray::number(mtime.toMSecsSinceEpoch()) + spaceAndDirAndNewline;
-        out.write(newLine);
-        out.finalize();
+void TrashSizeCache::clear()
+{
+    // Nobody may append to the journal while it is removed
+    const int fd = lockJournal();
+    QFile::remove(mJournalPath);
+    QFile::remove(mTrashSizeCachePath);
+    reset();
+    if (fd >= 0) {
+        ::close(fd);
     }
-    kDebug() << mTrashSizeCachePath << "exists:" << QFile::exists(mTrashSizeCachePath);
 }
 
-void TrashSizeCache::remove( const QString &directoryName )
+qulonglong TrashSizeCache::calculateSize()
 {
-    kDebug() << directoryName;
-    const QByteArray encodedDir = QFile::encodeName(directoryName).toPercentEncoding();
-    const QByteArray spaceAndDirAndNewline = ' ' + encodedDir + '\n';
-    QFile file( mTrashSizeCachePath );
-    KSaveFile out( mTrashSizeCachePath );
-    if (file.open(QIODevice::ReadOnly) && out.open(QIODevice::WriteOnly)) {
-        while (!file.atEnd()) {
-            const QByteArray line = file.readLine();
-            if (line.endsWith(spaceAndDirAndNewline)) {
-                // Found it -> skip it
+    const int fd = KDE_open(QFile::encodeName(mJournalPath), O_RDONLY);
+    if (fd >= 0) {
+        readJournal(fd);
+        ::close(fd);
+    } else {
+        reset();
+    }
+
+    if (mFilesMtime == -1 || mFilesMtime != filesModificationTime()) {
+        const int lockedFd = lockJournal();
+        rebuild();
+        if (lockedFd >= 0) {
+            ::close(lockedFd);
+        }
+    }
+    return mTotal;
+}
+
+bool TrashSizeCache::cachedSize( qulonglong &size )
+{
+    const int fd = KDE_open(QFile::encodeName(mJournalPath), O_RDONLY);
+    if (fd < 0) {
+        reset();
+        return false;
+    }
+    readJournal(fd);
+    ::close(fd);
+
+    if (mFilesMtime == -1 || mFilesMtime != filesModificationTime()) {
+        return false;
+    }
+    size = mTotal;
+    return true;
+}
+
+int TrashSizeCache::lockJournal()
+{
+    const QByteArray journalPath = QFile::encodeName(mJournalPath);
+    forever {
+        const int fd = KDE_open(journalPath, O_RDWR | O_CREAT | O_APPEND, 0600);
+        if (fd < 0) {
+            kWarning() << "Could not open" << mJournalPath << strerror(errno);
+            return -1;
+        }
+        ::flock(fd, LOCK_EX);
+
+        // Whoever had the lock before may have replaced the journal
+        KDE_struct_stat fdStat;
+        KDE_struct_stat pathStat;
+        if (KDE_fstat(fd, &fdStat) == 0 && KDE_stat(journalPath, &pathStat) == 0 &&
+            fdStat.st_ino == pathStat.st_ino) {
+            return fd;
+        }
+        ::close(fd);
+    }
+}
+
+void TrashSizeCache::readJournal( int fd )
+{
+    KDE_struct_stat buff;
+    if (KDE_fstat(fd, &buff) != 0) {
+        reset();
+        return;
+    }
+
+    // Compacted since it was read, the inode alone is no proof as it may be reused
+    QByteArray generation(GENERATION_MAXIMUM_LENGTH, Qt::Uninitialized);
+    const ssize_t headerRead = ::pread(fd, generation.data(), generation.size(), 0);
+    generation.truncate(qMax(headerRead, ssize_t(0)));
+    generation.truncate(generation.indexOf('\n') + 1);
+    if (generation != mJournalGeneration || buff.st_size < mJournalOffset) {
+        reset();
+        mJournalGeneration = generation;
+    }
+    if (buff.st_size == mJournalOffset) {
+        return;
+    }
+
+    QByteArray data(buff.st_size - mJournalOffset, Qt::Uninitialized);
+    const ssize_t bytesRead = ::pread(fd, data.data(), data.size(), mJournalOffset);
+    if (bytesRead <= 0) {
+        return;
+    }
+    data.truncate(bytesRead);
+
+    // A line which is still being written is left for the next time
+    int start = 0;
+    int end;
+    while ((end = data.indexOf('\n', start)) != -1) {
+        const QByteArray line = data.mid(start, end - start);
+        start = end + 1;
+        ++mJournalLines;
+
+        if (line.startsWith("F ") || line.startsWith("D ")) {
+            Entry entry;
+            entry.isDir = (line.at(0) == 'D');
+            entry.mtime = 0;
+            const int sizeEnd = line.indexOf(' ', 2);
+            if (sizeEnd == -1) {
                 continue;
             }
-            out.write(line);
+            entry.size = line.mid(2, sizeEnd - 2).toULongLong();
+            int nameStart = sizeEnd + 1;
+            if (entry.isDir) {
+                const int mtimeEnd = line.indexOf(' ', nameStart);
+                if (mtimeEnd == -1) {
+                    continue;
+                }
+                entry.mtime = line.mid(nameStart, mtimeEnd - nameStart).toLongLong();
+                nameStart = mtimeEnd + 1;
+            }
+            const QByteArray name = line.mid(nameStart);
+            QHash<QByteArray, Entry>::iterator it = mEntries.find(name);
+            if (it != mEntries.end()) {
+                mTotal -= it->size;
+                *it = entry;
+            } else {
+                mEntries.insert(name, entry);
+            }
+            mTotal += entry.size;
+        } else if (line.startsWith("- ")) {
+            QHash<QByteArray, Entry>::iterator it = mEntries.find(line.mid(2));
+            if (it != mEntries.end()) {
+                mTotal -= it->size;
+                mEntries.erase(it);
+            }
+        } else if (line.startsWith("M ")) {
+            mFilesMtime = line.mid(2).toLongLong();
         }
     }
-    out.finalize();
+    mJournalOffset += start;
 }
 
-void TrashSizeCache::clear()
+void TrashSizeCache::appendToJournal( const QByteArray &lines )
 {
-    QFile::remove(mTrashSizeCachePath);
+    int fd = lockJournal();
+    if (fd < 0) {
+        return;
+    }
+    readJournal(fd);
+
+    if (mFilesMtime == -1) {
+        // A new journal must start with all items which are in the trash already
+        rebuild();
+        ::close(fd);
+        fd = lockJournal();
+        if (fd < 0) {
+            return;
+        }
+        readJournal(fd);
+    }
+
+    // One write, so that readers see the change together with its time stamp
+    const QByteArray data = lines + "M " + QByteArray::number(filesModificationTime()) + '\n';
+    if (::write(fd, data.constData(), data.size()) != data.size()) {
+        kWarning() << "Could not write" << mJournalPath << strerror(errno);
+    }
+    readJournal(fd);
+
+    if (mJournalLines > COMPACT_MINIMUM_LINES && mJournalLines > 2 * mEntries.count()) {
+        writeJournal();
+    }
+    ::close(fd);
 }
 
-struct CacheData {
-    qint64 mtime;
-    qulonglong size;
-};
+void TrashSizeCache::writeJournal()
+{
+    KSaveFile journal( mJournalPath );
+    KSaveFile dirCache( mTrashSizeCachePath );
+    if (!journal.open(QIODevice::WriteOnly) || !dirCache.open(QIODevice::WriteOnly)) {
+        kWarning() << "Could not write" << mJournalPath;
+        return;
+    }
 
-qulonglong TrashSizeCache::calculateSize()
+    static int counter = 0;
+    const QByteArray generation = "J " + QByteArray::number(QDateTime::currentMSecsSinceEpoch()) + '.' +
+                                  QByteArray::number(getpid()) + '.' + QByteArray::number(++counter) + '\n';
+    journal.write(generation);
+
+    QHash<QByteArray, Entry>::const_iterator it = mEntries.constBegin();
+    for (; it != mEntries.constEnd(); ++it) {
+        if (it->isDir) {
+            const QByteArray sizeAndMtime = QByteArray::number(it->size) + ' ' + QByteArray::number(it->mtime);
+            journal.write("D " + sizeAndMtime + ' ' + it.key() + '\n');
+            dirCache.write(sizeAndMtime + ' ' + it.key() + '\n');
+        } else {
+            journal.write("F " + QByteArray::number(it->size) + ' ' + it.key() + '\n');
+        }
+    }
+    journal.write("M " + QByteArray::number(mFilesMtime) + '\n');
+    dirCache.finalize();
+    journal.finalize();
+
+    KDE_struct_stat buff;
+    if (KDE::stat(mJournalPath, &buff) == 0) {
+        mJournalGeneration = generation;
+        mJournalOffset = buff.st_size;
+        mJournalLines = mEntries.count() + 2;
+    }
+}
+
+void TrashSizeCache::rebuild()
 {
+    kDebug() << mTrashPath;
     // First read the directorysizes cache into memory
     QFile file( mTrashSizeCachePath );
-    typedef QHash<QByteArray, CacheData> DirCacheHash;
-    DirCacheHash dirCache;
+    QHash<QByteArray, Entry> dirCache;
     if (file.open(QIODevice::ReadOnly)) {
         while (!file.atEnd()) {
-            const QByteArray line = file.readLine();
+            QByteArray line = file.readLine();
+            line.chop(1);
             const int firstSpace = line.indexOf(' ');
             const int secondSpace = line.indexOf(' ', firstSpace + 1);
-            CacheData data;
-            data.mtime = line.left(firstSpace).toLongLong();
-            // "012 4567 name" -> firstSpace=3, secondSpace=8, we want mid(4,4)
-            data.size = line.mid(firstSpace + 1, secondSpace - firstSpace - 1).toULongLong();
+            if (firstSpace == -1 || secondSpace == -1) {
+                continue;
+            }
+            Entry data;
+            // "012 4567 name" -> firstSpace=3, secondSpace=8
+            data.size = line.left(firstSpace).toULongLong();
+            data.mtime = line.mid(firstSpace + 1, secondSpace - firstSpace - 1).toLongLong();
             dirCache.insert(line.mid(secondSpace + 1), data);
         }
     }
+
+    // Taken before the files are looked at, so that changes meanwhile lead to another rebuild
+    reset();
+    mFilesMtime = filesModificationTime();
+
     // Iterate over the actual trashed files.
     // Orphan items (no .fileinfo) still take space.
     QDirIterator it( mTrashPath + QString::fromLatin1( "/files/" ), QDirIterator::NoIteratorFlags );
-
-    qulonglong sum = 0;
     while ( it.hasNext() ) {
         const QFileInfo file = it.next();
         if (file.fileName() == QLatin1String(".") || file.fileName() == QLatin1String("..")) {
             continue;
         }
+        const QString fileId = file.fileName();
+        const QByteArray encodedName = QFile::encodeName(fileId).toPercentEncoding();
+        Entry entry;
+        entry.mtime = 0;
+        entry.isDir = false;
         if ( file.isSymLink() ) {
             // QFileInfo::size does not return the actual size of a symlink. #253776
             KDE_struct_stat buff;
-            return static_cast<qulonglong>(KDE::lstat(file.absoluteFilePath(), &buff) == 0 ? buff.st_size : 0);
+            entry.size = static_cast<qulonglong>(KDE::lstat(file.absoluteFilePath(), &buff) == 0 ? buff.st_size : 0);
         } else if (file.isFile()) {
-            sum += file.size();
+            entry.size = file.size();
         } else {
-            bool usableCache = false;
-            const QString fileId = file.fileName();
-            DirCacheHash::const_iterator it = dirCache.constFind(QFile::encodeName(fileId));
-            if (it != dirCache.constEnd()) {
-                const CacheData &data = *it;
-                const QString fileInfoPath = mTrashPath + "/info/" + fileId + ".trashinfo";
-                if (QFileInfo(fileInfoPath).lastModified().toMSecsSinceEpoch() == data.mtime) {
-                    sum += data.size;
-                    usableCache = true;
-                }
-            }
-            if (!usableCache) {
-                const qulonglong size = DiscSpaceUtil::sizeOfPath(file.absoluteFilePath());
-                sum += size;
-                add(fileId, size);
+            const QString fileInfoPath = mTrashPath + "/info/" + fileId + ".trashinfo";
+            entry.isDir = true;
+            entry.mtime = QFileInfo(fileInfoPath).lastModified().toMSecsSinceEpoch();
+            QHash<QByteArray, Entry>::const_iterator cached = dirCache.constFind(encodedName);
+            if (cached != dirCache.constEnd() && cached->mtime == entry.mtime) {
+                entry.size = cached->size;
+            } else {
+                entry.size = DiscSpaceUtil::sizeOfPath(file.absoluteFilePath());
             }
         }
-
+        mEntries.insert(encodedName, entry);
+        mTotal += entry.size;
     }
 
-    return sum;
+    writeJournal();
+}
+
+void TrashSizeCache::reset()
+{
+    mEntries.clear();
+    mTotal = 0;
+    mFilesMtime = -1;
+    mJournalGeneration.clear();
+    mJournalOffset = 0;
+    mJournalLines = 0;
+}
+
+qint64 TrashSizeCache::filesModificationTime() const
+{
+    KDE_struct_stat buff;
+    if (KDE::stat(mTrashPath + QString::fromLatin1("/files"), &buff) != 0) {
+        return -1;
+    }
+    // Seconds would miss a change within the second of the last one
+#ifdef Q_OS_MAC
+    return qint64(buff.st_mtime) * 1000000000 + buff.st_mtimespec.tv_nsec;
+#else
+    return qint64(buff.st_mtime) * 1000000000 + buff.st_mtim.tv_nsec;
+#endif
 }
@@ -23,6 +23,7 @@
 #ifndef TRASHSIZECACHE_H
 #define TRASHSIZECACHE_H
 
+#include <QtCore/QHash>
 #include <QtCore/QString>
 
 #include <kconfig.h>
@@ -35,6 +36,15 @@
  * Since version 1.0, http://standards.freedesktop.org/trash-spec/trashspec-latest.html specifies this cache
  * as a standard way to cache this information.
  *
+ * On top of it, the size of every trashed item is kept in an append-only journal,
+ * so that the size of the trash is known without looking at the trashed files.
+ * The journal is shared by all processes using the trash, each object reads the
+ * entries added by the others before it uses its total. The journal is compacted
+ * once most of its entries are obsolete, which also drops the entries of removed
+ * directories from the directory size cache.
+ *
+ * Changes by other implementations of the trash are noticed by the modification
+ * time of the files directory, the journal is then built again from scratch.
  */
 class TrashSizeCache
 {
@@ -45,16 +55,17 @@ class TrashSizeCache
         TrashSizeCache( const QString &path );
 
         /**
-         * Adds a directory to the cache.
-         * @param directoryName fileId of the directory
-         * @param directorySize size in bytes
+         * Adds a trashed item to the cache.
+         * @param fileId fileId of the item
+         * @param size size in bytes
+         * @param isDir whether the item is a directory, which goes into the directory size cache too
          */
-        void add( const QString &directoryName, qulonglong directorySize );
+        void add( const QString &fileId, qulonglong size, bool isDir );
 
         /**
-         * Removes a directory from the cache.
+         * Removes a trashed item from the cache.
          */
-        void remove( const QString &directoryName );
+        void remove( const QString &fileId );
 
         /**
          * Sets the trash size to 0 bytes.
@@ -62,13 +73,46 @@ class TrashSizeCache
         void clear();
 
         /**
-         * Calculates and returns the current trash size.
+         * Returns the current trash size. This only reads the new entries of the
+         * journal, unless the trash was changed by somebody else.
          */
         qulonglong calculateSize();
 
+        /**
+         * Sets @p size to the trash size known from the journal, without
+         * looking at the trashed files.
+         * @return false if the journal does not match the files directory,
+         * so that only calculateSize() could tell the size
+         */
+        bool cachedSize( qulonglong &size );
+
     private:
+        struct Entry {
+            qulonglong size;
+            qint64 mtime; // of the .trashinfo file, for directories
+            bool isDir;
+        };
+
+        int lockJournal();
+        void readJournal( int fd );
+        void appendToJournal( const QByteArray &lines );
+        void writeJournal();
+        void rebuild();
+        void reset();
+        qint64 filesModificationTime() const;
+
         QString mTrashSizeCachePath;
+        QString mJournalPath;
         QString mTrashPath;
+
+        QHash<QByteArray, Entry> mEntries;
+        qulonglong mTotal;
+        // Modification time of the files directory the journal is valid for in nanoseconds, -1 if unknown
+        qint64 mFilesMtime;
+        // The first line of the journal file, which is unique for each compaction, and how far it was read
+        QByteArray mJournalGeneration;
+        qint64 mJournalOffset;
+        int mJournalLines;
 };
 
 #endif
@@ -17,14 +17,18 @@
   * Boston, MA 02110-1301, USA.
   */
 
+#include <config-kwalletbackend.h>
 #include <QIODevice>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextDocument>
+#include <QtEndian>
 #include <assert.h>
 #include <ksavefile.h>
 #include <kdebug.h>
 #include <kmessagebox.h>
 #include <klocalizedstring.h>
+#include <gcrypt.h>
 #ifdef HAVE_QGPGME
 #include <gpgme.h>
 #include <gpgme++/context.h>
@@ -44,17 +48,51 @@
 #ifdef Q_OS_WIN
 #include <windows.h>
 #include <wincrypt.h>
+#else
+#include <unistd.h>
 #endif
 
 #define KWALLET_CIPHER_BLOWFISH_ECB 0 // this was the old KWALLET_CIPHER_BLOWFISH_CBC
 #define KWALLET_CIPHER_3DES_CBC     1 // unsupported
 #define KWALLET_CIPHER_GPG          2
 #define KWALLET_CIPHER_BLOWFISH_CBC 3
+#define KWALLET_CIPHER_BLOWFISH_LOG 4 // log of separately encrypted records
+#define KWALLET_CIPHER_AES_GCM_LOG  5 // the same with AES-256-GCM
 
 #define KWALLET_HASH_SHA1       0
 #define KWALLET_HASH_MD5        1 // unsupported
 #define KWALLET_HASH_PBKDF2_SHA512 2 // used when using kwallet with pam or since 4.13 version
 
+// A log wallet file is a sequence of records after the version bytes:
+//   type (1 byte), size of the encrypted data (4 bytes),
+//   MD5 of the folder name (16 bytes, folder and entry records),
+//   MD5 of the entry key (16 bytes, entry records),
+//   IV and encrypted data: plain size (4 bytes), plain data, padding,
+//   MAC of the generation, the MAC of the previous record, the offset of the
+//   record in the file and all of the above.
+// Blowfish records use CBC and HMAC-SHA1. AES-GCM records need no padding,
+// the MAC is the GCM tag and the rest of the record is authenticated data.
+// The hashes are readable without the password like in the older format.
+// The check record holds the random generation of the file, its MAC covers
+// neither the generation nor a previous record. The records of a sync only
+// count once its commit record is read.
+#define KWALLET_RECORD_CHECK          0 // written first, to check the password
+#define KWALLET_RECORD_FOLDER         1 // the folder exists and is empty
+#define KWALLET_RECORD_FOLDER_REMOVED 2
+#define KWALLET_RECORD_ENTRY          3 // the entry was written
+#define KWALLET_RECORD_ENTRY_REMOVED  4
+#define KWALLET_RECORD_COMMIT         5 // ends each sync
+
+#define KWALLET_RECORD_HEADER_LEN 5
+#define KWALLET_HMAC_SHA1_LEN     20
+#define KWALLET_GCM_IV_LEN        12
+#define KWALLET_GCM_TAG_LEN       16
+#define KWALLET_AES_KEY_LEN       32
+#define KWALLET_GENERATION_LEN    16
+#define KWALLET_LOG_BUFFER_SIZE   65536
+// Superseded records allowed beyond the number of live ones before the file is rewritten
+#define KWALLET_LOG_SLACK         64
+
 namespace KWallet {
 
 static int getRandomBlock(QByteArray& randBlock) {
@@ -141,11 +179,16 @@ static int getRandomBlock(QByteArray& randBlock) {
 #endif
 }
 
-BackendPersistHandler *BackendPersistHandler::getPersistHandler(BackendCipherType cipherType)
+BackendPersistHandler *BackendPersistHandler::getPersistHandler(BackendCipherType cipherType, bool log)
 {
     switch (cipherType){
         case BACKEND_CIPHER_BLOWFISH:
-            return new BlowfishPersistHandler;
+            if (!log) {
+                return new BlowfishPersistHandler;
+            }
+            // fall through
+        case BACKEND_CIPHER_AES_GCM:
+            return new LogPersistHandler(cipherType);
 #ifdef HAVE_QGPGME
         case BACKEND_CIPHER_GPG:
             return new GpgPersistHandler;
@@ -166,6 +209,10 @@ BackendPersistHandler *BackendPersistHandler::getPersistHandler(char magicBuf[12
         }
         return new BlowfishPersistHandler(useECBforReading);
     }
+    if ((magicBuf[2] == KWALLET_CIPHER_BLOWFISH_LOG || magicBuf[2] == KWALLET_CIPHER_AES_GCM_LOG) &&
+        (magicBuf[3] == KWALLET_HASH_SHA1 || magicBuf[3] == KWALLET_HASH_PBKDF2_SHA512)) {
+        return new LogPersistHandler(magicBuf[2] == KWALLET_CIPHER_AES_GCM_LOG ? BACKEND_CIPHER_AES_GCM : BACKEND_CIPHER_BLOWFISH);
+    }
 #ifdef HAVE_QGPGME
     if (magicBuf[2] == KWALLET_CIPHER_GPG &&
         magicBuf[3] == 0) {
@@ -322,7 +369,15 @@ int BlowfishPersistHandler::write(Backend* wb, KSaveFile& sf, QByteArray& versio
 
 int BlowfishPersistHandler::read(Backend* wb, QFile& db, WId)
 {
-    wb->_cipherType = BACKEND_CIPHER_BLOWFISH;
+    if (wb->_upgradeFormat) {
+        // Written as a log on the next sync, which keeps a copy of this file
+        wb->_cipherType = wb->passwordCipherType();
+        wb->_logFormat = true;
+        wb->_backupLegacy = true;
+    } else {
+        wb->_cipherType = BACKEND_CIPHER_BLOWFISH;
+        wb->_logFormat = false;
+    }
     wb->_hashes.clear();
     // Read in the hashes
     QDataStream hds(&db);
@@ -466,6 +521,673 @@ int BlowfishPersistHandler::read(Backend* wb, QFile& db, WId)
     return 0;
 }
 
+LogPersistHandler::LogPersistHandler(BackendCipherType cipherType)
+    : _cipherType(cipherType)
+    , _aes(0)
+    , _nextIV(0)
+{
+    if (_cipherType == BACKEND_CIPHER_AES_GCM) {
+        _ivSize = KWALLET_GCM_IV_LEN;
+        _padding = 1;
+        _macSize = KWALLET_GCM_TAG_LEN;
+    } else {
+        _ivSize = _bf.blockSize();
+        _padding = _bf.blockSize();
+        _macSize = KWALLET_HMAC_SHA1_LEN;
+    }
+}
+
+bool LogPersistHandler::hasAesGcm()
+{
+#ifdef HAVE_GCRYPT_GCM
+    return gcry_check_version("1.6.0") != 0;
+#else
+    return false;
+#endif
+}
+
+LogPersistHandler::~LogPersistHandler()
+{
+    if (_aes) {
+        gcry_cipher_close(_aes);
+    }
+    _macKey.fill(0);
+}
+
+void LogPersistHandler::setVersion(QByteArray& version) const
+{
+    version[2] = _cipherType == BACKEND_CIPHER_AES_GCM ? KWALLET_CIPHER_AES_GCM_LOG : KWALLET_CIPHER_BLOWFISH_LOG;
+    // The minor version tells whether the password hash is PBKDF2_SHA512
+    version[3] = version[1] ? KWALLET_HASH_PBKDF2_SHA512 : KWALLET_HASH_SHA1;
+}
+
+static bool macMatches(const QByteArray& mac, const char *expected)
+{
+    char diff = 0;
+    for (int i = 0; i < mac.size(); i++) {
+        diff |= mac[i] ^ expected[i];
+    }
+    return diff == 0;
+}
+
+bool LogPersistHandler::setKey(Backend* wb)
+{
+    if (_cipherType == BACKEND_CIPHER_AES_GCM) {
+        if (!hasAesGcm()) {
+            kWarning() << "libgcrypt is too old for AES-GCM";
+            return false;
+        }
+#ifdef HAVE_GCRYPT_GCM
+        // libgcrypt uses AES-NI and PCLMUL for GCM where the CPU has them
+        if (!_aes && gcry_cipher_open(&_aes, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, 0) != 0) {
+            _aes = 0;
+            return false;
+        }
+
+        // The password hash is 20, 40 or 56 bytes, AES-256 needs 32
+        static const char label[] = "KWallet AES-GCM key";
+        QByteArray material(label, sizeof(label) - 1);
+        material.append(wb->_passhash);
+        QByteArray key(KWALLET_AES_KEY_LEN, 0);
+        gcry_md_hash_buffer(GCRY_MD_SHA256, key.data(), material.constData(), material.size());
+        const bool ok = gcry_cipher_setkey(_aes, key.constData(), key.size()) == 0;
+        material.fill(0);
+        key.fill(0);
+        return ok;
+#endif
+    }
+
+    if (!_bf.setKey(wb->_passhash.data(), wb->_passhash.size() * 8)) {
+        return false;
+    }
+
+    // Derive a separate key for the MACs from the password hash
+    static const char label[] = "KWallet record MAC";
+    SHA1 sha;
+    sha.process(label, sizeof(label) - 1);
+    sha.process(wb->_passhash.constData(), wb->_passhash.size());
+    _macKey = QByteArray(reinterpret_cast<const char *>(sha.hash()), 20);
+    sha.reset();
+    return true;
+}
+
+int LogPersistHandler::prepareIVs(int count)
+{
+    // Read the random data for all records of a sync at once
+    _ivs.resize(count * _ivSize);
+    _nextIV = 0;
+    return getRandomBlock(_ivs);
+}
+
+QByteArray LogPersistHandler::macPrefix(qint64 offset) const
+{
+    // Authenticated along with each record, so that records cannot be moved
+    // around, dropped from the middle or taken from another generation
+    QByteArray prefix = _generation + _chain;
+    const int start = prefix.size();
+    prefix.resize(start + 8);
+    qToBigEndian<quint64>(offset, reinterpret_cast<uchar *>(prefix.data() + start));
+    return prefix;
+}
+
+QByteArray LogPersistHandler::recordMac(const QByteArray& prefix, const char *record, int len) const
+{
+    // HMAC-SHA1
+    char pad[64];
+
+    SHA1 sha;
+    memset(pad, 0x36, sizeof(pad));
+    for (int i = 0; i < _macKey.size(); i++) {
+        pad[i] ^= _macKey[i];
+    }
+    sha.process(pad, sizeof(pad));
+    sha.process(prefix.constData(), prefix.size());
+    sha.process(record, len);
+    const QByteArray inner(reinterpret_cast<const char *>(sha.hash()), 20);
+    sha.reset();
+
+    memset(pad, 0x5c, sizeof(pad));
+    for (int i = 0; i < _macKey.size(); i++) {
+        pad[i] ^= _macKey[i];
+    }
+    sha.process(pad, sizeof(pad));
+    sha.process(inner.constData(), inner.size());
+    const QByteArray mac(reinterpret_cast<const char *>(sha.hash()), KWALLET_HMAC_SHA1_LEN);
+    sha.reset();
+    memset(pad, 0, sizeof(pad));
+
+    return mac;
+}
+
+void LogPersistHandler::addRecord(QByteArray& out, qint64 offset, char type, const QByteArray& hashes, QByteArray& plain)
+{
+    const int headerSize = KWALLET_RECORD_HEADER_LEN + hashes.size();
+    const int encryptedSize = _ivSize + (4 + plain.size() + _padding - 1) / _padding * _padding;
+    const int start = out.size();
+    out.resize(start + headerSize + encryptedSize + _macSize);
+
+    char *record = out.data() + start;
+    record[0] = type;
+    qToBigEndian<quint32>(encryptedSize, reinterpret_cast<uchar *>(record + 1));
+    memcpy(record + KWALLET_RECORD_HEADER_LEN, hashes.constData(), hashes.size());
+
+    // Each record has its own IV, so that it can be decrypted on its own
+    char *iv = record + headerSize;
+    assert(_nextIV + _ivSize <= _ivs.size());
+    memcpy(iv, _ivs.constData() + _nextIV, _ivSize);
+    _nextIV += _ivSize;
+
+    char *data = iv + _ivSize;
+    char *end = iv + encryptedSize;
+    qToBigEndian<quint32>(plain.size(), reinterpret_cast<uchar *>(data));
+    memcpy(data + 4, plain.constData(), plain.size());
+    memset(data + 4 + plain.size(), 0, end - data - 4 - plain.size());
+    plain.fill(0);
+
+    sealRecord(record, headerSize, encryptedSize, offset);
+}
+
+void LogPersistHandler::sealRecord(char *record, int headerSize, int encryptedSize, qint64 offset)
+{
+    char *iv = record + headerSize;
+    char *end = iv + encryptedSize;
+
+#ifdef HAVE_GCRYPT_GCM
+    if (_cipherType == BACKEND_CIPHER_AES_GCM) {
+        QByteArray aad = macPrefix(offset);
+        aad.append(record, headerSize);
+
+        gcry_cipher_setiv(_aes, iv, _ivSize);
+        gcry_cipher_authenticate(_aes, aad.constData(), aad.size());
+        gcry_cipher_encrypt(_aes, iv + _ivSize, end - iv - _ivSize, 0, 0);
+        gcry_cipher_gettag(_aes, end, _macSize);
+        _chain = QByteArray(end, _macSize);
+        return;
+    }
+#endif
+
+    const int blksz = _bf.blockSize();
+    quint32 block[2];
+    assert(blksz == int(sizeof(block)));
+    for (char *b = iv + blksz; b < end; b += blksz) {
+        for (int i = 0; i < blksz; i++) {
+            b[i] ^= b[i - blksz];
+        }
+        memcpy(block, b, blksz);
+        _bf.encrypt(block, blksz);
+        memcpy(b, block, blksz);
+    }
+
+    const QByteArray mac = recordMac(macPrefix(offset), record, end - record);
+    memcpy(end, mac.constData(), _macSize);
+    _chain = mac;
+}
+
+bool LogPersistHandler::openRecord(char *record, int headerSize, int encryptedSize, qint64 offset)
+{
+    char *iv = record + headerSize;
+    char *end = iv + encryptedSize;
+
+#ifdef HAVE_GCRYPT_GCM
+    if (_cipherType == BACKEND_CIPHER_AES_GCM) {
+        QByteArray aad = macPrefix(offset);
+        aad.append(record, headerSize);
+
+        gcry_cipher_setiv(_aes, iv, _ivSize);
+        gcry_cipher_authenticate(_aes, aad.constData(), aad.size());
+        gcry_cipher_decrypt(_aes, iv + _ivSize, end - iv - _ivSize, 0, 0);
+        if (gcry_cipher_checktag(_aes, end, _macSize) != 0) {
+            return false;
+        }
+        _chain = QByteArray(end, _macSize);
+        return true;
+    }
+#endif
+
+    if (!macMatches(recordMac(macPrefix(offset), record, end - record), end)) {
+        return false;
+    }
+    _chain = QByteArray(end, _macSize);
+
+    // Go backwards, so that the previous block is still encrypted
+    const int blksz = _bf.blockSize();
+    quint32 block[2];
+    for (char *b = end - blksz; b > iv; b -= blksz) {
+        memcpy(block, b, blksz);
+        _bf.decrypt(block, blksz);
+        memcpy(b, block, blksz);
+        for (int i = 0; i < blksz; i++) {
+            b[i] ^= b[i - blksz];
+        }
+    }
+    memset(block, 0, sizeof(block));
+    return true;
+}
+
+void LogPersistHandler::addFolderRecord(QByteArray& out, qint64 offset, const QString& folder, bool exists)
+{
+    KMD5 md5(folder.toUtf8());
+    const QByteArray hashes(reinterpret_cast<const char *>(&(md5.rawDigest()[0])), 16);
+
+    QByteArray plain;
+    QDataStream stream(&plain, QIODevice::WriteOnly);
+    stream << folder;
+
+    addRecord(out, offset, exists ? KWALLET_RECORD_FOLDER : KWALLET_RECORD_FOLDER_REMOVED, hashes, plain);
+}
+
+void LogPersistHandler::addCommitRecord(QByteArray& out, qint64 offset)
+{
+    QByteArray plain;
+    addRecord(out, offset, KWALLET_RECORD_COMMIT, QByteArray(), plain);
+}
+
+void LogPersistHandler::addEntryRecord(QByteArray& out, qint64 offset, const QString& folder, const QString& key, const Entry* e)
+{
+    KMD5 md5(folder.toUtf8());
+    QByteArray hashes(reinterpret_cast<const char *>(&(md5.rawDigest()[0])), 16);
+    md5.reset();
+    md5.update(key.toUtf8());
+    hashes.append(reinterpret_cast<const char *>(&(md5.rawDigest()[0])), 16);
+
+    QByteArray plain;
+    QDataStream stream(&plain, QIODevice::WriteOnly);
+    stream << folder;
+    stream << key;
+    if (e) {
+        stream << static_cast<qint32>(e->type());
+        stream << e->value();
+    }
+
+    addRecord(out, offset, e ? KWALLET_RECORD_ENTRY : KWALLET_RECORD_ENTRY_REMOVED, hashes, plain);
+}
+
+int LogPersistHandler::replayRecord(Backend* wb, char type, const char *plain, int len)
+{
+    QDataStream stream(QByteArray::fromRawData(plain, len));
+    QString folder;
+    QString key;
+    qint32 x = 0; // necessary to read properly
+    QByteArray value;
+    stream >> folder;
+    if (type == KWALLET_RECORD_ENTRY || type == KWALLET_RECORD_ENTRY_REMOVED) {
+        stream >> key;
+    }
+    if (type == KWALLET_RECORD_ENTRY) {
+        stream >> x;
+        stream >> value;
+    }
+    if (stream.status() != QDataStream::Ok) {
+        return -8;
+    }
+
+    Backend::FolderMap::Iterator fi = wb->_entries.find(folder);
+    switch (type) {
+    case KWALLET_RECORD_FOLDER:
+        if (fi == wb->_entries.end()) {
+            wb->_entries.insert(folder, Backend::EntryMap());
+        } else {
+            qDeleteAll(fi.value());
+            fi.value().clear();
+        }
+        break;
+    case KWALLET_RECORD_FOLDER_REMOVED:
+        if (fi != wb->_entries.end()) {
+            qDeleteAll(fi.value());
+            wb->_entries.erase(fi);
+        }
+        break;
+    case KWALLET_RECORD_ENTRY: {
+        KWallet::Wallet::EntryType et = static_cast<KWallet::Wallet::EntryType>(x);
+        switch (et) {
+        case KWallet::Wallet::Password:
+        case KWallet::Wallet::Stream:
+        case KWallet::Wallet::Map:
+            break;
+        default: // Unknown entry
+            return 0;
+        }
+
+        Entry *&e = wb->_entries[folder][key];
+        if (!e) {
+            e = new Entry;
+        }
+        e->setValue(value);
+        e->setType(et);
+        e->setKey(key);
+        break;
+    }
+    case KWALLET_RECORD_ENTRY_REMOVED:
+        if (fi != wb->_entries.end()) {
+            Backend::EntryMap::Iterator ei = fi.value().find(key);
+            if (ei != fi.value().end()) {
+                delete ei.value();
+                fi.value().erase(ei);
+            }
+        }
+        break;
+    }
+    return 0;
+}
+
+int LogPersistHandler::write(Backend* wb, KSaveFile& sf, QByteArray& version, WId)
+{
+    assert(wb->_cipherType == _cipherType);
+
+    setVersion(version);
+    if (sf.write(version, 4) != 4) {
+        sf.abort();
+        return -4; // write error
+    }
+
+    if (!setKey(wb)) {
+        sf.abort();
+        return -2; // encrypt error
+    }
+
+    int records = 2; // the check and commit records
+    for (Backend::FolderMap::ConstIterator i = wb->_entries.constBegin(); i != wb->_entries.constEnd(); ++i) {
+        records += 1 + i.value().count();
+    }
+    QByteArray generation(KWALLET_GENERATION_LEN, 0);
+    if (prepareIVs(records) < 0 || getRandomBlock(generation) < 0) {
+        sf.abort();
+        return -3;      // Fatal error: can't get random
+    }
+
+    // The check record makes a wrong password fail on the first record,
+    // even for an empty wallet, and keeps the file above the minimum size
+    qint64 offset = KWMAGIC_LEN + 4;
+    QByteArray buffer;
+    QByteArray check = generation;
+    _generation.clear();
+    _chain.clear();
+    addRecord(buffer, offset, KWALLET_RECORD_CHECK, QByteArray(), check);
+    _generation = generation;
+
+    // Encrypt and write the records a buffer at a time
+    for (Backend::FolderMap::ConstIterator i = wb->_entries.constBegin(); i != wb->_entries.constEnd(); ++i) {
+        addFolderRecord(buffer, offset + buffer.size(), i.key(), true);
+
+        for (Backend::EntryMap::ConstIterator j = i.value().constBegin(); j != i.value().constEnd(); ++j) {
+            addEntryRecord(buffer, offset + buffer.size(), i.key(), j.key(), j.value());
+
+            if (buffer.size() >= KWALLET_LOG_BUFFER_SIZE) {
+                if (sf.write(buffer) != buffer.size()) {
+                    sf.abort();
+                    return -4; // write error
+                }
+                offset += buffer.size();
+                buffer.clear();
+            }
+        }
+    }
+    addCommitRecord(buffer, offset + buffer.size());
+
+    if (sf.write(buffer) != buffer.size()) {
+        sf.abort();
+        return -4; // write error
+    }
+    offset += buffer.size();
+
+    if (!sf.finalize()) {
+        kDebug() << "WARNING: wallet sync to disk failed! KSaveFile status was " << sf.errorString();
+        return -4; // write error
+    }
+
+    wb->_logVersion = version;
+    wb->_logSize = offset;
+    wb->_logRecords = records;
+    wb->_logGeneration = _generation;
+    wb->_logMac = _chain;
+    return 0;
+}
+
+bool LogPersistHandler::canAppend(Backend* wb, const QByteArray& version)
+{
+    QByteArray logVersion = version;
+    setVersion(logVersion);
+    if (wb->_logVersion != logVersion || QFileInfo(wb->_path).size() != wb->_logSize) {
+        return false;
+    }
+
+    // Compact the file once the superseded records outnumber the live ones
+    int live = 1;
+    for (Backend::FolderMap::ConstIterator i = wb->_entries.constBegin(); i != wb->_entries.constEnd(); ++i) {
+        live += 1 + i.value().count();
+    }
+    const int records = wb->_logRecords + wb->_changedFolders.count() + wb->_changedEntries.count();
+    return records <= 2 * live + KWALLET_LOG_SLACK;
+}
+
+int LogPersistHandler::append(Backend* wb, QFile& sf, WId)
+{
+    assert(wb->_cipherType == _cipherType);
+
+    if (wb->_changedFolders.isEmpty() && wb->_changedEntries.isEmpty()) {
+        return 0;
+    }
+
+    if (!setKey(wb)) {
+        return -2; // encrypt error
+    }
+    if (prepareIVs(wb->_changedFolders.count() + wb->_changedEntries.count() + 1) < 0) {
+        return -3;      // Fatal error: can't get random
+    }
+    _generation = wb->_logGeneration;
+    _chain = wb->_logMac;
+
+    // Folder records go first, as they drop the entries of the folder
+    QByteArray records;
+    int count = 0;
+    foreach (const QString& folder, wb->_changedFolders) {
+        addFolderRecord(records, wb->_logSize + records.size(), folder, wb->_entries.contains(folder));
+        count++;
+    }
+
+    typedef QPair<QString, QString> EntryName;
+    foreach (const EntryName& name, wb->_changedEntries) {
+        const Entry *e = 0;
+        Backend::FolderMap::ConstIterator fi = wb->_entries.constFind(name.first);
+        if (fi != wb->_entries.constEnd()) {
+            e = fi.value().value(name.second);
+        }
+        if (!e && wb->_changedFolders.contains(name.first)) {
+            continue; // gone with its folder already
+        }
+        addEntryRecord(records, wb->_logSize + records.size(), name.first, name.second, e);
+        count++;
+    }
+    addCommitRecord(records, wb->_logSize + records.size());
+    count++;
+
+    if (!sf.seek(wb->_logSize) || sf.write(records) != records.size() || !sf.flush()) {
+        // A partly written record is ignored when reading, and the
+        // whole file is written on the next sync
+        wb->_logVersion.clear();
+        return -4; // write error
+    }
+#ifndef Q_OS_WIN
+    fsync(sf.handle());
+#endif
+
+    wb->_logSize += records.size();
+    wb->_logRecords += count;
+    wb->_logMac = _chain;
+    return 0;
+}
+
+// A record read before the commit record of its sync
+struct PendingRecord {
+    char type;
+    QByteArray hashes;
+    QByteArray plain;
+};
+
+void LogPersistHandler::replayHashes(Backend* wb, char type, const char *hashes)
+{
+    if (type == KWALLET_RECORD_FOLDER) {
+        wb->_hashes[MD5Digest(hashes)].clear();
+    } else if (type == KWALLET_RECORD_FOLDER_REMOVED) {
+        wb->_hashes.remove(MD5Digest(hashes));
+    } else if (type == KWALLET_RECORD_ENTRY) {
+        wb->_hashes[MD5Digest(hashes)].append(MD5Digest(hashes + 16));
+    } else if (type == KWALLET_RECORD_ENTRY_REMOVED) {
+        Backend::HashMap::iterator it = wb->_hashes.find(MD5Digest(hashes));
+        if (it != wb->_hashes.end()) {
+            it.value().removeAll(MD5Digest(hashes + 16));
+        }
+    }
+}
+
+int LogPersistHandler::read(Backend* wb, QFile& db, WId)
+{
+    wb->_cipherType = _cipherType;
+    wb->_logFormat = true;
+    wb->_hashes.clear();
+
+    qint64 offset = db.pos();
+    db.seek(offset - 4);
+    const QByteArray version = db.read(4);
+
+    if (!setKey(wb)) {
+        wb->_passhash.fill(0);
+        return -6;  // decrypt error
+    }
+
+    const qint64 fileSize = db.size();
+    QByteArray record;
+    int records = 0;
+    int rc = 0;
+    QList<PendingRecord> pending;
+    qint64 committedSize = 0;
+    int committedRecords = 0;
+    QByteArray committedMac;
+    _generation.clear();
+    _chain.clear();
+
+    // Decrypt one record at a time. After one fails to authenticate, the
+    // rest is still read for the hashes, like the older format allows.
+    while (offset + KWALLET_RECORD_HEADER_LEN + _macSize <= fileSize) {
+        char header[KWALLET_RECORD_HEADER_LEN];
+        if (db.read(header, KWALLET_RECORD_HEADER_LEN) != KWALLET_RECORD_HEADER_LEN) {
+            rc = -7; // file structure error
+            break;
+        }
+
+        const char type = header[0];
+        const qint64 encryptedSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(header + 1));
+        int hashesSize = -1;
+        switch (type) {
+        case KWALLET_RECORD_CHECK:
+        case KWALLET_RECORD_COMMIT:
+            hashesSize = 0;
+            break;
+        case KWALLET_RECORD_FOLDER:
+        case KWALLET_RECORD_FOLDER_REMOVED:
+            hashesSize = 16;
+            break;
+        case KWALLET_RECORD_ENTRY:
+        case KWALLET_RECORD_ENTRY_REMOVED:
+            hashesSize = 32;
+            break;
+        }
+        if (hashesSize < 0 || encryptedSize < _ivSize + 4 || ((encryptedSize - _ivSize) % _padding) != 0 ||
+            (records == 0) != (type == KWALLET_RECORD_CHECK)) {
+            rc = -7; // file structure error
+            break;
+        }
+
+        const qint64 recordSize = KWALLET_RECORD_HEADER_LEN + hashesSize + encryptedSize + _macSize;
+        if (offset + recordSize > fileSize) {
+            // The last sync was interrupted, its records are dropped below
+            break;
+        }
+        record.resize(recordSize);
+        memcpy(record.data(), header, KWALLET_RECORD_HEADER_LEN);
+        if (db.read(record.data() + KWALLET_RECORD_HEADER_LEN, recordSize - KWALLET_RECORD_HEADER_LEN) != recordSize - KWALLET_RECORD_HEADER_LEN) {
+            rc = -7; // file structure error
+            break;
+        }
+
+        const char *hashes = record.constData() + KWALLET_RECORD_HEADER_LEN;
+        if (rc != 0) {
+            replayHashes(wb, type, hashes);
+        } else {
+            char *encrypted = record.data() + KWALLET_RECORD_HEADER_LEN + hashesSize;
+            if (!openRecord(record.data(), KWALLET_RECORD_HEADER_LEN + hashesSize, encryptedSize, offset)) {
+                rc = records == 0 ? -9 : -8; // wrong password, or hash error
+                foreach (const PendingRecord& p, pending) {
+                    replayHashes(wb, p.type, p.hashes.constData());
+                }
+                replayHashes(wb, type, hashes);
+            } else {
+                const char *data = encrypted + _ivSize;
+                const quint32 plainSize = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(data));
+                if (plainSize > quint32(encryptedSize - _ivSize - 4)) {
+                    rc = -8;
+                } else if (type == KWALLET_RECORD_CHECK) {
+                    if (plainSize != KWALLET_GENERATION_LEN) {
+                        rc = -8;
+                    }
+                    _generation = QByteArray(data + 4, plainSize);
+                } else if (type == KWALLET_RECORD_COMMIT) {
+                    // The records of the sync are complete
+                    for (int i = 0; i < pending.count(); i++) {
+                        replayHashes(wb, pending[i].type, pending[i].hashes.constData());
+                        if (rc == 0) {
+                            rc = replayRecord(wb, pending[i].type, pending[i].plain.constData(), pending[i].plain.size());
+                        }
+                        pending[i].plain.fill(0);
+                    }
+                    pending.clear();
+                    committedSize = offset + recordSize;
+                    committedRecords = records + 1;
+                    committedMac = _chain;
+                } else {
+                    PendingRecord p;
+                    p.type = type;
+                    p.hashes = QByteArray(hashes, hashesSize);
+                    p.plain = QByteArray(data + 4, plainSize);
+                    pending.append(p);
+                }
+            }
+            memset(encrypted, 0, encryptedSize);
+        }
+
+        offset += recordSize;
+        records++;
+    }
+
+    // Records without a commit record are left from an interrupted sync, or
+    // the file was truncated. They are dropped, and as the file does not
+    // match _logSize, it is written again on the next sync.
+    for (int i = 0; i < pending.count(); i++) {
+        pending[i].plain.fill(0);
+    }
+
+    if (rc == 0 && committedRecords == 0) {
+        rc = -7; // file structure error
+    }
+    if (rc != 0) {
+        for (Backend::FolderMap::ConstIterator i = wb->_entries.constBegin(); i != wb->_entries.constEnd(); ++i) {
+            qDeleteAll(i.value());
+        }
+        wb->_entries.clear();
+        return rc;
+    }
+
+    wb->_changedFolders.clear();
+    wb->_changedEntries.clear();
+    wb->_logVersion = version;
+    wb->_logSize = committedSize;
+    wb->_logRecords = committedRecords;
+    wb->_logGeneration = _generation;
+    wb->_logMac = committedMac;
+    wb->_open = true;
+    return 0;
+}
+
 #ifdef HAVE_QGPGME
 GpgME::Error initGpgME()
 {
@@ -22,19 +22,26 @@
 #define KWMAGIC_LEN 12
 
 #include <qwindowdefs.h>
+#include <QtCore/QByteArray>
+
+#include "blowfish.h"
 
 class QFile;
 class KSaveFile;
+class QString;
+struct gcry_cipher_handle;
 namespace KWallet {
 
 class Backend;
+class Entry;
 
 enum BackendCipherType {
     BACKEND_CIPHER_UNKNOWN,  /// this is used by freshly allocated wallets
     BACKEND_CIPHER_BLOWFISH, /// use the legacy blowfish cipher type
 #ifdef HAVE_QGPGME
-    BACKEND_CIPHER_GPG       /// use GPG backend to encrypt wallet contents
+    BACKEND_CIPHER_GPG,      /// use GPG backend to encrypt wallet contents
 #endif // HAVE_QGPGME
+    BACKEND_CIPHER_AES_GCM = 3 /// use AES-256-GCM from libgcrypt, needs the log format
 };
         
 
@@ -48,13 +55,24 @@ public:
      * for reading/writing using the given cipher type
      * 
      * @param cypherType indication of the backend that should be returned
+     * @param log whether a Blowfish wallet is written as a log, see LogPersistHandler
      * @return a pointer to an instance of the requested handler type. No need to delete this pointer, it's lifetime is taken care of by this factory
      */
-    static BackendPersistHandler *getPersistHandler(BackendCipherType cipherType);
+    static BackendPersistHandler *getPersistHandler(BackendCipherType cipherType, bool log = false);
     static BackendPersistHandler *getPersistHandler(char magicBuf[KWMAGIC_LEN]);
     
     virtual int write(Backend* wb, KSaveFile& sf, QByteArray& version, WId w) =0;
     virtual int read(Backend* wb, QFile& sf, WId w) =0;
+
+    /**
+     * Handlers which write the wallet file as a log can add the changes made
+     * since it was last read or written to its end instead of writing it again.
+     *
+     * @param version the version bytes the wallet would be written with
+     * @return true if append() can be used for the next sync
+     */
+    virtual bool canAppend(Backend* wb, const QByteArray& version) { Q_UNUSED(wb); Q_UNUSED(version); return false; }
+    virtual int append(Backend* wb, QFile& sf, WId w) { Q_UNUSED(wb); Q_UNUSED(sf); Q_UNUSED(w); return -4; }
 };
 
 
@@ -69,6 +87,58 @@ private:
     bool _useECBforReading;
 };
 
+/**
+ * Writes the wallet as a log of records, each one encrypted and authenticated
+ * on its own, either with Blowfish-CBC and HMAC-SHA1 or with AES-GCM. A sync
+ * only appends records for the folders and entries changed since the previous
+ * one; the whole file is written again when the superseded records outnumber
+ * the live ones, or when the password changes.
+ *
+ * The MAC of each record also covers the MAC of the previous one and a random
+ * generation written each time the whole file is, and every sync ends with a
+ * commit record. Reading stops at the last commit, so a file can neither be
+ * truncated within a sync nor put together from two generations.
+ */
+class LogPersistHandler : public BackendPersistHandler {
+public:
+    explicit LogPersistHandler(BackendCipherType cipherType);
+    virtual ~LogPersistHandler();
+
+    /** @return true if kwalletd was built with and runs on a libgcrypt that has AES-GCM */
+    static bool hasAesGcm();
+
+    virtual int write(Backend* wb, KSaveFile& sf, QByteArray& version, WId w);
+    virtual int read(Backend* wb, QFile& sf, WId w);
+    virtual bool canAppend(Backend* wb, const QByteArray& version);
+    virtual int append(Backend* wb, QFile& sf, WId w);
+private:
+    void setVersion(QByteArray& version) const;
+    bool setKey(Backend* wb);
+    int prepareIVs(int count);
+    void addRecord(QByteArray& out, qint64 offset, char type, const QByteArray& hashes, QByteArray& plain);
+    void addFolderRecord(QByteArray& out, qint64 offset, const QString& folder, bool exists);
+    void addEntryRecord(QByteArray& out, qint64 offset, const QString& folder, const QString& key, const Entry* e);
+    void addCommitRecord(QByteArray& out, qint64 offset);
+    void sealRecord(char *record, int headerSize, int encryptedSize, qint64 offset);
+    bool openRecord(char *record, int headerSize, int encryptedSize, qint64 offset);
+    QByteArray macPrefix(qint64 offset) const;
+    QByteArray recordMac(const QByteArray& prefix, const char *record, int len) const;
+    void replayHashes(Backend* wb, char type, const char *hashes);
+    int replayRecord(Backend* wb, char type, const char *plain, int len);
+
+    BackendCipherType _cipherType;
+    int _ivSize;
+    int _padding;       // the encrypted data is a multiple of this
+    int _macSize;
+    BlowFish _bf;
+    QByteArray _macKey;
+    struct gcry_cipher_handle *_aes;
+    QByteArray _ivs;    // one IV for each record still to be written
+    int _nextIV;
+    QByteArray _generation; // from the check record, empty while it is written or read
+    QByteArray _chain;      // MAC of the previous record
+};
+
 #ifdef HAVE_QGPGME
 class GpgPersistHandler : public BackendPersistHandler {
 public:
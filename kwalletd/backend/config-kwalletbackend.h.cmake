@@ -1,3 +1,5 @@
 #cmakedefine HAVE_STDINT_H 1
 
 #cmakedefine HAVE_SYS_BITYPES_H 1
+
+#cmakedefine HAVE_GCRYPT_GCM 1
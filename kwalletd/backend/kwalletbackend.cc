@@ -72,6 +72,11 @@ Backend::Backend(const QString& name, bool isPath)
     , _useNewHash(false)
     , _ref(0)
     , _cipherType(KWallet::BACKEND_CIPHER_UNKNOWN)
+    , _upgradeFormat(false)
+    , _logFormat(false)
+    , _backupLegacy(false)
+    , _logSize(0)
+    , _logRecords(0)
 {
 	initKWalletDir();
 	if (isPath) {
@@ -96,6 +101,15 @@ void Backend::setCipherType(BackendCipherType ct)
     // changing cipher type on already initialed wallets is not permitted
     assert(_cipherType == KWallet::BACKEND_CIPHER_UNKNOWN);
     _cipherType = ct;
+    _logFormat = ct == KWallet::BACKEND_CIPHER_AES_GCM || _upgradeFormat;
+}
+
+BackendCipherType Backend::passwordCipherType() const
+{
+    if (_upgradeFormat && LogPersistHandler::hasAesGcm()) {
+        return KWallet::BACKEND_CIPHER_AES_GCM;
+    }
+    return KWallet::BACKEND_CIPHER_BLOWFISH;
 }
 
 static int password2PBKDF2_SHA512(const QByteArray &password, QByteArray& hash, const QByteArray &salt)
@@ -393,18 +407,6 @@ int Backend::sync(WId w) {
 		return -255;  // not open yet
 	}
 
-	KSaveFile sf(_path);
-
-	if (!sf.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
-		return -1;		// error opening file
-	}
-	sf.setPermissions(QFile::ReadUser|QFile::WriteUser);
-
-	if (sf.write(KWMAGIC, KWMAGIC_LEN) != KWMAGIC_LEN) {
-		sf.abort();
-		return -4; // write error
-	}
-
 	// Write the version number
 	QByteArray version(4, 0);
 	version[0] = KWALLET_VERSION_MAJOR;
@@ -417,17 +419,59 @@ int Backend::sync(WId w) {
     }
 
 
-    BackendPersistHandler *phandler = BackendPersistHandler::getPersistHandler(_cipherType);
+    if (_backupLegacy) {
+        // The first sync after opening a legacy wallet converts it
+        if (!KSaveFile::simpleBackupFile(_path, QString(), QLatin1String(".bak"))) {
+            kWarning() << "Could not back up" << _path << ", keeping the legacy format";
+            _cipherType = KWallet::BACKEND_CIPHER_BLOWFISH;
+            _logFormat = false;
+        }
+        _backupLegacy = false;
+    }
+
+    BackendPersistHandler *phandler = BackendPersistHandler::getPersistHandler(_cipherType, _logFormat);
     if (0 == phandler) {
         return -4; // write error
     }
-    int rc = phandler->write(this, sf, version, w);
+
+    int rc;
+    QString errorString;
+    if (phandler->canAppend(this, version)) {
+        // Only the changes since the last sync are added to the file
+        QFile f(_path);
+        if (!f.open(QIODevice::ReadWrite)) {
+            delete phandler;
+            return -1;		// error opening file
+        }
+        rc = phandler->append(this, f, w);
+        errorString = f.errorString();
+    } else {
+        KSaveFile sf(_path);
+
+        if (!sf.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+            delete phandler;
+            return -1;		// error opening file
+        }
+        sf.setPermissions(QFile::ReadUser|QFile::WriteUser);
+
+        if (sf.write(KWMAGIC, KWMAGIC_LEN) != KWMAGIC_LEN) {
+            sf.abort();
+            delete phandler;
+            return -4; // write error
+        }
+
+        rc = phandler->write(this, sf, version, w);
+        errorString = sf.errorString();
+    }
     if (rc<0) {
         // Oops! wallet file sync filed! Display a notification about that
         // TODO: change kwalletd status flags, when status flags will be implemented
         KNotification *notification = new KNotification( "syncFailed" );
-        notification->setText( i18n("Failed to sync wallet <b>%1</b> to disk. Error codes are:\nRC <b>%2</b>\nSF <b>%3</b>. Please file a BUG report using this information to bugs.kde.org").arg(_name).arg(rc).arg(sf.errorString()) );
+        notification->setText( i18n("Failed to sync wallet <b>%1</b> to disk. Error codes are:\nRC <b>%2</b>\nSF <b>%3</b>. Please file a BUG report using this information to bugs.kde.org").arg(_name).arg(rc).arg(errorString) );
         notification->sendEvent();
+    } else {
+        _changedFolders.clear();
+        _changedEntries.clear();
     }
     delete phandler;
     return rc;
@@ -450,6 +494,9 @@ int Backend::close(bool save) {
 		}
 	}
 	_entries.clear();
+	_changedFolders.clear();
+	_changedEntries.clear();
+	_logVersion.clear();
 
 	// empty the password hash
 	_passhash.fill(0);
@@ -516,6 +563,7 @@ bool Backend::createFolder(const QString& f) {
 	}
 
 	_entries.insert(f, EntryMap());
+	_changedFolders.insert(f);
 
 	KMD5 folderMd5;
 	folderMd5.update(f.toUtf8());
@@ -534,6 +582,8 @@ int Backend::renameEntry(const QString& oldName, const QString& newName) {
 		Entry *e = oi.value();
 		emap.erase(oi);
 		emap[newName] = e;
+		_changedEntries.insert(qMakePair(_folder, oldName));
+		_changedEntries.insert(qMakePair(_folder, newName));
 
 		KMD5 folderMd5;
 		folderMd5.update(_folder.toUtf8());
@@ -561,6 +611,7 @@ void Backend::writeEntry(Entry *e) {
 		_entries[_folder][e->key()] = new Entry;
 	}
 	_entries[_folder][e->key()]->copy(e);
+	_changedEntries.insert(qMakePair(_folder, e->key()));
 
 	KMD5 folderMd5;
 	folderMd5.update(_folder.toUtf8());
@@ -590,6 +641,7 @@ bool Backend::removeEntry(const QString& key) {
 	if (fi != _entries.end() && ei != fi.value().end()) {
 		delete ei.value();
 		fi.value().erase(ei);
+		_changedEntries.insert(qMakePair(_folder, key));
 		KMD5 folderMd5;
 		folderMd5.update(_folder.toUtf8());
 
@@ -623,6 +675,7 @@ bool Backend::removeFolder(const QString& f) {
 		}
 
 		_entries.erase(fi);
+		_changedFolders.insert(f);
 
 		KMD5 folderMd5;
 		folderMd5.update(f.toUtf8());
@@ -655,6 +708,7 @@ bool Backend::entryDoesNotExist(const QString& folder, const QString& entry) con
 
 void Backend::setPassword(const QByteArray &password) {
 	_passhash.fill(0); // empty just in case
+	_logVersion.clear(); // the records have to be encrypted again
 	BlowFish _bf;
 	CipherBlockChain bf(&_bf);
 	_passhash.resize(bf.keyLen()/8);
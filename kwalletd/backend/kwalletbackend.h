@@ -27,6 +27,8 @@
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 #include <QtCore/QMap>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
 #include "kwalletentry.h"
 #include "backendpersisthandler.h"
 
@@ -161,6 +163,18 @@ class KDE_EXPORT Backend {
 
         void setCipherType(BackendCipherType ct);
         BackendCipherType cipherType() const { return _cipherType; }
+
+        /**
+         * Allows writing password wallets in the log format, see
+         * LogPersistHandler. New wallets are then created with
+         * passwordCipherType(), and a wallet in the legacy Blowfish format is
+         * converted on its next sync after being copied to <wallet>.kwl.bak.
+         * Wallets already in the log format keep it either way.
+         * Has to be called before setCipherType() or open().
+         */
+        void setUpgradeFormat(bool upgrade) { _upgradeFormat = upgrade; }
+        /** @return the cipher type new password wallets should be created with */
+        BackendCipherType passwordCipherType() const;
 #ifdef HAVE_QGPGME
         const GpgME::Key &gpgKey() const;
 #endif
@@ -184,10 +198,23 @@ class KDE_EXPORT Backend {
 		QByteArray _passhash;   // password hash used for saving the wallet
 		QByteArray _newPassHash; //Modern hash using KWALLET_HASH_PBKDF2_SHA512
 		BackendCipherType _cipherType; // the kind of encryption used for this wallet
+		bool _upgradeFormat;   // see setUpgradeFormat()
+		bool _logFormat;       // the wallet is written by LogPersistHandler
+		bool _backupLegacy;    // copy the legacy file before it is written as a log
 #ifdef HAVE_QGPGME
         GpgME::Key      _gpgKey;
 #endif
+		// Folders and entries changed since the wallet was read or written
+		QSet<QString> _changedFolders;
+		QSet<QPair<QString, QString> > _changedEntries;
+		// The wallet file as a log of records, see LogPersistHandler
+		QByteArray _logVersion; // version bytes of the file, empty if it has to be written again
+		qint64 _logSize;        // offset after the last record
+		int _logRecords;        // records in the file, including superseded ones
+		QByteArray _logGeneration; // random bytes of the check record
+		QByteArray _logMac;     // MAC of the last record, which the next one is chained to
 		friend class BlowfishPersistHandler;
+		friend class LogPersistHandler;
         friend class GpgPersistHandler;
       
       // open the wallet with the password already set. This is
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <kaboutdata.h>
+#include <kcmdlineargs.h>
+#include <kapplication.h>
+#include <kglobal.h>
+#include <klocale.h>
+#include <kstandarddirs.h>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+
+#include "kwalletbackend.h"
+
+#define ENTRIES 10000
+#define CHANGES 100
+
+// Times opening and syncing a wallet of ENTRIES passwords with the given cipher,
+// in the log format if upgrade is set
+static void benchmark(KWallet::BackendCipherType cipherType, bool upgrade, const char *name)
+{
+   const QString walletName = QString("kbenchmark-%1").arg(name);
+   KWallet::Backend be(walletName);
+   be.setUpgradeFormat(upgrade);
+   be.setCipherType(cipherType);
+
+   const QString path = KGlobal::dirs()->saveLocation("kwallet") + walletName;
+   QFile::remove(path + ".kwl");
+
+   QByteArray pass("apassword", 9);
+   QElapsedTimer timer;
+
+   int rc = be.open(pass);
+   if (rc != 0) {
+      printf("%s: be.open(pass) returned %d  (should be 0)\n", name, rc);
+      return;
+   }
+
+   be.createFolder("Passwords");
+   be.setFolder("Passwords");
+   KWallet::Entry e;
+   e.setType(KWallet::Wallet::Password);
+   for (int i = 0; i < ENTRIES; ++i) {
+      e.setKey(QString("http://www.example.com/%1").arg(i));
+      e.setValue(QString("password %1").arg(i));
+      be.writeEntry(&e);
+   }
+
+   timer.start();
+   rc = be.sync(0);
+   printf("%s: sync of %d new entries took %lld ms (rc %d)\n", name, ENTRIES, timer.elapsed(), rc);
+
+   timer.start();
+   for (int i = 0; i < CHANGES; ++i) {
+      e.setKey(QString("http://www.example.com/%1").arg(i));
+      e.setValue(QString("changed %1").arg(i));
+      be.writeEntry(&e);
+      rc |= be.sync(0);
+   }
+   printf("%s: sync of one changed entry took %.2f ms on average (rc %d)\n", name, double(timer.elapsed()) / CHANGES, rc);
+
+   be.close();
+
+   timer.start();
+   rc = be.open(pass);
+   printf("%s: open took %lld ms (rc %d)\n", name, timer.elapsed(), rc);
+
+   be.setFolder("Passwords");
+   printf("%s: %d entries read  (should be %d)\n", name, be.entryList().count(), ENTRIES);
+
+   be.close();
+   QFile::remove(path + ".kwl");
+   QFile::remove(path + ".salt");
+}
+
+int main(int argc, char **argv) {
+   KAboutData aboutData("backendbenchmark", 0, ki18n("backendbenchmark"), "version");
+   KCmdLineArgs::init(argc, argv, &aboutData);
+   KApplication a;
+
+   benchmark(KWallet::BACKEND_CIPHER_BLOWFISH, false, "legacy");
+   benchmark(KWallet::BACKEND_CIPHER_BLOWFISH, true, "blowfish");
+   benchmark(KWallet::BACKEND_CIPHER_AES_GCM, true, "aes-gcm");
+
+   return 0;
+}
@@ -5,7 +5,10 @@
 #include <kcmdlineargs.h>
 #include <kdebug.h>
 #include <kapplication.h>
+#include <kglobal.h>
 #include <klocale.h>
+#include <kstandarddirs.h>
+#include <QtCore/QFile>
 #include <QtCore/QString>
 
 #include "kwalletbackend.h"
@@ -16,6 +19,8 @@ int main(int argc, char **argv) {
    KApplication a;
 
    KWallet::Backend be("ktestwallet");
+   be.setUpgradeFormat(true);
+   be.setCipherType(KWallet::BACKEND_CIPHER_BLOWFISH);
    printf("KWalletBackend constructed\n");
 
    QByteArray apass("apassword", 9);
@@ -44,6 +49,85 @@ int main(int argc, char **argv) {
 
    printf("be.open(bpass) returned %d  (should be 0)\n", rc);
 
+   // The changes of each sync are appended to the wallet file
+   be.createFolder("folder");
+   be.setFolder("folder");
+   KWallet::Entry e;
+   e.setKey("key");
+   e.setValue(QString("value"));
+   e.setType(KWallet::Wallet::Password);
+   be.writeEntry(&e);
+
+   rc = be.sync(0);
+
+   printf("be.sync(0) returned %d  (should be 0)\n", rc);
+
+   e.setKey("other");
+   be.writeEntry(&e);
+   be.removeEntry("key");
+   rc = be.close(true);
+
+   printf("be.close(true) returned %d  (should be 0)\n", rc);
+
+   rc = be.open(bpass);
+
+   printf("be.open(bpass) returned %d  (should be 0)\n", rc);
+
+   be.setFolder("folder");
+   printf("be.hasEntry(\"key\") returned %d  (should be 0)\n", be.hasEntry("key"));
+   printf("be.hasEntry(\"other\") returned %d  (should be 1)\n", be.hasEntry("other"));
+   printf("be.folderDoesNotExist(\"folder\") returned %d  (should be 0)\n", be.folderDoesNotExist("folder"));
+
+   // A sync cut short by a truncated file is dropped as a whole
+   e.setKey("third");
+   be.writeEntry(&e);
+   rc = be.close(true);
+
+   printf("be.close(true) returned %d  (should be 0)\n", rc);
+
+   QFile file(KGlobal::dirs()->saveLocation("kwallet") + "ktestwallet.kwl");
+   file.resize(file.size() - 1);
+   rc = be.open(bpass);
+
+   printf("be.open(bpass) returned %d  (should be 0)\n", rc);
+
+   be.setFolder("folder");
+   printf("be.hasEntry(\"other\") returned %d  (should be 1)\n", be.hasEntry("other"));
+   printf("be.hasEntry(\"third\") returned %d  (should be 0)\n", be.hasEntry("third"));
+   be.close();
+
+   // Legacy wallets keep their format unless the upgrade is asked for
+   const QString legacyPath = KGlobal::dirs()->saveLocation("kwallet") + "ktestlegacy.kwl";
+   QFile::remove(legacyPath);
+   QFile::remove(legacyPath + ".bak");
+   {
+      KWallet::Backend legacy("ktestlegacy");
+      legacy.setCipherType(KWallet::BACKEND_CIPHER_BLOWFISH);
+      legacy.open(bpass);
+      legacy.createFolder("folder");
+      rc = legacy.close(true);
+
+      printf("legacy.close(true) returned %d  (should be 0)\n", rc);
+   }
+   QFile legacyFile(legacyPath);
+   legacyFile.open(QIODevice::ReadOnly);
+   printf("legacy cipher byte is %d  (should be 3)\n", int(legacyFile.readAll().at(14)));
+   legacyFile.close();
+   {
+      KWallet::Backend legacy("ktestlegacy");
+      legacy.setUpgradeFormat(true);
+      rc = legacy.open(bpass);
+
+      printf("legacy.open(bpass) returned %d  (should be 0)\n", rc);
+
+      rc = legacy.close(true);
+
+      printf("legacy.close(true) returned %d  (should be 0)\n", rc);
+   }
+   legacyFile.open(QIODevice::ReadOnly);
+   printf("upgraded cipher byte is %d  (should be 4 or 5)\n", int(legacyFile.readAll().at(14)));
+   printf("QFile::exists(legacyPath + \".bak\") returned %d  (should be 1)\n", QFile::exists(legacyPath + ".bak"));
+
    return 0;
 }
 
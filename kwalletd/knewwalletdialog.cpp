@@ -46,9 +46,9 @@ KNewWalletDialog::KNewWalletDialog(const QString &appName, const QString &wallet
     _gpgId = addPage(_gpg);
 }
 
-bool KNewWalletDialog::isBlowfish() const
+bool KNewWalletDialog::isPasswordBased() const
 {
-    return _intro->isBlowfish();
+    return _intro->isPasswordBased();
 }
 
 GpgME::Key KNewWalletDialog::gpgKey() const
@@ -67,20 +67,20 @@ KNewWalletDialogIntro::KNewWalletDialogIntro(const QString& appName, const QStri
     }
 }
 
-void KNewWalletDialogIntro::onBlowfishToggled(bool blowfish)
+void KNewWalletDialogIntro::onPasswordToggled(bool password)
 {
-    setFinalPage(blowfish);
+    setFinalPage(password);
 }
 
 
-bool KNewWalletDialogIntro::isBlowfish() const
+bool KNewWalletDialogIntro::isPasswordBased() const
 {
-    return _ui.radioBlowfish->isChecked();
+    return _ui.radioPassword->isChecked();
 }
 
 int KNewWalletDialogIntro::nextId() const
 {
-    if (isBlowfish()){
+    if (isPasswordBased()){
         return -1;
     } else {
         return qobject_cast< const KNewWalletDialog* >(wizard())->gpgId();
@@ -39,7 +39,7 @@ class KNewWalletDialog : public QWizard {
 public:
     KNewWalletDialog(const QString &appName, const QString &walletName, QWidget* parent = 0);
 
-    bool isBlowfish() const;
+    bool isPasswordBased() const;
     int gpgId() const { return _gpgId; }
     GpgME::Key gpgKey() const;
 private:
@@ -53,10 +53,10 @@ class KNewWalletDialogIntro : public QWizardPage {
     Q_OBJECT
 public:
     KNewWalletDialogIntro(const QString &appName, const QString &walletName, QWidget* parent = 0);
-    bool isBlowfish() const;
+    bool isPasswordBased() const;
     virtual int nextId() const;
 protected Q_SLOTS:
-    void onBlowfishToggled(bool);
+    void onPasswordToggled(bool);
 private:
     Ui_KNewWalletDialogIntro _ui;
 };
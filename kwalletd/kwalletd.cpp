@@ -441,11 +441,12 @@ int KWalletD::doTransactionOpen(const QString& appid, const QString& wallet, boo
 			}
 
 			// Create the wallet
-            // TODO GPG select the correct wallet type upon cretion (GPG or blowfish based)
+            // TODO GPG select the correct wallet type upon cretion (GPG or password based)
 			KWallet::Backend *b = new KWallet::Backend(KWallet::Wallet::LocalWallet());
+			b->setUpgradeFormat(_upgradeFormat);
 #ifdef HAVE_QGPGME
-            if (wiz->field("useBlowfish").toBool()) {
-                b->setCipherType(KWallet::BACKEND_CIPHER_BLOWFISH);
+            if (wiz->field("usePassword").toBool()) {
+                b->setCipherType(b->passwordCipherType());
 #endif
                 QString pass = wiz->field("pass1").toString();
                 QByteArray p(pass.toUtf8(), pass.length());
@@ -503,6 +504,7 @@ int KWalletD::internalOpen(const QString& appid, const QString& wallet, bool isP
 		}
 
 		KWallet::Backend *b = new KWallet::Backend(wallet, isPath);
+		b->setUpgradeFormat(_upgradeFormat);
 		QString password;
 		bool emptyPass = false;
 		if ((isPath && QFile::exists(wallet)) || (!isPath && KWallet::Backend::exists(wallet))) {
@@ -525,6 +527,7 @@ int KWalletD::internalOpen(const QString& appid, const QString& wallet, bool isP
 					// release, start anew
 					delete b;
 					b = new KWallet::Backend(wallet, isPath);
+					b->setUpgradeFormat(_upgradeFormat);
 				}
 				KPasswordDialog *kpd = new KPasswordDialog();
 				if (appid.isEmpty()) {
@@ -593,7 +596,7 @@ int KWalletD::internalOpen(const QString& appid, const QString& wallet, bool isP
             GpgME::Key gpgKey;
             setupDialog( newWalletDlg.get(), (WId)w, appid, true );
             if (newWalletDlg->exec() == QDialog::Accepted) {
-                newWalletType = newWalletDlg->isBlowfish() ? KWallet::BACKEND_CIPHER_BLOWFISH : KWallet::BACKEND_CIPHER_GPG;
+                newWalletType = newWalletDlg->isPasswordBased() ? b->passwordCipherType() : KWallet::BACKEND_CIPHER_GPG;
                 gpgKey = newWalletDlg->gpgKey();
             } else {
                 // user cancelled the dialog box
@@ -604,9 +607,9 @@ int KWalletD::internalOpen(const QString& appid, const QString& wallet, bool isP
             if (newWalletType == KWallet::BACKEND_CIPHER_GPG) {
                 b->setCipherType(newWalletType);
                 b->open(gpgKey);
-            } else if (newWalletType == KWallet::BACKEND_CIPHER_BLOWFISH) {
+            } else if (newWalletType == b->passwordCipherType()) {
 #endif // HAVE_QGPGME
-            b->setCipherType(KWallet::BACKEND_CIPHER_BLOWFISH);
+            b->setCipherType(b->passwordCipherType());
 			KNewPasswordDialog *kpd = new KNewPasswordDialog();
 			if (wallet == KWallet::Wallet::LocalWallet() ||
 						 wallet == KWallet::Wallet::NetworkWallet())
@@ -646,7 +649,7 @@ int KWalletD::internalOpen(const QString& appid, const QString& wallet, bool isP
 		}
 
         
-		if ((b->cipherType() == KWallet::BACKEND_CIPHER_BLOWFISH) && 
+		if ((b->cipherType() == KWallet::BACKEND_CIPHER_BLOWFISH || b->cipherType() == KWallet::BACKEND_CIPHER_AES_GCM) && 
             !emptyPass && (password.isNull() || !b->isOpen())) {
 			delete b;
 			return -1;
@@ -1448,6 +1451,7 @@ void KWalletD::reconfigure() {
 	_enabled = walletGroup.readEntry("Enabled", true);
 	_launchManager = walletGroup.readEntry("Launch Manager", false);
 	_leaveOpen = walletGroup.readEntry("Leave Open", false);
+	_upgradeFormat = walletGroup.readEntry("Upgrade Wallet Format", false);
 	bool idleSave = _closeIdle;
 	_closeIdle = walletGroup.readEntry("Close When Idle", false);
 	_openPrompt = walletGroup.readEntry("Prompt on Open", false);
@@ -1631,9 +1635,11 @@ int KWalletD::pamOpen(const QString &wallet, const QByteArray &passwordHash, int
     //If the wallet we want to open does not exists. create it and set pam hash
     if (!wallets().contains(wallet)) {
         b = new KWallet::Backend(wallet);
-        b->setCipherType(KWallet::BACKEND_CIPHER_BLOWFISH);
+        b->setUpgradeFormat(_upgradeFormat);
+        b->setCipherType(b->passwordCipherType());
     } else {
         b = new KWallet::Backend(wallet);
+        b->setUpgradeFormat(_upgradeFormat);
     }
 
     if (_wallets.count() > 20) {
@@ -223,6 +223,7 @@ class KWalletD : public QObject, protected QDBusContext {
 		// configuration values
 		bool _leaveOpen, _closeIdle, _launchManager, _enabled;
 		bool _openPrompt, _firstUse, _showingFailureNotify;
+		bool _upgradeFormat; // convert legacy wallets, see KWallet::Backend::setUpgradeFormat
 		int _idleTime;
 		QMap<QString,QStringList> _implicitAllowMap, _implicitDenyMap;
 		KTimeout _closeTimers;
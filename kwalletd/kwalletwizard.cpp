@@ -88,8 +88,8 @@ public:
         registerField("pass2", ui._pass2);
 #ifdef HAVE_QGPGME
         registerField("useGPG", ui._radioGpg);
-        registerField("useBlowfish", ui._radioBlowfish);
-        connect(ui._radioBlowfish, SIGNAL(toggled(bool)), parent, SLOT(passwordPageUpdate()));
+        registerField("usePassword", ui._radioPassword);
+        connect(ui._radioPassword, SIGNAL(toggled(bool)), parent, SLOT(passwordPageUpdate()));
 #endif
 
         connect(ui._useWallet, SIGNAL(clicked()), parent, SLOT(passwordPageUpdate()));
@@ -102,7 +102,7 @@ public:
 #ifdef HAVE_QGPGME
         int nextId = -1;
         if (field("useWallet").toBool()) {
-            if (field("useBlowfish").toBool()) {
+            if (field("usePassword").toBool()) {
                 nextId = static_cast<KWalletWizard*>(wizard())->wizardType() == KWalletWizard::Basic ? -1 : KWalletWizard::PageOptionsId; // same as non QGPGME case
             } else {
                 nextId = KWalletWizard::PageGpgKeyId;
@@ -269,7 +269,7 @@ void KWalletWizard::passwordPageUpdate()
     bool complete = true;
     if (field("useWallet").toBool()) {
 #ifdef HAVE_QGPGME
-        if (field("useBlowfish").toBool()) {
+        if (field("usePassword").toBool()) {
             m_pagePasswd->setFinalPage(wizardType() == Basic);
             button(NextButton)->setVisible(wizardType() != Basic);
 #endif